@@ -287,6 +287,8 @@ Standalone question:)",
         llm_provider_ogroup->add_option("--embedding_model_api_key", provider_options.api_key, "API key for commercial services like OpenAI. Leave blank for services without ACL.");
         llm_provider_ogroup->add_option("--embedding_model_endpoint", provider_options.endpoint_url_string, "Endpoint for text embedding model, .e.g. 'https://api.openai.com/v1/api/embeddings' for OpenAI.");
         llm_provider_ogroup->add_option("--embedding_model_model_name", provider_options.model_name, "Specify name of the model to be used.");
+        llm_provider_ogroup->add_option("--embedding_model_weight_type", provider_options.weight_type, "Precision of weights for local model, e.g. q4_1, q8_0, f16. Weights are converted at load time if they differ from model file.");
+        llm_provider_ogroup->add_flag("--embedding_model_warm_up", provider_options.warm_up, "Prefetch weights of local model in background and run a dummy forward on startup, so that first request doesn't wait for weights to be paged in.");
     }
 
     static void BuildRerankerProviderOptionGroup(CLI::Option_group* llm_provider_ogroup,
@@ -299,6 +301,11 @@ Standalone question:)",
         llm_provider_ogroup->add_option("--reranker_model_api_key", provider_options.api_key, "API key for commercial services like Jina.ai. Leave blank for services without ACL.");
         llm_provider_ogroup->add_option("--reranker_model_endpoint", provider_options.endpoint_url_string, "Endpoint for reranker model API.");
         llm_provider_ogroup->add_option("--reranker_model_model_name", provider_options.model_name, "Specify name of the model to be used.");
+        llm_provider_ogroup->add_option("--reranker_model_weight_type", provider_options.weight_type, "Precision of weights for local model, e.g. q4_1, q8_0, f16. Weights are converted at load time if they differ from model file.");
+        llm_provider_ogroup->add_flag("--reranker_model_window", provider_options.ranking_window.enabled, "Score passages longer than max length of local model with overlapping windows instead of truncating them.");
+        llm_provider_ogroup->add_option("--reranker_model_window_overlap", provider_options.ranking_window.overlap, "Count of passage tokens shared by adjacent windows.")
+                ->default_val(64);
+        llm_provider_ogroup->add_flag("--reranker_model_warm_up", provider_options.warm_up, "Prefetch weights of local model in background and run a dummy forward on startup, so that first request doesn't wait for weights to be paged in.");
     }
 
     static void BuildChatModelProviderOptionGroup(
@@ -265,6 +265,11 @@ int main(int argc, char** argv) {
         ogroup->add_option("--reranker_model_api_key", application_options.ranking_model.api_key, "API key for commercial services like Jina.ai. Leave blank for services without ACL.");
         ogroup->add_option("--reranker_model_endpoint", application_options.ranking_model.endpoint_url_string, "Endpoint for reranker model API.");
         ogroup->add_option("--reranker_model_model_name", application_options.ranking_model.model_name, "Specify name of the model to be used.");
+        ogroup->add_option("--reranker_model_weight_type", application_options.ranking_model.weight_type, "Precision of weights for local model, e.g. q4_1, q8_0, f16. Weights are converted at load time if they differ from model file.");
+        ogroup->add_flag("--reranker_model_window", application_options.ranking_model.ranking_window.enabled, "Score passages longer than max length of local model with overlapping windows instead of truncating them.");
+        ogroup->add_option("--reranker_model_window_overlap", application_options.ranking_model.ranking_window.overlap, "Count of passage tokens shared by adjacent windows.")
+                ->default_val(64);
+        ogroup->add_flag("--reranker_model_warm_up", application_options.ranking_model.warm_up, "Prefetch weights of local model in background and run a dummy forward on startup, so that first request doesn't wait for weights to be paged in.");
     }
 
     app.add_option("--agent_executor_type", application_options.agent_executor.agent_executor_name, "Specify agent executor type. `llm_compiler` enables parallel function calling with opensourced models like mistral series and llama series, while `openai_tool` relies on official OpenAI function calling capability to direct agent workflow.")
@@ -0,0 +1,59 @@
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <CLI/CLI.hpp>
+
+#include <instinct/transformer/model_converter.hpp>
+
+int main(int argc, char** argv) {
+    using namespace INSTINCT_TRANSFORMER_NS;
+    CLI::App app{"Convert weights of local model file to another precision"};
+
+    std::string input_path;
+    std::string output_path;
+    std::string weight_type_name;
+    app.add_option("-i,--input", input_path, "Path to model file, e.g. a float checkpoint.")
+        ->required()
+        ->check(CLI::ExistingFile);
+    app.add_option("-o,--output", output_path, "Path to write converted model file.")
+        ->required();
+    app.add_option("-t,--weight_type", weight_type_name, "Type of weight matrices in output file.")
+        ->required()
+        ->check(CLI::IsMember({"f32", "f16", "q8_0", "q5_1", "q5_0", "q4_1", "q4_0"}));
+    std::vector<std::string> extra_tensors;
+    app.add_option("-x,--extra_tensor", extra_tensors, "Float tensor appended to output file, in form of `name:dim0,dim1=path`, where path is a file of raw float32 values, e.g. `sparse_linear.weight:1,1024=sparse_linear.weight.f32`.");
+
+    CLI11_PARSE(app, argc, argv);
+
+    const auto t1 = std::chrono::steady_clock::now();
+    ModelConverter converter {input_path, output_path};
+    const auto converted = converter.convert(parse_weight_type(weight_type_name));
+    for (const auto& spec: extra_tensors) {
+        const auto colon = spec.find(':');
+        const auto equal = spec.find('=', colon);
+        if (colon == std::string::npos || equal == std::string::npos) {
+            std::cerr << "invalid extra tensor: " << spec << std::endl;
+            return 1;
+        }
+        const auto name = spec.substr(0, colon);
+        std::vector<int> shape;
+        std::stringstream dims {spec.substr(colon + 1, equal - colon - 1)};
+        for (std::string dim; std::getline(dims, dim, ',');) {
+            shape.push_back(std::stoi(dim));
+        }
+        std::ifstream input {spec.substr(equal + 1), std::ios::binary | std::ios::ate};
+        if (!input) {
+            std::cerr << "failed to open " << spec.substr(equal + 1) << std::endl;
+            return 1;
+        }
+        std::vector<float> values((size_t) input.tellg() / sizeof(float));
+        input.seekg(0);
+        input.read(reinterpret_cast<char *>(values.data()), (std::streamsize) (values.size() * sizeof(float)));
+        converter.append_tensor(name, shape, values);
+        std::cout << "appended tensor " << name << std::endl;
+    }
+    std::cout << "converted " << converted << " tensors to " << weight_type_name << " in "
+        << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - t1).count() << "ms" << std::endl;
+    return 0;
+}
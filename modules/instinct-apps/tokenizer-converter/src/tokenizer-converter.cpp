@@ -0,0 +1,45 @@
+#include <chrono>
+#include <iostream>
+#include <CLI/CLI.hpp>
+
+#include <instinct/tokenizer/tiktoken_tokenizer.hpp>
+
+int main(int argc, char** argv) {
+    using namespace INSTINCT_LLM_NS;
+    CLI::App app{"Convert rank file of tiktoken tokenizer to binary vocab file"};
+
+    std::string input_path;
+    std::string output_path;
+    std::string name;
+    std::string encoder_json_path;
+    app.add_option("-i,--input", input_path, "Path to rank file, e.g. cl100k_base.tiktoken or gpt2 vocab.bpe.")
+        ->required()
+        ->check(CLI::ExistingFile);
+    app.add_option("-o,--output", output_path, "Path to write binary vocab file.")
+        ->required();
+    app.add_option("-n,--name", name, "Name of tokenizer.")
+        ->required()
+        ->check(CLI::IsMember({"cl100k_base", "gpt2"}));
+    app.add_option("--encoder_json", encoder_json_path, "Path to encoder.json, required by gpt2.")
+        ->check(CLI::ExistingFile);
+
+    CLI11_PARSE(app, argc, argv);
+
+    if (name == "gpt2" && encoder_json_path.empty()) {
+        std::cerr << "--encoder_json is required by gpt2" << std::endl;
+        return 1;
+    }
+
+    const auto t1 = std::chrono::steady_clock::now();
+    const auto config = name == "gpt2" ?
+        TiktokenTokenizer::MakeGPT2Config(input_path, encoder_json_path) :
+        TiktokenTokenizer::MakeCL100KConfig(input_path);
+    std::vector<std::filesystem::path> source_files {input_path};
+    if (name == "gpt2") {
+        source_files.emplace_back(encoder_json_path);
+    }
+    TiktokenTokenizer::ConvertToBinaryVocab(config, output_path, BinaryBPEVocabSource::Of(source_files));
+    std::cout << "converted " << config.mergeable_ranks.size() << " ranks of " << name << " in "
+        << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - t1).count() << "ms" << std::endl;
+    return 0;
+}
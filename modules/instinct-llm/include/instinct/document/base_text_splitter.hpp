@@ -23,6 +23,18 @@ namespace  INSTINCT_LLM_NS {
         ILengthCalculator(ILengthCalculator&&)=delete;
         ILengthCalculator(const ILengthCalculator&)=delete;
         virtual size_t GetLength(const UnicodeString& s) =0;
+
+        /**
+         * Calculate lengths of many strings at once, which implementations can do in parallel
+         */
+        virtual std::vector<size_t> GetLengths(const std::vector<UnicodeString>& strings) {
+            std::vector<size_t> lengths;
+            lengths.reserve(strings.size());
+            for (const auto& s: strings) {
+                lengths.push_back(GetLength(s));
+            }
+            return lengths;
+        }
     };
 
     using LengthCalculatorPtr = std::shared_ptr<ILengthCalculator>;
@@ -49,7 +61,11 @@ namespace  INSTINCT_LLM_NS {
         }
 
         size_t GetLength(const UnicodeString &s) override {
-            return tokenizer_->Encode(s, {.allow_special = kAll}).size();
+            return tokenizer_->CountTokens(s, {.allow_special = kAll});
+        }
+
+        std::vector<size_t> GetLengths(const std::vector<UnicodeString>& strings) override {
+            return tokenizer_->CountTokensBatch(strings, {.allow_special = kAll});
         }
     };
 
@@ -104,10 +120,14 @@ namespace  INSTINCT_LLM_NS {
         void MergeSplits_(const std::vector<UnicodeString>& splits, const UnicodeString& separator,
                           std::vector<UnicodeString>& docs) const {
             const auto s_len = length_calculator_->GetLength(separator);
+            const auto lengths = length_calculator_->GetLengths(splits);
             std::vector<UnicodeString> current_doc;
+            // lengths of strings in `current_doc`
+            std::vector<size_t> current_lengths;
             size_t total = 0;
-            for (const auto& s: splits) {
-                const auto d_len = length_calculator_->GetLength(s);
+            for (size_t i = 0; i < splits.size(); ++i) {
+                const auto& s = splits[i];
+                const auto d_len = lengths[i];
                 // if chunk_size is reached, merge partials in `current_doc` a new string and append to `docs`.
                 if (total + d_len + (current_doc.empty() ? 0 : s_len) > chunk_size_) {
                     if (!current_doc.empty()) {
@@ -119,12 +139,14 @@ namespace  INSTINCT_LLM_NS {
                         }
 
                         while (total > chunk_overlap_ || ((total + d_len + (current_doc.empty() ? s_len : 0) > chunk_size_) && total > 0)) {
-                            total -= length_calculator_->GetLength(current_doc.front()) + (current_doc.size() > 1 ? s_len : 0);
+                            total -= current_lengths.front() + (current_doc.size() > 1 ? s_len : 0);
                             current_doc.erase(current_doc.begin());
+                            current_lengths.erase(current_lengths.begin());
                         }
                     }
                 }
                 current_doc.push_back(s);
+                current_lengths.push_back(d_len);
                 total += d_len + (current_doc.size() > 1 ? s_len: 0);
             }
             if (const auto rest = JoinDocs_(current_doc, separator); !rest.isEmpty()) {
@@ -85,8 +85,10 @@ namespace INSTINCT_LLM_NS {
 
             // Tricky part: if `keep_separator` is true, then the splits vector (`good_splits`) already contain separators, so we cannot join splits with seperator again, other there will be duplicated separators between splits.
             const auto merging_separator = keep_separator_ ? "" : separator;
-            for(auto& s: splits) {
-                if(length_calculator_->GetLength(s) < chunk_size_) {
+            const auto lengths = length_calculator_->GetLengths(splits);
+            for(size_t i = 0; i < splits.size(); ++i) {
+                const auto& s = splits[i];
+                if(lengths[i] < chunk_size_) {
                     good_splits.push_back(s);
                 } else {
                     // merge partials if possible
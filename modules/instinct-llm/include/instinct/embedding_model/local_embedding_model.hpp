@@ -9,8 +9,10 @@
 #include <instinct/llm_global.hpp>
 #include <instinct/transformer/models.hpp>
 #include <instinct/transformer/model_factory.hpp>
+#include <instinct/transformer/inference_scheduler.hpp>
 #include <instinct/transformer/tokenizer.hpp>
 #include <instinct/model/embedding_model.hpp>
+#include <instinct/tools/assertions.hpp>
 #include <instinct/tools/file_vault/file_system_file_vault.hpp>
 #include <instinct/tools/file_vault/file_vault.hpp>
 
@@ -20,27 +22,54 @@
 namespace INSTINCT_LLM_NS {
     using namespace INSTINCT_TRANSFORMER_NS;
 
-    class LocalEmbeddingModel final: public IEmbeddingModel {
+    class LocalEmbeddingModel final: public IHybridEmbeddingModel {
         transformer::tokenizer::TokenizerPtr tokenizer_;
         models::ModelPtr model_;
         size_t dimension_;
+        unsigned int num_threads_;
+        std::unique_ptr<InferenceScheduler> scheduler_;
     public:
-        explicit LocalEmbeddingModel(const std::filesystem::path& model_file_path) {
-            std::tie(model_, tokenizer_) = ModelFactory::GetInstance().load(model_file_path);
+        /**
+         * @param model_file_path
+         * @param max_concurrency count of forwards that can run in parallel. Cores are split evenly among them.
+         * @param load_options precision of weights, prefetch and warm-up. Weights are used as stored in model file by default.
+         * @param scheduler_options micro-batching of texts from concurrent callers by length. Disabled by default.
+         */
+        explicit LocalEmbeddingModel(const std::filesystem::path& model_file_path, const size_t max_concurrency = default_model_concurrency(), ModelLoadOptions load_options = {}, const InferenceSchedulerOptions& scheduler_options = {}) {
+            load_options.warm_up_threads = std::max<unsigned int>(1, std::thread::hardware_concurrency() / std::max<size_t>(1, max_concurrency));
+            std::tie(model_, tokenizer_) = ModelFactory::GetInstance().load(model_file_path, load_options);
+            const auto stats = model_->get_cold_start_stats();
+            LOG_INFO("LocalEmbeddingModel loaded: load_ms={}, warm_up_ms={}", stats.load_ms, stats.warm_up_ms);
+            model_->set_max_concurrency(max_concurrency);
             dimension_ = model_->get_text_embedding_dim();
+            num_threads_ = std::max<unsigned int>(1, std::thread::hardware_concurrency() / model_->get_max_concurrency());
+            if (scheduler_options.enabled) {
+                scheduler_ = std::make_unique<InferenceScheduler>(model_, scheduler_options);
+            }
         }
 
         std::vector<Embedding> EmbedDocuments(const std::vector<std::string> &texts) override {
+            std::vector<std::vector<int>> batch_input_ids;
+            tokenizer_->encode_batch(texts, batch_input_ids);
             std::vector<Embedding> output;
-            output.reserve(texts.size());
-            for(int i=0;i<texts.size();++i) {
-                output[i] = EmbedQuery(texts[i]);
+            if (scheduler_) {
+                // texts are mixed with those of other callers and grouped by length
+                scheduler_->text_embedding(batch_input_ids, output);
+                return output;
             }
+            // texts are packed into padded batches by model, so that each forward is shared by many sequences
+            const GenerationConfig config {.num_threads = num_threads_};
+            model_->batch_text_embedding(config, batch_input_ids, output);
             return output;
         }
 
         Embedding EmbedQuery(const std::string &text) override {
-            constexpr GenerationConfig config {};
+            if (scheduler_) {
+                std::vector<Embedding> output;
+                scheduler_->text_embedding({tokenizer_->encode(text)}, output);
+                return std::move(output.front());
+            }
+            const GenerationConfig config {.num_threads = num_threads_};
             Embedding embedding;
             model_->text_embedding(config, tokenizer_->encode(text), embedding);
             return embedding;
@@ -49,6 +78,34 @@ namespace INSTINCT_LLM_NS {
         size_t GetDimension() override {
             return dimension_;
         }
+
+        std::vector<HybridEmbedding> EmbedDocumentsHybrid(const std::vector<std::string> &texts) override {
+            assert_true(model_->has_hybrid_embedding(), "Hybrid embedding is not supported by model file");
+            std::vector<std::vector<int>> batch_input_ids;
+            tokenizer_->encode_batch(texts, batch_input_ids);
+            const GenerationConfig config {.num_threads = num_threads_};
+            std::vector<models::HybridEmbedding> outputs;
+            model_->batch_hybrid_text_embedding(config, batch_input_ids, outputs);
+            std::vector<HybridEmbedding> result;
+            result.reserve(outputs.size());
+            for (auto& output: outputs) {
+                result.push_back({
+                    .dense = std::move(output.dense),
+                    .sparse = {output.lexical_weights.begin(), output.lexical_weights.end()},
+                    .multi_vectors = std::move(output.multi_vectors)
+                });
+            }
+            return result;
+        }
+
+        HybridEmbedding EmbedQueryHybrid(const std::string &text) override {
+            auto result = EmbedDocumentsHybrid({text});
+            return std::move(result[0]);
+        }
+
+        bool SupportsHybridEmbedding() override {
+            return model_->has_hybrid_embedding();
+        }
     };
 
     static void PreloadEmbeddingModelFiles(const FileVaultPtr& file_vault = DEFAULT_FILE_VAULT) {
@@ -62,13 +119,13 @@ namespace INSTINCT_LLM_NS {
         }
     }
 
-    static EmbeddingsPtr CreateLocalEmbeddingModel(const ModelType model_type, const FileVaultPtr& file_vault = DEFAULT_FILE_VAULT) {
+    static EmbeddingsPtr CreateLocalEmbeddingModel(const ModelType model_type, const FileVaultPtr& file_vault = DEFAULT_FILE_VAULT, const size_t max_concurrency = default_model_concurrency(), const ModelLoadOptions& load_options = {}, const InferenceSchedulerOptions& scheduler_options = {}) {
         static std::mutex FILE_MUTEX;
         std::lock_guard file_lock {FILE_MUTEX};
         PreloadEmbeddingModelFiles(file_vault);
         const auto resource_name = "model_bins/" + to_file_name(model_type);
         const auto entry = file_vault->GetResource(resource_name).get();
-        return std::make_shared<LocalEmbeddingModel>(entry.local_path);
+        return std::make_shared<LocalEmbeddingModel>(entry.local_path, max_concurrency, load_options, scheduler_options);
     }
 
 }
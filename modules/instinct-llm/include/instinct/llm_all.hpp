@@ -63,8 +63,11 @@
 #include <instinct/prompt/string_prompt_template.hpp>
 #include <instinct/ranker/base_ranking_model.hpp>
 #include <instinct/ranker/local_ranking_model.hpp>
+#include <instinct/tokenizer/binary_bpe_vocab.hpp>
 #include <instinct/tokenizer/bpe_token_ranks_reader.hpp>
+#include <instinct/tokenizer/encode_cache.hpp>
 #include <instinct/tokenizer/gpt2_bpe_file_reader.hpp>
+#include <instinct/tokenizer/pre_tokenizer.hpp>
 #include <instinct/tokenizer/regex_tokenizer.hpp>
 #include <instinct/tokenizer/tiktoken_bpe_file_reader.hpp>
 #include <instinct/tokenizer/tiktoken_tokenizer.hpp>
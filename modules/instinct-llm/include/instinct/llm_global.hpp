@@ -24,6 +24,11 @@ namespace INSTINCT_LLM_NS {
 
     using Embedding = std::vector<float>;
 
+    /**
+     * Lexical weights of distinct tokens in text, as pairs of token id and weight sorted by token id
+     */
+    using SparseEmbedding = std::vector<std::pair<int32_t, float>>;
+
     struct ChainOptions {
 
     };
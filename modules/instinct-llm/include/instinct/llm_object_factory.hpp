@@ -12,6 +12,7 @@
 #include <instinct/chat_model/openai_chat.hpp>
 #include <instinct/commons/ollama_commons.hpp>
 #include <instinct/commons/openai_commons.hpp>
+#include <instinct/embedding_model/local_embedding_model.hpp>
 #include <instinct/embedding_model/ollama_embedding.hpp>
 #include <instinct/embedding_model/openai_embedding.hpp>
 
@@ -46,6 +47,14 @@ namespace INSTINCT_LLM_NS {
         std::string api_key;
         std::string endpoint_url_string;
         int dim = 0;
+        // precision of weights for local models, e.g. `q4_1`, `q8_0` or `f16`. Leave blank to use the one stored in model file.
+        std::string weight_type;
+        // for local models, prefetch weights in background and run a dummy forward on creation, so that first request doesn't pay for page faults. Weights are mapped lazily by default.
+        bool warm_up = false;
+        // for local models, group texts of concurrent requests into micro-batches by length instead of running each request on its own
+        bool batch_scheduling = false;
+        // for local ranking models, score long passages with sliding windows instead of truncating them
+        RankingWindowOptions ranking_window = {};
         OpenAIConfiguration openai;
         OllamaConfiguration ollama;
         JinaConfiguration jina;
@@ -57,13 +66,25 @@ namespace INSTINCT_LLM_NS {
     };
 
     class LLMObjectFactory final {
+        static ModelLoadOptions to_model_load_options(const ModelProviderOptions& options) {
+            return {
+                .weight_type = parse_weight_type(options.weight_type),
+                .mapping = {.prefetch = options.warm_up},
+                .warm_up = options.warm_up
+            };
+        }
+
+        static InferenceSchedulerOptions to_scheduler_options(const ModelProviderOptions& options) {
+            return {.enabled = options.batch_scheduling};
+        }
+
     public:
 
         static RankingModelPtr CreateRankingModel(ModelProviderOptions options) {
             switch (options.provider) {
                 case kLOCAL: {
                     // only BGE-M3-Reranker is supported right now
-                    return CreateLocalRankingModel(BGE_M3_RERANKER);
+                    return CreateLocalRankingModel(BGE_M3_RERANKER, DEFAULT_FILE_VAULT, default_model_concurrency(), to_model_load_options(options), options.ranking_window, to_scheduler_options(options));
                 }
                 case kJINAAI: {
                     options.jina.model_name = options.model_name;
@@ -115,6 +136,10 @@ namespace INSTINCT_LLM_NS {
 
         static EmbeddingsPtr CreateEmbeddingModel(ModelProviderOptions options) {
             switch (options.provider) {
+                case kLOCAL: {
+                    // only BGE-M3 is supported right now
+                    return CreateLocalEmbeddingModel(BGE_M3_EMBEDDING, DEFAULT_FILE_VAULT, default_model_concurrency(), to_model_load_options(options), to_scheduler_options(options));
+                }
                 case kOLLAMA: {
                     options.ollama.model_name = options.model_name;
                     options.ollama.dimension = options.dim;
@@ -4,6 +4,7 @@
 
 #ifndef LLMTESTGLOBALS_HPP
 #define LLMTESTGLOBALS_HPP
+#include <map>
 #include <random>
 
 #include <instinct/chat_model/base_chat_model.hpp>
@@ -152,6 +153,59 @@ talking non-sense
         }
     };
 
+    /**
+     * Hybrid embedding model whose lexical weights are one for each distinct word, with token ids derived from word hashes
+     */
+    class PesudoHybridEmbeddings final: public IHybridEmbeddingModel {
+        std::unordered_map<std::string, Embedding> caches_ = {};
+        size_t dim_;
+    public:
+        explicit PesudoHybridEmbeddings(const size_t dim = 512)
+                : dim_(dim) {
+        }
+
+        std::vector<Embedding> EmbedDocuments(const std::vector<std::string>& texts) override {
+            std::vector<Embedding> result;
+            for(const auto& text: texts) {
+                result.push_back(EmbedQuery(text));
+            }
+            return result;
+        }
+
+        Embedding EmbedQuery(const std::string& text) override {
+            if (!caches_.contains(text)) {
+                caches_.emplace(text, make_random_vector(dim_));
+            }
+            return caches_.at(text);
+        }
+
+        size_t GetDimension() override {
+            return dim_;
+        }
+
+        std::vector<HybridEmbedding> EmbedDocumentsHybrid(const std::vector<std::string>& texts) override {
+            std::vector<HybridEmbedding> result;
+            for(const auto& text: texts) {
+                result.push_back(EmbedQueryHybrid(text));
+            }
+            return result;
+        }
+
+        HybridEmbedding EmbedQueryHybrid(const std::string& text) override {
+            std::map<int32_t, float> weights;
+            for (const auto& word: StringUtils::ReSplit(text)) {
+                if (!word.empty()) {
+                    weights[(int32_t) (std::hash<std::string> {}(word) % 100000)] = 1.0f;
+                }
+            }
+            return {.dense = EmbedQuery(text), .sparse = {weights.begin(), weights.end()}};
+        }
+
+        bool SupportsHybridEmbedding() override {
+            return true;
+        }
+    };
+
     static ChatModelPtr create_pesudo_chat_model() {
         return std::make_shared<PesudoChatModel>();
     }
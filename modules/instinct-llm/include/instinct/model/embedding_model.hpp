@@ -23,6 +23,35 @@ namespace INSTINCT_LLM_NS {
     };
 
     using EmbeddingsPtr = std::shared_ptr<IEmbeddingModel>;
+
+
+    /**
+     * All representations of a text computed in a single model pass
+     */
+    struct HybridEmbedding {
+        Embedding dense;
+        SparseEmbedding sparse;
+        /**
+         * One vector for each token, used in late-interaction scoring like ColBERT
+         */
+        std::vector<Embedding> multi_vectors;
+    };
+
+    /**
+     * Embedding model that outputs lexical weights and multi-vectors along with dense embedding, like BGE-M3. Hybrid retrieval can then be served by one model pass, instead of a separate BM25 index build plus a dense embedding pass.
+     */
+    class IHybridEmbeddingModel: public IEmbeddingModel {
+    public:
+        virtual std::vector<HybridEmbedding> EmbedDocumentsHybrid(const std::vector<std::string>& texts) = 0;
+        virtual HybridEmbedding EmbedQueryHybrid(const std::string& text) = 0;
+
+        /**
+         * @return false if hybrid outputs are not available, e.g. weights of extra heads are missing in model file
+         */
+        virtual bool SupportsHybridEmbedding() = 0;
+    };
+
+    using HybridEmbeddingsPtr = std::shared_ptr<IHybridEmbeddingModel>;
 }
 
 #endif //EMBEDDINGS_HPP
@@ -5,6 +5,7 @@
 #ifndef BASE_RANKER_HPP
 #define BASE_RANKER_HPP
 #include <ranges>
+#include <algorithm>
 #include <instinct/llm_global.hpp>
 #include <instinct/functional/runnable.hpp>
 #include <instinct/model/ranking_model.hpp>
@@ -26,15 +27,38 @@ namespace INSTINCT_LLM_NS {
             return this->GetRankingScore(input.query, input.doc);
         }
 
+        /**
+         * Compute ranking scores of a query against many docs. Sub-classes should override this if scores can be computed in batch.
+         * @param query
+         * @param docs
+         * @return scores in the same order of `docs`
+         */
+        virtual std::vector<float> GetRankingScores(const std::string &query, const std::vector<std::string> &docs) {
+            std::vector<float> scores;
+            scores.reserve(docs.size());
+            for (const auto& doc: docs) {
+                scores.push_back(this->GetRankingScore(query, doc));
+            }
+            return scores;
+        }
+
         std::vector<IdxWithScore> RerankDocuments(const std::vector<Document> &docs, const std::string &query, const int top_n) override {
             assert_true(top_n <= docs.size());
+            std::vector<std::string> texts;
+            texts.reserve(docs.size());
+            for (const auto& doc: docs) {
+                texts.push_back(doc.text());
+            }
+            const auto scores = this->GetRankingScores(query, texts);
             std::vector<IdxWithScore> result;
             result.reserve(docs.size());
-            for (int i=0; const auto& doc: docs) {
-                result.emplace_back(i++, this->GetRankingScore(query, doc.text()));
+            for (size_t i=0; i<scores.size(); ++i) {
+                result.emplace_back(i, scores[i]);
             }
-            std::ranges::sort(result, std::ranges::greater{}, &IdxWithScore::second);
-            return {result.begin(), result.begin() + top_n};
+            // only top_n entries need to be ordered
+            std::ranges::partial_sort(result, result.begin() + top_n, std::ranges::greater{}, &IdxWithScore::second);
+            result.resize(top_n);
+            return result;
         }
     };
 
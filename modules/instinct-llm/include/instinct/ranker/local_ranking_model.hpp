@@ -8,6 +8,7 @@
 #include <instinct/ranker/base_ranking_model.hpp>
 #include <instinct/transformer/models.hpp>
 #include <instinct/transformer/model_factory.hpp>
+#include <instinct/transformer/inference_scheduler.hpp>
 #include <instinct/tools/file_vault/file_system_file_vault.hpp>
 #include <instinct/tools/file_vault/http_url_resource_provider.hpp>
 
@@ -15,27 +16,111 @@ namespace INSTINCT_LLM_NS {
     using namespace  INSTINCT_TRANSFORMER_NS;
 
 
+    enum WindowPooling {
+        kMaxWindowPooling,
+        kMeanWindowPooling
+    };
+
+    struct RankingWindowOptions {
+        /**
+         * Split passages longer than model's max length into overlapping windows instead of truncating them
+         */
+        bool enabled = false;
+        /**
+         * Count of passage tokens shared by adjacent windows
+         */
+        size_t overlap = 64;
+        /**
+         * How window scores are aggregated into score of passage
+         */
+        WindowPooling pooling = kMaxWindowPooling;
+    };
+
     /**
      * This class uses models in `instinct-transformer` module
      */
     class LocalRankingModel final: public BaseRankingModel {
         transformer::tokenizer::TokenizerPtr tokenizer_;
         ModelPtr model_;
-        std::mutex run_mutex_;
+        unsigned int num_threads_;
+        RankingWindowOptions window_options_;
+        std::unique_ptr<InferenceScheduler> scheduler_;
+
+        void batch_qa_rank_(const std::vector<std::vector<int>>& batch_ids, std::vector<float>& scores) const {
+            if (scheduler_) {
+                // pairs are mixed with those of other callers and grouped by length
+                scheduler_->qa_rank(batch_ids, scores);
+                return;
+            }
+            // pairs are packed into padded batches by model
+            const GenerationConfig config {.num_threads = num_threads_};
+            model_->batch_qa_rank(config, batch_ids, scores);
+        }
+
     public:
-        explicit LocalRankingModel(const std::filesystem::path& model_file_path) {
-            std::tie(model_, tokenizer_) = ModelFactory::GetInstance().load(model_file_path);
+        /**
+         * @param model_file_path
+         * @param max_concurrency count of forwards that can run in parallel. Cores are split evenly among them.
+         * @param load_options precision of weights, prefetch and warm-up. Weights are used as stored in model file by default.
+         * @param window_options scoring of long passages with sliding windows
+         * @param scheduler_options micro-batching of pairs from concurrent callers by length. Disabled by default.
+         */
+        explicit LocalRankingModel(const std::filesystem::path& model_file_path, const size_t max_concurrency = default_model_concurrency(), ModelLoadOptions load_options = {}, const RankingWindowOptions& window_options = {}, const InferenceSchedulerOptions& scheduler_options = {}):
+            window_options_(window_options) {
+            load_options.warm_up_threads = std::max<unsigned int>(1, std::thread::hardware_concurrency() / std::max<size_t>(1, max_concurrency));
+            std::tie(model_, tokenizer_) = ModelFactory::GetInstance().load(model_file_path, load_options);
+            const auto stats = model_->get_cold_start_stats();
+            LOG_INFO("LocalRankingModel loaded: load_ms={}, warm_up_ms={}", stats.load_ms, stats.warm_up_ms);
+            model_->set_max_concurrency(max_concurrency);
+            num_threads_ = std::max<unsigned int>(1, std::thread::hardware_concurrency() / model_->get_max_concurrency());
+            if (scheduler_options.enabled) {
+                scheduler_ = std::make_unique<InferenceScheduler>(model_, scheduler_options);
+            }
         }
 
         float GetRankingScore(const std::string &query, const std::string &doc) override {
+            if (window_options_.enabled || scheduler_) {
+                return GetRankingScores(query, {doc}).front();
+            }
             trace_span span {"GetRankingScore"};
-            // TODO remove this lock by using multi-instance or batching.
-            std::lock_guard guard {run_mutex_};
-            const GenerationConfig config {.num_threads = std::thread::hardware_concurrency() / 2};
+            // at most `max_concurrency` calls are running, and others are waiting for free buffers in model
+            const GenerationConfig config {.num_threads = num_threads_};
             std::vector<int> ids;
             this->tokenizer_->encode_qa(query, doc, ids);
             return this->model_->qa_rank(config, ids);
         }
+
+        std::vector<float> GetRankingScores(const std::string &query, const std::vector<std::string> &docs) override {
+            trace_span span {"GetRankingScores"};
+            std::vector<std::vector<int>> batch_ids;
+            if (!window_options_.enabled) {
+                this->tokenizer_->encode_qa_batch(query, docs, batch_ids);
+                std::vector<float> scores;
+                batch_qa_rank_(batch_ids, scores);
+                return scores;
+            }
+
+            // windows of all docs share forwards
+            std::vector<size_t> doc_indices;
+            this->tokenizer_->encode_qa_windows(query, docs, window_options_.overlap, batch_ids, doc_indices);
+            std::vector<float> window_scores;
+            batch_qa_rank_(batch_ids, window_scores);
+
+            std::vector<float> scores(docs.size(), window_options_.pooling == kMaxWindowPooling ? std::numeric_limits<float>::lowest() : 0.0f);
+            std::vector<size_t> window_counts(docs.size(), 0);
+            for (size_t i = 0; i < window_scores.size(); ++i) {
+                const auto doc_index = doc_indices[i];
+                scores[doc_index] = window_options_.pooling == kMaxWindowPooling ? std::max(scores[doc_index], window_scores[i]) : scores[doc_index] + window_scores[i];
+                ++window_counts[doc_index];
+            }
+            if (window_options_.pooling == kMeanWindowPooling) {
+                for (size_t i = 0; i < scores.size(); ++i) {
+                    scores[i] /= (float) std::max<size_t>(1, window_counts[i]);
+                }
+            }
+            LOG_DEBUG("windowed ranking: docs={}, windows={}", docs.size(), batch_ids.size());
+            return scores;
+        }
     };
 
     static void PreloadRankingModelFiles(const FileVaultPtr& file_vault = DEFAULT_FILE_VAULT) {
@@ -49,13 +134,13 @@ namespace INSTINCT_LLM_NS {
         }
     }
 
-    static RankingModelPtr CreateLocalRankingModel(const ModelType model_type, const FileVaultPtr& file_vault = DEFAULT_FILE_VAULT) {
+    static RankingModelPtr CreateLocalRankingModel(const ModelType model_type, const FileVaultPtr& file_vault = DEFAULT_FILE_VAULT, const size_t max_concurrency = default_model_concurrency(), const ModelLoadOptions& load_options = {}, const RankingWindowOptions& window_options = {}, const InferenceSchedulerOptions& scheduler_options = {}) {
         static std::mutex FILE_MUTEX;
         std::lock_guard file_lock {FILE_MUTEX};
         PreloadRankingModelFiles(file_vault);
         const auto resource_name = "model_bins/" + to_file_name(model_type);
         const auto entry = file_vault->GetResource(resource_name).get();
-        return std::make_shared<LocalRankingModel>(entry.local_path);
+        return std::make_shared<LocalRankingModel>(entry.local_path, max_concurrency, load_options, window_options, scheduler_options);
     }
 
 }
@@ -0,0 +1,463 @@
+#ifndef BINARY_BPE_VOCAB_HPP
+#define BINARY_BPE_VOCAB_HPP
+
+#include <array>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <string_view>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <instinct/tokenizer/tokenizer.hpp>
+
+
+namespace INSTINCT_LLM_NS {
+
+    using ByteShuffleTable = std::array<uint8_t, 256>;
+
+    /**
+     * Stamp of rank files that a binary vocab file is converted from. A cached binary vocab file is stale once stamp of its rank files changes.
+     */
+    struct BinaryBPEVocabSource {
+        // total size of source files
+        uint64_t size = 0;
+        // hash of size and modification time of each source file
+        uint64_t fingerprint = 0;
+
+        bool operator==(const BinaryBPEVocabSource&) const = default;
+
+        static BinaryBPEVocabSource Of(const std::vector<std::filesystem::path>& files) {
+            BinaryBPEVocabSource source;
+            // FNV-1a over stamps of files
+            source.fingerprint = 0xcbf29ce484222325ULL;
+            auto mix = [&](const uint64_t value) {
+                source.fingerprint = (source.fingerprint ^ value) * 0x100000001b3ULL;
+            };
+            for (const auto& file: files) {
+                const auto file_size = (uint64_t) std::filesystem::file_size(file);
+                source.size += file_size;
+                mix(file_size);
+                mix((uint64_t) std::filesystem::last_write_time(file).time_since_epoch().count());
+            }
+            return source;
+        }
+    };
+
+    /**
+     * Layout of binary vocab file. All sections are aligned to 8 bytes and integers are stored in host byte order, which is checked with `byte_order_mark` at load.
+     */
+    struct BinaryBPEVocabHeader {
+        static constexpr char MAGIC[8] = {'I', 'N', 'S', 'T', 'B', 'P', 'E', 'V'};
+        static constexpr uint32_t VERSION = 2;
+        static constexpr uint32_t BYTE_ORDER_MARK = 0x01020304;
+
+        char magic[8];
+        uint32_t version;
+        uint32_t byte_order_mark;
+        // count of merges, slots of perfect hash table and buckets of displacements
+        uint32_t n_merges;
+        uint32_t n_slots;
+        uint32_t n_buckets;
+        // size of decoder table, which is max token id plus one
+        uint32_t n_tokens;
+        uint64_t pattern_offset;
+        uint64_t pattern_size;
+        // records of `int32_t id`, `uint32_t length` and bytes of special token
+        uint64_t specials_offset;
+        uint64_t specials_size;
+        uint64_t byte_shuffle_offset;
+        uint64_t buckets_offset;
+        uint64_t slots_offset;
+        uint64_t token_offsets_offset;
+        uint64_t token_bytes_offset;
+        uint64_t token_bytes_size;
+        uint64_t file_size;
+        // stamp of rank files, or zeros if unknown
+        uint64_t source_size;
+        uint64_t source_fingerprint;
+    };
+
+    /**
+     * Read-only BPE merges and decoder table of a memory-mapped binary vocab file, so that a tokenizer can be created without parsing rank files and recovering byte pairs.
+     *
+     * Merges are stored in a perfect hash table built with hash-and-displace: each pair is hashed into a bucket, and each bucket has a displacement that sends all of its pairs to distinct slots. A lookup reads one displacement and one slot.
+     */
+    class BinaryBPEVocab final {
+        struct MergeSlot {
+            uint64_t key;
+            int32_t rank;
+            int32_t reserved;
+        };
+
+        static constexpr uint64_t EMPTY_KEY = UINT64_MAX;
+
+        const char* data_ = nullptr;
+        size_t size_ = 0;
+        const BinaryBPEVocabHeader* header_ = nullptr;
+        const uint32_t* displacements_ = nullptr;
+        const MergeSlot* slots_ = nullptr;
+        const uint32_t* token_offsets_ = nullptr;
+        const char* token_bytes_ = nullptr;
+
+    public:
+        explicit BinaryBPEVocab(const std::filesystem::path& path) {
+            const int fd = open(path.c_str(), O_RDONLY);
+            if (fd < 0) {
+                throw InstinctException("failed to open binary vocab file at " + path.string());
+            }
+            struct stat sb {};
+            if (fstat(fd, &sb) != 0 || sb.st_size < (off_t) sizeof(BinaryBPEVocabHeader)) {
+                close(fd);
+                throw InstinctException("invalid binary vocab file at " + path.string());
+            }
+            size_ = sb.st_size;
+            void* data = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+            close(fd);
+            if (data == MAP_FAILED) {
+                throw InstinctException("failed to map binary vocab file at " + path.string());
+            }
+            data_ = static_cast<const char*>(data);
+            try {
+                Validate_();
+            } catch (...) {
+                munmap(const_cast<char*>(data_), size_);
+                throw;
+            }
+        }
+
+        BinaryBPEVocab(const BinaryBPEVocab&) = delete;
+        BinaryBPEVocab& operator=(const BinaryBPEVocab&) = delete;
+
+        ~BinaryBPEVocab() {
+            munmap(const_cast<char*>(data_), size_);
+        }
+
+        /**
+         * @return rank of merged pair, which is also id of merged token, or -1 if pair is not mergeable
+         */
+        [[nodiscard]] int32_t FindMerge(const int32_t left, const int32_t right) const {
+            if (header_->n_slots == 0) {
+                return -1;
+            }
+            const auto key = PackPair_(left, right);
+            const auto displacement = displacements_[BucketOf_(key, header_->n_buckets)];
+            const auto& slot = slots_[SlotOf_(key, displacement, header_->n_slots)];
+            return slot.key == key ? slot.rank : -1;
+        }
+
+        /**
+         * @return bytes of token, or empty view if id is unknown
+         */
+        [[nodiscard]] std::string_view GetTokenBytes(const int32_t id) const {
+            if (id < 0 || (uint32_t) id >= header_->n_tokens) {
+                return {};
+            }
+            return {token_bytes_ + token_offsets_[id], token_offsets_[id + 1] - token_offsets_[id]};
+        }
+
+        [[nodiscard]] size_t GetMergeCount() const {
+            return header_->n_merges;
+        }
+
+        [[nodiscard]] std::string GetPattern() const {
+            return {data_ + header_->pattern_offset, header_->pattern_size};
+        }
+
+        [[nodiscard]] StringIDDict GetSpecialTokens() const {
+            StringIDDict special_tokens;
+            size_t offset = header_->specials_offset;
+            const size_t end = header_->specials_offset + header_->specials_size;
+            while (offset + 2 * sizeof(int32_t) <= end) {
+                int32_t id;
+                uint32_t length;
+                std::memcpy(&id, data_ + offset, sizeof(id));
+                std::memcpy(&length, data_ + offset + sizeof(id), sizeof(length));
+                offset += sizeof(id) + sizeof(length);
+                if (offset + length > end) {
+                    throw InstinctException("corrupted special tokens in binary vocab file");
+                }
+                special_tokens[UnicodeString::fromUTF8(std::string {data_ + offset, length})] = id;
+                offset += length;
+            }
+            return special_tokens;
+        }
+
+        [[nodiscard]] BinaryBPEVocabSource GetSource() const {
+            return {header_->source_size, header_->source_fingerprint};
+        }
+
+        [[nodiscard]] ByteShuffleTable GetByteShuffle() const {
+            ByteShuffleTable byte_shuffle {};
+            std::memcpy(byte_shuffle.data(), data_ + header_->byte_shuffle_offset, byte_shuffle.size());
+            return byte_shuffle;
+        }
+
+        /**
+         * Check magic and version without mapping whole file
+         */
+        static bool IsBinaryVocabFile(const std::filesystem::path& path) {
+            BinaryBPEVocabHeader header {};
+            return ReadHeader_(path, header);
+        }
+
+        /**
+         * Check magic, version and stamp of rank files without mapping whole file
+         * @param path path to binary vocab file
+         * @param source stamp of rank files it should be converted from
+         */
+        static bool IsBinaryVocabFileOf(const std::filesystem::path& path, const BinaryBPEVocabSource& source) {
+            BinaryBPEVocabHeader header {};
+            return ReadHeader_(path, header)
+                && BinaryBPEVocabSource {header.source_size, header.source_fingerprint} == source;
+        }
+
+        /**
+         * Write a binary vocab file. File is written to a temporary path first and renamed, so that a concurrent reader never sees a partial file.
+         * @param path output path
+         * @param merges ranks of byte pairs
+         * @param vocab bytes of each token
+         * @param pattern split pattern in UTF-8
+         * @param special_tokens special tokens and their ids
+         * @param byte_shuffle mapping of raw bytes to ids of single-byte tokens
+         * @param source stamp of rank files
+         */
+        static void Write(
+            const std::filesystem::path& path,
+            const BPERanks& merges,
+            const Vocab& vocab,
+            const std::string& pattern,
+            const StringIDDict& special_tokens,
+            const ByteShuffleTable& byte_shuffle,
+            const BinaryBPEVocabSource& source = {}) {
+            BinaryBPEVocabHeader header {};
+            std::memcpy(header.magic, BinaryBPEVocabHeader::MAGIC, sizeof(header.magic));
+            header.version = BinaryBPEVocabHeader::VERSION;
+            header.byte_order_mark = BinaryBPEVocabHeader::BYTE_ORDER_MARK;
+            header.source_size = source.size;
+            header.source_fingerprint = source.fingerprint;
+
+            // perfect hash table of merges
+            std::vector<uint32_t> displacements;
+            std::vector<MergeSlot> slots;
+            BuildPerfectHash_(merges, displacements, slots);
+            header.n_merges = (uint32_t) merges.size();
+            header.n_buckets = (uint32_t) displacements.size();
+            header.n_slots = (uint32_t) slots.size();
+
+            // decoder table
+            int32_t max_id = -1;
+            for (const auto& [id, _]: vocab) {
+                max_id = std::max(max_id, id);
+            }
+            header.n_tokens = (uint32_t) (max_id + 1);
+            std::vector<uint32_t> token_offsets(header.n_tokens + 1, 0);
+            std::string token_bytes;
+            for (uint32_t id = 0; id < header.n_tokens; ++id) {
+                token_offsets[id] = (uint32_t) token_bytes.size();
+                if (const auto itr = vocab.find((int32_t) id); itr != vocab.end()) {
+                    token_bytes += itr->second;
+                }
+            }
+            token_offsets[header.n_tokens] = (uint32_t) token_bytes.size();
+
+            std::string specials;
+            for (const auto& [token, id]: special_tokens) {
+                const auto token_utf8 = details::conv_to_utf8_string(token);
+                const auto length = (uint32_t) token_utf8.size();
+                specials.append(reinterpret_cast<const char*>(&id), sizeof(id));
+                specials.append(reinterpret_cast<const char*>(&length), sizeof(length));
+                specials.append(token_utf8);
+            }
+
+            // lay out sections
+            uint64_t offset = sizeof(BinaryBPEVocabHeader);
+            auto place = [&](const uint64_t size) {
+                offset = Align_(offset);
+                const auto section_offset = offset;
+                offset += size;
+                return section_offset;
+            };
+            header.pattern_size = pattern.size();
+            header.pattern_offset = place(header.pattern_size);
+            header.specials_size = specials.size();
+            header.specials_offset = place(header.specials_size);
+            header.byte_shuffle_offset = place(byte_shuffle.size());
+            header.buckets_offset = place(displacements.size() * sizeof(uint32_t));
+            header.slots_offset = place(slots.size() * sizeof(MergeSlot));
+            header.token_offsets_offset = place(token_offsets.size() * sizeof(uint32_t));
+            header.token_bytes_size = token_bytes.size();
+            header.token_bytes_offset = place(header.token_bytes_size);
+            header.file_size = offset;
+
+            const auto tmp_path = path.string() + ".tmp" + std::to_string(getpid());
+            {
+                std::ofstream file(tmp_path, std::ios::binary | std::ios::trunc);
+                if (!file.is_open()) {
+                    throw InstinctException("failed to open " + tmp_path + " for writing");
+                }
+                uint64_t written = 0;
+                auto write = [&](const uint64_t section_offset, const void* bytes, const uint64_t size) {
+                    static constexpr char padding[8] = {};
+                    file.write(padding, (std::streamsize) (section_offset - written));
+                    file.write(static_cast<const char*>(bytes), (std::streamsize) size);
+                    written = section_offset + size;
+                };
+                write(0, &header, sizeof(header));
+                write(header.pattern_offset, pattern.data(), pattern.size());
+                write(header.specials_offset, specials.data(), specials.size());
+                write(header.byte_shuffle_offset, byte_shuffle.data(), byte_shuffle.size());
+                write(header.buckets_offset, displacements.data(), displacements.size() * sizeof(uint32_t));
+                write(header.slots_offset, slots.data(), slots.size() * sizeof(MergeSlot));
+                write(header.token_offsets_offset, token_offsets.data(), token_offsets.size() * sizeof(uint32_t));
+                write(header.token_bytes_offset, token_bytes.data(), token_bytes.size());
+                if (!file.good()) {
+                    throw InstinctException("failed to write binary vocab file to " + tmp_path);
+                }
+            }
+            std::filesystem::rename(tmp_path, path);
+        }
+
+    private:
+        static bool ReadHeader_(const std::filesystem::path& path, BinaryBPEVocabHeader& header) {
+            std::ifstream file(path, std::ios::binary);
+            if (!file.read(reinterpret_cast<char*>(&header), sizeof(header))) {
+                return false;
+            }
+            return std::memcmp(header.magic, BinaryBPEVocabHeader::MAGIC, sizeof(header.magic)) == 0
+                && header.version == BinaryBPEVocabHeader::VERSION
+                && header.byte_order_mark == BinaryBPEVocabHeader::BYTE_ORDER_MARK;
+        }
+
+        static uint64_t Align_(const uint64_t offset) {
+            return (offset + 7) / 8 * 8;
+        }
+
+        static uint64_t PackPair_(const int32_t left, const int32_t right) {
+            return (uint64_t) (uint32_t) left << 32 | (uint32_t) right;
+        }
+
+        static uint64_t Mix_(uint64_t x) {
+            // finalizer of splitmix64
+            x ^= x >> 30;
+            x *= 0xbf58476d1ce4e5b9ULL;
+            x ^= x >> 27;
+            x *= 0x94d049bb133111ebULL;
+            x ^= x >> 31;
+            return x;
+        }
+
+        static uint32_t BucketOf_(const uint64_t key, const uint32_t n_buckets) {
+            return (uint32_t) (Mix_(key) % n_buckets);
+        }
+
+        static uint32_t SlotOf_(const uint64_t key, const uint32_t displacement, const uint32_t n_slots) {
+            return (uint32_t) (Mix_(key ^ (displacement * 0x9e3779b97f4a7c15ULL)) % n_slots);
+        }
+
+        static void BuildPerfectHash_(const BPERanks& merges, std::vector<uint32_t>& displacements, std::vector<MergeSlot>& slots) {
+            if (merges.empty()) {
+                return;
+            }
+            // about four keys per bucket, and one fifth of slots left empty
+            const auto n_buckets = (uint32_t) std::max<size_t>(1, merges.size() / 4);
+            const auto n_slots = (uint32_t) (merges.size() + merges.size() / 4 + 1);
+            std::vector<std::vector<std::pair<uint64_t, int32_t>>> buckets(n_buckets);
+            for (const auto& [pair, rank]: merges) {
+                const auto key = PackPair_(pair.first, pair.second);
+                buckets[BucketOf_(key, n_buckets)].emplace_back(key, rank);
+            }
+            std::vector<uint32_t> order(n_buckets);
+            for (uint32_t i = 0; i < n_buckets; ++i) {
+                order[i] = i;
+            }
+            // place large buckets first while most slots are free
+            std::stable_sort(order.begin(), order.end(), [&](const uint32_t a, const uint32_t b) {
+                return buckets[a].size() > buckets[b].size();
+            });
+
+            displacements.assign(n_buckets, 0);
+            slots.assign(n_slots, {EMPTY_KEY, -1, 0});
+            std::vector<uint32_t> candidate_slots;
+            for (const auto b: order) {
+                const auto& bucket = buckets[b];
+                if (bucket.empty()) {
+                    break;
+                }
+                bool placed = false;
+                for (uint32_t displacement = 1; displacement < 100000000 && !placed; ++displacement) {
+                    candidate_slots.clear();
+                    placed = true;
+                    for (const auto& [key, _]: bucket) {
+                        const auto slot = SlotOf_(key, displacement, n_slots);
+                        if (slots[slot].key != EMPTY_KEY || std::find(candidate_slots.begin(), candidate_slots.end(), slot) != candidate_slots.end()) {
+                            placed = false;
+                            break;
+                        }
+                        candidate_slots.push_back(slot);
+                    }
+                    if (placed) {
+                        displacements[b] = displacement;
+                        for (size_t i = 0; i < bucket.size(); ++i) {
+                            slots[candidate_slots[i]] = {bucket[i].first, bucket[i].second, 0};
+                        }
+                    }
+                }
+                if (!placed) {
+                    throw InstinctException("failed to build perfect hash table of merges");
+                }
+            }
+        }
+
+        void Validate_() {
+            header_ = reinterpret_cast<const BinaryBPEVocabHeader*>(data_);
+            if (std::memcmp(header_->magic, BinaryBPEVocabHeader::MAGIC, sizeof(header_->magic)) != 0) {
+                throw InstinctException("not a binary vocab file");
+            }
+            if (header_->version != BinaryBPEVocabHeader::VERSION) {
+                throw InstinctException("unsupported version of binary vocab file: " + std::to_string(header_->version));
+            }
+            if (header_->byte_order_mark != BinaryBPEVocabHeader::BYTE_ORDER_MARK) {
+                throw InstinctException("binary vocab file is written with different byte order");
+            }
+            if (header_->file_size != size_) {
+                throw InstinctException("binary vocab file is truncated");
+            }
+            auto check_section = [&](const uint64_t offset, const uint64_t size) {
+                if (offset % 8 != 0 || offset > size_ || size > size_ - offset) {
+                    throw InstinctException("corrupted section in binary vocab file");
+                }
+            };
+            check_section(header_->pattern_offset, header_->pattern_size);
+            check_section(header_->specials_offset, header_->specials_size);
+            check_section(header_->byte_shuffle_offset, sizeof(ByteShuffleTable));
+            check_section(header_->buckets_offset, (uint64_t) header_->n_buckets * sizeof(uint32_t));
+            check_section(header_->slots_offset, (uint64_t) header_->n_slots * sizeof(MergeSlot));
+            check_section(header_->token_offsets_offset, ((uint64_t) header_->n_tokens + 1) * sizeof(uint32_t));
+            check_section(header_->token_bytes_offset, header_->token_bytes_size);
+            if (header_->n_slots > 0 && header_->n_buckets == 0) {
+                throw InstinctException("corrupted merge table in binary vocab file");
+            }
+
+            displacements_ = reinterpret_cast<const uint32_t*>(data_ + header_->buckets_offset);
+            slots_ = reinterpret_cast<const MergeSlot*>(data_ + header_->slots_offset);
+            token_offsets_ = reinterpret_cast<const uint32_t*>(data_ + header_->token_offsets_offset);
+            token_bytes_ = data_ + header_->token_bytes_offset;
+            for (uint32_t id = 0; id < header_->n_tokens; ++id) {
+                if (token_offsets_[id] > token_offsets_[id + 1]) {
+                    throw InstinctException("corrupted decoder table in binary vocab file");
+                }
+            }
+            if (token_offsets_[header_->n_tokens] > header_->token_bytes_size) {
+                throw InstinctException("corrupted decoder table in binary vocab file");
+            }
+        }
+    };
+
+    using BinaryBPEVocabPtr = std::shared_ptr<const BinaryBPEVocab>;
+
+}
+
+#endif //BINARY_BPE_VOCAB_HPP
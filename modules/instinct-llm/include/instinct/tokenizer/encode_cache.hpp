@@ -0,0 +1,151 @@
+#ifndef ENCODE_CACHE_HPP
+#define ENCODE_CACHE_HPP
+
+#include <list>
+#include <mutex>
+#include <string_view>
+#include <unordered_map>
+
+#include <instinct/llm_global.hpp>
+
+
+namespace INSTINCT_LLM_NS {
+
+    struct EncodeCacheOptions {
+        /**
+         * Max count of cached chunks in all shards. Zero disables cache.
+         */
+        size_t capacity = 32768;
+
+        /**
+         * Count of shards, each of which has its own lock and LRU list
+         */
+        size_t shards = 16;
+
+        /**
+         * Longer chunks are rarely repeated, so they are not cached
+         */
+        size_t max_chunk_bytes = 128;
+    };
+
+    struct EncodeCacheStats {
+        size_t hits = 0;
+        size_t misses = 0;
+        size_t size = 0;
+
+        [[nodiscard]] double hit_rate() const {
+            return hits + misses == 0 ? 0 : (double) hits / (double) (hits + misses);
+        }
+    };
+
+    /**
+     * A bounded LRU cache from bytes of pre-split chunks to token ids, shared by threads. Entries are distributed among shards by hash of chunk, so that concurrent encoding rarely waits for the same lock.
+     */
+    class EncodeCache final {
+        using Entry = std::pair<std::string, std::vector<int32_t>>;
+
+        struct Shard {
+            std::mutex mutex;
+            std::list<Entry> entries;
+            // keys are views of strings in `entries`
+            std::unordered_map<std::string_view, std::list<Entry>::iterator> index;
+            size_t hits = 0;
+            size_t misses = 0;
+        };
+
+        EncodeCacheOptions options_;
+        size_t shard_capacity_;
+        std::vector<std::unique_ptr<Shard>> shards_;
+
+    public:
+        explicit EncodeCache(const EncodeCacheOptions& options = {}):
+            options_(options),
+            shard_capacity_((options.capacity + std::max<size_t>(1, options.shards) - 1) / std::max<size_t>(1, options.shards)) {
+            for (size_t i = 0; i < std::max<size_t>(1, options.shards); ++i) {
+                shards_.push_back(std::make_unique<Shard>());
+            }
+        }
+
+        [[nodiscard]] bool IsEnabled() const {
+            return options_.capacity > 0;
+        }
+
+        /**
+         * Look up ids of a chunk, which is moved to front of LRU list if found
+         * @param chunk chunk bytes before any transformation of tokenizer
+         * @param ids set to cached ids if found
+         * @return true if found
+         */
+        bool Get(const std::string_view chunk, std::vector<int32_t>& ids) {
+            if (!IsCacheable_(chunk)) {
+                return false;
+            }
+            auto& shard = GetShard_(chunk);
+            std::lock_guard lock {shard.mutex};
+            const auto itr = shard.index.find(chunk);
+            if (itr == shard.index.end()) {
+                ++shard.misses;
+                return false;
+            }
+            ++shard.hits;
+            shard.entries.splice(shard.entries.begin(), shard.entries, itr->second);
+            ids = itr->second->second;
+            return true;
+        }
+
+        /**
+         * Add ids of a chunk, evicting least recently used ones if shard is full
+         */
+        void Put(const std::string_view chunk, const std::vector<int32_t>& ids) {
+            if (!IsCacheable_(chunk)) {
+                return;
+            }
+            auto& shard = GetShard_(chunk);
+            std::lock_guard lock {shard.mutex};
+            if (shard.index.contains(chunk)) {
+                // added by another thread in the meantime
+                return;
+            }
+            shard.entries.emplace_front(std::string {chunk}, ids);
+            shard.index.emplace(shard.entries.front().first, shard.entries.begin());
+            while (shard.entries.size() > shard_capacity_) {
+                shard.index.erase(shard.entries.back().first);
+                shard.entries.pop_back();
+            }
+        }
+
+        void Clear() {
+            for (const auto& shard: shards_) {
+                std::lock_guard lock {shard->mutex};
+                shard->index.clear();
+                shard->entries.clear();
+            }
+        }
+
+        EncodeCacheStats GetStats() {
+            EncodeCacheStats stats;
+            for (const auto& shard: shards_) {
+                std::lock_guard lock {shard->mutex};
+                stats.hits += shard->hits;
+                stats.misses += shard->misses;
+                stats.size += shard->entries.size();
+            }
+            return stats;
+        }
+
+    private:
+        [[nodiscard]] bool IsCacheable_(const std::string_view chunk) const {
+            return IsEnabled() && chunk.size() <= options_.max_chunk_bytes;
+        }
+
+        Shard& GetShard_(const std::string_view chunk) {
+            // high bits, as low bits are used by buckets of index in shard
+            const auto hash = std::hash<std::string_view> {}(chunk);
+            return *shards_[(hash >> 16) % shards_.size()];
+        }
+    };
+
+    using EncodeCachePtr = std::shared_ptr<EncodeCache>;
+}
+
+#endif //ENCODE_CACHE_HPP
@@ -0,0 +1,250 @@
+#ifndef PRE_TOKENIZER_HPP
+#define PRE_TOKENIZER_HPP
+
+#include <string_view>
+#include <unicode/uchar.h>
+#include <unicode/utf8.h>
+
+#include <instinct/tokenizer/tokenizer.hpp>
+
+
+namespace INSTINCT_LLM_NS {
+
+    static const std::string GPT2_SPLIT_PATTERN = R"""('(?:[sdmt]|ll|ve|re)| ?\p{L}+| ?\p{N}+| ?[^\s\p{L}\p{N}]+|\s+(?!\S)|\s+)""";
+
+    static const std::string CL100K_SPLIT_PATTERN = R"""('(?i:[sdmt]|ll|ve|re)|[^\r\n\p{L}\p{N}]?+\p{L}+|\p{N}{1,3}| ?[^\s\p{L}\p{N}]++[\r\n]*|\s*[\r\n]|\s+(?!\S)|\s+)""";
+
+    /**
+     * Split patterns that have a hand-written pre-tokenizer
+     */
+    enum SplitPatternKind {
+        kCustomSplitPattern,
+        kGPT2SplitPattern,
+        kCL100KSplitPattern
+    };
+
+    namespace details {
+
+        static SplitPatternKind detect_split_pattern(const UnicodeString& pattern) {
+            if (pattern == UnicodeString::fromUTF8(GPT2_SPLIT_PATTERN)) {
+                return kGPT2SplitPattern;
+            }
+            if (pattern == UnicodeString::fromUTF8(CL100K_SPLIT_PATTERN)) {
+                return kCL100KSplitPattern;
+            }
+            return kCustomSplitPattern;
+        }
+
+        /**
+         * Code points of UTF-8 text, with character classes used by split patterns
+         */
+        class CodePointSequence {
+            std::vector<UChar32> code_points_;
+            std::vector<int32_t> offsets_;
+
+        public:
+            explicit CodePointSequence(const std::string_view text) {
+                code_points_.reserve(text.size());
+                offsets_.reserve(text.size() + 1);
+                const auto* s = reinterpret_cast<const uint8_t*>(text.data());
+                const auto length = static_cast<int32_t>(text.size());
+                int32_t i = 0;
+                while (i < length) {
+                    offsets_.push_back(i);
+                    UChar32 c;
+                    U8_NEXT(s, i, length, c);
+                    // ill-formed sequences are treated like U+FFFD, as they are when converted to UnicodeString
+                    code_points_.push_back(c < 0 ? 0xFFFD : c);
+                }
+                offsets_.push_back(length);
+            }
+
+            [[nodiscard]] size_t size() const {
+                return code_points_.size();
+            }
+
+            [[nodiscard]] UChar32 at(const size_t i) const {
+                return code_points_[i];
+            }
+
+            [[nodiscard]] int32_t offset(const size_t i) const {
+                return offsets_[i];
+            }
+
+            [[nodiscard]] bool is_letter(const size_t i) const {
+                const auto c = code_points_[i];
+                if (c < 0x80) {
+                    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+                }
+                return (U_GET_GC_MASK(c) & U_GC_L_MASK) != 0;
+            }
+
+            [[nodiscard]] bool is_number(const size_t i) const {
+                const auto c = code_points_[i];
+                if (c < 0x80) {
+                    return c >= '0' && c <= '9';
+                }
+                return (U_GET_GC_MASK(c) & U_GC_N_MASK) != 0;
+            }
+
+            /**
+             * `\s` of ICU regex, which is Unicode White_Space property
+             */
+            [[nodiscard]] bool is_space(const size_t i) const {
+                const auto c = code_points_[i];
+                if (c < 0x80) {
+                    return c == ' ' || (c >= '\t' && c <= '\r');
+                }
+                return u_hasBinaryProperty(c, UCHAR_WHITE_SPACE);
+            }
+
+            [[nodiscard]] bool is_new_line(const size_t i) const {
+                return code_points_[i] == '\r' || code_points_[i] == '\n';
+            }
+
+            /**
+             * `[^\s\p{L}\p{N}]`
+             */
+            [[nodiscard]] bool is_other(const size_t i) const {
+                return !is_space(i) && !is_letter(i) && !is_number(i);
+            }
+
+            [[nodiscard]] size_t skip_letters(size_t i) const {
+                while (i < size() && is_letter(i)) ++i;
+                return i;
+            }
+
+            [[nodiscard]] size_t skip_numbers(size_t i) const {
+                while (i < size() && is_number(i)) ++i;
+                return i;
+            }
+
+            [[nodiscard]] size_t skip_others(size_t i) const {
+                while (i < size() && is_other(i)) ++i;
+                return i;
+            }
+
+            [[nodiscard]] size_t skip_spaces(size_t i) const {
+                while (i < size() && is_space(i)) ++i;
+                return i;
+            }
+
+            /**
+             * `\s+(?!\S)|\s+` at position `i` which is a space. Trailing spaces before a non-space are left to the next chunk, unless there is only one.
+             */
+            [[nodiscard]] size_t match_spaces(const size_t i) const {
+                const auto end = skip_spaces(i);
+                if (end == size() || end - 1 == i) {
+                    return end;
+                }
+                return end - 1;
+            }
+        };
+
+        /**
+         * Contractions like `'s`, `'ll`, returning end of match or `i` if not matched
+         */
+        static size_t match_contraction(const CodePointSequence& seq, const size_t i, const bool ignore_case) {
+            if (seq.at(i) != '\'' || i + 1 >= seq.size()) {
+                return i;
+            }
+            auto fold = [&](const UChar32 c) -> UChar32 {
+                if (!ignore_case) return c;
+                // U+017F LATIN SMALL LETTER LONG S folds to `s`
+                if (c == 0x017F) return 's';
+                return c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c;
+            };
+            const auto c1 = fold(seq.at(i + 1));
+            if (c1 == 's' || c1 == 'd' || c1 == 'm' || c1 == 't') {
+                return i + 2;
+            }
+            if (i + 2 < seq.size()) {
+                const auto c2 = fold(seq.at(i + 2));
+                if ((c1 == 'l' && c2 == 'l') || (c1 == 'v' && c2 == 'e') || (c1 == 'r' && c2 == 'e')) {
+                    return i + 3;
+                }
+            }
+            return i;
+        }
+
+        /**
+         * Match of `GPT2_SPLIT_PATTERN` starting at `i`
+         */
+        static size_t match_gpt2_pattern(const CodePointSequence& seq, const size_t i) {
+            if (const auto end = match_contraction(seq, i, false); end > i) {
+                return end;
+            }
+            // ` ?\p{L}+| ?\p{N}+| ?[^\s\p{L}\p{N}]+`
+            const size_t j = seq.at(i) == ' ' && i + 1 < seq.size() ? i + 1 : i;
+            if (seq.is_letter(j)) {
+                return seq.skip_letters(j);
+            }
+            if (seq.is_number(j)) {
+                return seq.skip_numbers(j);
+            }
+            if (seq.is_other(j)) {
+                return seq.skip_others(j);
+            }
+            if (seq.is_space(i)) {
+                return seq.match_spaces(i);
+            }
+            return i + 1;
+        }
+
+        /**
+         * Match of `CL100K_SPLIT_PATTERN` starting at `i`
+         */
+        static size_t match_cl100k_pattern(const CodePointSequence& seq, const size_t i) {
+            if (const auto end = match_contraction(seq, i, true); end > i) {
+                return end;
+            }
+            // `[^\r\n\p{L}\p{N}]?+\p{L}+`, where optional prefix is possessive
+            const size_t j = !seq.is_new_line(i) && !seq.is_letter(i) && !seq.is_number(i) ? i + 1 : i;
+            if (j < seq.size() && seq.is_letter(j)) {
+                return seq.skip_letters(j);
+            }
+            // `\p{N}{1,3}`
+            if (seq.is_number(i)) {
+                size_t end = i + 1;
+                while (end < seq.size() && end < i + 3 && seq.is_number(end)) ++end;
+                return end;
+            }
+            // ` ?[^\s\p{L}\p{N}]++[\r\n]*`
+            const size_t k = seq.at(i) == ' ' && i + 1 < seq.size() ? i + 1 : i;
+            if (seq.is_other(k)) {
+                size_t end = seq.skip_others(k);
+                while (end < seq.size() && seq.is_new_line(end)) ++end;
+                return end;
+            }
+            if (seq.is_space(i)) {
+                // `\s*[\r\n]` ends at last new line of spaces
+                const auto spaces_end = seq.skip_spaces(i);
+                for (size_t m = spaces_end; m > i; --m) {
+                    if (seq.is_new_line(m - 1)) {
+                        return m;
+                    }
+                }
+                return seq.match_spaces(i);
+            }
+            return i + 1;
+        }
+
+        /**
+         * Split UTF-8 text into chunks the same as `find_all_with_regex` does with GPT2 or cl100k pattern, without going through `UnicodeString` and regex engine.
+         * @param kind pattern to follow, which should not be `kCustomSplitPattern`
+         * @param text UTF-8 text
+         * @param chunks views of `text`
+         */
+        static void pre_tokenize(const SplitPatternKind kind, const std::string_view text, std::vector<std::string_view>& chunks) {
+            const CodePointSequence seq {text};
+            size_t i = 0;
+            while (i < seq.size()) {
+                const size_t end = kind == kGPT2SplitPattern ? match_gpt2_pattern(seq, i) : match_cl100k_pattern(seq, i);
+                chunks.push_back(text.substr(seq.offset(i), seq.offset(end) - seq.offset(i)));
+                i = end;
+            }
+        }
+    }
+}
+
+#endif //PRE_TOKENIZER_HPP
@@ -7,6 +7,10 @@
 
 
 #include <instinct/tokenizer/tokenizer.hpp>
+#include <instinct/tokenizer/pre_tokenizer.hpp>
+#include <instinct/tokenizer/encode_cache.hpp>
+#include <instinct/tokenizer/binary_bpe_vocab.hpp>
+#include <mutex>
 #include <ranges>
 #include <unordered_set>
 #include <utility>
@@ -19,22 +23,61 @@ namespace INSTINCT_LLM_NS {
 
 
 
+    enum BPEMergeStrategy {
+        /**
+         * Find the lowest-ranked pair by scanning the whole chunk after every merge, which is quadratic in chunk length
+         */
+        kNaiveMerge,
+        /**
+         * Keep candidate pairs in a priority queue over a linked list of tokens, which is O(n log n) in chunk length. Output is the same as `kNaiveMerge`.
+         */
+        kHeapMerge
+    };
+
     class RegexTokenizer: public Tokenizer {
+        BPEMergeStrategy merge_strategy_ = kHeapMerge;
         BPERanks merges_;
         Vocab vocab_{};
+        // merges and decoder table from a mapped binary vocab file, used in place of `merges_` and `vocab_` if present
+        BinaryBPEVocabPtr binary_vocab_;
         UnicodeString regexp_pattern_{};
+        // split pattern is compiled once. Matchers of it are not thread-safe, so idle ones are kept here and each call checks out its own.
+        std::shared_ptr<RegexPattern> compiled_pattern_;
+        mutable std::mutex idle_matchers_mutex_;
+        mutable std::vector<std::unique_ptr<RegexMatcher>> idle_matchers_;
+        SplitPatternKind split_pattern_kind_;
+        bool fast_pre_tokenizer_ = true;
+        EncodeCachePtr encode_cache_ = std::make_shared<EncodeCache>();
         StringIDDict special_tokens_{};
         ReversedStringIDDict reversed_special_tokens_{};
 
     public:
         RegexTokenizer()=delete;
-        RegexTokenizer(UnicodeString regexp_string, const StringIDDict& special_tokens): regexp_pattern_(std::move(regexp_string)) {
+        RegexTokenizer(UnicodeString regexp_string, const StringIDDict& special_tokens):
+            regexp_pattern_(std::move(regexp_string)),
+            compiled_pattern_(details::compile_regex(regexp_pattern_)),
+            split_pattern_kind_(details::detect_split_pattern(regexp_pattern_)) {
             RegisterSpecials(special_tokens);
         }
-        RegexTokenizer(BPERanks bpe_ranks, Vocab vocab, UnicodeString  regexp_string, const StringIDDict& special_tokens):  merges_(std::move(bpe_ranks)), vocab_(std::move(vocab)), regexp_pattern_(std::move(regexp_string)) {
+        RegexTokenizer(BPERanks bpe_ranks, Vocab vocab, UnicodeString  regexp_string, const StringIDDict& special_tokens):
+            merges_(std::move(bpe_ranks)),
+            vocab_(std::move(vocab)),
+            regexp_pattern_(std::move(regexp_string)),
+            compiled_pattern_(details::compile_regex(regexp_pattern_)),
+            split_pattern_kind_(details::detect_split_pattern(regexp_pattern_)) {
             // initialize revsered speicial tokens
             RegisterSpecials(special_tokens);
         }
+        /**
+         * Create tokenizer from a binary vocab file, which also carries split pattern and special tokens
+         */
+        explicit RegexTokenizer(BinaryBPEVocabPtr binary_vocab):
+            binary_vocab_(std::move(binary_vocab)),
+            regexp_pattern_(UnicodeString::fromUTF8(binary_vocab_->GetPattern())),
+            compiled_pattern_(details::compile_regex(regexp_pattern_)),
+            split_pattern_kind_(details::detect_split_pattern(regexp_pattern_)) {
+            RegisterSpecials(binary_vocab_->GetSpecialTokens());
+        }
 
         void RegisterSpecials(const StringIDDict& special_tokens) {
             for (const auto&[token,id]: special_tokens) {
@@ -43,10 +86,55 @@ namespace INSTINCT_LLM_NS {
             }
         }
 
+        /**
+         * @return vocab in memory, which is empty if tokenizer is created from a binary vocab file
+         */
         Vocab& GetVocab() {
             return vocab_;
         }
 
+        [[nodiscard]] const BPERanks& GetMerges() const {
+            return merges_;
+        }
+
+        [[nodiscard]] const UnicodeString& GetPattern() const {
+            return regexp_pattern_;
+        }
+
+        [[nodiscard]] const StringIDDict& GetSpecialTokens() const {
+            return special_tokens_;
+        }
+
+        void SetMergeStrategy(const BPEMergeStrategy merge_strategy) {
+            merge_strategy_ = merge_strategy;
+        }
+
+        [[nodiscard]] BPEMergeStrategy GetMergeStrategy() const {
+            return merge_strategy_;
+        }
+
+        /**
+         * Split texts with hand-written pre-tokenizer instead of regex if split pattern is the one of GPT2 or cl100k. It's enabled by default.
+         */
+        void SetFastPreTokenizer(const bool enabled) {
+            fast_pre_tokenizer_ = enabled;
+        }
+
+        [[nodiscard]] bool HasFastPreTokenizer() const {
+            return fast_pre_tokenizer_ && split_pattern_kind_ != kCustomSplitPattern;
+        }
+
+        /**
+         * Replace cache of chunk ids with an empty one of given options. It should be called before tokenizer is shared among threads.
+         */
+        void SetEncodeCacheOptions(const EncodeCacheOptions& options) {
+            encode_cache_ = std::make_shared<EncodeCache>(options);
+        }
+
+        EncodeCacheStats GetEncodeCacheStats() {
+            return encode_cache_->GetStats();
+        }
+
         UnicodeString Decode(const std::vector<int32_t>& ids) override {
             return UnicodeString::fromUTF8(Decode_(ids));
         }
@@ -56,50 +144,24 @@ namespace INSTINCT_LLM_NS {
         }
 
         std::vector<int32_t> Encode(const UnicodeString& text, const TokenizerEncodeOptions& options) override {
-            StringIDDict specials;
-            switch (options.allow_special) {
-                case kAll:
-                    specials = special_tokens_;
-                break;
-                case kNone:
-                    break;
-                case kNoneRaise:
-                    for(const auto& token: special_tokens_ | std::views::keys) {
-                        if(text.indexOf(token) > -1) {
-                            throw InstinctException("special token not allowed in text");
-                        }
-                    }
-                break;
-                case kSome:
-                    for(const auto& token: options.specials) {
-                        specials.emplace(token, special_tokens_[token]);
-                    }
-                case kUnspecified:
-                    throw InstinctException("allowd_special unspecified");
-            }
-            if(specials.empty()) {
-                return EncodeOrdinary_(text);
-            }
-            const auto pattern_string = "(" + details::join_with_seperator(
-                "|",
-                specials | std::views::keys | std::views::transform([](const auto& s) {return details::escape_for_regular_expression(s);})
-                ) + ")";
-
-
-            std::vector<UnicodeString> chunks;
-            U32StringUtils::SplitWithRegex(text, pattern_string, chunks);
             std::vector<int32_t> result;
-            for(const auto& chunk: chunks) {
-                if(specials.contains(chunk)) {
-                    result.push_back(specials[chunk]);
-                } else {
-                    auto chunk_result = EncodeOrdinary_(chunk);
-                    result.insert(result.end(), chunk_result.begin(), chunk_result.end());
-                }
-            }
+            Encode_(text, options, [&](const std::vector<int32_t>& ids) {
+                result.insert(result.end(), ids.begin(), ids.end());
+            });
             return result;
         }
 
+        /**
+         * Count tokens without building the list of ids. Ids of each chunk are written to a buffer owned by current thread and only their count is kept.
+         */
+        size_t CountTokens(const UnicodeString& text, const TokenizerEncodeOptions& options) override {
+            size_t count = 0;
+            Encode_(text, options, [&](const std::vector<int32_t>& ids) {
+                count += ids.size();
+            });
+            return count;
+        }
+
         void Train(const UnicodeString& text, int vocab_size) override {
             if (vocab_size<256) {
                 throw InstinctException("vocab_size should be greter than 256");
@@ -112,7 +174,7 @@ namespace INSTINCT_LLM_NS {
             // });
             // auto ids = std::vector{ids_view.begin(), ids_view.end()};
             std::vector<UnicodeString> splits;
-            details::find_all_with_regex(text, regexp_pattern_, splits);
+            details::find_all_with_regex(text, *AcquireMatcher_(), splits);
 
             std::vector<std::vector<int32_t>> ids;
             for(const auto& chunk: splits) {
@@ -147,15 +209,43 @@ namespace INSTINCT_LLM_NS {
             }
             this->merges_ = std::move(merges);
             this->vocab_ = std::move(vocab);
+            this->binary_vocab_.reset();
+            // cached ids are from previous merges
+            encode_cache_->Clear();
         }
 
 
+    protected:
+        /**
+         * @return bytes of a non-special token, or empty view if id is unknown
+         */
+        [[nodiscard]] std::string_view GetTokenBytes_(const int32_t id) const {
+            if (binary_vocab_) {
+                return binary_vocab_->GetTokenBytes(id);
+            }
+            if (const auto itr = vocab_.find(id); itr != vocab_.end()) {
+                return itr->second;
+            }
+            return {};
+        }
+
+        /**
+         * @return rank of merged pair, which is also id of merged token, or -1 if pair is not mergeable
+         */
+        [[nodiscard]] int32_t FindMerge_(const int32_t left, const int32_t right) const {
+            if (binary_vocab_) {
+                return binary_vocab_->FindMerge(left, right);
+            }
+            const auto itr = merges_.find(BPEPair {left, right});
+            return itr == merges_.end() ? -1 : itr->second;
+        }
+
     private:
         std::string Decode_(const std::vector<int32_t>& ids) {
             std::string text_bytes;
             for(const auto& id: ids) {
-                if (vocab_.contains(id)) {
-                    text_bytes.append(vocab_[id]);
+                if (const auto token_bytes = GetTokenBytes_(id); !token_bytes.empty()) {
+                    text_bytes.append(token_bytes);
                 } else if(reversed_special_tokens_.contains(id)) {
                     text_bytes.append(details::conv_to_utf8_string(reversed_special_tokens_[id]));
                 } else {
@@ -167,38 +257,186 @@ namespace INSTINCT_LLM_NS {
 
 
 
-        std::vector<int32_t> EncodeOrdinary_(const UnicodeString& text) {
-            std::vector<int32_t> result;
+        /**
+         * Matcher checked out from idle ones of tokenizer, which is returned on destruction
+         */
+        class MatcherLease {
+            const RegexTokenizer* owner_;
+            std::unique_ptr<RegexMatcher> matcher_;
+        public:
+            MatcherLease(const RegexTokenizer* owner, std::unique_ptr<RegexMatcher> matcher): owner_(owner), matcher_(std::move(matcher)) {}
+            MatcherLease(const MatcherLease&) = delete;
+            MatcherLease& operator=(const MatcherLease&) = delete;
 
+            ~MatcherLease() {
+                std::lock_guard lock {owner_->idle_matchers_mutex_};
+                owner_->idle_matchers_.push_back(std::move(matcher_));
+            }
+
+            RegexMatcher& operator*() const {
+                return *matcher_;
+            }
+        };
+
+        /**
+         * @return matcher of split pattern for exclusive use until returned lease is destroyed. Count of matchers is bounded by count of concurrent calls.
+         */
+        MatcherLease AcquireMatcher_() const {
+            {
+                std::lock_guard lock {idle_matchers_mutex_};
+                if (!idle_matchers_.empty()) {
+                    auto matcher = std::move(idle_matchers_.back());
+                    idle_matchers_.pop_back();
+                    return {this, std::move(matcher)};
+                }
+            }
+            UErrorCode status = U_ZERO_ERROR;
+            std::unique_ptr<RegexMatcher> matcher {compiled_pattern_->matcher(status)};
+            if(U_FAILURE(status)) {
+                throw InstinctException("Failed to create regex matcher");
+            }
+            return {this, std::move(matcher)};
+        }
+
+        /**
+         * Buffers reused by encoding on the same thread, so that encoding many texts doesn't allocate for every chunk
+         */
+        struct EncodeScratch {
+            Bytes text_bytes;
+            std::vector<std::string_view> byte_chunks;
             std::vector<UnicodeString> text_chunks;
-            details::find_all_with_regex(text, regexp_pattern_, text_chunks);
+            Bytes chunk_bytes;
+            std::vector<int32_t> ids;
+        };
 
-            for(const auto& chunk: text_chunks) {
-                Bytes buf;
-                chunk.toUTF8String(buf);
-                auto parts = EncodeChunk_(buf);
-                result.insert(result.end(), parts.begin(), parts.end());
+        static EncodeScratch& GetScratch_() {
+            thread_local EncodeScratch scratch;
+            return scratch;
+        }
+
+        StringIDDict ResolveSpecials_(const UnicodeString& text, const TokenizerEncodeOptions& options) const {
+            StringIDDict specials;
+            switch (options.allow_special) {
+                case kAll:
+                    specials = special_tokens_;
+                break;
+                case kNone:
+                    break;
+                case kNoneRaise:
+                    for(const auto& token: special_tokens_ | std::views::keys) {
+                        if(text.indexOf(token) > -1) {
+                            throw InstinctException("special token not allowed in text");
+                        }
+                    }
+                break;
+                case kSome:
+                    for(const auto& token: options.specials) {
+                        // lookup without insertion, as tokenizer can be shared by threads
+                        const auto itr = special_tokens_.find(token);
+                        if (itr == special_tokens_.end()) {
+                            throw InstinctException("unknown special token: " + details::conv_to_utf8_string(token));
+                        }
+                        specials.emplace(itr->first, itr->second);
+                    }
+                break;
+                case kUnspecified:
+                    throw InstinctException("allowd_special unspecified");
             }
-            return result;
+            return specials;
+        }
+
+        /**
+         * Encode text and pass ids of each chunk or special token to `sink`. Ids passed are only valid during the call.
+         */
+        template<typename Sink>
+        void Encode_(const UnicodeString& text, const TokenizerEncodeOptions& options, Sink&& sink) {
+            const auto specials = ResolveSpecials_(text, options);
+            if(specials.empty()) {
+                EncodeOrdinary_(text, sink);
+                return;
+            }
+            const auto pattern_string = "(" + details::join_with_seperator(
+                "|",
+                specials | std::views::keys | std::views::transform([](const auto& s) {return details::escape_for_regular_expression(s);})
+                ) + ")";
+
+
+            std::vector<UnicodeString> chunks;
+            U32StringUtils::SplitWithRegex(text, pattern_string, chunks);
+            std::vector<int32_t> special_ids(1);
+            for(const auto& chunk: chunks) {
+                if(const auto itr = specials.find(chunk); itr != specials.end()) {
+                    special_ids[0] = itr->second;
+                    sink(special_ids);
+                } else {
+                    EncodeOrdinary_(chunk, sink);
+                }
+            }
+        }
+
+        template<typename Sink>
+        void EncodeOrdinary_(const UnicodeString& text, Sink&& sink) {
+            auto& scratch = GetScratch_();
+
+            if (HasFastPreTokenizer()) {
+                scratch.text_bytes.clear();
+                text.toUTF8String(scratch.text_bytes);
+                scratch.byte_chunks.clear();
+                details::pre_tokenize(split_pattern_kind_, scratch.text_bytes, scratch.byte_chunks);
+                for(const auto& chunk: scratch.byte_chunks) {
+                    EncodeChunk_(chunk, scratch);
+                    sink(scratch.ids);
+                }
+                return;
+            }
+
+            scratch.text_chunks.clear();
+            details::find_all_with_regex(text, *AcquireMatcher_(), scratch.text_chunks);
+
+            for(const auto& chunk: scratch.text_chunks) {
+                scratch.text_bytes.clear();
+                chunk.toUTF8String(scratch.text_bytes);
+                EncodeChunk_(scratch.text_bytes, scratch);
+                sink(scratch.ids);
+            }
+            // chunks are aliases of `text`
+            scratch.text_chunks.clear();
         }
 
         virtual void HandleChunkBytes_(Bytes& text_bytes) {}
 
-        std::vector<int32_t> EncodeChunk_(Bytes& text_bytes) {
+        /**
+         * Encode a pre-split chunk into `scratch.ids`. Ids are looked up in cache first, as common words are repeated a lot in natural language.
+         */
+        void EncodeChunk_(const std::string_view chunk, EncodeScratch& scratch) {
+            if (encode_cache_->Get(chunk, scratch.ids)) {
+                return;
+            }
+            scratch.chunk_bytes.assign(chunk);
+            MergeChunk_(scratch.chunk_bytes, scratch.ids);
+            encode_cache_->Put(chunk, scratch.ids);
+        }
+
+        void MergeChunk_(Bytes& text_bytes, std::vector<int32_t>& ids) {
             // give subclass changes to alter `text_bytes`
             HandleChunkBytes_(text_bytes);
-            std::vector<int32_t> ids;
+            ids.clear();
             for(const auto &c: text_bytes) {
                 // from [-128,128) to [0,256)
                 ids.push_back(static_cast<u_int8_t>(c));
             }
+            if (merge_strategy_ == kHeapMerge) {
+                details::merge_with_heap(ids, [this](const int32_t left, const int32_t right) {
+                    return FindMerge_(left, right);
+                });
+                return;
+            }
             while (ids.size()>=2) {
                 auto stats = details::compute_pairs_state(ids);
                 int32_t min_idx = INT32_MAX;
                 auto min_entry = stats.end();
                 for(auto itr=stats.begin();itr!=stats.end();++itr) {
-                    if(merges_.contains(itr->first)) {
-                        auto cur_idx = merges_[itr->first];
+                    if(const auto cur_idx = FindMerge_(itr->first.first, itr->first.second); cur_idx >= 0) {
                         if (cur_idx < min_idx) {
                             min_idx = cur_idx;
                             min_entry = itr;
@@ -208,10 +446,8 @@ namespace INSTINCT_LLM_NS {
                 if (min_entry==stats.end()) {// no mergeable found
                     break;
                 }
-                auto idx = merges_[min_entry->first];
-                details::merge_u32_ids(ids, min_entry->first, idx);
+                details::merge_u32_ids(ids, min_entry->first, min_idx);
             }
-            return ids;
         }
 
 
@@ -6,6 +6,7 @@
 #define TIKTOKENTOKENIZER_HPP
 
 #include <filesystem>
+#include <functional>
 #include <instinct/tokenizer/regex_tokenizer.hpp>
 #include <ranges>
 
@@ -71,6 +72,11 @@ namespace INSTINCT_LLM_NS {
         ByteShuffle reversed_byte_shuffle_;
 
     public:
+        /**
+         * Suffix of binary vocab file that is written next to a rank file on first load
+         */
+        static constexpr auto BINARY_VOCAB_SUFFIX = ".vocab.bin";
+
         TiktokenTokenizer(BPERanks bpe_ranks, Vocab vocab, const UnicodeString& regexp_string,
             const StringIDDict& special_tokens, ByteShuffle byte_shuffle)
             : RegexTokenizer(std::move(bpe_ranks), std::move(vocab), regexp_string, special_tokens),
@@ -80,33 +86,76 @@ namespace INSTINCT_LLM_NS {
             }
         }
 
+        explicit TiktokenTokenizer(BinaryBPEVocabPtr binary_vocab): RegexTokenizer(binary_vocab) {
+            const auto byte_shuffle = binary_vocab->GetByteShuffle();
+            for(const auto i: std::ranges::iota_view {0, 256}) {
+                byte_shuffle_[i] = byte_shuffle[i];
+                reversed_byte_shuffle_[byte_shuffle[i]] = i;
+            }
+        }
+
         void Train(const UnicodeString& text, int vocab_size) override {
             throw InstinctException("Not implemented");
         }
 
         static TokenizerPtr FromTiktokenConfig(const TiktokenConfig& config) {
-            BPERanks bpe_ranks = details::recover_byte_pair_bpe_ranks(config.mergeable_ranks);
+            auto [bpe_ranks, vocab, byte_shuffle] = PrepareTiktokenConfig_(config);
+            return std::make_shared<TiktokenTokenizer>(std::move(bpe_ranks), std::move(vocab), UnicodeString::fromUTF8(config.pat_str), config.special_tokens, std::move(byte_shuffle));
+        }
 
-            // init vocab
-            Vocab vocab;
-            for(int i: std::ranges::iota_view {0, 256}) {
-                vocab[i] = Bytes{static_cast<char>(i)};
-            }
-            for(const auto& [pair, id]: bpe_ranks) {
-                // rebuild vocab from lower rank to higher rank, assuming id > pair.first and id > pair.second
-                vocab[id] = vocab[pair.first] + vocab[pair.second];
+        /**
+         * Create tokenizer from a binary vocab file, which is mapped into memory instead of being parsed
+         */
+        static TokenizerPtr FromBinaryVocab(const std::filesystem::path& binary_vocab_path) {
+            trace_span span {"FromBinaryVocab"};
+            return std::make_shared<TiktokenTokenizer>(std::make_shared<const BinaryBPEVocab>(binary_vocab_path));
+        }
+
+        /**
+         * Convert rank file of a tiktoken config into binary vocab file, with byte pairs recovered ahead of time
+         * @param config tiktoken config
+         * @param binary_vocab_path output path
+         * @param source stamp of rank files that config is read from
+         */
+        static void ConvertToBinaryVocab(const TiktokenConfig& config, const std::filesystem::path& binary_vocab_path, const BinaryBPEVocabSource& source = {}) {
+            const auto [bpe_ranks, vocab, byte_shuffle] = PrepareTiktokenConfig_(config);
+            ByteShuffleTable byte_shuffle_table {};
+            for (const auto& [byte, id]: byte_shuffle) {
+                byte_shuffle_table[byte] = id;
             }
+            BinaryBPEVocab::Write(binary_vocab_path, bpe_ranks, vocab, config.pat_str, config.special_tokens, byte_shuffle_table, source);
+        }
 
-            // byte mapping
-            ByteShuffle byte_shuffle;
+        static TiktokenConfig MakeGPT2Config(
+            const std::filesystem::path& bpe_file_path,
+            const std::filesystem::path& encoder_json_file_path
+            ) {
+            auto reader = GPT2BPEFileReader(bpe_file_path, encoder_json_file_path);
+            return {
+                .name = "gpt2",
+                .explict_n_vocab = 50257,
+                .pat_str = GPT2_SPLIT_PATTERN,
+                .mergeable_ranks =  reader.Fetch(),
+                .special_tokens = {
+                    {"<|endoftext|>", 50256}
+                }
+            };
+        }
 
-            for(const auto i: std::ranges::iota_view {0, 256}) {
-                // uint8_t to char, that's from [0.256) to [-128,128)
-                const int32_t id = config.mergeable_ranks.at(Bytes{static_cast<char>(i)});
-                // first 256 char have rank of less than 256,  so it's safe to cast back to uint8_t
-                byte_shuffle[i] = id;
-            }
-            return std::make_shared<TiktokenTokenizer>(bpe_ranks, vocab, UnicodeString::fromUTF8(config.pat_str), config.special_tokens, byte_shuffle);
+        static TiktokenConfig MakeCL100KConfig(const std::filesystem::path& tiktoken_bpe_file_path) {
+            TiktokenBPEFileReader reader(tiktoken_bpe_file_path);
+            return {
+                .name = "cl100k_base",
+                .pat_str = CL100K_SPLIT_PATTERN,
+                .mergeable_ranks = reader.Fetch(),
+                .special_tokens = {
+                    {"<|endoftext|>", 100257},
+                    {"<|fim_prefix|>", 100258},
+                    {"<|fim_middle|>", 100259},
+                    {"<|fim_suffix|>", 100260},
+                    {"<|endofprompt|>", 100276}
+                }
+            };
         }
 
         static TokenizerPtr MakeGPT2Tokenizer(const FileVaultPtr& file_vault = DEFAULT_FILE_VAULT) {
@@ -115,8 +164,10 @@ namespace INSTINCT_LLM_NS {
             if (!GPT2_TOKENIZER_INSTANCE) {
                 PreloadGPT2TokenizerResources(file_vault);
                 const auto entry1 = DEFAULT_FILE_VAULT->GetResource("tiktoken/gpt2_vocab.bpe").get();
-                const auto entry2 = DEFAULT_FILE_VAULT->GetResource("tiktoken/gpt2_vocab.bpe").get();
-                GPT2_TOKENIZER_INSTANCE = MakeGPT2Tokenizer(entry1.local_path, entry2.local_path);
+                const auto entry2 = DEFAULT_FILE_VAULT->GetResource("tiktoken/gpt2_encoder.json").get();
+                GPT2_TOKENIZER_INSTANCE = LoadWithBinaryVocab(entry1.local_path.string() + BINARY_VOCAB_SUFFIX, {entry1.local_path, entry2.local_path}, [&] {
+                    return MakeGPT2Config(entry1.local_path, entry2.local_path);
+                });
             }
             return GPT2_TOKENIZER_INSTANCE;
         }
@@ -125,16 +176,7 @@ namespace INSTINCT_LLM_NS {
             const std::filesystem::path& bpe_file_path,
             const std::filesystem::path& encoder_json_file_path
             ) {
-            auto reader = GPT2BPEFileReader(bpe_file_path, encoder_json_file_path);
-            return FromTiktokenConfig({
-                .name = "gpt2",
-                .explict_n_vocab = 50257,
-                .pat_str = R"""('(?:[sdmt]|ll|ve|re)| ?\p{L}+| ?\p{N}+| ?[^\s\p{L}\p{N}]+|\s+(?!\S)|\s+)""",
-                .mergeable_ranks =  reader.Fetch(),
-                .special_tokens = {
-                    {"<|endoftext|>", 50256}
-                }
-            });
+            return FromTiktokenConfig(MakeGPT2Config(bpe_file_path, encoder_json_file_path));
         }
 
         static TokenizerPtr MakeGPT4Tokenizer() {
@@ -143,33 +185,63 @@ namespace INSTINCT_LLM_NS {
             if (!GPT4_TOKENIZER_INSTANCE) {
                 PreloadGPT4TokenizerResources(DEFAULT_FILE_VAULT);
                 const auto entry = DEFAULT_FILE_VAULT->GetResource("tiktoken/cl100k_base.tiktoken").get();
-                GPT4_TOKENIZER_INSTANCE = MakeGPT4Tokenizer(entry.local_path);
+                GPT4_TOKENIZER_INSTANCE = LoadWithBinaryVocab(entry.local_path.string() + BINARY_VOCAB_SUFFIX, {entry.local_path}, [&] {
+                    return MakeCL100KConfig(entry.local_path);
+                });
             }
             return GPT4_TOKENIZER_INSTANCE;
         }
 
+        /**
+         * @param tiktoken_bpe_file_path path to `cl100k_base.tiktoken`, or to a binary vocab file converted from it
+         */
         static TokenizerPtr MakeGPT4Tokenizer(
             const std::filesystem::path& tiktoken_bpe_file_path
             ) {
-            TiktokenBPEFileReader reader(tiktoken_bpe_file_path);
-            return FromTiktokenConfig({
-                .name = "cl100k_base",
-                .pat_str = R"""('(?i:[sdmt]|ll|ve|re)|[^\r\n\p{L}\p{N}]?+\p{L}+|\p{N}{1,3}| ?[^\s\p{L}\p{N}]++[\r\n]*|\s*[\r\n]|\s+(?!\S)|\s+)""",
-                .mergeable_ranks = reader.Fetch(),
-                .special_tokens = {
-                    {"<|endoftext|>", 100257},
-                    {"<|fim_prefix|>", 100258},
-                    {"<|fim_middle|>", 100259},
-                    {"<|fim_suffix|>", 100260},
-                    {"<|endofprompt|>", 100276}
+            if (BinaryBPEVocab::IsBinaryVocabFile(tiktoken_bpe_file_path)) {
+                return FromBinaryVocab(tiktoken_bpe_file_path);
+            }
+            return FromTiktokenConfig(MakeCL100KConfig(tiktoken_bpe_file_path));
+        }
+
+        /**
+         * Load tokenizer from binary vocab file if it's valid and converted from current rank files. Otherwise, create tokenizer from config and write binary vocab file for next time.
+         * @param binary_vocab_path path to binary vocab file
+         * @param source_files rank files that `make_config` reads, whose sizes and modification times are checked against the ones recorded in binary vocab file
+         * @param make_config function to read rank files
+         */
+        static TokenizerPtr LoadWithBinaryVocab(
+            const std::filesystem::path& binary_vocab_path,
+            const std::vector<std::filesystem::path>& source_files,
+            const std::function<TiktokenConfig()>& make_config) {
+            const auto source = BinaryBPEVocabSource::Of(source_files);
+            if (BinaryBPEVocab::IsBinaryVocabFileOf(binary_vocab_path, source)) {
+                try {
+                    return FromBinaryVocab(binary_vocab_path);
+                } catch (const InstinctException& e) {
+                    LOG_WARN("failed to load binary vocab file at {}, rebuild from rank file: {}", binary_vocab_path.string(), e.what());
                 }
-            });
+            } else if (BinaryBPEVocab::IsBinaryVocabFile(binary_vocab_path)) {
+                LOG_INFO("rank files are changed since binary vocab file at {} is written, rebuild it", binary_vocab_path.string());
+            }
+            const auto config = make_config();
+            try {
+                ConvertToBinaryVocab(config, binary_vocab_path, source);
+            } catch (const std::exception& e) {
+                // tokenizer still works without it, only next start is slower
+                LOG_WARN("failed to write binary vocab file at {}: {}", binary_vocab_path.string(), e.what());
+            }
+            return FromTiktokenConfig(config);
         }
 
         UnicodeString Decode(const std::vector<int32_t>& ids) override {
             Bytes text_bytes;
             for(const auto& id: ids) {
-                text_bytes += GetVocab().at(id);
+                const auto token_bytes = GetTokenBytes_(id);
+                if (token_bytes.empty()) {
+                    throw InstinctException("Invalid token value found: " + std::to_string(id));
+                }
+                text_bytes += token_bytes;
             }
             Bytes result;
             for(const auto& c: text_bytes) {
@@ -179,6 +251,37 @@ namespace INSTINCT_LLM_NS {
         }
 
     private:
+        struct PreparedTiktokenConfig {
+            BPERanks bpe_ranks;
+            Vocab vocab;
+            ByteShuffle byte_shuffle;
+        };
+
+        static PreparedTiktokenConfig PrepareTiktokenConfig_(const TiktokenConfig& config) {
+            BPERanks bpe_ranks = details::recover_byte_pair_bpe_ranks(config.mergeable_ranks);
+
+            // init vocab
+            Vocab vocab;
+            for(int i: std::ranges::iota_view {0, 256}) {
+                vocab[i] = Bytes{static_cast<char>(i)};
+            }
+            for(const auto& [pair, id]: bpe_ranks) {
+                // rebuild vocab from lower rank to higher rank, assuming id > pair.first and id > pair.second
+                vocab[id] = vocab[pair.first] + vocab[pair.second];
+            }
+
+            // byte mapping
+            ByteShuffle byte_shuffle;
+
+            for(const auto i: std::ranges::iota_view {0, 256}) {
+                // uint8_t to char, that's from [0.256) to [-128,128)
+                const int32_t id = config.mergeable_ranks.at(Bytes{static_cast<char>(i)});
+                // first 256 char have rank of less than 256,  so it's safe to cast back to uint8_t
+                byte_shuffle[i] = id;
+            }
+            return {std::move(bpe_ranks), std::move(vocab), std::move(byte_shuffle)};
+        }
+
         void HandleChunkBytes_(Bytes& text_bytes) override {
             Bytes new_bytes;
             for (const auto&c: text_bytes) {
@@ -7,6 +7,7 @@
 
 #include <instinct/llm_global.hpp>
 #include <map>
+#include <queue>
 #include <utility>
 #include <unicode/regex.h>
 #include <unicode/unistr.h>
@@ -89,9 +90,67 @@ namespace INSTINCT_LLM_NS {
         virtual UnicodeString Decode(const std::vector<int32_t>& ids) = 0;
         virtual void Train(const UnicodeString& text, int vocab_size) = 0;
 
+        /**
+         * Count tokens of text. Subclasses may override it to count without building the list of ids.
+         */
+        virtual size_t CountTokens(const UnicodeString& text, const TokenizerEncodeOptions& options) {
+            return Encode(text, options).size();
+        }
+
+        /**
+         * Encode texts in parallel with given thread pool. `Encode` of implementation should be safe to be called from multiple threads.
+         * @param texts texts to encode
+         * @param options options for every text
+         * @param thread_pool pool to run on. Texts are encoded on current thread if it's a worker of the same pool.
+         * @return ids of each text, in the same order of `texts`
+         */
+        std::vector<std::vector<int32_t>> EncodeBatch(
+            const std::vector<UnicodeString>& texts,
+            const TokenizerEncodeOptions& options = {},
+            ThreadPool& thread_pool = COMPUTE_WORKER_POOL) {
+            std::vector<std::vector<int32_t>> result(texts.size());
+            RunBatch_(texts.size(), thread_pool, [&](const size_t i) {
+                result[i] = Encode(texts[i], options);
+            });
+            return result;
+        }
+
+        /**
+         * Count tokens of texts in parallel with given thread pool. It's cheaper than `EncodeBatch` if only lengths are needed.
+         * @return count of tokens of each text, in the same order of `texts`
+         */
+        std::vector<size_t> CountTokensBatch(
+            const std::vector<UnicodeString>& texts,
+            const TokenizerEncodeOptions& options = {},
+            ThreadPool& thread_pool = COMPUTE_WORKER_POOL) {
+            std::vector<size_t> result(texts.size());
+            RunBatch_(texts.size(), thread_pool, [&](const size_t i) {
+                result[i] = CountTokens(texts[i], options);
+            });
+            return result;
+        }
+
         // virtual size_t GetVocabSize() = 0;
         // virtual std::string IdToToken(int32_t id) = 0;
         // virtual int32_t TokenToId(const std::string& token) = 0;
+
+    private:
+        template<typename Fn>
+        static void RunBatch_(const size_t n, ThreadPool& thread_pool, Fn&& fn) {
+            // waiting on tasks of the pool from one of its workers may never return if all workers are waiting
+            const auto current_pool = BS::this_thread::get_pool();
+            if (n < 2 || (current_pool && *current_pool == &thread_pool)) {
+                for (size_t i = 0; i < n; ++i) {
+                    fn(i);
+                }
+                return;
+            }
+            // texts are split into one block per worker, and each worker reuses its own scratch buffers within a block
+            auto futures = thread_pool.submit_loop<size_t>(0, n, fn);
+            // blocks refer to `fn` and results on caller's stack, so all of them have to finish before `get` rethrows error of any text
+            futures.wait();
+            futures.get();
+        }
     };
 
     using TokenizerPtr = std::shared_ptr<Tokenizer>;
@@ -120,6 +179,81 @@ namespace INSTINCT_LLM_NS {
             }
         }
 
+        /**
+         * Apply merges to `ids` with a priority queue of candidate pairs over a linked list of tokens, which is O(n log n) in length of `ids`.
+         *
+         * Candidates are popped by lowest rank first and leftmost position next, so the result is the same as merging all occurrences of lowest-ranked pair from left to right in each round, given that a merged token always ranks higher than its parts.
+         * @param ids token ids, which are replaced by merged ones
+         * @param find_rank returns rank of a pair, which is also id of merged token, or -1 if pair is not mergeable
+         */
+        template<typename FindRank>
+        static void merge_with_heap(std::vector<int32_t>& ids, FindRank&& find_rank) {
+            const auto n = static_cast<int32_t>(ids.size());
+            if (n < 2) {
+                return;
+            }
+            std::vector<int32_t> next(n), prev(n);
+            for (int32_t i=0;i<n;++i) {
+                prev[i] = i - 1;
+                next[i] = i + 1 < n ? i + 1 : -1;
+            }
+
+            struct Candidate {
+                int32_t rank;
+                int32_t pos;
+                int32_t left;
+                int32_t right;
+
+                bool operator>(const Candidate& other) const {
+                    return rank != other.rank ? rank > other.rank : pos > other.pos;
+                }
+            };
+            std::priority_queue<Candidate, std::vector<Candidate>, std::greater<>> candidates;
+            auto push_candidate = [&](const int32_t pos) {
+                if (pos < 0 || next[pos] < 0) {
+                    return;
+                }
+                if (const int32_t rank = find_rank(ids[pos], ids[next[pos]]); rank >= 0) {
+                    candidates.push({rank, pos, ids[pos], ids[next[pos]]});
+                }
+            };
+            for (int32_t i=0;i<n-1;++i) {
+                push_candidate(i);
+            }
+
+            while (!candidates.empty()) {
+                const auto candidate = candidates.top();
+                candidates.pop();
+                const int32_t right = next[candidate.pos];
+                // skip if either token has been merged since candidate was pushed
+                if (ids[candidate.pos] != candidate.left || right < 0 || ids[right] != candidate.right) {
+                    continue;
+                }
+                ids[candidate.pos] = candidate.rank;
+                ids[right] = -1;
+                next[candidate.pos] = next[right];
+                if (next[right] >= 0) {
+                    prev[next[right]] = candidate.pos;
+                }
+                push_candidate(prev[candidate.pos]);
+                push_candidate(candidate.pos);
+            }
+
+            // first token is never removed, as merged token takes position of left one
+            int32_t size = 0;
+            for (int32_t i=0;i>=0;i=next[i]) {
+                ids[size++] = ids[i];
+            }
+            ids.resize(size);
+        }
+
+        static void merge_with_heap(std::vector<int32_t>& ids, const BPERanks& merges) {
+            merge_with_heap(ids, [&](const int32_t left, const int32_t right) {
+                const auto itr = merges.find(BPEPair {left, right});
+                return itr == merges.end() ? -1 : itr->second;
+            });
+        }
+
         static BPEPair get_min_pair(const BPERanks& stats) {
             int32_t min = INT32_MAX;
             auto min_pair_itr = stats.end();
@@ -183,13 +317,21 @@ namespace INSTINCT_LLM_NS {
             return result;
         }
 
-        static void find_all_with_regex(const UnicodeString& text, const UnicodeString& regexp_pattern, std::vector<UnicodeString>& result) {
+        static std::shared_ptr<RegexPattern> compile_regex(const UnicodeString& regexp_pattern) {
             UErrorCode status = U_ZERO_ERROR;
-            RegexMatcher regex_matcher_(regexp_pattern, 0, status);
+            std::shared_ptr<RegexPattern> pattern {RegexPattern::compile(regexp_pattern, 0, status)};
             if(U_FAILURE(status)) {
                 std::string sep_utf8;
                 throw InstinctException("Failed to compile regex with seperator string: " + regexp_pattern.toUTF8String(sep_utf8));
             }
+            return pattern;
+        }
+
+        /**
+         * Find all matches with a matcher that can be reused across calls, so that pattern is not compiled every time.
+         */
+        static void find_all_with_regex(const UnicodeString& text, RegexMatcher& regex_matcher_, std::vector<UnicodeString>& result) {
+            UErrorCode status = U_ZERO_ERROR;
             regex_matcher_.reset(text);
             while (regex_matcher_.find()) {
                 const int start = regex_matcher_.start(status);
@@ -204,6 +346,16 @@ namespace INSTINCT_LLM_NS {
             }
         }
 
+        static void find_all_with_regex(const UnicodeString& text, const UnicodeString& regexp_pattern, std::vector<UnicodeString>& result) {
+            UErrorCode status = U_ZERO_ERROR;
+            const auto pattern = compile_regex(regexp_pattern);
+            const std::unique_ptr<RegexMatcher> regex_matcher {pattern->matcher(status)};
+            if(U_FAILURE(status)) {
+                throw InstinctException("Failed to create regex matcher");
+            }
+            find_all_with_regex(text, *regex_matcher, result);
+        }
+
         /**
          *
          * https://stackoverflow.com/questions/39228912/stdregex-escape-special-characters-for-use-in-regex
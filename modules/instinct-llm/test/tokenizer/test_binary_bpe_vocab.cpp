@@ -0,0 +1,146 @@
+#include <chrono>
+#include <random>
+#include <gtest/gtest.h>
+
+#include <instinct/tokenizer/binary_bpe_vocab.hpp>
+
+namespace INSTINCT_LLM_NS {
+
+    class BinaryBPEVocabTest: public testing::Test {
+    protected:
+        void SetUp() override {
+            // random merges, each of which makes a token with id of its rank
+            std::mt19937 rng {42};
+            for (int i = 0; i < 256; ++i) {
+                vocab_[i] = Bytes {static_cast<char>(i)};
+            }
+            for (int32_t id = 256; id < 5000; ++id) {
+                std::uniform_int_distribution<int32_t> dist(0, id - 1);
+                BPEPair pair {dist(rng), dist(rng)};
+                if (merges_.contains(pair)) {
+                    continue;
+                }
+                merges_[pair] = id;
+                vocab_[id] = vocab_[pair.first] + vocab_[pair.second];
+            }
+            for (int i = 0; i < 256; ++i) {
+                byte_shuffle_[i] = static_cast<uint8_t>(255 - i);
+            }
+            path_ = std::filesystem::temp_directory_path() / ("test_binary_bpe_vocab_" + std::to_string(getpid()) + ".bin");
+        }
+
+        void TearDown() override {
+            std::filesystem::remove(path_);
+        }
+
+        void Write() const {
+            BinaryBPEVocab::Write(path_, merges_, vocab_, "\\s+", {{"<|end|>", 6000}, {"<|begin|>", 6001}}, byte_shuffle_);
+        }
+
+        BPERanks merges_;
+        Vocab vocab_;
+        ByteShuffleTable byte_shuffle_ {};
+        std::filesystem::path path_;
+    };
+
+    TEST_F(BinaryBPEVocabTest, WriteAndLoad) {
+        Write();
+        ASSERT_TRUE(BinaryBPEVocab::IsBinaryVocabFile(path_));
+        const BinaryBPEVocab binary_vocab {path_};
+
+        ASSERT_EQ(binary_vocab.GetMergeCount(), merges_.size());
+        for (const auto& [pair, rank]: merges_) {
+            ASSERT_EQ(binary_vocab.FindMerge(pair.first, pair.second), rank);
+            // reversed pair is merged only if it's in merges too
+            const auto reversed = merges_.find(BPEPair {pair.second, pair.first});
+            ASSERT_EQ(binary_vocab.FindMerge(pair.second, pair.first), reversed == merges_.end() ? -1 : reversed->second);
+        }
+        ASSERT_EQ(binary_vocab.FindMerge(-1, 3), -1);
+        ASSERT_EQ(binary_vocab.FindMerge(100000, 100000), -1);
+
+        for (const auto& [id, bytes]: vocab_) {
+            ASSERT_EQ(binary_vocab.GetTokenBytes(id), bytes);
+        }
+        ASSERT_TRUE(binary_vocab.GetTokenBytes(-1).empty());
+        ASSERT_TRUE(binary_vocab.GetTokenBytes(100000).empty());
+
+        ASSERT_EQ(binary_vocab.GetPattern(), "\\s+");
+        const auto specials = binary_vocab.GetSpecialTokens();
+        ASSERT_EQ(specials.size(), 2);
+        ASSERT_EQ(specials.at("<|end|>"), 6000);
+        ASSERT_EQ(specials.at("<|begin|>"), 6001);
+        ASSERT_EQ(binary_vocab.GetByteShuffle(), byte_shuffle_);
+    }
+
+    TEST_F(BinaryBPEVocabTest, EmptyMerges) {
+        merges_.clear();
+        Write();
+        const BinaryBPEVocab binary_vocab {path_};
+        ASSERT_EQ(binary_vocab.GetMergeCount(), 0);
+        ASSERT_EQ(binary_vocab.FindMerge(1, 2), -1);
+        ASSERT_EQ(binary_vocab.GetTokenBytes(97), "a");
+    }
+
+    TEST_F(BinaryBPEVocabTest, SourceStamp) {
+        const auto rank_file = std::filesystem::temp_directory_path() / ("test_binary_bpe_vocab_" + std::to_string(getpid()) + ".tiktoken");
+        {
+            std::ofstream file(rank_file, std::ios::binary | std::ios::trunc);
+            file << "IQ== 0\n";
+        }
+        const auto source = BinaryBPEVocabSource::Of({rank_file});
+        ASSERT_EQ(source.size, 7);
+        ASSERT_EQ(BinaryBPEVocabSource::Of({rank_file}), source);
+
+        BinaryBPEVocab::Write(path_, merges_, vocab_, "\\s+", {}, byte_shuffle_, source);
+        ASSERT_TRUE(BinaryBPEVocab::IsBinaryVocabFileOf(path_, source));
+        ASSERT_EQ(BinaryBPEVocab {path_}.GetSource(), source);
+
+        // modified rank file of same size
+        std::filesystem::last_write_time(rank_file, std::filesystem::last_write_time(rank_file) + std::chrono::hours(1));
+        const auto touched = BinaryBPEVocabSource::Of({rank_file});
+        ASSERT_NE(touched, source);
+        ASSERT_FALSE(BinaryBPEVocab::IsBinaryVocabFileOf(path_, touched));
+
+        // rank file of different size
+        {
+            std::ofstream file(rank_file, std::ios::binary | std::ios::app);
+            file << "Ig== 1\n";
+        }
+        ASSERT_FALSE(BinaryBPEVocab::IsBinaryVocabFileOf(path_, BinaryBPEVocabSource::Of({rank_file})));
+        ASSERT_TRUE(BinaryBPEVocab::IsBinaryVocabFile(path_));
+
+        // file written without stamp never matches rank files
+        Write();
+        ASSERT_EQ(BinaryBPEVocab {path_}.GetSource(), BinaryBPEVocabSource {});
+        ASSERT_FALSE(BinaryBPEVocab::IsBinaryVocabFileOf(path_, BinaryBPEVocabSource::Of({rank_file})));
+        std::filesystem::remove(rank_file);
+    }
+
+    TEST_F(BinaryBPEVocabTest, RejectInvalidFile) {
+        // not a binary vocab file
+        {
+            std::ofstream file(path_, std::ios::binary | std::ios::trunc);
+            file << "SW5zdGluY3Q= 0\n";
+        }
+        ASSERT_FALSE(BinaryBPEVocab::IsBinaryVocabFile(path_));
+        ASSERT_THROW(BinaryBPEVocab {path_}, InstinctException);
+
+        // truncated
+        Write();
+        std::filesystem::resize_file(path_, std::filesystem::file_size(path_) - 16);
+        ASSERT_TRUE(BinaryBPEVocab::IsBinaryVocabFile(path_));
+        ASSERT_THROW(BinaryBPEVocab {path_}, InstinctException);
+
+        // section out of bounds
+        Write();
+        {
+            std::fstream file(path_, std::ios::binary | std::ios::in | std::ios::out);
+            const uint64_t bad_offset = 1 << 30;
+            file.seekp(offsetof(BinaryBPEVocabHeader, slots_offset));
+            file.write(reinterpret_cast<const char*>(&bad_offset), sizeof(bad_offset));
+        }
+        ASSERT_THROW(BinaryBPEVocab {path_}, InstinctException);
+
+        ASSERT_THROW(BinaryBPEVocab {path_.string() + ".not_found"}, InstinctException);
+    }
+}
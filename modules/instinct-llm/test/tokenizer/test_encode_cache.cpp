@@ -0,0 +1,77 @@
+#include <future>
+#include <gtest/gtest.h>
+
+#include <instinct/tokenizer/encode_cache.hpp>
+
+namespace INSTINCT_LLM_NS {
+
+    TEST(EncodeCache, GetAndPut) {
+        EncodeCache cache {{.capacity = 8, .shards = 1}};
+        std::vector<int32_t> ids;
+        ASSERT_FALSE(cache.Get("hello", ids));
+        cache.Put("hello", {1, 2});
+        ASSERT_TRUE(cache.Get("hello", ids));
+        ASSERT_EQ(ids, (std::vector<int32_t> {1, 2}));
+
+        const auto stats = cache.GetStats();
+        ASSERT_EQ(stats.hits, 1);
+        ASSERT_EQ(stats.misses, 1);
+        ASSERT_EQ(stats.size, 1);
+        ASSERT_DOUBLE_EQ(stats.hit_rate(), 0.5);
+
+        cache.Clear();
+        ASSERT_FALSE(cache.Get("hello", ids));
+        ASSERT_EQ(cache.GetStats().size, 0);
+    }
+
+    TEST(EncodeCache, EvictLeastRecentlyUsed) {
+        EncodeCache cache {{.capacity = 2, .shards = 1}};
+        std::vector<int32_t> ids;
+        cache.Put("a", {1});
+        cache.Put("b", {2});
+        // `a` becomes most recently used
+        ASSERT_TRUE(cache.Get("a", ids));
+        cache.Put("c", {3});
+        ASSERT_EQ(cache.GetStats().size, 2);
+        ASSERT_FALSE(cache.Get("b", ids));
+        ASSERT_TRUE(cache.Get("a", ids));
+        ASSERT_TRUE(cache.Get("c", ids));
+    }
+
+    TEST(EncodeCache, SkipUncacheable) {
+        EncodeCache disabled {{.capacity = 0}};
+        std::vector<int32_t> ids;
+        disabled.Put("a", {1});
+        ASSERT_FALSE(disabled.Get("a", ids));
+
+        EncodeCache cache {{.max_chunk_bytes = 4}};
+        cache.Put("hello", {1});
+        ASSERT_FALSE(cache.Get("hello", ids));
+        // long chunks are not counted as misses
+        ASSERT_EQ(cache.GetStats().misses, 0);
+    }
+
+    TEST(EncodeCache, ConcurrentAccess) {
+        EncodeCache cache {{.capacity = 256, .shards = 8}};
+        std::vector<std::future<void>> futures;
+        for (int t = 0; t < 8; ++t) {
+            futures.push_back(std::async(std::launch::async, [&cache] {
+                std::vector<int32_t> ids;
+                for (int i = 0; i < 10000; ++i) {
+                    const auto key = std::to_string(i % 500);
+                    if (cache.Get(key, ids)) {
+                        ASSERT_EQ(ids, (std::vector<int32_t> {i % 500}));
+                    } else {
+                        cache.Put(key, {i % 500});
+                    }
+                }
+            }));
+        }
+        for (auto& f: futures) {
+            f.get();
+        }
+        const auto stats = cache.GetStats();
+        ASSERT_LE(stats.size, 256);
+        ASSERT_EQ(stats.hits + stats.misses, 80000);
+    }
+}
@@ -0,0 +1,74 @@
+#include <random>
+#include <gtest/gtest.h>
+
+#include <instinct/tokenizer/pre_tokenizer.hpp>
+
+namespace INSTINCT_LLM_NS {
+
+    class PreTokenizerTest: public testing::Test {
+    protected:
+        // letters, numbers, spaces, contractions and symbols of various categories
+        const std::vector<std::string> alphabet = {
+            "a", "Z", "s", "t", "l", "e", "v", "r", "S", "L", "\xc3\xa9", "\xe4\xb8\xad", "\xc5\xbf",
+            "0", "7", "\xd9\xa3", "\xe2\x85\xab", "\xc2\xb2",
+            " ", " ", "  ", "\t", "\n", "\r", "\r\n", "\x0b", "\x0c", "\xc2\xa0", "\xe3\x80\x80", "\xe2\x80\xa8", "\xc2\x85",
+            "'", "'s", "'S", "'ll", "'LL", "'ve", "'Re", "'\xc5\xbf", "'x",
+            ".", ",", "!", "?", "-", "_", "=", "/", "+", "(", "\"", "\xf0\x9f\x91\x8b", "\xcc\x81", "\xe2\x80\x8d", "\xe2\x80\x8b", "\xe2\x80\x94"
+        };
+        std::mt19937 rng {42};
+
+        std::string random_text(const int n_parts) {
+            std::uniform_int_distribution<size_t> dist(0, alphabet.size() - 1);
+            std::string text;
+            for (int i = 0; i < n_parts; ++i) {
+                text += alphabet[dist(rng)];
+            }
+            return text;
+        }
+
+        static std::vector<std::string> split_with_regex(const std::string& pattern, const std::string& text) {
+            // chunks are aliases of input
+            const auto unicode_text = UnicodeString::fromUTF8(text);
+            std::vector<UnicodeString> chunks;
+            details::find_all_with_regex(unicode_text, UnicodeString::fromUTF8(pattern), chunks);
+            std::vector<std::string> result;
+            for (const auto& chunk: chunks) {
+                result.push_back(details::conv_to_utf8_string(chunk));
+            }
+            return result;
+        }
+
+        static std::vector<std::string> split_fast(const SplitPatternKind kind, const std::string& text) {
+            std::vector<std::string_view> chunks;
+            details::pre_tokenize(kind, text, chunks);
+            return {chunks.begin(), chunks.end()};
+        }
+    };
+
+    TEST_F(PreTokenizerTest, DetectSplitPattern) {
+        ASSERT_EQ(details::detect_split_pattern(UnicodeString::fromUTF8(GPT2_SPLIT_PATTERN)), kGPT2SplitPattern);
+        ASSERT_EQ(details::detect_split_pattern(UnicodeString::fromUTF8(CL100K_SPLIT_PATTERN)), kCL100KSplitPattern);
+        ASSERT_EQ(details::detect_split_pattern(R"(\s+)"), kCustomSplitPattern);
+    }
+
+    TEST_F(PreTokenizerTest, SameChunksAsRegex) {
+        const std::vector<std::string> texts = {
+            "",
+            "hello world \xf0\x9f\x91\x8b",
+            "I'm sure they'll say it's 12345 dollars, isn't it?\n\n  Yes!!!\r\n\tNo...   ",
+            "   leading and trailing   ",
+            "https://example.com/a?b=1&c=2#frag",
+            "function(a,b){return a+b};\n"
+        };
+        for (const auto& [pattern, kind]: std::vector<std::pair<std::string, SplitPatternKind>> {{GPT2_SPLIT_PATTERN, kGPT2SplitPattern}, {CL100K_SPLIT_PATTERN, kCL100KSplitPattern}}) {
+            for (const auto& text: texts) {
+                ASSERT_EQ(split_fast(kind, text), split_with_regex(pattern, text)) << "text: " << text;
+            }
+            std::uniform_int_distribution<int> text_length(1, 60);
+            for (int i = 0; i < 2000; ++i) {
+                const auto text = random_text(text_length(rng));
+                ASSERT_EQ(split_fast(kind, text), split_with_regex(pattern, text)) << "text: " << text;
+            }
+        }
+    }
+}
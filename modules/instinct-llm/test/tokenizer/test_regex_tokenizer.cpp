@@ -38,6 +38,27 @@ The ancestors of llamas are thought to have originated from the Great Plains of
         ASSERT_EQ(ret1, "hello");
     }
 
+    TEST(RegexTokenizer, TestMergeStrategies) {
+        auto reg_pattern = UnicodeString::fromUTF8(R"""('(?i:[sdmt]|ll|ve|re)|[^\r\n\p{L}\p{N}]?+\p{L}+|\p{N}{1,3}| ?[^\s\p{L}\p{N}]++[\r\n]*|\s*[\r\n]|\s+(?!\S)|\s+)""");
+        RegexTokenizer regexp_tokenizer(reg_pattern, {});
+        regexp_tokenizer.SetEncodeCacheOptions({.capacity = 0});
+        regexp_tokenizer.Train(text1, 512);
+        const std::vector<UnicodeString> texts = {
+            text1,
+            UnicodeString::fromUTF8(std::string(3000, 'l')),
+            "llamasllamasllamasllamasllamasllamasllamasllamasllamasllamasllamasllamas",
+            "aaaaaaaaa bbbbbbbb lalalalalala"
+        };
+        for (const auto& text: texts) {
+            regexp_tokenizer.SetMergeStrategy(kHeapMerge);
+            const auto ids1 = regexp_tokenizer.Encode(text, {.allow_special = kNone});
+            regexp_tokenizer.SetMergeStrategy(kNaiveMerge);
+            const auto ids2 = regexp_tokenizer.Encode(text, {.allow_special = kNone});
+            ASSERT_TRUE(check_equality(ids1, ids2));
+            ASSERT_EQ(regexp_tokenizer.Decode(ids1), text);
+        }
+    }
+
 }
 
 
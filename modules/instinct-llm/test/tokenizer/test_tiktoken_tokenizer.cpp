@@ -1,6 +1,8 @@
 //
 // Created by RobinQu on 2024/3/2.
 //
+#include <chrono>
+#include <random>
 #include <gtest/gtest.h>
 #include <instinct/tokenizer/tiktoken_tokenizer.hpp>
 #include <instinct/tools/assertions.hpp>
@@ -55,4 +57,215 @@ The ancestors of llamas are thought to have originated from the Great Plains of
         ASSERT_TRUE(check_equality(ids3, std::vector{100257, 791, 94776, 47325, 135, 230, 75, 133, 239, 135, 238, 76, 99638, 14, 26, 15506, 71722, 25, 510, 135, 230, 134, 236, 3105, 60, 477, 510, 135, 230, 134, 251, 3105, 2526, 320, 43, 3105, 2840, 3105, 8, 374, 264, 13018, 660, 4987, 3778, 50252, 307, 11, 13882, 1511, 439, 264, 13339, 323, 3854, 10065, 555, 1628, 5420, 27833, 2533, 279, 864, 7813, 1152, 13464, 11639, 627, 43, 24705, 300, 527, 3674, 10099, 323, 3974, 449, 3885, 439, 264, 59213, 13, 11205, 39640, 374, 8579, 323, 5727, 1193, 264, 2678, 3392, 315, 31791, 37737, 8032, 17, 60, 445, 24705, 300, 649, 4048, 4382, 9256, 1306, 264, 2478, 86066, 13, 3277, 1701, 264, 3854, 11, 814, 649, 6920, 922, 220, 914, 311, 220, 966, 4, 315, 872, 2547, 4785, 369, 220, 23, 311, 220, 1032, 13437, 320, 20, 4235, 23, 8931, 94638, 18, 60, 578, 836, 94776, 320, 258, 279, 3347, 1101, 68918, 330, 81101, 1, 477, 330, 6200, 3105, 909, 574, 18306, 555, 7665, 61107, 505, 10068, 3700, 12328, 5493, 8032, 19, 933, 791, 38618, 315, 9507, 29189, 527, 3463, 311, 617, 44853, 505, 279, 8681, 63911, 315, 4892, 5270, 922, 220, 1272, 3610, 1667, 4227, 11, 323, 28520, 73691, 311, 4987, 5270, 922, 2380, 3610, 1667, 4227, 2391, 279, 8681, 3778, 5783, 3455, 13, 3296, 279, 842, 315, 279, 1566, 10054, 4325, 320, 605, 11, 931, 4235, 717, 11, 931, 1667, 4227, 705, 50252, 3447, 1051, 69918, 304, 4892, 5270, 8032, 18, 60, 1666, 315, 220, 1049, 22, 11, 1070, 1051, 927, 8254, 3610, 9507, 29189, 323, 453, 46051, 300, 304, 4987, 5270, 323, 927, 220, 11286, 11, 931, 9507, 29189, 323, 220, 1041, 11, 931, 453, 46051, 300, 11, 58842, 505, 84360, 12170, 25973, 3389, 304, 279, 220, 508, 339, 9478, 11, 304, 279, 3723, 4273, 323, 7008, 8032, 20, 933, 100258, 644, 362, 1631, 5169, 59492, 11, 9507, 29189, 527, 3062, 23837, 13, 578, 88150, 445, 81101, 374, 1071, 311, 7172, 3090, 505, 279, 18435, 323, 4433, 258, 988, 439, 433, 62555, 8032, 21, 60, 10771, 311, 362, 1631, 5169, 1560, 9884, 2508, 11, 100260, 1405, 814, 2586, 505, 520, 279, 842, 315, 892, 8032, 21, 60, 100259, 9507, 29189, 690, 471, 311, 279, 3090, 42242, 323, 89455, 100276}));
     }
 
+    /**
+     * texts without breaks for regex, which are split into very long chunks
+     */
+    static std::vector<UnicodeString> make_merge_corpus() {
+        std::mt19937 rng {42};
+        const std::string base64_chars = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+        std::uniform_int_distribution<size_t> dist(0, base64_chars.size() - 1);
+        std::string base64;
+        for (int i = 0; i < 20000; ++i) {
+            base64 += base64_chars[dist(rng)];
+        }
+        std::string url = "https://example.com/search?";
+        for (int i = 0; i < 500; ++i) {
+            url += "q" + std::to_string(i) + "=value_" + std::to_string(i * 7) + "&";
+        }
+        std::string minified_js;
+        for (int i = 0; i < 500; ++i) {
+            minified_js += "function f" + std::to_string(i) + "(a,b){return a.map(function(x){return x*b+" + std::to_string(i) + "})};";
+        }
+        return {
+            text1,
+            text2,
+            "hello world 👋",
+            UnicodeString::fromUTF8(base64),
+            UnicodeString::fromUTF8(url),
+            UnicodeString::fromUTF8(minified_js),
+            UnicodeString::fromUTF8(std::string(10000, 'a')),
+            UnicodeString::fromUTF8(std::string(5000, '=') + std::string(5000, ' '))
+        };
+    }
+
+    TEST(TiktokenTokenizer, TestMergeStrategies) {
+        const std::filesystem::path assets_dir = std::filesystem::current_path() / "_assets";
+        const auto tokenizer = std::dynamic_pointer_cast<TiktokenTokenizer>(TiktokenTokenizer::MakeGPT4Tokenizer(assets_dir / "bpe_ranks" / "cl100k_base.tiktoken"));
+        ASSERT_EQ(tokenizer->GetMergeStrategy(), kHeapMerge);
+        // every encoding should go through merging
+        tokenizer->SetEncodeCacheOptions({.capacity = 0});
+        for (const auto& text: make_merge_corpus()) {
+            tokenizer->SetMergeStrategy(kHeapMerge);
+            auto t1 = ChronoUtils::GetCurrentTimeMillis();
+            const auto ids1 = tokenizer->Encode(text, {.allow_special = kNone});
+            const auto heap_ms = ChronoUtils::GetCurrentTimeMillis() - t1;
+
+            tokenizer->SetMergeStrategy(kNaiveMerge);
+            t1 = ChronoUtils::GetCurrentTimeMillis();
+            const auto ids2 = tokenizer->Encode(text, {.allow_special = kNone});
+            const auto naive_ms = ChronoUtils::GetCurrentTimeMillis() - t1;
+
+            std::cout << "tokens=" << ids1.size() << ", heap_merge=" << heap_ms << "ms, naive_merge=" << naive_ms << "ms" << std::endl;
+            ASSERT_EQ(ids1, ids2);
+            ASSERT_EQ(tokenizer->Decode(ids1), text);
+        }
+    }
+
+    TEST(TiktokenTokenizer, TestFastPreTokenizer) {
+        const std::filesystem::path assets_dir = std::filesystem::current_path() / "_assets";
+        const auto tokenizer = std::dynamic_pointer_cast<TiktokenTokenizer>(TiktokenTokenizer::MakeGPT4Tokenizer(assets_dir / "bpe_ranks" / "cl100k_base.tiktoken"));
+        ASSERT_TRUE(tokenizer->HasFastPreTokenizer());
+        tokenizer->SetEncodeCacheOptions({.capacity = 0});
+        for (const auto& text: make_merge_corpus()) {
+            tokenizer->SetFastPreTokenizer(true);
+            const auto ids1 = tokenizer->Encode(text, {.allow_special = kAll});
+            tokenizer->SetFastPreTokenizer(false);
+            const auto ids2 = tokenizer->Encode(text, {.allow_special = kAll});
+            ASSERT_EQ(ids1, ids2);
+        }
+        tokenizer->SetFastPreTokenizer(true);
+    }
+
+    TEST(TiktokenTokenizer, TestEncodeCache) {
+        const std::filesystem::path assets_dir = std::filesystem::current_path() / "_assets";
+        const auto tokenizer = std::dynamic_pointer_cast<TiktokenTokenizer>(TiktokenTokenizer::MakeGPT4Tokenizer(assets_dir / "bpe_ranks" / "cl100k_base.tiktoken"));
+        tokenizer->SetEncodeCacheOptions({.capacity = 0});
+        const auto expected = tokenizer->Encode(text2, {.allow_special = kAll});
+
+        tokenizer->SetEncodeCacheOptions({});
+        const auto ids1 = tokenizer->Encode(text2, {.allow_special = kAll});
+        const auto stats1 = tokenizer->GetEncodeCacheStats();
+        ASSERT_GT(stats1.size, 0);
+        // words like `llamas` and `the` are repeated in text
+        ASSERT_GT(stats1.hits, 0);
+
+        const auto ids2 = tokenizer->Encode(text2, {.allow_special = kAll});
+        const auto stats2 = tokenizer->GetEncodeCacheStats();
+        ASSERT_EQ(stats2.misses, stats1.misses);
+        ASSERT_EQ(stats2.size, stats1.size);
+        std::cout << "hit_rate=" << stats2.hit_rate() << ", size=" << stats2.size << std::endl;
+
+        ASSERT_EQ(ids1, expected);
+        ASSERT_EQ(ids2, expected);
+    }
+
+    TEST(TiktokenTokenizer, TestBinaryVocab) {
+        const std::filesystem::path assets_dir = std::filesystem::current_path() / "_assets";
+        const auto rank_file = assets_dir / "bpe_ranks" / "cl100k_base.tiktoken";
+        const auto binary_file = std::filesystem::temp_directory_path() / "test_cl100k_base.vocab.bin";
+
+        auto t1 = ChronoUtils::GetCurrentTimeMillis();
+        const auto tokenizer = TiktokenTokenizer::MakeGPT4Tokenizer(rank_file);
+        std::cout << "load from rank file: " << ChronoUtils::GetCurrentTimeMillis() - t1 << "ms" << std::endl;
+
+        TiktokenTokenizer::ConvertToBinaryVocab(TiktokenTokenizer::MakeCL100KConfig(rank_file), binary_file);
+        t1 = ChronoUtils::GetCurrentTimeMillis();
+        const auto binary_tokenizer = std::dynamic_pointer_cast<TiktokenTokenizer>(TiktokenTokenizer::MakeGPT4Tokenizer(binary_file));
+        std::cout << "load from binary vocab file: " << ChronoUtils::GetCurrentTimeMillis() - t1 << "ms" << std::endl;
+        ASSERT_TRUE(binary_tokenizer);
+        ASSERT_TRUE(binary_tokenizer->GetVocab().empty());
+        ASSERT_EQ(binary_tokenizer->GetSpecialTokens().size(), 5);
+
+        auto corpus = make_merge_corpus();
+        corpus.push_back(text2);
+        for (const auto& text: corpus) {
+            const auto ids = tokenizer->Encode(text, {.allow_special = kAll});
+            ASSERT_EQ(binary_tokenizer->Encode(text, {.allow_special = kAll}), ids);
+            ASSERT_EQ(binary_tokenizer->Decode(ids), tokenizer->Decode(ids));
+        }
+        ASSERT_THROW(binary_tokenizer->Decode({200000}), InstinctException);
+
+        // a cached binary file is written on first load and used on next one
+        const auto copied_rank_file = std::filesystem::temp_directory_path() / "test_cl100k_base.tiktoken";
+        std::filesystem::copy_file(rank_file, copied_rank_file, std::filesystem::copy_options::overwrite_existing);
+        std::filesystem::remove(binary_file);
+        bool config_called = false;
+        auto make_config = [&] {
+            config_called = true;
+            return TiktokenTokenizer::MakeCL100KConfig(copied_rank_file);
+        };
+        const auto config_loaded = TiktokenTokenizer::LoadWithBinaryVocab(binary_file, {copied_rank_file}, make_config);
+        ASSERT_TRUE(config_called);
+        ASSERT_TRUE(BinaryBPEVocab::IsBinaryVocabFile(binary_file));
+        config_called = false;
+        const auto binary_loaded = TiktokenTokenizer::LoadWithBinaryVocab(binary_file, {copied_rank_file}, make_config);
+        ASSERT_FALSE(config_called);
+        ASSERT_EQ(binary_loaded->Encode(text2, {.allow_special = kAll}), config_loaded->Encode(text2, {.allow_special = kAll}));
+
+        // cached binary file is rebuilt once rank file is modified
+        std::filesystem::last_write_time(copied_rank_file, std::filesystem::last_write_time(copied_rank_file) + std::chrono::hours(1));
+        const auto reloaded = TiktokenTokenizer::LoadWithBinaryVocab(binary_file, {copied_rank_file}, make_config);
+        ASSERT_TRUE(config_called);
+        ASSERT_TRUE(BinaryBPEVocab::IsBinaryVocabFileOf(binary_file, BinaryBPEVocabSource::Of({copied_rank_file})));
+        ASSERT_EQ(reloaded->Encode(text2, {.allow_special = kAll}), config_loaded->Encode(text2, {.allow_special = kAll}));
+        std::filesystem::remove(binary_file);
+        std::filesystem::remove(copied_rank_file);
+    }
+
+    TEST(TiktokenTokenizer, TestEncodeBatch) {
+        const std::filesystem::path assets_dir = std::filesystem::current_path() / "_assets";
+        const auto tokenizer = TiktokenTokenizer::MakeGPT4Tokenizer(assets_dir / "bpe_ranks" / "cl100k_base.tiktoken");
+        std::vector<UnicodeString> texts;
+        for (int i = 0; i < 20; ++i) {
+            for (const auto& text: make_merge_corpus()) {
+                texts.push_back(text);
+            }
+            texts.push_back(text1);
+            texts.emplace_back();
+        }
+
+        auto t1 = ChronoUtils::GetCurrentTimeMillis();
+        std::vector<std::vector<int32_t>> expected;
+        for (const auto& text: texts) {
+            expected.push_back(tokenizer->Encode(text, {.allow_special = kAll}));
+        }
+        std::cout << "sequential: " << ChronoUtils::GetCurrentTimeMillis() - t1 << "ms" << std::endl;
+
+        t1 = ChronoUtils::GetCurrentTimeMillis();
+        const auto batch_ids = tokenizer->EncodeBatch(texts, {.allow_special = kAll});
+        std::cout << "batch: " << ChronoUtils::GetCurrentTimeMillis() - t1 << "ms" << std::endl;
+        ASSERT_EQ(batch_ids, expected);
+
+        t1 = ChronoUtils::GetCurrentTimeMillis();
+        const auto counts = tokenizer->CountTokensBatch(texts, {.allow_special = kAll});
+        std::cout << "count: " << ChronoUtils::GetCurrentTimeMillis() - t1 << "ms" << std::endl;
+        ASSERT_EQ(counts.size(), texts.size());
+        for (size_t i = 0; i < texts.size(); ++i) {
+            ASSERT_EQ(counts[i], expected[i].size());
+        }
+        ASSERT_EQ(tokenizer->CountTokens(text2, {.allow_special = kAll}), tokenizer->Encode(text2, {.allow_special = kAll}).size());
+
+        // only listed specials are encoded as special tokens
+        const auto some_ids = tokenizer->Encode(text2, {.allow_special = kSome, .specials = {"<|endoftext|>"}});
+        ASSERT_EQ(some_ids.front(), 100257);
+        ASSERT_EQ(std::ranges::count(some_ids, 100258), 0);
+        ASSERT_THROW(tokenizer->Encode(text2, {.allow_special = kSome, .specials = {"<|unknown|>"}}), InstinctException);
+
+        // error of any text is thrown to caller
+        ASSERT_THROW(tokenizer->CountTokensBatch({text1, text2, text1}), InstinctException);
+        ASSERT_TRUE(tokenizer->EncodeBatch({}).empty());
+    }
+
+    TEST(TiktokenTokenizer, TestBatchError) {
+        const std::filesystem::path assets_dir = std::filesystem::current_path() / "_assets";
+        const auto tokenizer = TiktokenTokenizer::MakeGPT4Tokenizer(assets_dir / "bpe_ranks" / "cl100k_base.tiktoken");
+        // only one text in the middle of batch has special tokens
+        std::vector<UnicodeString> texts(200, text1);
+        texts[100] = text2;
+        ThreadPool thread_pool {4};
+
+        for (int i = 0; i < 10; ++i) {
+            // other blocks are still writing results when one of them throws, and batch call should not return before they finish
+            ASSERT_THROW(tokenizer->EncodeBatch(texts, {.allow_special = kNoneRaise}, thread_pool), InstinctException);
+            ASSERT_THROW(tokenizer->CountTokensBatch(texts, {.allow_special = kNoneRaise}, thread_pool), InstinctException);
+            ASSERT_THROW(tokenizer->EncodeBatch(texts, {.allow_special = kSome, .specials = {"<|unknown|>"}}, thread_pool), InstinctException);
+        }
+
+        // pool is still usable after errors
+        texts[100] = text1;
+        const auto counts = tokenizer->CountTokensBatch(texts, {.allow_special = kNoneRaise}, thread_pool);
+        ASSERT_EQ(counts.size(), texts.size());
+        ASSERT_EQ(counts[100], tokenizer->CountTokens(text1));
+    }
+
 }
@@ -8,7 +8,11 @@
 
 #include <instinct/ingestor/ingestor.hpp>
 #include <instinct/tools/assertions.hpp>
+#include <instinct/tools/chrono_utils.hpp>
 #include <filesystem>
+#include <deque>
+#include <optional>
+#include <condition_variable>
 
 #include <instinct/ingestor/single_file_ingestor.hpp>
 
@@ -19,50 +23,164 @@ namespace INSTINCT_RETRIEVAL_NS {
 
     /**
      * DirectoryTreeIngestor is capable of turning regular files in a directory into split documents.
+     *
+     * Files are loaded in parallel by a bounded number of tasks in given thread pool. Documents of each file are emitted together in their original order, and a new file is scheduled only after a loaded file is consumed by downstream, so memory usage is bounded by `max_parallelism` files.
+     *
+     * Files are emitted in order of completion rather than order of directory listing. Set `max_parallelism` to one if a deterministic order is required.
      */
     class DirectoryTreeIngestor final: public BaseIngestor {
         std::filesystem::path folder_path_;
         std::unique_ptr<RegexMatcher> regex_matcher_;
         IngestorFactoryFunction ingestor_factory_function_;
         bool recursive_;
+        ThreadPool& thread_pool_;
+        size_t max_parallelism_;
     public:
         DirectoryTreeIngestor(
             std::filesystem::path folder_path,
             std::unique_ptr<RegexMatcher> regex_matcher,
             IngestorFactoryFunction ingestor_factory_function,
-            const bool recursive
+            const bool recursive,
+            ThreadPool& thread_pool = IO_WORKER_POOL,
+            const size_t max_parallelism = std::thread::hardware_concurrency()
             )
             : BaseIngestor(nullptr),
-            folder_path_(std::move(folder_path)), regex_matcher_(std::move(regex_matcher)), ingestor_factory_function_(std::move(ingestor_factory_function)),  recursive_(recursive) {
+            folder_path_(std::move(folder_path)), regex_matcher_(std::move(regex_matcher)), ingestor_factory_function_(std::move(ingestor_factory_function)),  recursive_(recursive),
+            thread_pool_(thread_pool), max_parallelism_(std::max<size_t>(1, max_parallelism)) {
             assert_true(std::filesystem::exists(folder_path_), "Given folder should exist");
             assert_true(std::filesystem::is_directory(folder_path_), "should be a folder");
         }
 
         AsyncIterator<Document> Load() override {
-            std::vector<std::filesystem::path> valid_files;
-            if (recursive_) {
-                for (const auto& dir_entry: std::filesystem::recursive_directory_iterator{folder_path_}) {
-                    if (MatchSingleEntry_(dir_entry)) {
-                        valid_files.push_back(dir_entry.path());
+            return rpp::source::create<Document>([&](const auto& observer) {
+                if (recursive_) {
+                    LoadFiles_(std::filesystem::recursive_directory_iterator{folder_path_}, observer);
+                } else {
+                    LoadFiles_(std::filesystem::directory_iterator{folder_path_}, observer);
+                }
+            });
+        }
+
+    private:
+        struct FileResult {
+            std::filesystem::path path;
+            std::vector<Document> documents;
+            std::exception_ptr error;
+            long elapsed;
+        };
+
+        /**
+         * States shared with loading tasks, which may outlive the call of `LoadFiles_` if it returns early
+         */
+        struct LoadingState {
+            std::mutex mutex;
+            std::condition_variable cv;
+            std::deque<FileResult> completed;
+            IngestorFactoryFunction ingestor_factory_function;
+        };
+
+        /**
+         * Walk through directory lazily, and keep at most `max_parallelism_` files loading at the same time.
+         */
+        template<typename DirectoryIterator, typename Observer>
+        void LoadFiles_(DirectoryIterator dir_itr, const Observer& observer) {
+            const auto state = std::make_shared<LoadingState>();
+            state->ingestor_factory_function = ingestor_factory_function_;
+            size_t in_flight = 0;
+            std::exception_ptr error;
+            size_t file_count = 0, doc_count = 0;
+            const long t1 = ChronoUtils::GetCurrentTimeMillis();
+
+            auto next_file = [&]() -> std::optional<std::filesystem::path> {
+                for (; dir_itr != DirectoryIterator {}; ++dir_itr) {
+                    if (MatchSingleEntry_(*dir_itr)) {
+                        auto path = dir_itr->path();
+                        ++dir_itr;
+                        return path;
                     }
                 }
-            } else {
-                for (auto const& dir_entry : std::filesystem::directory_iterator{folder_path_}) {
-                    if (MatchSingleEntry_(dir_entry)) {
-                        valid_files.push_back(dir_entry.path());
+                return std::nullopt;
+            };
+
+            auto schedule = [&](const std::filesystem::path& path) {
+                // task only refers to shared state, so it's safe even if nobody waits for it any more
+                thread_pool_.detach_task([state, path] {
+                    FileResult result {.path = path};
+                    const long start = ChronoUtils::GetCurrentTimeMillis();
+                    try {
+                        if (const auto ingestor = state->ingestor_factory_function(path)) {
+                            CollectVector(ingestor->Load(), result.documents);
+                        } else {
+                            LOG_WARN("No ingestor for file {}, skipped", path.string());
+                        }
+                    } catch (...) {
+                        result.error = std::current_exception();
+                    }
+                    result.elapsed = ChronoUtils::GetCurrentTimeMillis() - start;
+                    std::lock_guard lock {state->mutex};
+                    state->completed.push_back(std::move(result));
+                    state->cv.notify_one();
+                });
+                ++in_flight;
+            };
+
+            bool exhausted = false;
+            while (true) {
+                // fill up the window unless downstream is gone or something went wrong
+                while (!exhausted && !error && !observer.is_disposed() && in_flight < max_parallelism_) {
+                    try {
+                        if (const auto path = next_file()) {
+                            schedule(*path);
+                        } else {
+                            exhausted = true;
+                        }
+                    } catch (...) {
+                        error = std::current_exception();
                     }
                 }
+                if (in_flight == 0) {
+                    break;
+                }
+
+                FileResult result;
+                {
+                    std::unique_lock lock {state->mutex};
+                    state->cv.wait(lock, [&] { return !state->completed.empty(); });
+                    result = std::move(state->completed.front());
+                    state->completed.pop_front();
+                }
+                --in_flight;
+
+                // results of tasks still running are drained, so that their errors are not reported after completion
+                if (error || observer.is_disposed()) {
+                    continue;
+                }
+                if (result.error) {
+                    error = result.error;
+                    continue;
+                }
+                std::error_code ec;
+                LOG_INFO("Ingested file {}: documents={}, bytes={}, rt={}ms",
+                    result.path.string(),
+                    result.documents.size(),
+                    std::filesystem::file_size(result.path, ec),
+                    result.elapsed);
+                ++file_count;
+                doc_count += result.documents.size();
+                // downstream runs synchronously in on_next, which throttles scheduling of new files
+                for (auto& doc: result.documents) {
+                    observer.on_next(std::move(doc));
+                }
             }
 
-            // TODO Do it in parallel
-            return rpp::source::from_iterable(valid_files)
-                | rpp::operators::flat_map([&](const std::filesystem::path& entry) {
-                    const auto ingestor = ingestor_factory_function_(entry);
-                    return ingestor->Load();
-                });
+            if (error) {
+                observer.on_error(error);
+                return;
+            }
+            LOG_INFO("Ingested directory {}: files={}, documents={}, rt={}ms", folder_path_.string(), file_count, doc_count, ChronoUtils::GetCurrentTimeMillis() - t1);
+            observer.on_completed();
         }
 
-    private:
         [[nodiscard]] bool MatchSingleEntry_(const std::filesystem::directory_entry& dir_entry) const {
             // only accepting regular file, skipping directories, symlinks and block files, etc.
             if (dir_entry.is_regular_file()) {
@@ -5,6 +5,7 @@
 #ifndef PARQUETFILEINGESTOR_HPP
 #define PARQUETFILEINGESTOR_HPP
 #include <duckdb.hpp>
+#include <optional>
 #include <instinct/store/duckdb/base_duckdb_store.hpp>
 #include <utility>
 
@@ -30,7 +31,12 @@ namespace INSTINCT_RETRIEVAL_NS {
 
     struct ParquetFileIngestorOptions {
         // used by naive ingestor to limit line count
-        size_t limit;
+        size_t limit = 0;
+
+        /**
+         * Count of threads used by DuckDB to scan parquet file. Row groups are read ahead of consumer by parallel scans, so a larger value trades memory for throughput. Zero means default of DuckDB, which is count of CPU cores.
+         */
+        size_t threads = 0;
     };
 
     class BaseParquetFileIngestor: public BaseIngestor {
@@ -49,71 +55,212 @@ namespace INSTINCT_RETRIEVAL_NS {
               file_source_id_(std::move(file_source_id)) {
         }
 
-        virtual unique_ptr<MaterializedQueryResult> ReadParquet(Connection& conn, const std::string& file_source) = 0;
+        /**
+         * Query parquet file with given columns. Returned result should contain exactly given columns in given order, and it's recommended to return a `StreamQueryResult` so that rows are fetched incrementally.
+         * @param conn Connection to a temporary database
+         * @param file_source Parquet file source
+         * @param column_names Names of columns to be selected
+         * @return
+         */
+        virtual unique_ptr<QueryResult> ReadParquet(Connection& conn, const std::string& file_source, const std::vector<std::string>& column_names) = 0;
+
+        /**
+         * Configure temporary database before reading
+         */
+        virtual void Configure(DBConfig& config) {}
 
         AsyncIterator<Document> Load() override {
             return rpp::source::create<Document>([&](const auto & observer) {
-                duckdb::DuckDB duck_db(nullptr);
+                DBConfig config;
+                Configure(config);
+                duckdb::DuckDB duck_db(nullptr, &config);
                 duckdb::Connection conn(duck_db);
-                if(const auto result = ReadParquet(conn, file_source_); check_query_ok(result)) {
-                    for(int i=0; const auto& row: *result) {
-                        Document document = CreateNewDocument(
-                            "",
-                            ROOT_DOC_ID,
-                            ++i,
-                            StringUtils::IsBlankString(file_source_id_) ? file_source_ : file_source_id_
-                        );
-                        for(const auto&[column_type, metadata_field_schema, column_idx] : column_mapping_) {
-                            if(column_type == kTextColumn) {
-                                document.set_text(row.GetValue<std::string>(column_idx));
-                                continue;
+
+                // only mapped columns are selected, and column indices are translated to positions in projection
+                std::vector<std::string> column_names;
+                std::vector<size_t> column_positions;
+                try {
+                    ResolveProjection_(conn, column_names, column_positions);
+                } catch (...) {
+                    observer.on_error(std::current_exception());
+                    return;
+                }
+
+                const auto result = ReadParquet(conn, file_source_, column_names);
+                if (result->HasError()) {
+                    observer.on_error(std::make_exception_ptr(InstinctException(result->GetError())));
+                    return;
+                }
+
+                try {
+                    int i = 0;
+                    while (!observer.is_disposed()) {
+                        const auto chunk = result->Fetch();
+                        if (!chunk || chunk->size() == 0) {
+                            break;
+                        }
+                        // vector columns are read from chunk directly, instead of boxing each float as `Value`
+                        std::vector<std::optional<VectorColumnReader>> vector_readers(column_mapping_.size());
+                        for (size_t j = 0; j < column_mapping_.size(); ++j) {
+                            if (column_mapping_[j].column_type == kVectorColumn) {
+                                vector_readers[j].emplace(chunk->data[column_positions[j]], chunk->size(), column_mapping_[j].column_index);
                             }
-                            if (column_type == kMetadataColumn) {
-                                auto* metadata_field = document.add_metadata();
-                                metadata_field->set_name(metadata_field_schema.name());
-                                switch (const auto field_schema = metadata_field_schema; field_schema.type()) {
-                                    case INT32:
-                                        metadata_field->set_int_value(row.GetValue<int32_t>(column_idx));
-                                        break;
-                                    case INT64:
-                                        metadata_field->set_long_value(row.GetValue<int64_t>(column_idx));
-                                        break;
-                                    case FLOAT:
-                                        metadata_field->set_float_value(row.GetValue<float>(column_idx));
-                                        break;
-                                    case DOUBLE:
-                                        metadata_field->set_double_value(row.GetValue<double>(column_idx));
-                                        break;
-                                    case VARCHAR:
-                                        metadata_field->set_string_value(row.GetValue<std::string>(column_idx));
-                                        break;
-                                    case BOOL:
-                                        metadata_field->set_bool_value(row.GetValue<bool>(column_idx));
-                                        break;
-                                    default:
-                                        observer.on_error(std::make_exception_ptr(InstinctException("unknown field type for field named " + field_schema.name())));
+                        }
+                        for (idx_t row = 0; row < chunk->size() && !observer.is_disposed(); ++row) {
+                            Document document = CreateNewDocument(
+                                "",
+                                ROOT_DOC_ID,
+                                ++i,
+                                StringUtils::IsBlankString(file_source_id_) ? file_source_ : file_source_id_
+                            );
+                            for (size_t j = 0; j < column_mapping_.size(); ++j) {
+                                if (vector_readers[j]) {
+                                    vector_readers[j]->Read(row, document);
+                                } else {
+                                    ConvertColumn_(column_mapping_[j], chunk->GetValue(column_positions[j], row), document);
                                 }
-                                continue;
                             }
-                            observer.on_error(std::make_exception_ptr(InstinctException(fmt::format("unknown column type at index {}, column name {}, given column type {}",
-                                std::to_string(column_idx),
-                                metadata_field_schema.name(),
-                                metadata_field_schema.type()
-                                ))));
+                            DocumentUtils::AddMissingPresetMetadataFields(document);
+                            observer.on_next(document);
                         }
-                        DocumentUtils::AddMissingPresetMetadataFields(document);
-                        observer.on_next(document);
                     }
-                    observer.on_completed();
-                } else {
-                    observer.on_error(std::make_exception_ptr(InstinctException(result->GetError())));
+                    if (result->HasError()) {
+                        observer.on_error(std::make_exception_ptr(InstinctException(result->GetError())));
+                        return;
+                    }
+                } catch (...) {
+                    observer.on_error(std::current_exception());
+                    return;
                 }
+                observer.on_completed();
             });
         }
+
+    private:
+        /**
+         * Reader of a LIST or fixed-size ARRAY column of numbers in one chunk. Elements of other numeric types are cast to FLOAT once for the whole chunk.
+         */
+        class VectorColumnReader {
+            LogicalTypeId type_id_;
+            idx_t array_size_ = 0;
+            UnifiedVectorFormat format_;
+            // child vector is only owned if it's cast from other type
+            std::unique_ptr<Vector> casted_child_;
+            UnifiedVectorFormat child_format_;
+
+        public:
+            VectorColumnReader(Vector& column, const idx_t count, const int column_idx): type_id_(column.GetType().id()) {
+                assert_true(type_id_ == LogicalTypeId::LIST || type_id_ == LogicalTypeId::ARRAY, fmt::format("vector column at index {} should be of LIST or ARRAY type", column_idx));
+                column.ToUnifiedFormat(count, format_);
+                Vector* child;
+                idx_t child_count;
+                if (type_id_ == LogicalTypeId::LIST) {
+                    child = &ListVector::GetEntry(column);
+                    child_count = ListVector::GetListSize(column);
+                } else {
+                    child = &ArrayVector::GetEntry(column);
+                    child_count = ArrayVector::GetTotalSize(column);
+                    array_size_ = ArrayType::GetSize(column.GetType());
+                }
+                if (child->GetType().id() != LogicalTypeId::FLOAT) {
+                    casted_child_ = std::make_unique<Vector>(LogicalType::FLOAT, child_count);
+                    VectorOperations::DefaultCast(*child, *casted_child_, child_count);
+                    child = casted_child_.get();
+                }
+                child->ToUnifiedFormat(child_count, child_format_);
+            }
+
+            void Read(const idx_t row, Document& document) const {
+                const auto idx = format_.sel->get_index(row);
+                if (!format_.validity.RowIsValid(idx)) {
+                    return;
+                }
+                idx_t offset, length;
+                if (type_id_ == LogicalTypeId::LIST) {
+                    const auto& entry = UnifiedVectorFormat::GetData<list_entry_t>(format_)[idx];
+                    offset = entry.offset;
+                    length = entry.length;
+                } else {
+                    offset = idx * array_size_;
+                    length = array_size_;
+                }
+                const auto* values = UnifiedVectorFormat::GetData<float>(child_format_);
+                auto* vector = document.mutable_vector();
+                vector->Reserve(static_cast<int>(length));
+                for (idx_t i = offset; i < offset + length; ++i) {
+                    const auto child_idx = child_format_.sel->get_index(i);
+                    assert_true(child_format_.validity.RowIsValid(child_idx), "vector column should not contain NULL element");
+                    vector->Add(values[child_idx]);
+                }
+            }
+        };
+
+        void ResolveProjection_(Connection& conn, std::vector<std::string>& column_names, std::vector<size_t>& column_positions) const {
+            // statement is only prepared to get column names from parquet schema
+            const auto prepared = conn.Prepare(fmt::format("select * from read_parquet('{}');", file_source_));
+            assert_prepared_ok(prepared, fmt::format("Failed to read schema of parquet file {}", file_source_));
+            const auto& all_names = prepared->GetNames();
+            std::unordered_map<int, size_t> positions;
+            for (const auto& mapping: column_mapping_) {
+                assert_true(mapping.column_index >= 0 && static_cast<size_t>(mapping.column_index) < all_names.size(), fmt::format("column index {} is out of range of parquet file with {} columns", mapping.column_index, all_names.size()));
+                if (!positions.contains(mapping.column_index)) {
+                    positions[mapping.column_index] = column_names.size();
+                    column_names.push_back(all_names[mapping.column_index]);
+                }
+                column_positions.push_back(positions[mapping.column_index]);
+            }
+        }
+
+        static void ConvertColumn_(const ParquetColumnMapping& mapping, const Value& value, Document& document) {
+            const auto& [column_type, metadata_field_schema, column_idx] = mapping;
+            if(column_type == kTextColumn) {
+                if (!value.IsNull()) {
+                    document.set_text(value.GetValue<std::string>());
+                }
+                return;
+            }
+            if (column_type == kMetadataColumn) {
+                auto* metadata_field = document.add_metadata();
+                metadata_field->set_name(metadata_field_schema.name());
+                // field is still added for NULL, so that stores can write NULL to its column instead of rejecting the document for a missing field
+                if (value.IsNull()) {
+                    metadata_field->set_is_null(true);
+                    return;
+                }
+                switch (metadata_field_schema.type()) {
+                    case INT32:
+                        metadata_field->set_int_value(value.GetValue<int32_t>());
+                        break;
+                    case INT64:
+                        metadata_field->set_long_value(value.GetValue<int64_t>());
+                        break;
+                    case FLOAT:
+                        metadata_field->set_float_value(value.GetValue<float>());
+                        break;
+                    case DOUBLE:
+                        metadata_field->set_double_value(value.GetValue<double>());
+                        break;
+                    case VARCHAR:
+                        metadata_field->set_string_value(value.GetValue<std::string>());
+                        break;
+                    case BOOL:
+                        metadata_field->set_bool_value(value.GetValue<bool>());
+                        break;
+                    default:
+                        throw InstinctException("unknown field type for field named " + metadata_field_schema.name());
+                }
+                return;
+            }
+            throw InstinctException(fmt::format("unknown column type at index {}, column name {}, given column type {}",
+                std::to_string(column_idx),
+                metadata_field_schema.name(),
+                metadata_field_schema.type()
+                ));
+        }
     };
 
     /**
-     * This ingestor will trigger a `SELECT *` against parquet file. A more delicate handling is needed for large parquet file.
+     * This ingestor streams rows of selected columns from parquet file, so that memory usage is bounded regardless of file size.
      */
     class NaiveParquetFileIngestor final: public BaseParquetFileIngestor {
         ParquetFileIngestorOptions options_;
@@ -126,12 +273,23 @@ namespace INSTINCT_RETRIEVAL_NS {
             : BaseParquetFileIngestor(file_source, column_mapping, document_post_processor, file_source_id), options_(options) {
         }
 
-        unique_ptr<MaterializedQueryResult> ReadParquet(Connection &conn, const std::string &file_source) override {
+        void Configure(DBConfig &config) override {
+            if (options_.threads > 0) {
+                config.options.maximum_threads = options_.threads;
+            }
+        }
+
+        unique_ptr<QueryResult> ReadParquet(Connection &conn, const std::string &file_source, const std::vector<std::string>& column_names) override {
+            std::vector<std::string> quoted_names;
+            for (const auto& name: column_names) {
+                quoted_names.push_back(KeywordHelper::WriteQuoted(name, '"'));
+            }
+            const auto projection = StringUtils::JoinWith(quoted_names, ",");
             const auto sql_line = options_.limit > 0 ?
-                fmt::format("select * from read_parquet('{}') limit {};", file_source, options_.limit):
-                fmt::format("select * from read_parquet('{}');", file_source);
+                fmt::format("select {} from read_parquet('{}') limit {};", projection, file_source, options_.limit):
+                fmt::format("select {} from read_parquet('{}');", projection, file_source);
             LOG_DEBUG("Query SQL: {}", sql_line);
-            return conn.Query(sql_line);
+            return conn.SendQuery(sql_line);
         }
     };
 
@@ -148,7 +306,7 @@ namespace INSTINCT_RETRIEVAL_NS {
     /**
      * 
      * @param file_source remote or local file source
-     * @param mapping_string string literals that describes column mappings. e.g. "0:t,1:m:parent_doc_id:int64,3:m:source:varchar"
+     * @param mapping_string string literals that describes column mappings. e.g. "0:t,1:m:parent_doc_id:int64,3:m:source:varchar,4:v"
      * @param document_post_processor
      * @param file_source_id
      * @param options
@@ -157,7 +315,7 @@ namespace INSTINCT_RETRIEVAL_NS {
     static IngestorPtr CreateParquetIngestor(const std::string& file_source, const std::string& mapping_string, const ParquetFileIngestorOptions& options = {}, const DocumentPostProcessor &document_post_processor = nullptr, const std::string& file_source_id = "") {
         std::vector<ParquetColumnMapping> mappings;
 
-        bool found_text;
+        bool found_text = false;
         for(const auto& column: StringUtils::ReSplit(StringUtils::Trim(mapping_string), std::regex(","))) {
             if(StringUtils::IsBlankString(column)) continue;
             ParquetColumnMapping column_mapping;
@@ -170,6 +328,9 @@ namespace INSTINCT_RETRIEVAL_NS {
                 found_text = true;
                 column_mapping.column_type = kTextColumn;
             }
+            if(type_string == "v" || type_string == "vector") {
+                column_mapping.column_type = kVectorColumn;
+            }
             if(type_string == "m" || type_string == "metadata") {
                 assert_gte(column_parts.size(), 4, "definition for metadata field should contain exactly four parts.");
                 MetadataFieldSchema field_schema;
@@ -74,7 +74,8 @@ namespace INSTINCT_RETRIEVAL_NS {
             const std::filesystem::path& folder,
             std::unique_ptr<RegexMatcher> regex_matcher = nullptr,
             IngestorFactoryFunction ingestor_factory_function = nullptr,
-            bool recursive = true
+            bool recursive = true,
+            const size_t max_parallelism = std::thread::hardware_concurrency()
         ) {
             if (!ingestor_factory_function) {
                 ingestor_factory_function = [](const std::filesystem::path& path) {return CreateIngestor({
@@ -85,7 +86,9 @@ namespace INSTINCT_RETRIEVAL_NS {
                 folder,
                 std::move(regex_matcher),
                 ingestor_factory_function,
-                recursive
+                recursive,
+                IO_WORKER_POOL,
+                max_parallelism
             );
         }
 
@@ -93,7 +96,8 @@ namespace INSTINCT_RETRIEVAL_NS {
             const std::filesystem::path& folder,
             const std::string& regex_string,
             const IngestorFactoryFunction& ingestor_factory_function = nullptr,
-            bool recursive = true
+            bool recursive = true,
+            const size_t max_parallelism = std::thread::hardware_concurrency()
         ) {
             assert_not_blank(regex_string);
             std::unique_ptr<RegexMatcher> matcher = nullptr;
@@ -104,7 +108,8 @@ namespace INSTINCT_RETRIEVAL_NS {
                 folder,
                 std::move(matcher),
                 ingestor_factory_function,
-                recursive);
+                recursive,
+                max_parallelism);
         }
 
     };
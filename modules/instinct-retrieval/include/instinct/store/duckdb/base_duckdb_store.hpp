@@ -23,6 +23,37 @@ namespace INSTINCT_RETRIEVAL_NS {
     using namespace INSTINCT_LLM_NS;
     using namespace INSTINCT_DATA_NS;
 
+    enum VectorIndexType {
+        kNoVectorIndex,
+        kHNSWVectorIndex
+    };
+
+    /**
+     * Parameters for HNSW index provided by DuckDB's `vss` extension.
+     * https://duckdb.org/docs/extensions/vss.html
+     */
+    struct HNSWIndexOptions {
+        /**
+         * Max count of neighbors for each node. Larger value gives better recall with more memory and slower build.
+         */
+        size_t m = 16;
+
+        /**
+         * Count of candidates considered during index building.
+         */
+        size_t ef_construction = 128;
+
+        /**
+         * Count of candidates considered during search. Larger value gives better recall with higher latency.
+         */
+        size_t ef_search = 64;
+
+        /**
+         * Index is kept in memory and rebuilt during startup by default. Set this to true to store index in file-backed database, which is still experimental in DuckDB.
+         */
+        bool enable_persistence = false;
+    };
+
     struct DuckDBStoreOptions {
         /**
          * Table for storing data
@@ -39,6 +70,11 @@ namespace INSTINCT_RETRIEVAL_NS {
          */
         size_t dimension = 0;
 
+        /**
+         * A flag to add a column of lexical weights keyed by token id. Embedding model should be an `IHybridEmbeddingModel`, so that lexical weights are computed along with vectors.
+         */
+        bool sparse_vector = false;
+
         /**
          * A flag to allow unknown metadata fields. Otherwise, exception will be raised.
          */
@@ -63,9 +99,32 @@ namespace INSTINCT_RETRIEVAL_NS {
          * Optional instance id
          */
         std::string instance_id;
+
+        /**
+         * Index for vector column. Brute-force scan over whole table is used by default.
+         */
+        VectorIndexType vector_index_type = kNoVectorIndex;
+
+        /**
+         * Options for HNSW index, which only take effect if `vector_index_type` is `kHNSWVectorIndex`
+         */
+        HNSWIndexOptions hnsw_options = {};
     };
 
     namespace details {
+        /**
+         * Columns of id, text and metadata fields, which are read by `observe_query_result`. Vector columns are omitted to reduce payload size.
+         */
+        static std::string make_document_column_list(const std::shared_ptr<MetadataSchema>& metadata_schema) {
+            std::string column_list = "id, text";
+            auto name_view = metadata_schema->fields() | std::views::transform(
+                                 [](const MetadataFieldSchema& field)-> std::string {
+                                     return field.name();
+                                 });
+            column_list += name_view.empty() ? "" : ", " + StringUtils::JoinWith(name_view, ", ");
+            return column_list;
+        }
+
         static std::string make_mget_sql(
             const std::string& table_name,
             const std::shared_ptr<MetadataSchema>& metadata_schema,
@@ -100,7 +159,8 @@ namespace INSTINCT_RETRIEVAL_NS {
             const std::string& table_name,
             const size_t dimension,
             const std::shared_ptr<MetadataSchema>& metadata_schema,
-            bool create_or_replace_table = false
+            bool create_or_replace_table = false,
+            bool sparse_vector = false
         ) {
             auto create_table_sql = (create_or_replace_table ? "CREATE OR REPLACE TABLE " :  "CREATE TABLE IF NOT EXISTS ") + table_name + "(";
             std::vector<std::string> parts;
@@ -136,6 +196,10 @@ namespace INSTINCT_RETRIEVAL_NS {
                 }
                 parts.push_back(mfd);
             }
+            // placed after metadata fields, so that positions of metadata columns are kept for readers of `SELECT *`
+            if (sparse_vector) {
+                parts.emplace_back("sparse_vector MAP(INTEGER, FLOAT)");
+            }
             create_table_sql += StringUtils::JoinWith(parts, ", ");
             create_table_sql += ");";
             return create_table_sql;
@@ -232,14 +296,21 @@ namespace INSTINCT_RETRIEVAL_NS {
             appender.Append<>(doc.text().c_str());
         }
 
-        static void append_row_metadata_fields(
+        /**
+         * Validate metadata of document against schema and arrange values in the order of fields in schema.
+         * @param metadata_schema
+         * @param doc
+         * @param bypass_unknown_fields
+         * @return pointers to values in `doc`, or nullptr for null values
+         */
+        static std::vector<const PrimitiveValue*> resolve_metadata_values(
             const std::shared_ptr<MetadataSchema>& metadata_schema,
-            Appender& appender,
             const Document& doc,
             const bool bypass_unknown_fields
         ) {
+            std::vector<const PrimitiveValue*> values;
             if (!metadata_schema || metadata_schema == EMPTY_METADATA_SCHEMA || metadata_schema->fields_size() == 0) {
-                return;
+                return values;
             }
 
             // handle rows defined in metadata_schema
@@ -250,7 +321,6 @@ namespace INSTINCT_RETRIEVAL_NS {
             std::unordered_set<std::string> known_field_names{name_view.begin(), name_view.end()};
 
             const int metadata_size = doc.metadata_size();
-            auto defined_field_schema_map = DocumentUtils::ConvertToMetadataSchemaMap(metadata_schema);
             std::unordered_map<std::string, int> metadata_field_name_index_map;
 
             for (int i = 0; i < metadata_size; i++) {
@@ -266,30 +336,42 @@ namespace INSTINCT_RETRIEVAL_NS {
             assert_true(known_field_names.empty(),
                         "Some metadata fields not set: " + StringUtils::JoinWith(known_field_names, ","));
 
-
-            // append columns according to the order in metadata schema, or DuckDB will complain with SQL errors.
+            // values should be in the order of metadata schema, or DuckDB will complain with SQL errors.
+            values.reserve(metadata_schema->fields_size());
             for (const auto& metadata_field_schema: metadata_schema->fields()) {
-                const int i = metadata_field_name_index_map[metadata_field_schema.name()];
-                if (const auto& value = doc.metadata(i); value.is_null()) {
+                const auto& value = doc.metadata(metadata_field_name_index_map[metadata_field_schema.name()]);
+                values.push_back(value.is_null() ? nullptr : &value);
+            }
+            return values;
+        }
+
+        static void append_row_metadata_fields(
+            const std::shared_ptr<MetadataSchema>& metadata_schema,
+            Appender& appender,
+            const Document& doc,
+            const bool bypass_unknown_fields
+        ) {
+            for (const auto* value: resolve_metadata_values(metadata_schema, doc, bypass_unknown_fields)) {
+                if (!value) {
                     appender.Append(nullptr);
                 } else {
-                    if (value.has_bool_value()) {
-                        appender.Append<bool>(value.bool_value());
+                    if (value->has_bool_value()) {
+                        appender.Append<bool>(value->bool_value());
                     }
-                    if (value.has_double_value()) {
-                        appender.Append<double>(value.double_value());
+                    if (value->has_double_value()) {
+                        appender.Append<double>(value->double_value());
                     }
-                    if (value.has_float_value()) {
-                        appender.Append<float>(value.float_value());
+                    if (value->has_float_value()) {
+                        appender.Append<float>(value->float_value());
                     }
-                    if (value.has_int_value()) {
-                        appender.Append<int32_t>(value.int_value());
+                    if (value->has_int_value()) {
+                        appender.Append<int32_t>(value->int_value());
                     }
-                    if (value.has_long_value()) {
-                        appender.Append<int64_t>(value.long_value());
+                    if (value->has_long_value()) {
+                        appender.Append<int64_t>(value->long_value());
                     }
-                    if (value.has_string_value()) {
-                        appender.Append(value.string_value().c_str());
+                    if (value->has_string_value()) {
+                        appender.Append(value->string_value().c_str());
                     }
                 }
             }
@@ -317,9 +399,10 @@ namespace INSTINCT_RETRIEVAL_NS {
         {
             assert_true(metadata_schema, "should provide schema");
             assert_lt(options_.dimension, 10000, "dimension should be less than 10000");
+            assert_true(!options_.sparse_vector || options_.dimension > 0, "sparse_vector column requires vector column");
             assert_true(!StringUtils::IsBlankString(options_.table_name), "table_name cannot be blank");
 
-            const auto sql = details::make_create_table_sql(options_.table_name, options_.dimension, metadata_schema_, options_.create_or_replace_table);
+            const auto sql = details::make_create_table_sql(options_.table_name, options_.dimension, metadata_schema_, options_.create_or_replace_table, options_.sparse_vector);
             LOG_DEBUG("create document table with SQL if necessary: {}", sql);
             if (!options_.bypass_table_check) {
                 const auto create_table_result = connection_.Query(sql);
@@ -355,7 +438,7 @@ namespace INSTINCT_RETRIEVAL_NS {
         }
 
         AsyncIterator<Document> FindDocuments(const FindRequest &find_request) override {
-            const auto sql = SQLBuilder::ToSelectString(options_.table_name, "*", find_request.query(), find_request.sorters());
+            const auto sql = SQLBuilder::ToSelectString(options_.table_name, details::make_document_column_list(metadata_schema_), find_request.query(), find_request.sorters());
             LOG_DEBUG("FindDocuments with sql: {}", sql);
             auto result = GetConnection().Query(sql);
             assert_query_ok(result);
@@ -5,20 +5,57 @@
 #ifndef BASEDUCKDBVECTORSTORE_HPP
 #define BASEDUCKDBVECTORSTORE_HPP
 
+#include <cmath>
+#include <cstring>
 #include <instinct/store/duckdb/base_duckdb_store.hpp>
 #include <instinct/retrieval_global.hpp>
 #include <instinct/model/embedding_model.hpp>
+#include <instinct/store/vector_store.hpp>
 
 namespace INSTINCT_RETRIEVAL_NS {
     using namespace INSTINCT_LLM_NS;
 
     namespace details {
 
+        /**
+         * Scale vector to unit length in place, so that squared L2 distance between two vectors is `2 - 2 * cosine_similarity`. Zero vector is left as is.
+         */
+        static void normalize_embedding(Embedding& embedding) {
+            double norm = 0;
+            for (const float v: embedding) {
+                norm += (double) v * v;
+            }
+            if (norm > 0) {
+                const auto scale = (float) (1.0 / std::sqrt(norm));
+                for (float& v: embedding) {
+                    v *= scale;
+                }
+            }
+        }
+
+        /**
+         * Value of `sparse_vector` column, which is a map from token id to weight
+         */
+        static duckdb::Value make_sparse_vector_value(const SparseEmbedding& sparse_embedding) {
+            vector<duckdb::Value> keys, values;
+            keys.reserve(sparse_embedding.size());
+            values.reserve(sparse_embedding.size());
+            for (const auto& [token_id, weight]: sparse_embedding) {
+                keys.push_back(duckdb::Value::INTEGER(token_id));
+                values.push_back(duckdb::Value::FLOAT(weight));
+            }
+            return duckdb::Value::MAP(LogicalType::INTEGER, LogicalType::FLOAT, std::move(keys), std::move(values));
+        }
+
+        /**
+         * @param sparse_embedding lexical weights if table has `sparse_vector` column, or nullptr otherwise
+         */
         static void append_row(
                 const std::shared_ptr<MetadataSchema>& metadata_schema,
                 Appender& appender,
                 Document& doc,
                 const Embedding& embedding,
+                const SparseEmbedding* sparse_embedding,
                 UpdateResult& update_result,
                 const bool bypass_unknown_fields
         ) {
@@ -37,8 +74,191 @@ namespace INSTINCT_RETRIEVAL_NS {
             // metadata fields
             append_row_metadata_fields(metadata_schema, appender, doc, bypass_unknown_fields);
 
+            // column of lexical weights
+            if (sparse_embedding) {
+                appender.Append(make_sparse_vector_value(*sparse_embedding));
+            }
+
             appender.EndRow();
         }
+
+        /**
+         * Column types of table created by `make_create_table_sql`
+         */
+        static vector<LogicalType> make_column_types(const size_t dimension, const std::shared_ptr<MetadataSchema>& metadata_schema, const bool sparse_vector = false) {
+            vector<LogicalType> types {LogicalType::UUID, LogicalType::VARCHAR, LogicalType::ARRAY(LogicalType::FLOAT, dimension)};
+            for (const auto& field: metadata_schema->fields()) {
+                switch (field.type()) {
+                    case INT32:
+                        types.emplace_back(LogicalType::INTEGER);
+                        break;
+                    case INT64:
+                        types.emplace_back(LogicalType::BIGINT);
+                        break;
+                    case FLOAT:
+                        types.emplace_back(LogicalType::FLOAT);
+                        break;
+                    case DOUBLE:
+                        types.emplace_back(LogicalType::DOUBLE);
+                        break;
+                    case VARCHAR:
+                        types.emplace_back(LogicalType::VARCHAR);
+                        break;
+                    case BOOL:
+                        types.emplace_back(LogicalType::BOOLEAN);
+                        break;
+                    default:
+                        throw InstinctException("unknown field type :" + std::string(field.name()));
+                }
+            }
+            if (sparse_vector) {
+                types.emplace_back(LogicalType::MAP(LogicalType::INTEGER, LogicalType::FLOAT));
+            }
+            return types;
+        }
+
+        /**
+         * Write a metadata value into column vector. Values of exactly the same type are written in place, and others are casted by DuckDB.
+         */
+        static void set_metadata_value(Vector& column, const idx_t row, const PrimitiveValue* value) {
+            if (!value) {
+                FlatVector::SetNull(column, row, true);
+                return;
+            }
+            switch (column.GetType().id()) {
+                case LogicalTypeId::INTEGER:
+                    if (value->has_int_value()) {
+                        FlatVector::GetData<int32_t>(column)[row] = value->int_value();
+                        return;
+                    }
+                    break;
+                case LogicalTypeId::BIGINT:
+                    if (value->has_long_value()) {
+                        FlatVector::GetData<int64_t>(column)[row] = value->long_value();
+                        return;
+                    }
+                    break;
+                case LogicalTypeId::FLOAT:
+                    if (value->has_float_value()) {
+                        FlatVector::GetData<float>(column)[row] = value->float_value();
+                        return;
+                    }
+                    break;
+                case LogicalTypeId::DOUBLE:
+                    if (value->has_double_value()) {
+                        FlatVector::GetData<double>(column)[row] = value->double_value();
+                        return;
+                    }
+                    break;
+                case LogicalTypeId::BOOLEAN:
+                    if (value->has_bool_value()) {
+                        FlatVector::GetData<bool>(column)[row] = value->bool_value();
+                        return;
+                    }
+                    break;
+                case LogicalTypeId::VARCHAR:
+                    if (value->has_string_value()) {
+                        FlatVector::GetData<string_t>(column)[row] = StringVector::AddString(column, value->string_value());
+                        return;
+                    }
+                    break;
+                default:
+                    break;
+            }
+
+            // slow path for mismatched types
+            duckdb::Value boxed;
+            if (value->has_int_value()) {
+                boxed = duckdb::Value::INTEGER(value->int_value());
+            } else if (value->has_long_value()) {
+                boxed = duckdb::Value::BIGINT(value->long_value());
+            } else if (value->has_float_value()) {
+                boxed = duckdb::Value::FLOAT(value->float_value());
+            } else if (value->has_double_value()) {
+                boxed = duckdb::Value::DOUBLE(value->double_value());
+            } else if (value->has_bool_value()) {
+                boxed = duckdb::Value::BOOLEAN(value->bool_value());
+            } else if (value->has_string_value()) {
+                boxed = duckdb::Value(value->string_value());
+            }
+            column.SetValue(row, boxed.DefaultCastAs(column.GetType()));
+        }
+
+        /**
+         * Append rows in batches of `DataChunk`, so that embeddings are copied into array vectors directly without boxing each float in `Value`.
+         * Invalid documents are reported in `update_result` and skipped.
+         * @param sparse_embeddings lexical weights for each record if table has `sparse_vector` column, or nullptr otherwise
+         * @return count of appended rows
+         */
+        static int append_rows_with_chunks(
+            const std::shared_ptr<MetadataSchema>& metadata_schema,
+            Appender& appender,
+            std::vector<Document>& records,
+            const std::vector<Embedding>& embeddings,
+            const std::vector<SparseEmbedding>* sparse_embeddings,
+            const size_t dimension,
+            UpdateResult& update_result,
+            const bool bypass_unknown_fields
+        ) {
+            DataChunk chunk;
+            chunk.Initialize(Allocator::DefaultAllocator(), make_column_types(dimension, metadata_schema, sparse_embeddings != nullptr));
+            idx_t row = 0;
+            int affected_row = 0;
+
+            auto flush = [&]() {
+                if (row == 0) return;
+                chunk.SetCardinality(row);
+                appender.AppendDataChunk(chunk);
+                chunk.Reset();
+                row = 0;
+            };
+
+            for (size_t i = 0; i < records.size(); ++i) {
+                auto& doc = records[i];
+                const auto& embedding = embeddings[i];
+                std::vector<const PrimitiveValue*> metadata_values;
+                try {
+                    assert_true(embedding.size() == dimension, "Embedding should have dimension of " + std::to_string(dimension));
+                    metadata_values = resolve_metadata_values(metadata_schema, doc, bypass_unknown_fields);
+                } catch (const InstinctException& e) {
+                    update_result.add_failed_documents()->CopyFrom(doc);
+                    LOG_WARN("AppendRows error: {}", e.what());
+                    continue;
+                }
+
+                // column of id
+                const std::string new_id = StringUtils::GenerateUUIDString();
+                hugeint_t uuid;
+                UUID::FromString(new_id, uuid);
+                FlatVector::GetData<hugeint_t>(chunk.data[0])[row] = uuid;
+                update_result.add_returned_ids(new_id);
+                doc.set_id(new_id);
+
+                // column of text
+                FlatVector::GetData<string_t>(chunk.data[1])[row] = StringVector::AddString(chunk.data[1], doc.text());
+
+                // column of vector, whose child vector holds `dimension` floats for each row
+                auto& vector_child = ArrayVector::GetEntry(chunk.data[2]);
+                std::memcpy(FlatVector::GetData<float>(vector_child) + row * dimension, embedding.data(), dimension * sizeof(float));
+
+                // metadata columns
+                for (size_t j = 0; j < metadata_values.size(); ++j) {
+                    set_metadata_value(chunk.data[3 + j], row, metadata_values[j]);
+                }
+
+                // column of lexical weights, whose values are boxed as map is a nested type
+                if (sparse_embeddings) {
+                    chunk.data[3 + metadata_values.size()].SetValue(row, make_sparse_vector_value(sparse_embeddings->at(i)));
+                }
+
+                ++affected_row;
+                if (++row == STANDARD_VECTOR_SIZE) {
+                    flush();
+                }
+            }
+            flush();
+            return affected_row;
+        }
     }
 
 
@@ -47,6 +267,8 @@ namespace INSTINCT_RETRIEVAL_NS {
      */
     class DuckDBDocWithEmbeddingStore final: public BaseDuckDBStore {
         EmbeddingsPtr embeddings_;
+        // same model as `embeddings_`, which is set only if `sparse_vector` column is enabled
+        HybridEmbeddingsPtr hybrid_embeddings_;
     public:
         DuckDBDocWithEmbeddingStore(
             const DuckDBPtr& db,
@@ -55,34 +277,68 @@ namespace INSTINCT_RETRIEVAL_NS {
             const DuckDBStoreOptions &options
             )
             : BaseDuckDBStore(db, metadata_schema, options), embeddings_(embedding_model) {
+            if (options.sparse_vector) {
+                hybrid_embeddings_ = std::dynamic_pointer_cast<IHybridEmbeddingModel>(embedding_model);
+                assert_true(hybrid_embeddings_ && hybrid_embeddings_->SupportsHybridEmbedding(), "Embedding model should support hybrid embedding to fill sparse_vector column");
+            }
         }
 
         [[nodiscard]] EmbeddingsPtr GetEmbedding() const {
             return embeddings_;
         }
 
+        [[nodiscard]] HybridEmbeddingsPtr GetHybridEmbedding() const {
+            return hybrid_embeddings_;
+        }
+
         void AppendRows(Appender &appender, std::vector<Document> &records, UpdateResult &update_result) override {
-            auto text_view = records | std::views::transform([](auto&& record) -> std::string {
-                return record.text();
-            });
-            auto embeddings = embeddings_->EmbedDocuments({text_view.begin(), text_view.end()});
-            assert_equal_size(embeddings, records, "Count of result embeddings is not equal to that of records");
-            int affected_row = 0;
-            for (int i=0;i<records.size();i++) {
-                try {
-                    details::append_row(GetMetadataSchema(), appender, records[i], embeddings[i], update_result, GetOptions().bypass_unknown_fields);
-                    affected_row++;
-                } catch (const InstinctException& e) {
-                    update_result.add_failed_documents()->CopyFrom(records[i]);
-                    LOG_WARN("AppendRows error: {}", e.what());
-                }
+            // documents with precomputed vectors are not embedded again
+            std::vector<Embedding> embeddings;
+            std::vector<SparseEmbedding> sparse_embeddings;
+            if (hybrid_embeddings_) {
+                ResolveDocumentHybridEmbeddings(hybrid_embeddings_, records, GetOptions().dimension, embeddings, sparse_embeddings);
+            } else {
+                embeddings = ResolveDocumentEmbeddings(embeddings_, records, GetOptions().dimension);
             }
+            NormalizeEmbeddings_(embeddings);
+            const int affected_row = details::append_rows_with_chunks(
+                GetMetadataSchema(),
+                appender,
+                records,
+                embeddings,
+                hybrid_embeddings_ ? &sparse_embeddings : nullptr,
+                GetOptions().dimension,
+                update_result,
+                GetOptions().bypass_unknown_fields
+            );
             update_result.set_affected_rows(affected_row);
         }
 
         void AppendRow(Appender &appender, Document &doc, UpdateResult &update_result) override {
-            const auto embeddings = embeddings_->EmbedDocuments({doc.text()});
-            details::append_row(GetMetadataSchema(), appender, doc, embeddings[0], update_result, GetOptions().bypass_unknown_fields);
+            if (hybrid_embeddings_) {
+                std::vector<Embedding> embeddings;
+                std::vector<SparseEmbedding> sparse_embeddings;
+                ResolveDocumentHybridEmbeddings(hybrid_embeddings_, {doc}, GetOptions().dimension, embeddings, sparse_embeddings);
+                NormalizeEmbeddings_(embeddings);
+                details::append_row(GetMetadataSchema(), appender, doc, embeddings[0], &sparse_embeddings[0], update_result, GetOptions().bypass_unknown_fields);
+                return;
+            }
+            auto embeddings = ResolveDocumentEmbeddings(embeddings_, {doc}, GetOptions().dimension);
+            NormalizeEmbeddings_(embeddings);
+            details::append_row(GetMetadataSchema(), appender, doc, embeddings[0], nullptr, update_result, GetOptions().bypass_unknown_fields);
+        }
+
+    private:
+        /**
+         * HNSW index is built with L2 metric, which ranks rows the same as cosine similarity only if vectors are normalized. Cosine similarity of brute-force search is not affected by it.
+         */
+        void NormalizeEmbeddings_(std::vector<Embedding>& embeddings) const {
+            if (GetOptions().vector_index_type != kHNSWVectorIndex) {
+                return;
+            }
+            for (auto& embedding: embeddings) {
+                details::normalize_embedding(embedding);
+            }
         }
     };
 }
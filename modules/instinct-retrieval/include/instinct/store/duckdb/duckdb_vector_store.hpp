@@ -5,7 +5,11 @@
 #ifndef DUCKDBVECTORSTORE_HPP
 #define DUCKDBVECTORSTORE_HPP
 
+#include <list>
+#include <mutex>
+#include <shared_mutex>
 #include <duckdb.hpp>
+#include <fmt/ranges.h>
 #include <instinct/retrieval.pb.h>
 
 #include <instinct/store/duckdb/base_duckdb_store.hpp>
@@ -26,15 +30,18 @@ namespace INSTINCT_RETRIEVAL_NS {
     namespace details {
 
         /**
-         * make sql text for prepared statement, ignoring metadata filter
+         * make sql text for prepared statement. Parameters are query vector, values in predicate if any, and limit.
          * @param table_name
          * @param metadata_schema
+         * @param dimension dimension of vector column
+         * @param predicate optional parameterized predicate generated by `SQLBuilder::ToParameterizedPredicate`
          * @return
          */
         static std::string make_prepared_search_sql(
             const std::string& table_name,
-            const std::shared_ptr<MetadataSchema>& metadata_schema
-
+            const std::shared_ptr<MetadataSchema>& metadata_schema,
+            const size_t dimension,
+            const std::string& predicate = ""
             ) {
             std::string select_sql = "SELECT id, text";
             auto name_view = metadata_schema->fields() | std::views::transform(
@@ -42,57 +49,149 @@ namespace INSTINCT_RETRIEVAL_NS {
                                      return field.name();
                                  });
             select_sql += name_view.empty() ? ""  : ", " + StringUtils::JoinWith(name_view, ", ");
-            select_sql += ", array_cosine_similarity(vector, ?) AS similarity FROM ";
+            // parameter is cast to fixed-size array, which is the type of vector column
+            select_sql += ", array_cosine_similarity(vector, ?::FLOAT[" + std::to_string(dimension) + "]) AS similarity FROM ";
             select_sql += table_name;
+            if (!predicate.empty()) {
+                select_sql += " WHERE ";
+                select_sql += predicate;
+            }
             select_sql += " ORDER BY similarity DESC LIMIT ?";
             return select_sql;
         }
 
-
-        static std::string make_search_sql(
+        /**
+         * make sql text for search with HNSW index. Optimizer of vss extension only replaces an ascending top-n over `array_distance` between vector column and a constant array with HNSW index scan, so query vector and limit are inlined into sql text. Distance is converted back to cosine similarity, which holds as both stored vectors and query vector are normalized.
+         * @param table_name
+         * @param metadata_schema
+         * @param query_vector normalized query vector, whose values are written in shortest form that round-trips
+         * @param limit
+         * @return
+         */
+        static std::string make_hnsw_search_sql(
             const std::string& table_name,
             const std::shared_ptr<MetadataSchema>& metadata_schema,
             const std::vector<float>& query_vector,
-            const SearchQuery& metadata_filter,
-            const int limit = 10
-        ) {
+            const int limit
+            ) {
             assert_gt(limit, 0, "limit should be positive");
-            assert_lt(limit, 1000, "limit should be less than 1000");
-
-            // omit vector field to reduce payload size
-            std::string column_list = "id, text";
+            std::string column_sql = "id, text";
             auto name_view = metadata_schema->fields() | std::views::transform(
                                  [](const MetadataFieldSchema& field)-> std::string {
                                      return field.name();
                                  });
-            column_list += name_view.empty() ? ""  : ", " + StringUtils::JoinWith(name_view, ", ");
-            column_list += ", array_cosine_similarity(vector, array_value(";
+            column_sql += name_view.empty() ? ""  : ", " + StringUtils::JoinWith(name_view, ", ");
+            return fmt::format(
+                "SELECT {}, 1 - distance * distance / 2 AS similarity FROM (SELECT {}, array_distance(vector, [{}]::FLOAT[{}]) AS distance FROM {} ORDER BY distance LIMIT {}) ORDER BY distance",
+                column_sql,
+                column_sql,
+                fmt::join(query_vector, ", "),
+                query_vector.size(),
+                table_name,
+                limit
+            );
+        }
+
+        static duckdb::Value to_duckdb_value(const PrimitiveValue& value) {
+            switch (value.kind_case()) {
+                case PrimitiveValue::kIntValue:
+                    return duckdb::Value::INTEGER(value.int_value());
+                case PrimitiveValue::kLongValue:
+                    return duckdb::Value::BIGINT(value.long_value());
+                case PrimitiveValue::kFloatValue:
+                    return duckdb::Value::FLOAT(value.float_value());
+                case PrimitiveValue::kDoubleValue:
+                    return duckdb::Value::DOUBLE(value.double_value());
+                case PrimitiveValue::kBoolValue:
+                    return duckdb::Value::BOOLEAN(value.bool_value());
+                case PrimitiveValue::kStringValue:
+                    return {value.string_value()};
+                default:
+                    throw InstinctException("unsupported value type in metadata filter");
+            }
+        }
 
-            for (int i = 0; i < query_vector.size(); i++) {
-                column_list += std::to_string(query_vector.at(i)) + "::FLOAT";
-                if (i < query_vector.size() - 1) {
-                    column_list += ",";
+        /**
+         * Make sql to rank rows by lexical matching score, which is sum of products of weights of tokens shared by query and row. Parameters are token id and weight for each term of query, values in predicate, and limit, in that order.
+         * @param table_name
+         * @param metadata_schema
+         * @param term_count count of terms in lexical weights of query
+         * @param predicate optional parameterized predicate generated by `SQLBuilder::ToParameterizedPredicate`
+         * @return
+         */
+        static std::string make_prepared_lexical_search_sql(
+            const std::string& table_name,
+            const std::shared_ptr<MetadataSchema>& metadata_schema,
+            const size_t term_count,
+            const std::string& predicate = ""
+        ) {
+            assert_gt(term_count, 0, "lexical weights of query should not be empty");
+            std::string select_sql = "SELECT id, text";
+            auto name_view = metadata_schema->fields() | std::views::transform(
+                                 [](const MetadataFieldSchema& field)-> std::string {
+                                     return field.name();
+                                 });
+            select_sql += name_view.empty() ? ""  : ", " + StringUtils::JoinWith(name_view, ", ");
+            select_sql += ", (";
+            for (size_t i = 0; i < term_count; i++) {
+                // map_extract gives a list of matched values, which is empty for absent token
+                select_sql += "coalesce(map_extract(sparse_vector, ?::INTEGER)[1], 0) * ?::FLOAT";
+                if (i < term_count - 1) {
+                    select_sql += " + ";
                 }
             }
-            column_list += ")) AS similarity";
+            select_sql += ") AS similarity FROM ";
+            select_sql += table_name;
+            if (!predicate.empty()) {
+                select_sql += " WHERE ";
+                select_sql += predicate;
+            }
+            select_sql += " ORDER BY similarity DESC LIMIT ?";
+            return select_sql;
+        }
+
+        static std::string make_vector_index_name(const std::string& table_name) {
+            return table_name + "_vector_hnsw_idx";
+        }
+
+        static std::string make_create_hnsw_index_sql(const std::string& table_name, const HNSWIndexOptions& hnsw_options) {
+            return fmt::format(
+                "CREATE INDEX IF NOT EXISTS {} ON {} USING HNSW (vector) WITH (metric = 'l2sq', M = {}, ef_construction = {}, ef_search = {});",
+                make_vector_index_name(table_name),
+                table_name,
+                hnsw_options.m,
+                hnsw_options.ef_construction,
+                hnsw_options.ef_search
+            );
+        }
 
-            Sorter sorter;
-            auto* field_sort = sorter.mutable_field();
-            field_sort->set_field_name("similarity");
-            field_sort->set_order(DESC);
-            return SQLBuilder::ToSelectString(table_name, column_list, metadata_filter, std::vector {sorter}, -1, limit);
+        static std::string make_drop_hnsw_index_sql(const std::string& table_name) {
+            return fmt::format("DROP INDEX IF EXISTS {};", make_vector_index_name(table_name));
         }
 
     }
 
 
     /**
-     * IVectorStore implementation using brute-force cosine similarly executed by DuckDB instance
+     * IVectorStore implementation using cosine similarly executed by DuckDB instance. Brute-force scan is used unless HNSW index is enabled in `DuckDBStoreOptions`.
+     *
+     * With HNSW index, searches without metadata filter are approximate. Searches with metadata filter still scan whole table with prepared statements, as filtering candidates given by index may return fewer rows than `top_k`. Statement of HNSW search is prepared for each query, as query vector has to be inlined into sql text.
      */
     class DuckDBVectorStore final: public virtual IVectorStore {
+        /**
+         * Max count of prepared statements for filtered search, one for each distinct shape of metadata filter
+         */
+        static constexpr size_t MAX_FILTERED_STATEMENTS = 64;
+
         DuckDBDocWithEmbeddingStore store_;
         unique_ptr<PreparedStatement> prepared_search_statement_;
         EmbeddingsPtr embeddings_;
+        // LRU cache of prepared statements keyed by predicate text
+        std::list<std::pair<std::string, unique_ptr<PreparedStatement>>> filtered_statements_;
+        std::unordered_map<std::string, decltype(filtered_statements_)::iterator> filtered_statement_index_;
+        std::mutex filtered_statements_mutex_;
+        // searches with HNSW index share this lock, except the ones overriding `hnsw_ef_search`, which is a setting of the shared connection
+        std::shared_mutex hnsw_search_mutex_;
     public:
         DuckDBVectorStore() = delete;
 
@@ -109,7 +208,11 @@ namespace INSTINCT_RETRIEVAL_NS {
             assert_true(embeddings_->GetDimension() == options.dimension, "should have dimension set correctly");
             assert_true(metadata_schema, "should have provide valid metadata schema");
 
-            auto search_sql = details::make_prepared_search_sql(options.table_name, metadata_schema);
+            if (options.vector_index_type == kHNSWVectorIndex) {
+                InitVectorIndex();
+            }
+
+            auto search_sql = details::make_prepared_search_sql(options.table_name, metadata_schema, options.dimension);
             LOG_DEBUG("prepare search sql: {}", search_sql);
             prepared_search_statement_ =  store_.GetConnection().Prepare(search_sql);
             assert_prepared_ok(prepared_search_statement_, "Failed to prepare search statement");
@@ -124,6 +227,22 @@ namespace INSTINCT_RETRIEVAL_NS {
             return store_.GetOptions();
         }
 
+        /**
+         * Drop and build HNSW index again. HNSW index is updated incrementally on insertion, but deleted rows are only marked, so index should be rebuilt after massive deletion.
+         */
+        void RebuildVectorIndex() {
+            assert_true(GetOptions().vector_index_type == kHNSWVectorIndex, "HNSW index is not enabled");
+            trace_span span {"RebuildVectorIndex"};
+            DropVectorIndex();
+            const auto result = store_.GetConnection().Query(details::make_create_hnsw_index_sql(GetOptions().table_name, GetOptions().hnsw_options));
+            assert_query_ok(result);
+        }
+
+        void DropVectorIndex() {
+            const auto result = store_.GetConnection().Query(details::make_drop_hnsw_index_sql(GetOptions().table_name));
+            assert_query_ok(result);
+        }
+
         AsyncIterator<Document> FindDocuments(const FindRequest &find_request) override {
             return store_.FindDocuments(find_request);
         }
@@ -133,29 +252,22 @@ namespace INSTINCT_RETRIEVAL_NS {
         }
 
         AsyncIterator<Document> SearchDocuments(const SearchRequest& request) override {
+            return SearchDocuments(request, 0);
+        }
+
+        /**
+         * Search documents with `ef_search` of HNSW index overridden for this query
+         * @param request
+         * @param ef_search count of candidates considered during search, or zero to use the one given at index creation. It's ignored if HNSW index is not enabled or metadata filter is given. Searches with non-zero `ef_search` are serialized.
+         * @return
+         */
+        AsyncIterator<Document> SearchDocuments(const SearchRequest& request, const size_t ef_search) {
             // limit should be in range of [1,10000]
             const int limit = request.top_k() > 0 ? std::min(request.top_k(), 10000) : 10;
             LOG_DEBUG("Search started: request.query={}, request.top_k={}, normalized_limit={}", request.query(), request.top_k(), limit);
             long t1 = ChronoUtils::GetCurrentTimeMillis();
             const auto query_embedding = embeddings_->EmbedQuery(request.query());
-            unique_ptr<QueryResult> result;
-            if (request.has_metadata_filter()) {
-                const auto search_sql = details::make_search_sql(
-                store_.GetOptions().table_name,
-                GetMetadataSchema(),
-                query_embedding,
-                request.metadata_filter(),
-                limit);
-                LOG_DEBUG("search_sql: {}", search_sql);
-                result = store_.GetConnection().Query(search_sql);
-            } else {
-                // use prepared statement for better performance when no filter is actually given
-                vector<duckdb::Value> vector_array;
-                for(const float& f: query_embedding) {
-                    vector_array.push_back(duckdb::Value::FLOAT(f));
-                }
-                result = prepared_search_statement_->Execute(duckdb::Value::ARRAY(LogicalType::FLOAT, vector_array), limit);
-            }
+            auto result = ExecuteSearch_(request, query_embedding, limit, ef_search, false);
             assert_query_ok(result);
             return details::conv_query_result_to_iterator(
                     std::move(result),
@@ -165,6 +277,60 @@ namespace INSTINCT_RETRIEVAL_NS {
             });
         }
 
+        /**
+         * Explain physical plan of the query that `SearchDocuments` would execute, e.g. to check if `HNSW_INDEX_SCAN` is chosen.
+         */
+        std::string ExplainSearchDocuments(const SearchRequest& request) {
+            const int limit = request.top_k() > 0 ? std::min(request.top_k(), 10000) : 10;
+            const auto query_embedding = embeddings_->EmbedQuery(request.query());
+            const auto result = ExecuteSearch_(request, query_embedding, limit, 0, true);
+            assert_query_ok(result);
+            auto& materialized = result->Cast<MaterializedQueryResult>();
+            std::string plan;
+            for (idx_t i = 0; i < materialized.RowCount(); ++i) {
+                plan += materialized.GetValue(1, i).ToString();
+            }
+            return plan;
+        }
+
+        /**
+         * Search documents by lexical matching score against lexical weights of query, which are computed by the same hybrid embedding model. `sparse_vector` column should be enabled in `DuckDBStoreOptions`.
+         */
+        AsyncIterator<Document> SearchDocumentsByLexicalWeights(const SearchRequest& request) {
+            const auto hybrid_embeddings = store_.GetHybridEmbedding();
+            assert_true(hybrid_embeddings, "sparse_vector column is not enabled");
+            const int limit = request.top_k() > 0 ? std::min(request.top_k(), 10000) : 10;
+            long t1 = ChronoUtils::GetCurrentTimeMillis();
+            const auto query_weights = hybrid_embeddings->EmbedQueryHybrid(request.query()).sparse;
+            if (query_weights.empty()) {
+                return rpp::source::empty<Document>();
+            }
+            std::vector<PrimitiveValue> filter_params;
+            const auto predicate = request.has_metadata_filter() ? SQLBuilder::ToParameterizedPredicate(request.metadata_filter(), filter_params) : "";
+            const auto sql = details::make_prepared_lexical_search_sql(GetOptions().table_name, GetMetadataSchema(), query_weights.size(), predicate);
+            LOG_DEBUG("SearchDocumentsByLexicalWeights with sql: {}", sql);
+            vector<duckdb::Value> values;
+            values.reserve(query_weights.size() * 2 + filter_params.size() + 1);
+            for (const auto& [token_id, weight]: query_weights) {
+                values.push_back(duckdb::Value::INTEGER(token_id));
+                values.push_back(duckdb::Value::FLOAT(weight));
+            }
+            for (const auto& param: filter_params) {
+                values.push_back(details::to_duckdb_value(param));
+            }
+            values.emplace_back(limit);
+            const auto statement = store_.GetConnection().Prepare(sql);
+            assert_prepared_ok(statement, "Failed to prepare lexical search statement");
+            auto result = statement->Execute(values, false);
+            assert_query_ok(result);
+            return details::conv_query_result_to_iterator(
+                    std::move(result),
+                    GetMetadataSchema()
+            ) | rpp::operators::tap({}, {}, [t1]() {
+                LOG_INFO("Lexical search done, rt={}ms", ChronoUtils::GetCurrentTimeMillis()-t1);
+            });
+        }
+
         void AddDocuments(const AsyncIterator<Document>& documents_iterator, UpdateResult& update_result) override {
             store_.AddDocuments(documents_iterator, update_result);
         }
@@ -200,6 +366,99 @@ namespace INSTINCT_RETRIEVAL_NS {
         bool Destroy() override {
             return store_.Destroy();
         }
+
+    private:
+        unique_ptr<QueryResult> ExecuteSearch_(
+            const SearchRequest& request,
+            const std::vector<float>& query_embedding,
+            const int limit,
+            const size_t ef_search,
+            const bool explain) {
+            std::vector<PrimitiveValue> filter_params;
+            const auto predicate = request.has_metadata_filter() ? SQLBuilder::ToParameterizedPredicate(request.metadata_filter(), filter_params) : "";
+            // filter values are bound as parameters, so statement can be reused by filters of same shape
+            vector<duckdb::Value> filter_values;
+            filter_values.reserve(filter_params.size());
+            for (const auto& param: filter_params) {
+                filter_values.push_back(details::to_duckdb_value(param));
+            }
+
+            if (GetOptions().vector_index_type == kHNSWVectorIndex && predicate.empty()) {
+                auto normalized_query = query_embedding;
+                details::normalize_embedding(normalized_query);
+                const auto sql = (explain ? "EXPLAIN " : "") + details::make_hnsw_search_sql(GetOptions().table_name, GetMetadataSchema(), normalized_query, limit);
+                LOG_DEBUG("search with HNSW index: {}", sql);
+                auto& connection = store_.GetConnection();
+                if (ef_search == 0) {
+                    std::shared_lock lock {hnsw_search_mutex_};
+                    return connection.Query(sql);
+                }
+                std::unique_lock lock {hnsw_search_mutex_};
+                assert_query_ok(connection.Query(fmt::format("SET hnsw_ef_search = {};", ef_search)));
+                // result is materialized before setting is restored
+                auto result = connection.Query(sql);
+                assert_query_ok(connection.Query("RESET hnsw_ef_search;"));
+                return result;
+            }
+
+            vector<duckdb::Value> vector_array;
+            vector_array.reserve(query_embedding.size());
+            for(const float& f: query_embedding) {
+                vector_array.push_back(duckdb::Value::FLOAT(f));
+            }
+            vector<duckdb::Value> values;
+            values.reserve(filter_values.size() + 2);
+            values.push_back(duckdb::Value::ARRAY(LogicalType::FLOAT, vector_array));
+            values.insert(values.end(), filter_values.begin(), filter_values.end());
+            values.emplace_back(limit);
+            if (explain) {
+                auto statement = store_.GetConnection().Prepare("EXPLAIN " + details::make_prepared_search_sql(GetOptions().table_name, GetMetadataSchema(), GetOptions().dimension, predicate));
+                assert_prepared_ok(statement, "Failed to prepare search statement");
+                return statement->Execute(values, false);
+            }
+            if (!predicate.empty()) {
+                std::lock_guard lock {filtered_statements_mutex_};
+                return GetFilteredSearchStatement(predicate).Execute(values, false);
+            }
+            return prepared_search_statement_->Execute(values);
+        }
+
+        /**
+         * Get cached statement or prepare a new one. Caller should hold `filtered_statements_mutex_`.
+         */
+        PreparedStatement& GetFilteredSearchStatement(const std::string& predicate) {
+            if (const auto itr = filtered_statement_index_.find(predicate); itr != filtered_statement_index_.end()) {
+                filtered_statements_.splice(filtered_statements_.begin(), filtered_statements_, itr->second);
+                return *itr->second->second;
+            }
+            const auto sql = details::make_prepared_search_sql(GetOptions().table_name, GetMetadataSchema(), GetOptions().dimension, predicate);
+            LOG_DEBUG("prepare filtered search sql: {}", sql);
+            auto statement = store_.GetConnection().Prepare(sql);
+            assert_prepared_ok(statement, "Failed to prepare filtered search statement");
+            filtered_statements_.emplace_front(predicate, std::move(statement));
+            filtered_statement_index_[predicate] = filtered_statements_.begin();
+            if (filtered_statements_.size() > MAX_FILTERED_STATEMENTS) {
+                filtered_statement_index_.erase(filtered_statements_.back().first);
+                filtered_statements_.pop_back();
+            }
+            return *filtered_statements_.front().second;
+        }
+
+        void InitVectorIndex() {
+            auto& connection = store_.GetConnection();
+            const auto load_result = connection.Query(R"(INSTALL vss;
+LOAD vss;)");
+            assert_query_ok(load_result);
+            if (GetOptions().hnsw_options.enable_persistence) {
+                const auto set_result = connection.Query("SET hnsw_enable_experimental_persistence = true;");
+                assert_query_ok(set_result);
+            }
+            // existing rows are indexed during creation, and an index restored from database file is reused
+            const auto sql = details::make_create_hnsw_index_sql(GetOptions().table_name, GetOptions().hnsw_options);
+            LOG_DEBUG("create vector index with SQL if necessary: {}", sql);
+            const auto create_result = connection.Query(sql);
+            assert_query_ok(create_result);
+        }
     };
 
     /**
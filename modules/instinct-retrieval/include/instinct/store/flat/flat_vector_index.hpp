@@ -0,0 +1,555 @@
+#ifndef FLATVECTORINDEX_HPP
+#define FLATVECTORINDEX_HPP
+
+#include <cmath>
+#include <cstring>
+#include <cstdlib>
+#include <queue>
+#include <shared_mutex>
+#include <unordered_map>
+#include <unordered_set>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
+#include <instinct/retrieval_global.hpp>
+#include <instinct/tools/assertions.hpp>
+
+
+namespace INSTINCT_RETRIEVAL_NS {
+    using namespace INSTINCT_CORE_NS;
+
+    enum VectorQuantizationType {
+        kNoQuantization,
+        kInt8Quantization,
+        kFP16Quantization
+    };
+
+    namespace details {
+
+        /**
+         * Alignment of rows in vector matrix, which equals to cache line size and width of AVX-512 register
+         */
+        static constexpr size_t VECTOR_ALIGNMENT = 64;
+
+        static size_t align_dimension(const size_t dimension, const size_t element_size) {
+            const size_t n = VECTOR_ALIGNMENT / element_size;
+            return (dimension + n - 1) / n * n;
+        }
+
+        /**
+         * Growable matrix whose rows are aligned to `VECTOR_ALIGNMENT`. Padding elements are always zero so kernels can skip tail handling.
+         * @tparam T
+         */
+        template<typename T>
+        class AlignedMatrix {
+            size_t stride_;
+            size_t rows_ = 0;
+            size_t capacity_ = 0;
+            T* data_ = nullptr;
+        public:
+            explicit AlignedMatrix(const size_t dimension): stride_(align_dimension(dimension, sizeof(T))) {}
+
+            /**
+             * Allocate exactly `capacity` rows ahead, e.g. a single row for query vector
+             */
+            AlignedMatrix(const size_t dimension, const size_t capacity): AlignedMatrix(dimension) {
+                if (capacity > 0) {
+                    reserve(capacity);
+                }
+            }
+
+            AlignedMatrix(const AlignedMatrix&)=delete;
+            AlignedMatrix(AlignedMatrix&&)=delete;
+
+            ~AlignedMatrix() {
+                std::free(data_);
+            }
+
+            [[nodiscard]] size_t stride() const { return stride_; }
+
+            [[nodiscard]] size_t rows() const { return rows_; }
+
+            T* row(const size_t i) { return data_ + i * stride_; }
+
+            const T* row(const size_t i) const { return data_ + i * stride_; }
+
+            /**
+             * Append a zero-filled row and return its pointer
+             */
+            T* append() {
+                if (rows_ == capacity_) {
+                    reserve(std::max<size_t>(1024, capacity_ * 2));
+                }
+                T* ptr = row(rows_++);
+                std::memset(ptr, 0, stride_ * sizeof(T));
+                return ptr;
+            }
+
+            /**
+             * Remove row at `i` by moving last row into its place
+             */
+            void swap_remove(const size_t i) {
+                if (i != rows_ - 1) {
+                    std::memcpy(row(i), row(rows_ - 1), stride_ * sizeof(T));
+                }
+                --rows_;
+            }
+
+            void clear() {
+                rows_ = 0;
+            }
+
+        private:
+            void reserve(const size_t capacity) {
+                const size_t bytes = capacity * stride_ * sizeof(T);
+                auto* data = static_cast<T*>(std::aligned_alloc(VECTOR_ALIGNMENT, bytes));
+                if (!data) {
+                    throw std::bad_alloc();
+                }
+                if (data_) {
+                    std::memcpy(data, data_, rows_ * stride_ * sizeof(T));
+                    std::free(data_);
+                }
+                data_ = data;
+                capacity_ = capacity;
+            }
+        };
+
+        static uint16_t fp32_to_fp16(const float f) {
+            uint32_t x;
+            std::memcpy(&x, &f, sizeof(x));
+            const uint32_t sign = (x >> 16) & 0x8000;
+            const int32_t exponent = (int32_t) ((x >> 23) & 0xff) - 127 + 15;
+            uint32_t mantissa = x & 0x7fffff;
+            if (exponent <= 0) {
+                if (exponent < -10) {
+                    return sign;
+                }
+                // subnormal
+                mantissa |= 0x800000;
+                const int shift = 14 - exponent;
+                uint32_t half = mantissa >> shift;
+                if ((mantissa >> (shift - 1)) & 1) {
+                    ++half;
+                }
+                return sign | half;
+            }
+            if (exponent >= 31) {
+                // overflow and NaN are not expected for normalized vectors
+                return sign | 0x7c00;
+            }
+            uint32_t half = sign | (exponent << 10) | (mantissa >> 13);
+            if (mantissa & 0x1000) {
+                // round to nearest
+                ++half;
+            }
+            return half;
+        }
+
+        static float fp16_to_fp32(const uint16_t h) {
+            const uint32_t sign = (uint32_t) (h & 0x8000) << 16;
+            uint32_t exponent = (h >> 10) & 0x1f;
+            uint32_t mantissa = h & 0x3ff;
+            uint32_t x;
+            if (exponent == 0) {
+                if (mantissa == 0) {
+                    x = sign;
+                } else {
+                    // normalize subnormal
+                    exponent = 127 - 15 + 1;
+                    while (!(mantissa & 0x400)) {
+                        mantissa <<= 1;
+                        --exponent;
+                    }
+                    mantissa &= 0x3ff;
+                    x = sign | (exponent << 23) | (mantissa << 13);
+                }
+            } else if (exponent == 31) {
+                x = sign | 0x7f800000 | (mantissa << 13);
+            } else {
+                x = sign | ((exponent + 127 - 15) << 23) | (mantissa << 13);
+            }
+            float f;
+            std::memcpy(&f, &x, sizeof(f));
+            return f;
+        }
+
+        // scalar kernels. `n` is always a multiple of 16 as rows are padded.
+
+        static float dot_f32_scalar(const float* a, const float* b, const size_t n) {
+            float sum = 0;
+            for (size_t i = 0; i < n; ++i) {
+                sum += a[i] * b[i];
+            }
+            return sum;
+        }
+
+        static int32_t dot_i8_scalar(const int8_t* a, const int8_t* b, const size_t n) {
+            int32_t sum = 0;
+            for (size_t i = 0; i < n; ++i) {
+                sum += (int32_t) a[i] * (int32_t) b[i];
+            }
+            return sum;
+        }
+
+        static float dot_f16_scalar(const uint16_t* a, const float* b, const size_t n) {
+            float sum = 0;
+            for (size_t i = 0; i < n; ++i) {
+                sum += fp16_to_fp32(a[i]) * b[i];
+            }
+            return sum;
+        }
+
+#if (defined(__x86_64__) || defined(_M_X64)) && (defined(__GNUC__) || defined(__clang__))
+#define INSTINCT_FLAT_INDEX_X86_DISPATCH
+
+        __attribute__((target("avx2,fma")))
+        static float hsum_avx2(const __m256 v) {
+            const __m128 lo = _mm256_castps256_ps128(v);
+            const __m128 hi = _mm256_extractf128_ps(v, 1);
+            __m128 s = _mm_add_ps(lo, hi);
+            s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+            s = _mm_add_ss(s, _mm_movehdup_ps(s));
+            return _mm_cvtss_f32(s);
+        }
+
+        __attribute__((target("avx2,fma")))
+        static float dot_f32_avx2(const float* a, const float* b, const size_t n) {
+            __m256 acc0 = _mm256_setzero_ps();
+            __m256 acc1 = _mm256_setzero_ps();
+            for (size_t i = 0; i < n; i += 16) {
+                acc0 = _mm256_fmadd_ps(_mm256_load_ps(a + i), _mm256_load_ps(b + i), acc0);
+                acc1 = _mm256_fmadd_ps(_mm256_load_ps(a + i + 8), _mm256_load_ps(b + i + 8), acc1);
+            }
+            return hsum_avx2(_mm256_add_ps(acc0, acc1));
+        }
+
+        __attribute__((target("avx2")))
+        static int32_t dot_i8_avx2(const int8_t* a, const int8_t* b, const size_t n) {
+            // rows of int8 are padded to 64 elements
+            __m256i acc = _mm256_setzero_si256();
+            for (size_t i = 0; i < n; i += 16) {
+                const __m256i va = _mm256_cvtepi8_epi16(_mm_load_si128(reinterpret_cast<const __m128i*>(a + i)));
+                const __m256i vb = _mm256_cvtepi8_epi16(_mm_load_si128(reinterpret_cast<const __m128i*>(b + i)));
+                acc = _mm256_add_epi32(acc, _mm256_madd_epi16(va, vb));
+            }
+            __m128i s = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+            s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(1, 0, 3, 2)));
+            s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(2, 3, 0, 1)));
+            return _mm_cvtsi128_si32(s);
+        }
+
+        __attribute__((target("avx2,fma,f16c")))
+        static float dot_f16_avx2(const uint16_t* a, const float* b, const size_t n) {
+            __m256 acc0 = _mm256_setzero_ps();
+            __m256 acc1 = _mm256_setzero_ps();
+            for (size_t i = 0; i < n; i += 16) {
+                const __m256 a0 = _mm256_cvtph_ps(_mm_load_si128(reinterpret_cast<const __m128i*>(a + i)));
+                const __m256 a1 = _mm256_cvtph_ps(_mm_load_si128(reinterpret_cast<const __m128i*>(a + i + 8)));
+                acc0 = _mm256_fmadd_ps(a0, _mm256_load_ps(b + i), acc0);
+                acc1 = _mm256_fmadd_ps(a1, _mm256_load_ps(b + i + 8), acc1);
+            }
+            return hsum_avx2(_mm256_add_ps(acc0, acc1));
+        }
+
+        __attribute__((target("avx512f")))
+        static float dot_f32_avx512(const float* a, const float* b, const size_t n) {
+            __m512 acc = _mm512_setzero_ps();
+            for (size_t i = 0; i < n; i += 16) {
+                acc = _mm512_fmadd_ps(_mm512_load_ps(a + i), _mm512_load_ps(b + i), acc);
+            }
+            return _mm512_reduce_add_ps(acc);
+        }
+#endif
+
+        /**
+         * Dot product kernels selected once by CPU features at runtime, so that binaries built without `-march` flags still get SIMD.
+         */
+        struct VectorKernels {
+            float (*dot_f32)(const float*, const float*, size_t) = dot_f32_scalar;
+            int32_t (*dot_i8)(const int8_t*, const int8_t*, size_t) = dot_i8_scalar;
+            float (*dot_f16)(const uint16_t*, const float*, size_t) = dot_f16_scalar;
+
+            static const VectorKernels& Get() {
+                static const VectorKernels INSTANCE = Detect();
+                return INSTANCE;
+            }
+
+        private:
+            static VectorKernels Detect() {
+                VectorKernels kernels;
+#ifdef INSTINCT_FLAT_INDEX_X86_DISPATCH
+                __builtin_cpu_init();
+                if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+                    kernels.dot_f32 = dot_f32_avx2;
+                    kernels.dot_i8 = dot_i8_avx2;
+                    if (__builtin_cpu_supports("f16c")) {
+                        kernels.dot_f16 = dot_f16_avx2;
+                    }
+                }
+                if (__builtin_cpu_supports("avx512f")) {
+                    kernels.dot_f32 = dot_f32_avx512;
+                }
+#endif
+                return kernels;
+            }
+        };
+
+    }
+
+    /**
+     * Brute-force index for cosine similarity. Vectors are normalized and kept in a contiguous aligned matrix, optionally with a scalar-quantized copy for faster scanning.
+     * Search is split into row blocks which are scanned in parallel, and each block keeps a bounded heap of top-k candidates.
+     */
+    class FlatVectorIndex final {
+        using Candidate = std::pair<float, size_t>; // score and row
+
+        size_t dimension_;
+        VectorQuantizationType quantization_;
+        details::AlignedMatrix<float> vectors_;
+        details::AlignedMatrix<int8_t> int8_vectors_;
+        std::vector<float> int8_scales_;
+        details::AlignedMatrix<uint16_t> fp16_vectors_;
+        std::vector<std::string> ids_;
+        std::unordered_map<std::string, size_t> rows_;
+        mutable std::shared_mutex mutex_;
+
+    public:
+        FlatVectorIndex(const size_t dimension, const VectorQuantizationType quantization = kNoQuantization):
+            dimension_(dimension),
+            quantization_(quantization),
+            vectors_(dimension),
+            int8_vectors_(dimension),
+            fp16_vectors_(dimension) {
+            assert_gt(dimension, 0, "dimension should be positive");
+        }
+
+        [[nodiscard]] size_t GetDimension() const {
+            return dimension_;
+        }
+
+        [[nodiscard]] size_t Size() const {
+            std::shared_lock lock {mutex_};
+            return ids_.size();
+        }
+
+        /**
+         * Add or replace vector of given id
+         * @param id
+         * @param embedding
+         */
+        void Add(const std::string& id, const Embedding& embedding) {
+            assert_true(embedding.size() == dimension_, "embedding should have dimension of " + std::to_string(dimension_));
+            std::unique_lock lock {mutex_};
+            if (const auto itr = rows_.find(id); itr != rows_.end()) {
+                remove_row(itr->second);
+            }
+            float* row = vectors_.append();
+            float norm = 0;
+            for (const float f: embedding) {
+                norm += f * f;
+            }
+            norm = norm > 0 ? 1.0f / std::sqrt(norm) : 0.0f;
+            for (size_t i = 0; i < dimension_; ++i) {
+                row[i] = embedding[i] * norm;
+            }
+            if (quantization_ == kInt8Quantization) {
+                int8_scales_.push_back(quantize_int8(row, int8_vectors_.append()));
+            } else if (quantization_ == kFP16Quantization) {
+                uint16_t* half_row = fp16_vectors_.append();
+                for (size_t i = 0; i < dimension_; ++i) {
+                    half_row[i] = details::fp32_to_fp16(row[i]);
+                }
+            }
+            rows_[id] = ids_.size();
+            ids_.push_back(id);
+        }
+
+        bool Remove(const std::string& id) {
+            std::unique_lock lock {mutex_};
+            const auto itr = rows_.find(id);
+            if (itr == rows_.end()) {
+                return false;
+            }
+            remove_row(itr->second);
+            return true;
+        }
+
+        void Clear() {
+            std::unique_lock lock {mutex_};
+            vectors_.clear();
+            int8_vectors_.clear();
+            int8_scales_.clear();
+            fp16_vectors_.clear();
+            ids_.clear();
+            rows_.clear();
+        }
+
+        /**
+         * Find top-k vectors by cosine similarity
+         * @param query query vector, which needs not to be normalized
+         * @param k count of results
+         * @param allowed_ids optional set of ids to search within, which is typically results of a metadata filter
+         * @param thread_pool pool to scan row blocks in parallel
+         * @param block_size count of rows scanned by a single task
+         * @param rescore_factor with quantization, `k * rescore_factor` candidates found with quantized vectors are scored again with full precision
+         * @return ids with scores in descending order
+         */
+        std::vector<std::pair<std::string, float>> Search(
+            const Embedding& query,
+            const size_t k,
+            const std::unordered_set<std::string>* allowed_ids = nullptr,
+            ThreadPool& thread_pool = COMPUTE_WORKER_POOL,
+            const size_t block_size = 8192,
+            const size_t rescore_factor = 4
+        ) const {
+            assert_true(query.size() == dimension_, "query should have dimension of " + std::to_string(dimension_));
+            std::shared_lock lock {mutex_};
+            const size_t n = ids_.size();
+            if (n == 0 || k == 0) {
+                return {};
+            }
+
+            // normalized and padded query
+            details::AlignedMatrix<float> query_matrix(dimension_, 1);
+            float* q = query_matrix.append();
+            float norm = 0;
+            for (const float f: query) {
+                norm += f * f;
+            }
+            norm = norm > 0 ? 1.0f / std::sqrt(norm) : 0.0f;
+            for (size_t i = 0; i < dimension_; ++i) {
+                q[i] = query[i] * norm;
+            }
+
+            std::vector<uint8_t> mask;
+            if (allowed_ids) {
+                mask.resize(n, 0);
+                for (const auto& id: *allowed_ids) {
+                    if (const auto itr = rows_.find(id); itr != rows_.end()) {
+                        mask[itr->second] = 1;
+                    }
+                }
+            }
+
+            const auto& kernels = details::VectorKernels::Get();
+            const bool quantized = quantization_ != kNoQuantization;
+            const size_t candidate_size = quantized ? k * std::max<size_t>(1, rescore_factor) : k;
+
+            details::AlignedMatrix<int8_t> query_int8(dimension_, quantization_ == kInt8Quantization ? 1 : 0);
+            float query_scale = 0;
+            if (quantization_ == kInt8Quantization) {
+                query_scale = quantize_int8(q, query_int8.append());
+            }
+
+            auto score_row = [&](const size_t i) -> float {
+                switch (quantization_) {
+                    case kInt8Quantization:
+                        return (float) kernels.dot_i8(int8_vectors_.row(i), query_int8.row(0), int8_vectors_.stride()) * int8_scales_[i] * query_scale;
+                    case kFP16Quantization:
+                        // query has fewer padded elements than fp16 rows, but tail of both is zero
+                        return kernels.dot_f16(fp16_vectors_.row(i), q, vectors_.stride());
+                    default:
+                        return kernels.dot_f32(vectors_.row(i), q, vectors_.stride());
+                }
+            };
+
+            // scan blocks in parallel, each of which collects its own top candidates
+            const size_t block_count = (n + block_size - 1) / block_size;
+            std::vector<std::vector<Candidate>> block_results(block_count);
+            auto scan_block = [&](const size_t block) {
+                std::priority_queue<Candidate, std::vector<Candidate>, std::greater<>> heap;
+                const size_t end = std::min(n, (block + 1) * block_size);
+                for (size_t i = block * block_size; i < end; ++i) {
+                    if (!mask.empty() && !mask[i]) {
+                        continue;
+                    }
+                    const float score = score_row(i);
+                    if (heap.size() < candidate_size) {
+                        heap.emplace(score, i);
+                    } else if (score > heap.top().first) {
+                        heap.pop();
+                        heap.emplace(score, i);
+                    }
+                }
+                auto& result = block_results[block];
+                result.reserve(heap.size());
+                while (!heap.empty()) {
+                    result.push_back(heap.top());
+                    heap.pop();
+                }
+            };
+            // waiting on tasks of the pool from one of its workers may never return if all workers are waiting
+            const auto current_pool = BS::this_thread::get_pool();
+            if (block_count == 1 || (current_pool && *current_pool == &thread_pool)) {
+                for (size_t block = 0; block < block_count; ++block) {
+                    scan_block(block);
+                }
+            } else {
+                thread_pool.submit_loop<size_t>(0, block_count, scan_block).wait();
+            }
+
+            std::vector<Candidate> candidates;
+            for (const auto& result: block_results) {
+                candidates.insert(candidates.end(), result.begin(), result.end());
+            }
+            if (quantized) {
+                // restore precision of candidates before final selection
+                for (auto& [score, i]: candidates) {
+                    score = kernels.dot_f32(vectors_.row(i), q, vectors_.stride());
+                }
+            }
+            const size_t top_n = std::min(k, candidates.size());
+            std::partial_sort(candidates.begin(), candidates.begin() + (long) top_n, candidates.end(), std::greater<>());
+
+            std::vector<std::pair<std::string, float>> results;
+            results.reserve(top_n);
+            for (size_t i = 0; i < top_n; ++i) {
+                results.emplace_back(ids_[candidates[i].second], candidates[i].first);
+            }
+            return results;
+        }
+
+    private:
+        /**
+         * symmetric quantization with a scale for each vector
+         * @return scale to restore values
+         */
+        float quantize_int8(const float* row, int8_t* output) const {
+            float max_abs = 0;
+            for (size_t i = 0; i < dimension_; ++i) {
+                max_abs = std::max(max_abs, std::abs(row[i]));
+            }
+            if (max_abs == 0) {
+                return 0;
+            }
+            const float inv_scale = 127.0f / max_abs;
+            for (size_t i = 0; i < dimension_; ++i) {
+                output[i] = (int8_t) std::lround(row[i] * inv_scale);
+            }
+            return max_abs / 127.0f;
+        }
+
+        void remove_row(const size_t row) {
+            const size_t last = ids_.size() - 1;
+            vectors_.swap_remove(row);
+            if (quantization_ == kInt8Quantization) {
+                int8_vectors_.swap_remove(row);
+                int8_scales_[row] = int8_scales_[last];
+                int8_scales_.pop_back();
+            } else if (quantization_ == kFP16Quantization) {
+                fp16_vectors_.swap_remove(row);
+            }
+            rows_.erase(ids_[row]);
+            if (row != last) {
+                ids_[row] = std::move(ids_[last]);
+                rows_[ids_[row]] = row;
+            }
+            ids_.pop_back();
+        }
+    };
+}
+
+#endif //FLATVECTORINDEX_HPP
@@ -0,0 +1,287 @@
+#ifndef FLATVECTORSTORE_HPP
+#define FLATVECTORSTORE_HPP
+
+#include <instinct/store/vector_store.hpp>
+#include <instinct/store/sql_builder.hpp>
+#include <instinct/store/duckdb/duckdb_doc_with_embedding_store.hpp>
+#include <instinct/store/flat/flat_vector_index.hpp>
+#include <instinct/tools/chrono_utils.hpp>
+
+
+namespace INSTINCT_RETRIEVAL_NS {
+    using namespace INSTINCT_CORE_NS;
+    using namespace INSTINCT_LLM_NS;
+
+    struct FlatVectorStoreOptions {
+        /**
+         * Quantized copy of vectors used for scanning. Full-precision vectors are always kept to score final candidates.
+         */
+        VectorQuantizationType quantization = kNoQuantization;
+
+        /**
+         * Count of rows scanned by a single task
+         */
+        size_t block_size = 8192;
+
+        /**
+         * With quantization, `top_k * rescore_factor` candidates are scored again with full precision
+         */
+        size_t rescore_factor = 4;
+    };
+
+    /**
+     * IVectorStore implementation that searches over in-process flat index. `DuckDBDocWithEmbeddingStore` is used to persist text, metadata and vectors of documents, and to resolve metadata filters with exactly same semantics as `DuckDBVectorStore`.
+     *
+     * Index is loaded from vectors in table during construction, so documents are never embedded again after restart.
+     */
+    class FlatVectorStore final: public virtual IVectorStore {
+        std::shared_ptr<DuckDBDocWithEmbeddingStore> doc_store_;
+        EmbeddingsPtr embeddings_;
+        FlatVectorStoreOptions options_;
+        FlatVectorIndex index_;
+        ThreadPool& thread_pool_;
+
+    public:
+        FlatVectorStore(
+            const DuckDBPtr& db,
+            const EmbeddingsPtr& embeddings_model,
+            const MetadataSchemaPtr& metadata_schema,
+            const DuckDBStoreOptions& store_options,
+            const FlatVectorStoreOptions& options = {},
+            ThreadPool& thread_pool = COMPUTE_WORKER_POOL
+        ):
+            doc_store_(std::make_shared<DuckDBDocWithEmbeddingStore>(db, metadata_schema, embeddings_model, make_doc_store_options(store_options))),
+            embeddings_(embeddings_model),
+            options_(options),
+            index_(store_options.dimension, options.quantization),
+            thread_pool_(thread_pool) {
+            assert_true(embeddings_ != nullptr, "should provide embeddings object pointer");
+            assert_true(embeddings_->GetDimension() == store_options.dimension, "should have dimension set correctly");
+            RebuildIndex();
+        }
+
+        [[nodiscard]] DuckDBPtr GetDuckDB() const {
+            return doc_store_->GetDuckDB();
+        }
+
+        [[nodiscard]] const DuckDBStoreOptions& GetOptions() const {
+            return doc_store_->GetOptions();
+        }
+
+        /**
+         * Rebuild index with vectors persisted in table
+         */
+        void RebuildIndex() {
+            index_.Clear();
+            const long t1 = ChronoUtils::GetCurrentTimeMillis();
+            const size_t dimension = index_.GetDimension();
+            const auto result = doc_store_->GetConnection().Query(fmt::format("SELECT id::VARCHAR, vector FROM {};", GetOptions().table_name));
+            assert_query_ok(result);
+            Embedding embedding(dimension);
+            while (const auto chunk = result->Fetch()) {
+                if (chunk->size() == 0) {
+                    break;
+                }
+                chunk->Flatten();
+                const auto* ids = FlatVector::GetData<string_t>(chunk->data[0]);
+                // child vector of array column holds `dimension` floats for each row
+                const auto* floats = FlatVector::GetData<float>(ArrayVector::GetEntry(chunk->data[1]));
+                for (idx_t row = 0; row < chunk->size(); ++row) {
+                    std::memcpy(embedding.data(), floats + row * dimension, dimension * sizeof(float));
+                    index_.Add(ids[row].GetString(), embedding);
+                }
+            }
+            LOG_INFO("FlatVectorStore index rebuilt, size={}, rt={}ms", index_.Size(), ChronoUtils::GetCurrentTimeMillis() - t1);
+        }
+
+        AsyncIterator<Document> SearchDocuments(const SearchRequest &request) override {
+            const int limit = request.top_k() > 0 ? std::min(request.top_k(), 10000) : 10;
+            LOG_DEBUG("Search started: request.query={}, request.top_k={}, normalized_limit={}", request.query(), request.top_k(), limit);
+            const long t1 = ChronoUtils::GetCurrentTimeMillis();
+            const auto query_embedding = embeddings_->EmbedQuery(request.query());
+
+            std::vector<std::pair<std::string, float>> hits;
+            if (request.has_metadata_filter() && request.metadata_filter().query_case() != SearchQuery::QUERY_NOT_SET) {
+                const auto allowed_ids = FindIds(request.metadata_filter());
+                hits = index_.Search(query_embedding, limit, &allowed_ids, thread_pool_, options_.block_size, options_.rescore_factor);
+            } else {
+                hits = index_.Search(query_embedding, limit, nullptr, thread_pool_, options_.block_size, options_.rescore_factor);
+            }
+            if (hits.empty()) {
+                return rpp::source::empty<Document>();
+            }
+
+            // hydrate documents and restore order of scores
+            std::vector<std::string> ids;
+            ids.reserve(hits.size());
+            for (const auto& [id, _]: hits) {
+                ids.push_back(id);
+            }
+            std::unordered_map<std::string, Document> docs;
+            for (auto& doc: CollectVector(doc_store_->MultiGetDocuments(ids))) {
+                docs.emplace(doc.id(), std::move(doc));
+            }
+            std::vector<Document> result;
+            result.reserve(hits.size());
+            for (const auto& [id, _]: hits) {
+                if (const auto itr = docs.find(id); itr != docs.end()) {
+                    result.push_back(std::move(itr->second));
+                }
+            }
+            LOG_INFO("Search done, rt={}ms", ChronoUtils::GetCurrentTimeMillis()-t1);
+            return CreateAsyncIteratorWithRange<Document>(std::move(result));
+        }
+
+        EmbeddingsPtr GetEmbeddingModel() override {
+            return embeddings_;
+        }
+
+        void AddDocuments(const AsyncIterator<Document> &documents_iterator, UpdateResult &update_result) override {
+            std::vector<Document> docs;
+            CollectVector(documents_iterator, docs);
+            AddDocuments(docs, update_result);
+        }
+
+        void AddDocuments(std::vector<Document> &records, UpdateResult &update_result) override {
+            // embed before insertion so that no row is left without vector if embedding model fails, and pass vectors to doc store so that they are not computed twice
+            const auto embeddings = ResolveDocumentEmbeddings(embeddings_, records, index_.GetDimension());
+            const auto precomputed = FillVectors_(records, embeddings);
+            doc_store_->AddDocuments(records, update_result);
+            ClearVectors_(records, precomputed);
+
+            std::unordered_set<std::string> failed_ids;
+            for (const auto& failed: update_result.failed_documents()) {
+                failed_ids.insert(failed.id());
+            }
+            for (size_t i = 0; i < records.size(); ++i) {
+                if (!records[i].id().empty() && !failed_ids.contains(records[i].id())) {
+                    index_.Add(records[i].id(), embeddings[i]);
+                }
+            }
+        }
+
+        void AddDocument(Document &doc) override {
+            std::vector<Document> records {doc};
+            UpdateResult update_result;
+            AddDocuments(records, update_result);
+            doc = std::move(records[0]);
+        }
+
+        void DeleteDocuments(const std::vector<std::string> &ids, UpdateResult &update_result) override {
+            doc_store_->DeleteDocuments(ids, update_result);
+            for (const auto& id: ids) {
+                index_.Remove(id);
+            }
+        }
+
+        void DeleteDocuments(const SearchQuery &filter, UpdateResult &update_result) override {
+            const auto ids = FindIds(filter);
+            if (ids.empty()) {
+                update_result.set_affected_rows(0);
+                return;
+            }
+            DeleteDocuments(std::vector<std::string> {ids.begin(), ids.end()}, update_result);
+        }
+
+        AsyncIterator<Document> MultiGetDocuments(const std::vector<std::string> &ids) override {
+            return doc_store_->MultiGetDocuments(ids);
+        }
+
+        AsyncIterator<Document> FindDocuments(const FindRequest &find_request) override {
+            return doc_store_->FindDocuments(find_request);
+        }
+
+        [[nodiscard]] std::shared_ptr<MetadataSchema> GetMetadataSchema() const override {
+            return doc_store_->GetMetadataSchema();
+        }
+
+        size_t CountDocuments() override {
+            return doc_store_->CountDocuments();
+        }
+
+        bool Destroy() override {
+            index_.Clear();
+            return doc_store_->Destroy();
+        }
+
+    private:
+        static DuckDBStoreOptions make_doc_store_options(const DuckDBStoreOptions& store_options) {
+            assert_gt(store_options.dimension, 0, "dimension should be positive");
+            // vectors are stored in table but only searched in memory
+            DuckDBStoreOptions doc_store_options = store_options;
+            doc_store_options.sparse_vector = false;
+            doc_store_options.vector_index_type = kNoVectorIndex;
+            return doc_store_options;
+        }
+
+        /**
+         * Assign resolved embeddings to documents without precomputed vector
+         * @return flags of documents that carried precomputed vector
+         */
+        static std::vector<bool> FillVectors_(std::vector<Document>& records, const std::vector<Embedding>& embeddings) {
+            std::vector<bool> precomputed(records.size());
+            for (size_t i = 0; i < records.size(); ++i) {
+                if (records[i].vector_size() == (int) embeddings[i].size()) {
+                    precomputed[i] = true;
+                    continue;
+                }
+                records[i].mutable_vector()->Assign(embeddings[i].begin(), embeddings[i].end());
+            }
+            return precomputed;
+        }
+
+        /**
+         * Remove vectors assigned by `FillVectors_`, so that caller gets documents as they were
+         */
+        static void ClearVectors_(std::vector<Document>& records, const std::vector<bool>& precomputed) {
+            for (size_t i = 0; i < records.size(); ++i) {
+                if (!precomputed[i]) {
+                    records[i].clear_vector();
+                }
+            }
+        }
+
+        std::unordered_set<std::string> FindIds(const SearchQuery& filter) {
+            const auto sql = SQLBuilder::ToSelectString(GetOptions().table_name, "id", filter);
+            LOG_DEBUG("find ids with sql: {}", sql);
+            const auto result = doc_store_->GetConnection().Query(sql);
+            assert_query_ok(result);
+            std::unordered_set<std::string> ids;
+            for (const auto& row: *result) {
+                ids.insert(row.GetValue<std::string>(0));
+            }
+            return ids;
+        }
+    };
+
+    static VectorStorePtr CreateFlatVectorStore(
+        const DuckDBPtr& db,
+        const EmbeddingsPtr& embeddings_model,
+        const DuckDBStoreOptions& store_options,
+        const FlatVectorStoreOptions& options = {},
+        MetadataSchemaPtr metadata_schema = nullptr
+    ) {
+        if (!metadata_schema) {
+            metadata_schema = CreateVectorStorePresetMetadataSchema();
+        }
+        return std::make_shared<FlatVectorStore>(db, embeddings_model, metadata_schema, store_options, options);
+    }
+
+    static VectorStorePtr CreateFlatVectorStore(
+        const EmbeddingsPtr& embeddings_model,
+        const DuckDBStoreOptions& store_options,
+        const FlatVectorStoreOptions& options = {},
+        const MetadataSchemaPtr& metadata_schema = nullptr
+    ) {
+        return CreateFlatVectorStore(
+            store_options.in_memory ? std::make_shared<DuckDB>(nullptr) : std::make_shared<DuckDB>(store_options.db_file_path),
+            embeddings_model,
+            store_options,
+            options,
+            metadata_schema
+        );
+    }
+
+}
+
+#endif //FLATVECTORSTORE_HPP
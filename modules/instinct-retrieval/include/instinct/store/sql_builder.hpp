@@ -10,27 +10,38 @@
 namespace INSTINCT_RETRIEVAL_NS {
 
     namespace details {
-        static void build_bool_query(const BoolQuery& bool_query, std::string& sql);
-        static void build_term_query(const TermQuery& term_query, std::string& sql);
-        static void build_terms_query(const TermsQuery& terms_query, std::string& sql);
-        static void build_search_query(const SearchQuery& search_query, std::string& sql);
-        static void build_int_range_query(const IntRangeQuery& range_query, std::string& sql);
-        static void build_double_range_query(const DoubleRangeQuery& range_query, std::string& sql);
-
-        static void build_int_range_query(const IntRangeQuery& range_query, std::string& sql) {
+        // If `params` is given, values are rendered as `?` placeholders and collected in order, so that SQL text only depends on the shape of query.
+        static void build_bool_query(const BoolQuery& bool_query, std::string& sql, std::vector<PrimitiveValue>* params = nullptr);
+        static void build_term_query(const TermQuery& term_query, std::string& sql, std::vector<PrimitiveValue>* params = nullptr);
+        static void build_terms_query(const TermsQuery& terms_query, std::string& sql, std::vector<PrimitiveValue>* params = nullptr);
+        static void build_search_query(const SearchQuery& search_query, std::string& sql, std::vector<PrimitiveValue>* params = nullptr);
+        static void build_int_range_query(const IntRangeQuery& range_query, std::string& sql, std::vector<PrimitiveValue>* params = nullptr);
+        static void build_double_range_query(const DoubleRangeQuery& range_query, std::string& sql, std::vector<PrimitiveValue>* params = nullptr);
+
+        static void build_int_range_query(const IntRangeQuery& range_query, std::string& sql, std::vector<PrimitiveValue>* params) {
             std::vector<std::string> ranges;
             if (range_query.has_from()) {
                 std::string range;
                 range += range_query.name();
                 range += range_query.inclusive_start() ? " >= " : " > ";
-                range += std::to_string(range_query.from());
+                if (params) {
+                    range += "?";
+                    params->emplace_back().set_long_value(range_query.from());
+                } else {
+                    range += std::to_string(range_query.from());
+                }
                 ranges.push_back(range);
             }
             if (range_query.has_to()) {
                 std::string range;
                 range += range_query.name();
                 range += range_query.inclusive_end() ? " <= " : " < ";
-                range += std::to_string(range_query.to());
+                if (params) {
+                    range += "?";
+                    params->emplace_back().set_long_value(range_query.to());
+                } else {
+                    range += std::to_string(range_query.to());
+                }
                 ranges.push_back(range);
             }
             if (!ranges.empty()) {
@@ -44,20 +55,30 @@ namespace INSTINCT_RETRIEVAL_NS {
             }
         }
 
-        static void build_double_range_query(const DoubleRangeQuery& range_query, std::string& sql) {
+        static void build_double_range_query(const DoubleRangeQuery& range_query, std::string& sql, std::vector<PrimitiveValue>* params) {
             std::vector<std::string> ranges;
             if (range_query.has_from()) {
                 std::string range;
                 range += range_query.name();
                 range += range_query.inclusive_start() ? " >= " : " > ";
-                range += fmt::format("{}", range_query.from());
+                if (params) {
+                    range += "?";
+                    params->emplace_back().set_double_value(range_query.from());
+                } else {
+                    range += fmt::format("{}", range_query.from());
+                }
                 ranges.push_back(range);
             }
             if (range_query.has_to()) {
                 std::string range;
                 range += range_query.name();
                 range += range_query.inclusive_end() ? " <= " : " < ";
-                range += fmt::format("{}", range_query.to());
+                if (params) {
+                    range += "?";
+                    params->emplace_back().set_double_value(range_query.to());
+                } else {
+                    range += fmt::format("{}", range_query.to());
+                }
                 ranges.push_back(range);
             }
             if (!ranges.empty()) {
@@ -71,23 +92,26 @@ namespace INSTINCT_RETRIEVAL_NS {
             }
         }
 
-        static void build_search_query(const SearchQuery& search_query, std::string& sql) {
+        static void build_search_query(const SearchQuery& search_query, std::string& sql, std::vector<PrimitiveValue>* params) {
             if (search_query.has_bool_()) {
-                build_bool_query(search_query.bool_(), sql);
+                build_bool_query(search_query.bool_(), sql, params);
             } else if (search_query.has_term()) {
-                build_term_query(search_query.term(), sql);
+                build_term_query(search_query.term(), sql, params);
             } else if(search_query.has_terms()) {
-                build_terms_query(search_query.terms(), sql);
+                build_terms_query(search_query.terms(), sql, params);
             } else if(search_query.has_double_range()) {
-                build_double_range_query(search_query.double_range(), sql);
+                build_double_range_query(search_query.double_range(), sql, params);
             } else if(search_query.has_int_range()) {
-                build_int_range_query(search_query.int_range(), sql);
+                build_int_range_query(search_query.int_range(), sql, params);
             }
         }
 
-        static void build_term_value(const PrimitiveValue& value, std::string& sql) {
+        static void build_term_value(const PrimitiveValue& value, std::string& sql, std::vector<PrimitiveValue>* params = nullptr) {
             if (value.is_null()) {
                 sql += "NULL";
+            } else if (params) {
+                sql += "?";
+                params->push_back(value);
             } else {
                 if (value.has_double_value()) {
                     sql += std::to_string(value.double_value());
@@ -112,38 +136,39 @@ namespace INSTINCT_RETRIEVAL_NS {
             }
         }
 
-        static void build_terms_query(const TermsQuery& terms_query, std::string& sql) {
+        static void build_terms_query(const TermsQuery& terms_query, std::string& sql, std::vector<PrimitiveValue>* params) {
             sql += terms_query.name();
             sql += " IN (";
-            const auto term_values = terms_query.terms() | std::views::transform([&](const auto& term) {
+            std::vector<std::string> term_values;
+            for (const auto& term: terms_query.terms()) {
                 std::string v;
-                build_term_value(term,v);
-                return v;
-            });
+                build_term_value(term, v, params);
+                term_values.push_back(v);
+            }
             sql += StringUtils::JoinWith(term_values, ", ");
             sql += ")";
         }
 
-        static void build_term_query(const TermQuery& term_query, std::string& sql) {
+        static void build_term_query(const TermQuery& term_query, std::string& sql, std::vector<PrimitiveValue>* params) {
             sql += term_query.name();
             sql += " = ";
-            build_term_value(term_query.term(), sql);
+            build_term_value(term_query.term(), sql, params);
 
         }
 
-        static void build_bool_query(const BoolQuery& bool_query, std::string& sql) {
+        static void build_bool_query(const BoolQuery& bool_query, std::string& sql, std::vector<PrimitiveValue>* params) {
             std::vector<std::string> predicates;
             if (bool_query.must_size()>0) {
                 std::string predicate;
                 if (const auto n = bool_query.must_size(); n>1) {
                     predicate+= "(";
                     for(int i=0; i< n;++i) {
-                        build_search_query(bool_query.must(i), predicate);
+                        build_search_query(bool_query.must(i), predicate, params);
                         predicate += i==n-1 ?  "" : " AND ";
                     }
                     predicate += ")";
                 } else {
-                    build_search_query(bool_query.must(0), predicate);
+                    build_search_query(bool_query.must(0), predicate, params);
                 }
                 predicates.push_back(predicate);
             }
@@ -152,12 +177,12 @@ namespace INSTINCT_RETRIEVAL_NS {
                 if (const auto n = bool_query.should_size(); n>1) {
                     predicate+= "(";
                     for(int i=0; i< bool_query.should_size();++i) {
-                        build_search_query(bool_query.should(i), predicate);
+                        build_search_query(bool_query.should(i), predicate, params);
                         predicate += i==n-1 ?  "" : " OR ";
                     }
                     predicate += ")";
                 } else {
-                    build_search_query(bool_query.should(0), predicate);
+                    build_search_query(bool_query.should(0), predicate, params);
                 }
                 predicates.push_back(predicate);
             }
@@ -167,13 +192,13 @@ namespace INSTINCT_RETRIEVAL_NS {
                     predicate+= "(";
                     for(int i=0; i< bool_query.mustnot_size();++i) {
                         predicate+= "NOT ";
-                        build_search_query(bool_query.mustnot(i), predicate);
+                        build_search_query(bool_query.mustnot(i), predicate, params);
                         predicate += i==n-1 ?  "" : " AND ";
                     }
                     predicate += ")";
                 } else {
                     predicate += "NOT ";
-                    build_search_query(bool_query.mustnot(0), predicate);
+                    build_search_query(bool_query.mustnot(0), predicate, params);
                 }
                 predicates.push_back(predicate);
             }
@@ -234,6 +259,22 @@ namespace INSTINCT_RETRIEVAL_NS {
             return StringUtils::JoinWith(parts, " ") + ";";
         }
 
+        /**
+         * Build WHERE clause with `?` placeholders. Same SQL text is generated for queries of same shape, which is suitable as key for prepared statements.
+         * @param search_query
+         * @param params values for placeholders, in order of appearance
+         * @return predicates without `WHERE` keyword, or empty string if query is not set
+         */
+        static std::string ToParameterizedPredicate(
+            const SearchQuery& search_query,
+            std::vector<PrimitiveValue>& params) {
+            std::string sql;
+            if (search_query.query_case() != SearchQuery::QUERY_NOT_SET) {
+                details::build_search_query(search_query, sql, &params);
+            }
+            return sql;
+        }
+
         static std::string ToDeleteString(
             const std::string& table_name,
             const SearchQuery& search_query) {
@@ -5,11 +5,13 @@
 #ifndef COLLECTIONSTORAGE_HPP
 #define COLLECTIONSTORAGE_HPP
 
+#include <algorithm>
 #include <instinct/retrieval.pb.h>
 #include <instinct/retrieval_global.hpp>
 #include <instinct/model/embedding_model.hpp>
 #include <instinct/store/doc_store.hpp>
 #include <instinct/tools/metadata_schema_builder.hpp>
+#include <instinct/tools/assertions.hpp>
 
 
 namespace INSTINCT_RETRIEVAL_NS {
@@ -30,6 +32,80 @@ namespace INSTINCT_RETRIEVAL_NS {
     };
     using VectorStorePtr = std::shared_ptr<IVectorStore>;
 
+    /**
+     * Get embeddings for documents. Vectors carried by documents are used as-is if they have expected dimension, and the rest are embedded by given model in a single batch.
+     * @param embedding_model Model to embed documents without precomputed vectors
+     * @param records Documents
+     * @param dimension Expected dimension
+     * @return Embeddings in the same order of records
+     */
+    static std::vector<Embedding> ResolveDocumentEmbeddings(const EmbeddingsPtr& embedding_model, const std::vector<Document>& records, const size_t dimension) {
+        std::vector<Embedding> embeddings(records.size());
+        std::vector<size_t> missing;
+        std::vector<std::string> texts;
+        for (size_t i = 0; i < records.size(); ++i) {
+            if (const auto& vector = records[i].vector(); vector.size() == dimension) {
+                embeddings[i].assign(vector.begin(), vector.end());
+            } else {
+                if (!vector.empty()) {
+                    LOG_WARN("Precomputed vector with dimension of {} is ignored as {} is expected", vector.size(), dimension);
+                }
+                missing.push_back(i);
+                texts.push_back(records[i].text());
+            }
+        }
+        if (texts.empty()) {
+            return embeddings;
+        }
+        auto computed = embedding_model->EmbedDocuments(texts);
+        assert_equal_size(computed, texts, "Count of result embeddings is not equal to that of records");
+        for (size_t i = 0; i < missing.size(); ++i) {
+            embeddings[missing[i]] = std::move(computed[i]);
+        }
+        return embeddings;
+    }
+
+    /**
+     * Get embeddings and lexical weights for documents. Precomputed ones are used only if document carries both of them, and the rest are computed by given model in a single batch, which produces both in one pass.
+     * @param embedding_model Model to embed documents without precomputed values
+     * @param records Documents
+     * @param dimension Expected dimension
+     * @param embeddings Embeddings in the same order of records
+     * @param sparse_embeddings Lexical weights in the same order of records
+     */
+    static void ResolveDocumentHybridEmbeddings(
+        const HybridEmbeddingsPtr& embedding_model,
+        const std::vector<Document>& records,
+        const size_t dimension,
+        std::vector<Embedding>& embeddings,
+        std::vector<SparseEmbedding>& sparse_embeddings) {
+        embeddings.assign(records.size(), {});
+        sparse_embeddings.assign(records.size(), {});
+        std::vector<size_t> missing;
+        std::vector<std::string> texts;
+        for (size_t i = 0; i < records.size(); ++i) {
+            if (const auto& doc = records[i]; doc.vector().size() == dimension && !doc.sparse_vector().empty()) {
+                embeddings[i].assign(doc.vector().begin(), doc.vector().end());
+                for (const auto& [token_id, weight]: doc.sparse_vector()) {
+                    sparse_embeddings[i].emplace_back(token_id, weight);
+                }
+                std::sort(sparse_embeddings[i].begin(), sparse_embeddings[i].end());
+            } else {
+                missing.push_back(i);
+                texts.push_back(doc.text());
+            }
+        }
+        if (texts.empty()) {
+            return;
+        }
+        auto computed = embedding_model->EmbedDocumentsHybrid(texts);
+        assert_equal_size(computed, texts, "Count of result embeddings is not equal to that of records");
+        for (size_t i = 0; i < missing.size(); ++i) {
+            embeddings[missing[i]] = std::move(computed[i].dense);
+            sparse_embeddings[missing[i]] = std::move(computed[i].sparse);
+        }
+    }
+
 }
 
 #endif //COLLECTIONSTORAGE_HPP
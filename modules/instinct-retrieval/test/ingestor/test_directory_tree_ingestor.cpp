@@ -0,0 +1,75 @@
+#include <gtest/gtest.h>
+#include <fstream>
+
+#include <instinct/retriever_object_factory.hpp>
+#include <instinct/retrieval_test_global.hpp>
+
+namespace INSTINCT_RETRIEVAL_NS {
+    class TestDirectoryTreeIngestor: public testing::Test {
+    protected:
+        void SetUp() override {
+            SetupLogging();
+            corpus_dir = std::filesystem::current_path() / "_corpus";
+        }
+        std::filesystem::path corpus_dir;
+
+        static std::vector<std::string> LoadTexts(const IngestorPtr& ingestor) {
+            std::vector<std::string> texts;
+            for (const auto& doc: CollectVector(ingestor->Load())) {
+                texts.push_back(doc.text());
+            }
+            return texts;
+        }
+    };
+
+    TEST_F(TestDirectoryTreeIngestor, LoadInParallel) {
+        const auto serial = LoadTexts(RetrieverObjectFactory::CreateDirectoryTreeIngestor(corpus_dir / "recipes", nullptr, nullptr, true, 1));
+        ASSERT_EQ(serial.size(), 7);
+        const auto parallel = LoadTexts(RetrieverObjectFactory::CreateDirectoryTreeIngestor(corpus_dir / "recipes", nullptr, nullptr, true, 4));
+        ASSERT_EQ(std::unordered_set(serial.begin(), serial.end()), std::unordered_set(parallel.begin(), parallel.end()));
+    }
+
+    TEST_F(TestDirectoryTreeIngestor, StopEarly) {
+        const auto ingestor = RetrieverObjectFactory::CreateDirectoryTreeIngestor(corpus_dir / "recipes", nullptr, nullptr, true, 2);
+        const auto docs = CollectVector(ingestor->Load() | rpp::operators::take(2));
+        ASSERT_EQ(docs.size(), 2);
+    }
+
+    TEST_F(TestDirectoryTreeIngestor, LoadWithRegex) {
+        const auto ingestor = RetrieverObjectFactory::CreateDirectoryTreeIngestor(corpus_dir / "recipes", ".*shortcake.*");
+        ASSERT_EQ(LoadTexts(ingestor).size(), 2);
+    }
+
+    TEST_F(TestDirectoryTreeIngestor, EmitInCompletionOrder) {
+        // ingestor that takes given time to emit file name as text
+        class DelayedIngestor final: public BaseIngestor {
+            std::filesystem::path path_;
+            std::chrono::milliseconds delay_;
+        public:
+            DelayedIngestor(std::filesystem::path path, const std::chrono::milliseconds delay)
+                : BaseIngestor(nullptr), path_(std::move(path)), delay_(delay) {}
+
+            AsyncIterator<Document> Load() override {
+                std::this_thread::sleep_for(delay_);
+                return rpp::source::just(CreateNewDocument(path_.filename().string(), "", 1, path_.string()));
+            }
+        };
+
+        const auto folder = INSTINCT_LLM_NS::ensure_random_temp_folder();
+        for (const auto* name: {"a.txt", "b.txt"}) {
+            std::ofstream(folder / name) << name;
+        }
+        const auto ingestor = std::make_shared<DirectoryTreeIngestor>(
+            folder,
+            nullptr,
+            [](const std::filesystem::path& path) -> IngestorPtr {
+                return std::make_shared<DelayedIngestor>(path, std::chrono::milliseconds {path.filename() == "a.txt" ? 500 : 0});
+            },
+            false,
+            IO_WORKER_POOL,
+            2
+        );
+        // slow file is emitted last no matter how directory is listed
+        ASSERT_EQ(LoadTexts(ingestor), (std::vector<std::string> {"b.txt", "a.txt"}));
+    }
+}
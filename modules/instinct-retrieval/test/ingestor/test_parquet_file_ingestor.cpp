@@ -6,6 +6,7 @@
 #include <instinct/retrieval_global.hpp>
 #include <instinct/retrieval_test_global.hpp>
 #include <instinct/ingestor/parquet_file_ingestor.hpp>
+#include <instinct/store/duckdb/duckdb_vector_store.hpp>
 
 namespace INSTINCT_RETRIEVAL_NS {
     class ParquetFileIngestorTest: public testing::Test {
@@ -14,6 +15,41 @@ namespace INSTINCT_RETRIEVAL_NS {
             SetupLogging();
         }
         std::filesystem::path asset_dir_ = std::filesystem::current_path() / "_corpus";
+
+        /**
+         * Write a parquet file with ten rows of text, a LIST column and a fixed-size ARRAY column of same vectors, which are `[i, i+1, i+2, i+3]` for row `i`, and a BIGINT column which is NULL for even rows.
+         */
+        static std::filesystem::path WriteVectorParquetFile() {
+            const auto file_path = INSTINCT_LLM_NS::ensure_random_temp_folder() / "vectors.parquet";
+            duckdb::DuckDB db(nullptr);
+            Connection conn(db);
+            const auto result = conn.Query(fmt::format(
+                "COPY (SELECT i::VARCHAR AS text, [i, i+1, i+2, i+3]::FLOAT[] AS list_vector, [i, i+1, i+2, i+3]::FLOAT[4] AS array_vector, CASE WHEN i % 2 = 0 THEN NULL ELSE i END::BIGINT AS score FROM range(10) t(i)) TO '{}' (FORMAT PARQUET);",
+                file_path.string()
+            ));
+            assert_query_ok(result);
+            return file_path;
+        }
+
+        static void AssertVectors(const std::vector<Document>& records) {
+            ASSERT_EQ(records.size(), 10);
+            for (const auto& record: records) {
+                const float i = std::stof(record.text());
+                ASSERT_EQ(std::vector<float>(record.vector().begin(), record.vector().end()), (std::vector<float> {i, i+1, i+2, i+3}));
+            }
+        }
+    };
+
+    /**
+     * Read vector column as fixed-size ARRAY, which is not preserved by parquet files
+     */
+    class ArrayVectorParquetIngestor final: public BaseParquetFileIngestor {
+    public:
+        using BaseParquetFileIngestor::BaseParquetFileIngestor;
+
+        unique_ptr<QueryResult> ReadParquet(Connection &conn, const std::string &file_source, const std::vector<std::string>& column_names) override {
+            return conn.SendQuery(fmt::format("select {}, {}::FLOAT[4] from read_parquet('{}');", column_names[0], column_names[1], file_source));
+        }
     };
 
     TEST_F(ParquetFileIngestorTest, TestRemoteURL) {
@@ -36,5 +72,74 @@ namespace INSTINCT_RETRIEVAL_NS {
         const auto records = CollectVector(ingestor->Load());
         ASSERT_EQ(records.size(), 5);
     }
-}
 
+    TEST_F(ParquetFileIngestorTest, TestStreaming) {
+        // same column is mapped twice, and columns are projected out of order
+        const auto ingestor = CreateParquetIngestor(asset_dir_ / "huggingface_doc_qa_eval.parquet", "2:t,2:m:answer:varchar,0:m:context:varchar", {.threads=2});
+        const auto records = CollectVector(ingestor->Load());
+        ASSERT_EQ(records.size(), 67);
+        for (const auto& record: records) {
+            ASSERT_EQ(record.metadata_size(), 7);
+            ASSERT_EQ(DocumentUtils::GetStringValueMetadataField(record, "answer").value(), record.text());
+        }
+
+        // stop early
+        const auto first_three = CollectVector(ingestor->Load() | rpp::operators::take(3));
+        ASSERT_EQ(first_three.size(), 3);
+        ASSERT_EQ(first_three[0].text(), records[0].text());
+    }
+
+    TEST_F(ParquetFileIngestorTest, TestVectorColumn) {
+        const auto file_path = WriteVectorParquetFile();
+
+        // LIST column
+        AssertVectors(CollectVector(CreateParquetIngestor(file_path, "0:t,1:v")->Load()));
+        // column written as ARRAY
+        AssertVectors(CollectVector(CreateParquetIngestor(file_path, "0:t,2:vector")->Load()));
+
+        // column read as ARRAY
+        std::vector<ParquetColumnMapping> mappings(2);
+        mappings[0].column_type = kTextColumn;
+        mappings[0].column_index = 0;
+        mappings[1].column_type = kVectorColumn;
+        mappings[1].column_index = 2;
+        auto records = CollectVector(std::make_shared<ArrayVectorParquetIngestor>(file_path, mappings, nullptr, "")->Load());
+        AssertVectors(records);
+
+        // ingested vectors are stored as they are, without calling embedding model
+        const auto embeddings = INSTINCT_LLM_NS::create_pesudo_embedding_model(4);
+        const auto store = CreateDuckDBVectorStore(embeddings, {.table_name = "vector_parquet", .dimension = 4, .in_memory = true});
+        UpdateResult update_result;
+        store->AddDocuments(records, update_result);
+        ASSERT_EQ(update_result.returned_ids_size(), 10);
+        ASSERT_EQ(store->CountDocuments(), 10);
+        ASSERT_TRUE(embeddings->get_caches().empty());
+    }
+
+    TEST_F(ParquetFileIngestorTest, TestNullMetadata) {
+        const auto file_path = WriteVectorParquetFile();
+        const auto records = CollectVector(CreateParquetIngestor(file_path, "0:t,1:v,3:m:score:int64")->Load());
+        ASSERT_EQ(records.size(), 10);
+        for (const auto& record: records) {
+            const auto i = std::stoi(record.text());
+            const auto itr = std::ranges::find_if(record.metadata(), [](const auto& field) { return field.name() == "score"; });
+            ASSERT_TRUE(itr != record.metadata().end());
+            ASSERT_EQ(itr->is_null(), i % 2 == 0);
+            if (i % 2 != 0) {
+                ASSERT_EQ(itr->long_value(), i);
+            }
+        }
+
+        // NULL is written to column instead of failing the document for a missing field
+        const auto metadata_schema = CreateVectorStorePresetMetadataSchema();
+        auto* score_field = metadata_schema->add_fields();
+        score_field->set_name("score");
+        score_field->set_type(INT64);
+        const auto store = CreateDuckDBVectorStore(INSTINCT_LLM_NS::create_pesudo_embedding_model(4), {.table_name = "null_metadata_parquet", .dimension = 4, .in_memory = true}, metadata_schema);
+        auto docs = records;
+        UpdateResult update_result;
+        store->AddDocuments(docs, update_result);
+        ASSERT_EQ(update_result.returned_ids_size(), 10);
+        ASSERT_EQ(store->CountDocuments(), 10);
+    }
+}
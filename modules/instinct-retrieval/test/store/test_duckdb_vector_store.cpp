@@ -39,19 +39,44 @@ namespace INSTINCT_RETRIEVAL_NS {
         ASSERT_EQ(sql, "CREATE TABLE IF NOT EXISTS test_tb1(id UUID PRIMARY KEY, text VARCHAR NOT NULL, vector FLOAT[128] NOT NULL, name VARCHAR, address VARCHAR, age INTEGER);");
     }
 
-    TEST_F(DuckDBVectorStoreTest, make_search_sql) {
-        SearchQuery mq;
-        auto predicate = mq.mutable_term();
-        predicate->set_name("address");
-        predicate->mutable_term()->set_string_value("shanghai");
-        auto sql = details::make_search_sql("tb1", s1, INSTINCT_LLM_NS::make_zero_vector(), mq);
-        std::cout << sql << std::endl;
-        ASSERT_EQ(sql, "SELECT id, text, name, address, age, array_cosine_similarity(vector, array_value(0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT)) AS similarity FROM tb1 WHERE address = 'shanghai' ORDER BY similarity DESC LIMIT 10;");
+    TEST_F(DuckDBVectorStoreTest, make_create_table_sql_with_sparse_vector) {
+        const auto sql = details::make_create_table_sql("test_tb1", 128, s1, false, true);
+        ASSERT_EQ(sql, "CREATE TABLE IF NOT EXISTS test_tb1(id UUID PRIMARY KEY, text VARCHAR NOT NULL, vector FLOAT[128] NOT NULL, name VARCHAR, address VARCHAR, age INTEGER, sparse_vector MAP(INTEGER, FLOAT));");
+    }
 
-        sql = details::make_search_sql("tb1", s1, INSTINCT_LLM_NS::make_zero_vector(), SearchQuery {});
-        std::cout << sql << std::endl;
-        ASSERT_EQ(sql, "SELECT id, text, name, address, age, array_cosine_similarity(vector, array_value(0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT,0.000000::FLOAT)) AS similarity FROM tb1 ORDER BY similarity DESC LIMIT 10;");
+    TEST_F(DuckDBVectorStoreTest, make_prepared_lexical_search_sql) {
+        ASSERT_EQ(
+            details::make_prepared_lexical_search_sql("tb1", s1, 2),
+            "SELECT id, text, name, address, age, (coalesce(map_extract(sparse_vector, ?::INTEGER)[1], 0) * ?::FLOAT + coalesce(map_extract(sparse_vector, ?::INTEGER)[1], 0) * ?::FLOAT) AS similarity FROM tb1 ORDER BY similarity DESC LIMIT ?"
+        );
+        ASSERT_EQ(
+            details::make_prepared_lexical_search_sql("tb1", s1, 1, "address = ?"),
+            "SELECT id, text, name, address, age, (coalesce(map_extract(sparse_vector, ?::INTEGER)[1], 0) * ?::FLOAT) AS similarity FROM tb1 WHERE address = ? ORDER BY similarity DESC LIMIT ?"
+        );
+    }
 
+    TEST_F(DuckDBVectorStoreTest, make_prepared_search_sql) {
+        ASSERT_EQ(
+            details::make_prepared_search_sql("tb1", s1, 4),
+            "SELECT id, text, name, address, age, array_cosine_similarity(vector, ?::FLOAT[4]) AS similarity FROM tb1 ORDER BY similarity DESC LIMIT ?"
+        );
+        ASSERT_EQ(
+            details::make_prepared_search_sql("tb1", s1, 4, "address = ?"),
+            "SELECT id, text, name, address, age, array_cosine_similarity(vector, ?::FLOAT[4]) AS similarity FROM tb1 WHERE address = ? ORDER BY similarity DESC LIMIT ?"
+        );
+    }
+
+    TEST_F(DuckDBVectorStoreTest, make_hnsw_search_sql) {
+        ASSERT_EQ(
+            details::make_hnsw_search_sql("tb1", s1, {0.5f, -1.0f, 0.25f, 0.1f}, 5),
+            "SELECT id, text, name, address, age, 1 - distance * distance / 2 AS similarity FROM (SELECT id, text, name, address, age, array_distance(vector, [0.5, -1, 0.25, 0.1]::FLOAT[4]) AS distance FROM tb1 ORDER BY distance LIMIT 5) ORDER BY distance"
+        );
+    }
+
+    TEST_F(DuckDBVectorStoreTest, make_create_hnsw_index_sql) {
+        const auto sql = details::make_create_hnsw_index_sql("tb1", {.m = 32, .ef_construction = 200, .ef_search = 100});
+        std::cout << sql << std::endl;
+        ASSERT_EQ(sql, "CREATE INDEX IF NOT EXISTS tb1_vector_hnsw_idx ON tb1 USING HNSW (vector) WITH (metric = 'l2sq', M = 32, ef_construction = 200, ef_search = 100);");
     }
 
     TEST_F(DuckDBVectorStoreTest, make_delete_sql) {
@@ -102,6 +127,173 @@ namespace INSTINCT_RETRIEVAL_NS {
 
     }
 
+    TEST_F(DuckDBVectorStoreTest, TestRecallWithHNSWIndex) {
+        size_t dim = 128;
+        auto embeddings = INSTINCT_LLM_NS::create_pesudo_embedding_model(dim);
+
+        const auto store = std::make_shared<DuckDBVectorStore>(
+            std::make_shared<DuckDB>(nullptr),
+            embeddings,
+            CreateVectorStorePresetMetadataSchema(),
+            DuckDBStoreOptions { .table_name = "test_table_1", .dimension = dim, .vector_index_type = kHNSWVectorIndex}
+        );
+
+        std::vector<Document> docs;
+        for (int i: std::views::iota (0,1000)) {
+            Document document;
+            document.set_text(std::to_string(i));
+            DocumentUtils::AddMissingPresetMetadataFields(document);
+            docs.push_back(document);
+        }
+        UpdateResult update_result;
+        store->AddDocuments(docs, update_result);
+        // index built on populated table should work as well as the one maintained incrementally
+        store->RebuildVectorIndex();
+
+        int max = 100, n=0, hit=0;
+        for(const auto& [text, embedding]: embeddings->get_caches()) {
+            if(++n==max) {
+                break;
+            }
+            SearchRequest search_request;
+            search_request.set_query(text);
+            search_request.set_top_k(5);
+            store->SearchDocuments(search_request)
+                | rpp::operators::first()
+                | rpp::operators::subscribe([&](const Document& item) {
+                    if (item.text() == text) hit++;
+                });
+        }
+        // recall of approximate search should be close to exact one
+        ASSERT_GE(hit, (n-1) * 9 / 10);
+
+        // make sure index is actually used instead of a full scan
+        SearchRequest search_request;
+        search_request.set_query("1");
+        search_request.set_top_k(5);
+        const auto plan = store->ExplainSearchDocuments(search_request);
+        LOG_INFO("plan={}", plan);
+        ASSERT_TRUE(plan.find("HNSW_INDEX_SCAN") != std::string::npos);
+
+        // larger ef_search per query
+        store->SearchDocuments(search_request, 256)
+            | rpp::operators::first()
+            | rpp::operators::subscribe([&](const Document& item) {
+                ASSERT_EQ(item.text(), "1");
+            });
+
+        // search with metadata filter scans whole table, so that filter never leaves fewer rows than top_k
+        auto* cond = search_request.mutable_metadata_filter()->mutable_bool_()->add_mustnot();
+        cond->mutable_term()->set_name(METADATA_SCHEMA_FILE_SOURCE_KEY);
+        cond->mutable_term()->mutable_term()->set_string_value("not_found");
+        ASSERT_TRUE(store->ExplainSearchDocuments(search_request).find("HNSW_INDEX_SCAN") == std::string::npos);
+        const auto filtered = CollectVector(store->SearchDocuments(search_request));
+        ASSERT_EQ(filtered.size(), 5);
+        ASSERT_EQ(filtered[0].text(), "1");
+    }
+
+    TEST_F(DuckDBVectorStoreTest, AddDocumentsInChunks) {
+        size_t dim = 16;
+        auto embeddings = INSTINCT_LLM_NS::create_pesudo_embedding_model(dim);
+        const auto store = CreateDuckDBVectorStore(
+            embeddings,
+            { .table_name = "test_table_1", .dimension = dim, .in_memory = true},
+            s1
+        );
+
+        // more than one DataChunk of rows
+        std::vector<Document> docs;
+        for (const int i: std::views::iota (0,3000)) {
+            Document document;
+            document.set_text(std::to_string(i));
+            auto* name = document.add_metadata();
+            name->set_name("name");
+            name->set_string_value("name-" + std::to_string(i));
+            auto* address = document.add_metadata();
+            address->set_name("address");
+            address->set_is_null(true);
+            auto* age = document.add_metadata();
+            age->set_name("age");
+            if (i % 2 == 0) {
+                age->set_int_value(i);
+            } else {
+                // casted to INTEGER column
+                age->set_long_value(i);
+            }
+            docs.push_back(document);
+        }
+        // missing metadata field
+        Document bad_doc;
+        bad_doc.set_text("bad");
+        docs.push_back(bad_doc);
+
+        UpdateResult update_result;
+        store->AddDocuments(docs, update_result);
+        ASSERT_EQ(update_result.affected_rows(), 3000);
+        ASSERT_EQ(update_result.returned_ids_size(), 3000);
+        ASSERT_EQ(update_result.failed_documents_size(), 1);
+        ASSERT_EQ(store->CountDocuments(), 3000);
+
+        const auto fetched = CollectVector(store->MultiGetDocuments({docs[2047].id(), docs[2048].id()}));
+        ASSERT_EQ(fetched.size(), 2);
+        for (const auto& doc: fetched) {
+            const int i = std::stoi(doc.text());
+            ASSERT_TRUE(i == 2047 || i == 2048);
+            ASSERT_EQ(doc.metadata(0).string_value(), "name-" + std::to_string(i));
+            ASSERT_EQ(doc.metadata(2).int_value(), i);
+        }
+    }
+
+    TEST_F(DuckDBVectorStoreTest, AddDocumentsWithPrecomputedVectors) {
+        size_t dim = 16;
+        const auto embeddings = std::make_shared<INSTINCT_LLM_NS::PesudoEmbeddings>(dim);
+        const auto store = CreateDuckDBVectorStore(
+            embeddings,
+            { .table_name = "test_table_1", .dimension = dim, .in_memory = true},
+            s1
+        );
+        const auto query_vector = embeddings->EmbedQuery("query");
+
+        std::vector<Document> docs;
+        for (const int i: std::views::iota (0,4)) {
+            Document document;
+            document.set_text("doc-" + std::to_string(i));
+            auto* name = document.add_metadata();
+            name->set_name("name");
+            name->set_string_value("name-" + std::to_string(i));
+            auto* address = document.add_metadata();
+            address->set_name("address");
+            address->set_is_null(true);
+            auto* age = document.add_metadata();
+            age->set_name("age");
+            age->set_int_value(i);
+            if (i == 0) {
+                document.mutable_vector()->Add(query_vector.begin(), query_vector.end());
+            } else if (i < 3) {
+                const auto vector = INSTINCT_LLM_NS::make_random_vector(dim);
+                document.mutable_vector()->Add(vector.begin(), vector.end());
+            } else {
+                // wrong dimension
+                document.mutable_vector()->Add(1.0f);
+            }
+            docs.push_back(document);
+        }
+
+        UpdateResult update_result;
+        store->AddDocuments(docs, update_result);
+        ASSERT_EQ(update_result.affected_rows(), 4);
+        // only the query and doc-3 are embedded by model
+        ASSERT_EQ(embeddings->get_caches().size(), 2);
+        ASSERT_TRUE(embeddings->get_caches().contains("doc-3"));
+
+        SearchRequest search_request;
+        search_request.set_query("query");
+        search_request.set_top_k(1);
+        const auto result = CollectVector(store->SearchDocuments(search_request));
+        ASSERT_EQ(result.size(), 1);
+        ASSERT_EQ(result[0].text(), "doc-0");
+    }
+
     TEST_F(DuckDBVectorStoreTest, SearchWithFilter) {
         size_t dim = 128;
         auto db_file_path = INSTINCT_LLM_NS::ensure_random_temp_folder() / "test.db";
@@ -142,9 +334,57 @@ namespace INSTINCT_RETRIEVAL_NS {
 
     }
 
+    TEST_F(DuckDBVectorStoreTest, SearchWithLexicalWeights) {
+        size_t dim = 16;
+        const auto embeddings = std::make_shared<INSTINCT_LLM_NS::PesudoHybridEmbeddings>(dim);
+        const auto store = std::make_shared<DuckDBVectorStore>(
+            std::make_shared<DuckDB>(nullptr),
+            embeddings,
+            s1,
+            DuckDBStoreOptions { .table_name = "test_table_1", .dimension = dim, .sparse_vector = true, .in_memory = true}
+        );
 
+        std::vector<Document> docs;
+        for (const auto& text: {"apple banana", "banana cherry", "durian"}) {
+            Document document;
+            document.set_text(text);
+            auto* name = document.add_metadata();
+            name->set_name("name");
+            name->set_string_value(text);
+            auto* address = document.add_metadata();
+            address->set_name("address");
+            address->set_is_null(true);
+            auto* age = document.add_metadata();
+            age->set_name("age");
+            age->set_int_value(1);
+            docs.push_back(document);
+        }
+        // precomputed lexical weights are used as-is
+        const auto precomputed = embeddings->EmbedQueryHybrid("cherry");
+        docs[2].mutable_vector()->Add(precomputed.dense.begin(), precomputed.dense.end());
+        for (const auto& [token_id, weight]: precomputed.sparse) {
+            (*docs[2].mutable_sparse_vector())[token_id] = weight;
+        }
 
+        UpdateResult update_result;
+        store->AddDocuments(docs, update_result);
+        ASSERT_EQ(update_result.affected_rows(), 3);
 
+        SearchRequest search_request;
+        search_request.set_query("cherry banana");
+        search_request.set_top_k(3);
+        const auto result = CollectVector(store->SearchDocumentsByLexicalWeights(search_request));
+        ASSERT_EQ(result.size(), 3);
+        ASSERT_EQ(result[0].text(), "banana cherry");
 
+        // filter values are bound as parameters
+        search_request.mutable_metadata_filter()->mutable_term()->set_name("name");
+        search_request.mutable_metadata_filter()->mutable_term()->mutable_term()->set_string_value("durian");
+        const auto filtered = CollectVector(store->SearchDocumentsByLexicalWeights(search_request));
+        ASSERT_EQ(filtered.size(), 1);
+        ASSERT_EQ(filtered[0].text(), "durian");
 
+        search_request.mutable_metadata_filter()->mutable_term()->mutable_term()->set_string_value("x' OR '1'='1");
+        ASSERT_TRUE(CollectVector(store->SearchDocumentsByLexicalWeights(search_request)).empty());
+    }
 }
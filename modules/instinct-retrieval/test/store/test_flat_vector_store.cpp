@@ -0,0 +1,193 @@
+#include <gtest/gtest.h>
+#include <random>
+#include <ranges>
+#include <instinct/retrieval_global.hpp>
+#include <instinct/store/flat/flat_vector_store.hpp>
+#include <instinct/retrieval_test_global.hpp>
+
+
+namespace INSTINCT_RETRIEVAL_NS {
+
+    class FlatVectorStoreTest: public testing::Test {
+    protected:
+        void SetUp() override {
+            SetupLogging();
+        }
+
+        static std::vector<Document> make_docs(const int n) {
+            std::vector<Document> docs;
+            for (const int i: std::views::iota (0,n)) {
+                Document document;
+                document.set_text(std::to_string(i));
+                auto* parent_id = document.mutable_metadata()->Add();
+                parent_id->set_name(METADATA_SCHEMA_PARENT_DOC_ID_KEY);
+                parent_id->set_int_value(i);
+                DocumentUtils::AddMissingPresetMetadataFields(document);
+                docs.push_back(document);
+            }
+            return docs;
+        }
+    };
+
+    TEST_F(FlatVectorStoreTest, QuantizedIndexSearch) {
+        constexpr size_t dim = 100;
+        std::mt19937 rng {42};
+        std::normal_distribution<float> dist;
+        std::vector<Embedding> vectors;
+        for (const auto quantization: {kNoQuantization, kInt8Quantization, kFP16Quantization}) {
+            FlatVectorIndex index {dim, quantization};
+            vectors.clear();
+            for (int i=0; i<5000; ++i) {
+                Embedding embedding(dim);
+                for (auto& f: embedding) f = dist(rng);
+                index.Add(std::to_string(i), embedding);
+                vectors.push_back(embedding);
+            }
+            // removal moves last row into the hole
+            ASSERT_TRUE(index.Remove("0"));
+            ASSERT_FALSE(index.Remove("0"));
+            ASSERT_EQ(index.Size(), 4999);
+
+            for (int i=1; i<100; ++i) {
+                const auto result = index.Search(vectors[i], 3, nullptr, COMPUTE_WORKER_POOL, 1024);
+                ASSERT_EQ(result.size(), 3);
+                ASSERT_EQ(result[0].first, std::to_string(i));
+                ASSERT_NEAR(result[0].second, 1.0f, 1e-4);
+                ASSERT_GE(result[0].second, result[1].second);
+            }
+
+            const std::unordered_set<std::string> allowed_ids {"1", "2", "3"};
+            const auto result = index.Search(vectors[4], 10, &allowed_ids);
+            ASSERT_EQ(result.size(), 3);
+            for (const auto& [id, _]: result) {
+                ASSERT_TRUE(allowed_ids.contains(id));
+            }
+        }
+    }
+
+    TEST_F(FlatVectorStoreTest, SimpleRecall) {
+        size_t dim = 128;
+        auto embeddings = INSTINCT_LLM_NS::create_pesudo_embedding_model(dim);
+        const auto store = CreateFlatVectorStore(
+            embeddings,
+            { .table_name = "test_table_1", .dimension = dim, .in_memory = true},
+            { .quantization = kInt8Quantization }
+        );
+        auto docs = make_docs(1000);
+        UpdateResult update_result;
+        store->AddDocuments(docs, update_result);
+        ASSERT_EQ(update_result.returned_ids_size(), 1000);
+        ASSERT_EQ(store->CountDocuments(), 1000);
+
+        int max = 100, n=0;
+        for(const auto& [text, embedding]: embeddings->get_caches()) {
+            if(++n==max) {
+                break;
+            }
+            SearchRequest search_request;
+            search_request.set_query(text);
+            search_request.set_top_k(5);
+            const auto result = CollectVector(store->SearchDocuments(search_request));
+            ASSERT_EQ(result.size(), 5);
+            ASSERT_EQ(result[0].text(), text);
+        }
+    }
+
+    TEST_F(FlatVectorStoreTest, SearchWithFilterAndDelete) {
+        size_t dim = 128;
+        auto embeddings = INSTINCT_LLM_NS::create_pesudo_embedding_model(dim);
+        const auto store = CreateFlatVectorStore(
+            embeddings,
+            { .table_name = "test_table_1", .dimension = dim, .in_memory = true}
+        );
+        auto docs = make_docs(100);
+        UpdateResult update_result;
+        store->AddDocuments(docs, update_result);
+
+        for (int i=0; i<10; ++i) {
+            // query that excludes top-1 item with sql conditions
+            SearchRequest search_request;
+            search_request.set_query(std::to_string(i));
+            auto* cond1 = search_request.mutable_metadata_filter()->mutable_bool_()->add_mustnot();
+            cond1->mutable_term()->set_name(METADATA_SCHEMA_PARENT_DOC_ID_KEY);
+            cond1->mutable_term()->mutable_term()->set_int_value(i);
+            const auto result = CollectVector(store->SearchDocuments(search_request));
+            ASSERT_FALSE(result.empty());
+            ASSERT_NE(result[0].text(), std::to_string(i));
+        }
+
+        SearchQuery filter;
+        filter.mutable_term()->set_name(METADATA_SCHEMA_PARENT_DOC_ID_KEY);
+        filter.mutable_term()->mutable_term()->set_int_value(42);
+        UpdateResult delete_result;
+        store->DeleteDocuments(filter, delete_result);
+        ASSERT_EQ(delete_result.affected_rows(), 1);
+        ASSERT_EQ(store->CountDocuments(), 99);
+
+        SearchRequest search_request;
+        search_request.set_query("42");
+        search_request.set_top_k(1);
+        const auto result = CollectVector(store->SearchDocuments(search_request));
+        ASSERT_EQ(result.size(), 1);
+        ASSERT_NE(result[0].text(), "42");
+    }
+
+    TEST_F(FlatVectorStoreTest, LoadVectorsAfterRestart) {
+        // count documents sent to embedding model
+        class CountingEmbeddings final: public IEmbeddingModel {
+            EmbeddingsPtr delegate_;
+        public:
+            size_t embedded_documents = 0;
+
+            explicit CountingEmbeddings(EmbeddingsPtr delegate): delegate_(std::move(delegate)) {}
+
+            std::vector<Embedding> EmbedDocuments(const std::vector<std::string>& texts) override {
+                embedded_documents += texts.size();
+                return delegate_->EmbedDocuments(texts);
+            }
+
+            Embedding EmbedQuery(const std::string& text) override {
+                return delegate_->EmbedQuery(text);
+            }
+
+            size_t GetDimension() override {
+                return delegate_->GetDimension();
+            }
+        };
+
+        size_t dim = 128;
+        const auto db_file_path = INSTINCT_LLM_NS::ensure_random_temp_folder() / "flat.db";
+        const auto embeddings = std::make_shared<CountingEmbeddings>(INSTINCT_LLM_NS::create_pesudo_embedding_model(dim));
+        const DuckDBStoreOptions store_options { .table_name = "test_table_1", .db_file_path = db_file_path, .dimension = dim};
+        {
+            const auto store = CreateFlatVectorStore(embeddings, store_options);
+            auto docs = make_docs(100);
+            UpdateResult update_result;
+            store->AddDocuments(docs, update_result);
+            ASSERT_EQ(update_result.returned_ids_size(), 100);
+            // each document is embedded exactly once
+            ASSERT_EQ(embeddings->embedded_documents, 100);
+            // vectors assigned during insertion are not left in input documents
+            ASSERT_EQ(docs[0].vector_size(), 0);
+        }
+
+        // index is loaded from table without embedding documents again
+        const auto store = CreateFlatVectorStore(embeddings, store_options);
+        ASSERT_EQ(embeddings->embedded_documents, 100);
+        ASSERT_EQ(store->CountDocuments(), 100);
+        for (int i=0; i<10; ++i) {
+            SearchRequest search_request;
+            search_request.set_query(std::to_string(i));
+            search_request.set_top_k(1);
+            const auto result = CollectVector(store->SearchDocuments(search_request));
+            ASSERT_EQ(result.size(), 1);
+            ASSERT_EQ(result[0].text(), std::to_string(i));
+        }
+
+        // metadata columns are read correctly next to vector column
+        for (const auto& doc: CollectVector(store->FindDocuments({}))) {
+            ASSERT_EQ(std::to_string(DocumentUtils::GetIntValueMetadataField(doc, METADATA_SCHEMA_PARENT_DOC_ID_KEY).value()), doc.text());
+        }
+    }
+
+}
@@ -106,4 +106,41 @@ namespace INSTINCT_RETRIEVAL_NS {
     }
 
 
+    TEST(TestSQLBuilder, BuildParameterizedPredicate) {
+        std::vector<PrimitiveValue> params;
+        ASSERT_EQ(SQLBuilder::ToParameterizedPredicate(SearchQuery {}, params), "");
+        ASSERT_TRUE(params.empty());
+
+        SearchQuery search_query;
+        auto* condition1 = search_query.mutable_bool_()->add_must();
+        condition1->mutable_terms()->set_name("bar");
+        condition1->mutable_terms()->add_terms()->set_string_value("cow");
+        condition1->mutable_terms()->add_terms()->set_string_value("kar");
+        auto* condition2 = search_query.mutable_bool_()->add_mustnot();
+        condition2->mutable_int_range()->set_name("score1");
+        condition2->mutable_int_range()->set_from(0);
+        condition2->mutable_int_range()->set_to(10);
+        ASSERT_EQ(
+            SQLBuilder::ToParameterizedPredicate(search_query, params),
+            "bar IN (?, ?) AND NOT (score1 > ? AND score1 < ?)"
+        );
+        ASSERT_EQ(params.size(), 4);
+        ASSERT_EQ(params[0].string_value(), "cow");
+        ASSERT_EQ(params[1].string_value(), "kar");
+        ASSERT_EQ(params[2].long_value(), 0);
+        ASSERT_EQ(params[3].long_value(), 10);
+
+        // same shape gives same text
+        std::vector<PrimitiveValue> params2;
+        condition1->mutable_terms()->mutable_terms(0)->set_string_value("dog");
+        condition2->mutable_int_range()->set_to(100);
+        ASSERT_EQ(
+            SQLBuilder::ToParameterizedPredicate(search_query, params2),
+            "bar IN (?, ?) AND NOT (score1 > ? AND score1 < ?)"
+        );
+        ASSERT_EQ(params2[0].string_value(), "dog");
+        ASSERT_EQ(params2[3].long_value(), 100);
+    }
+
+
 }
@@ -0,0 +1,366 @@
+#ifndef INFERENCE_SCHEDULER_HPP
+#define INFERENCE_SCHEDULER_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <thread>
+
+#include <instinct/transformer_global.hpp>
+#include <instinct/transformer/models.hpp>
+
+namespace INSTINCT_TRANSFORMER_NS {
+    using namespace INSTINCT_TRANSFORMER_NS::models;
+
+    struct InferenceSchedulerOptions {
+        /**
+         * Put a scheduler in front of model. It's read by wrappers of local models, and scheduler itself ignores it.
+         */
+        bool enabled = false;
+
+        /**
+         * Max count of padded tokens in a micro-batch
+         */
+        size_t max_batch_tokens = 2048;
+
+        /**
+         * Sequences are grouped by length rounded up to a multiple of it, which should be the same as padding granularity of model
+         */
+        size_t seq_len_bucket_size = 16;
+
+        /**
+         * How long a sequence may wait for others of the same bucket before its micro-batch is dispatched anyway
+         */
+        std::chrono::milliseconds max_batch_delay {5};
+
+        /**
+         * Micro-batches are dispatched cheapest first. A bucket whose oldest sequence has waited longer than this is dispatched before all others, so that long inputs are not starved by a stream of short ones.
+         */
+        std::chrono::milliseconds max_queue_delay {200};
+
+        /**
+         * Count of threads shared by all running micro-batches
+         */
+        unsigned int total_threads = std::max(1u, std::thread::hardware_concurrency());
+
+        /**
+         * Count of micro-batches running in parallel. Zero means max concurrency of model. Workers beyond `total_threads` wait for free threads, as each micro-batch takes at least one.
+         */
+        size_t workers = 0;
+
+        /**
+         * Cost of a micro-batch, in tokens, that justifies one more thread. Smaller batches run on fewer threads, as synchronization among threads in each op outweighs computation.
+         */
+        size_t min_cost_per_thread = 64;
+    };
+
+    struct InferenceSchedulerStats {
+        size_t batches = 0;
+        size_t sequences = 0;
+        size_t padded_tokens = 0;
+    };
+
+    /**
+     * A scheduler in front of an encoder model, which serves concurrent callers with shared micro-batches.
+     *
+     * Pending sequences of all callers are grouped by task and length bucket. A micro-batch is formed from a single bucket once it's full or its oldest sequence reaches `max_batch_delay`, so short queries are not padded to the length of long documents. Threads are assigned to each micro-batch by its estimated cost, within a budget of `total_threads` shared by all running micro-batches, so mixed traffic neither leaves cores idle nor oversubscribes them. A worker doesn't take a micro-batch until some threads of the budget are free.
+     */
+    class InferenceScheduler {
+    public:
+        enum TaskKind {
+            kEmbeddingTask,
+            kRankingTask
+        };
+
+    private:
+        using Clock = std::chrono::steady_clock;
+
+        struct Request {
+            TaskKind kind;
+            const std::vector<std::vector<int>> *inputs;
+            std::vector<std::vector<float>> outputs;
+            size_t remaining;
+            std::exception_ptr error;
+            std::mutex mutex;
+            std::condition_variable done;
+        };
+
+        struct Item {
+            std::shared_ptr<Request> request;
+            size_t index;
+            Clock::time_point enqueued_at;
+        };
+
+        // task kind and padded length
+        using BucketKey = std::pair<TaskKind, size_t>;
+
+        ModelPtr model_;
+        InferenceSchedulerOptions options_;
+        size_t hidden_size_;
+        std::map<BucketKey, std::deque<Item>> buckets_;
+        int64_t free_threads_;
+        bool stopped_ = false;
+        InferenceSchedulerStats stats_;
+        std::mutex mutex_;
+        std::condition_variable cv_;
+        std::vector<std::thread> workers_;
+
+    public:
+        InferenceScheduler(ModelPtr model, const InferenceSchedulerOptions& options):
+            model_(std::move(model)),
+            options_(options),
+            hidden_size_(model_->get_text_embedding_dim() > 0 ? model_->get_text_embedding_dim() : 1024),
+            free_threads_(std::max(1u, options.total_threads)) {
+            const size_t n_workers = options_.workers > 0 ? options_.workers : std::max<size_t>(1, model_->get_max_concurrency());
+            for (size_t i = 0; i < n_workers; ++i) {
+                workers_.emplace_back([this] { work_(); });
+            }
+        }
+
+        InferenceScheduler(const InferenceScheduler&) = delete;
+        InferenceScheduler& operator=(const InferenceScheduler&) = delete;
+
+        /**
+         * Pending sequences are still computed before workers exit
+         */
+        ~InferenceScheduler() {
+            {
+                std::lock_guard lock {mutex_};
+                stopped_ = true;
+            }
+            cv_.notify_all();
+            for (auto& worker: workers_) {
+                worker.join();
+            }
+        }
+
+        /**
+         * Compute embeddings of sequences. Caller is blocked until all of them are done.
+         * @param batch_input_ids token ids for each sequence
+         * @param output_embeddings embedding for each sequence, in the same order of `batch_input_ids`
+         */
+        void text_embedding(const std::vector<std::vector<int>>& batch_input_ids, std::vector<std::vector<float>>& output_embeddings) {
+            output_embeddings = submit_(kEmbeddingTask, batch_input_ids);
+        }
+
+        /**
+         * Compute ranking scores of encoded QA pairs. Caller is blocked until all of them are done.
+         * @param batch_input_ids token ids for each QA pair
+         * @param scores score for each QA pair, in the same order of `batch_input_ids`
+         */
+        void qa_rank(const std::vector<std::vector<int>>& batch_input_ids, std::vector<float>& scores) {
+            const auto outputs = submit_(kRankingTask, batch_input_ids);
+            scores.resize(outputs.size());
+            for (size_t i = 0; i < outputs.size(); ++i) {
+                scores[i] = outputs[i].front();
+            }
+        }
+
+        InferenceSchedulerStats get_stats() {
+            std::lock_guard lock {mutex_};
+            return stats_;
+        }
+
+        /**
+         * Estimated cost of a forward in tokens. Cost of attention grows with square of sequence length, and relative to projections and MLP of each token, it's about `qlen / (6 * hidden_size)`.
+         */
+        static double estimate_cost(const size_t batch_size, const size_t qlen, const size_t hidden_size) {
+            const auto tokens = (double) (batch_size * qlen);
+            return tokens * (1.0 + (double) qlen / (6.0 * (double) hidden_size));
+        }
+
+        /**
+         * Count of threads for a micro-batch by its cost
+         */
+        static unsigned int assign_threads(const double cost, const size_t min_cost_per_thread, const unsigned int max_threads) {
+            const auto wanted = (unsigned int) std::ceil(cost / (double) std::max<size_t>(1, min_cost_per_thread));
+            return std::clamp(wanted, 1u, std::max(1u, max_threads));
+        }
+
+    private:
+        std::vector<std::vector<float>> submit_(const TaskKind kind, const std::vector<std::vector<int>>& batch_input_ids) {
+            if (batch_input_ids.empty()) {
+                return {};
+            }
+            const auto request = std::make_shared<Request>();
+            request->kind = kind;
+            request->inputs = &batch_input_ids;
+            request->outputs.resize(batch_input_ids.size());
+            request->remaining = batch_input_ids.size();
+
+            {
+                std::lock_guard lock {mutex_};
+                const auto now = Clock::now();
+                for (size_t i = 0; i < batch_input_ids.size(); ++i) {
+                    buckets_[{kind, bucket_length_(batch_input_ids[i].size())}].push_back({request, i, now});
+                }
+            }
+            cv_.notify_all();
+
+            std::unique_lock request_lock {request->mutex};
+            request->done.wait(request_lock, [&] { return request->remaining == 0; });
+            if (request->error) {
+                std::rethrow_exception(request->error);
+            }
+            return std::move(request->outputs);
+        }
+
+        [[nodiscard]] size_t bucket_length_(const size_t len) const {
+            const size_t bucket = std::max<size_t>(1, options_.seq_len_bucket_size);
+            return std::max<size_t>(1, (len + bucket - 1) / bucket * bucket);
+        }
+
+        [[nodiscard]] size_t bucket_capacity_(const size_t padded_length) const {
+            return std::max<size_t>(1, options_.max_batch_tokens / padded_length);
+        }
+
+        /**
+         * Pick a bucket to dispatch and move its sequences into `batch`. Caller should hold `mutex_`.
+         * @param now
+         * @param batch
+         * @param next_deadline set to the earliest time a bucket becomes ready if nothing is ready now
+         * @return padded length of picked bucket, or zero if none is ready
+         */
+        size_t take_batch_(const Clock::time_point now, std::vector<Item>& batch, std::optional<Clock::time_point>& next_deadline) {
+            auto picked = buckets_.end();
+            bool picked_starving = false;
+            double picked_cost = 0;
+            next_deadline.reset();
+
+            for (auto itr = buckets_.begin(); itr != buckets_.end(); ++itr) {
+                const auto& [key, items] = *itr;
+                if (items.empty()) continue;
+                const size_t capacity = bucket_capacity_(key.second);
+                const auto oldest = items.front().enqueued_at;
+                const auto deadline = oldest + options_.max_batch_delay;
+                if (!stopped_ && items.size() < capacity && deadline > now) {
+                    if (!next_deadline || deadline < *next_deadline) {
+                        next_deadline = deadline;
+                    }
+                    continue;
+                }
+
+                const bool starving = now - oldest >= options_.max_queue_delay;
+                const double cost = estimate_cost(std::min(items.size(), capacity), key.second, hidden_size_);
+                const bool better = picked == buckets_.end()
+                    || (starving && !picked_starving)
+                    || (starving && picked_starving && oldest < picked->second.front().enqueued_at)
+                    || (!starving && !picked_starving && cost < picked_cost);
+                if (better) {
+                    picked = itr;
+                    picked_starving = starving;
+                    picked_cost = cost;
+                }
+            }
+
+            if (picked == buckets_.end()) {
+                return 0;
+            }
+            auto& items = picked->second;
+            const size_t n = std::min(items.size(), bucket_capacity_(picked->first.second));
+            batch.assign(std::make_move_iterator(items.begin()), std::make_move_iterator(items.begin() + (int64_t) n));
+            items.erase(items.begin(), items.begin() + (int64_t) n);
+            const size_t padded_length = picked->first.second;
+            if (items.empty()) {
+                buckets_.erase(picked);
+            }
+            return padded_length;
+        }
+
+        [[nodiscard]] bool has_pending_() const {
+            return !buckets_.empty();
+        }
+
+        void work_() {
+            std::unique_lock lock {mutex_};
+            while (true) {
+                std::vector<Item> batch;
+                std::optional<Clock::time_point> next_deadline;
+                size_t padded_length = 0;
+                while (true) {
+                    if (stopped_ && !has_pending_()) {
+                        return;
+                    }
+                    // sequences are left in buckets until threads are free, so that they can still be joined by others
+                    if (free_threads_ <= 0) {
+                        cv_.wait(lock);
+                        continue;
+                    }
+                    if ((padded_length = take_batch_(Clock::now(), batch, next_deadline)) > 0) {
+                        break;
+                    }
+                    if (next_deadline) {
+                        cv_.wait_until(lock, *next_deadline);
+                    } else {
+                        cv_.wait(lock);
+                    }
+                }
+
+                const double cost = estimate_cost(batch.size(), padded_length, hidden_size_);
+                const auto threads = assign_threads(cost, options_.min_cost_per_thread, (unsigned int) free_threads_);
+                free_threads_ -= threads;
+                ++stats_.batches;
+                stats_.sequences += batch.size();
+                stats_.padded_tokens += batch.size() * padded_length;
+                lock.unlock();
+
+                run_batch_(batch, threads);
+
+                lock.lock();
+                free_threads_ += threads;
+                // wake workers waiting for free threads
+                cv_.notify_all();
+            }
+        }
+
+        void run_batch_(std::vector<Item>& batch, const unsigned int threads) const {
+            const GenerationConfig config {.num_threads = threads};
+            const TaskKind kind = batch.front().request->kind;
+            std::vector<std::vector<int>> batch_input_ids;
+            batch_input_ids.reserve(batch.size());
+            for (const auto& item: batch) {
+                batch_input_ids.push_back(item.request->inputs->at(item.index));
+            }
+
+            std::vector<std::vector<float>> outputs;
+            std::exception_ptr error;
+            try {
+                if (kind == kEmbeddingTask) {
+                    model_->batch_text_embedding(config, batch_input_ids, outputs);
+                } else {
+                    std::vector<float> scores;
+                    model_->batch_qa_rank(config, batch_input_ids, scores);
+                    outputs.reserve(scores.size());
+                    for (const float score: scores) {
+                        outputs.push_back({score});
+                    }
+                }
+            } catch (...) {
+                error = std::current_exception();
+            }
+
+            for (size_t i = 0; i < batch.size(); ++i) {
+                auto& request = *batch[i].request;
+                std::lock_guard request_lock {request.mutex};
+                if (error) {
+                    request.error = error;
+                } else {
+                    request.outputs[batch[i].index] = std::move(outputs[i]);
+                }
+                if (--request.remaining == 0) {
+                    request.done.notify_all();
+                }
+            }
+        }
+    };
+
+    using InferenceSchedulerPtr = std::shared_ptr<InferenceScheduler>;
+}
+
+#endif //INFERENCE_SCHEDULER_HPP
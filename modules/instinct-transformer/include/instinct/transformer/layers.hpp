@@ -8,6 +8,7 @@
 #include <ggml.h>
 #include <iostream>
 #include <cmath>
+#include <vector>
 
 #include <instinct/transformer/ops.hpp>
 
@@ -45,7 +46,12 @@ namespace INSTINCT_TRANSFORMER_NS::layers {
     struct ForwardContext final {
         ggml_context *g_ctx = nullptr;
         ggml_cgraph *g_cgraph = nullptr;
-        ggml_scratch g_scratch{};
+        // additive mask of [klen, 1, 1, batch] for padded positions in batched input. nullptr if no padding is involved.
+        ggml_tensor *attn_mask = nullptr;
+        // outputs other than the one returned by model, like per-token heads. They are kept in graph and can be read after compute.
+        std::vector<ggml_tensor *> extra_outputs;
+        // whether optional heads should be computed and recorded in `extra_outputs`
+        bool with_extra_outputs = false;
 
         ~ForwardContext() {
             ggml_free(g_ctx);
@@ -163,14 +169,24 @@ namespace INSTINCT_TRANSFORMER_NS::layers {
                 p[i] = i;
         }
 
+        // input: [batch, qlen]
         ggml_tensor *forward(ForwardContext *ctx, ggml_tensor *input, int n_past) override {
             int qlen = (int) input->ne[0];
+            int batch = (int) input->ne[1];
             ggml_tensor *idx = ggml_view_1d(ctx->g_ctx, indices, qlen,
                                             (n_past + pad_index) * ggml_element_size(indices));
 
-            ggml_tensor *output1 = ggml_get_rows(ctx->g_ctx, word_weight, input);
+            ggml_tensor *output1 = nullptr;
+            if (batch > 1) {
+                // ggml_get_rows only accepts 1d indices against a 2d weight, so flatten input and restore batch dim afterwards
+                output1 = ggml_get_rows(ctx->g_ctx, word_weight, ggml_reshape_1d(ctx->g_ctx, input, qlen * batch));
+                output1 = ggml_reshape_3d(ctx->g_ctx, output1, output1->ne[0], qlen, batch);
+            } else {
+                output1 = ggml_get_rows(ctx->g_ctx, word_weight, input);
+            }
             ggml_tensor *output2 = ggml_get_rows(ctx->g_ctx, position_weight, idx);
 
+            // position embeddings are broadcast over batch
             ggml_tensor *output = ggml_add_inplace(ctx->g_ctx, output1, output2);
 
             output = ln.forward(ctx, output);
@@ -231,9 +247,9 @@ namespace INSTINCT_TRANSFORMER_NS::layers {
             return kq;
         }
 
-        // k: [heads, qlen, head_size]
-        // q: [heads, qlen, head_size]
-        // v: [heads, head_size, klen]
+        // k: [batch, heads, qlen, head_size]
+        // q: [batch, heads, qlen, head_size]
+        // v: [batch, heads, head_size, klen]
         virtual ggml_tensor *calc_attn_scores(
                 ForwardContext *ctx,
                 int hidden_size,
@@ -254,6 +270,10 @@ namespace INSTINCT_TRANSFORMER_NS::layers {
 
             attn_scores = apply_pos_embedding_kq(ctx, attn_scores, hidden_size, qlen, pos);
 
+            // hide padded keys of batched input
+            if (ctx->attn_mask)
+                attn_scores = ggml_add_inplace(ctx->g_ctx, attn_scores, ctx->attn_mask);
+
             // attn_masked = mask_past(attn_scores)
             struct ggml_tensor *attn_masked = causal_ ? ggml_diag_mask_inf_inplace(ctx->g_ctx, attn_scores, n_past)
                                                       : attn_scores;
@@ -261,11 +281,12 @@ namespace INSTINCT_TRANSFORMER_NS::layers {
             // attn_probs = soft_max(attn_masked)
             struct ggml_tensor *attn_probs = ggml_soft_max_inplace(ctx->g_ctx, attn_masked);
 
-            ggml_tensor *context_layer = ggml_mul_mat(ctx->g_ctx, value_layer, attn_probs); // [heads, qlen, head_size]
-            context_layer = ggml_reshape_2d(
+            ggml_tensor *context_layer = ggml_mul_mat(ctx->g_ctx, value_layer, attn_probs); // [batch, heads, qlen, head_size]
+            const int batch = (int) context_layer->ne[3];
+            context_layer = ggml_reshape_3d(
                     ctx->g_ctx,
                     ggml_cont(ctx->g_ctx, ggml_permute(ctx->g_ctx, context_layer, 0, 2, 1, 3)),
-                    hidden_size, qlen);
+                    hidden_size, qlen, batch);
 
             return context_layer;
         }
@@ -366,13 +387,14 @@ namespace INSTINCT_TRANSFORMER_NS::layers {
             const int head_size = hidden_size / num_attention_heads;
             const int repeat = num_attention_heads / num_kv_heads;
             const int kv_hidden_size = hidden_size / repeat;
+            const int batch = (int) q->ne[2];
 
-            // [qlen, heads, head_size]
-            ggml_tensor *key_layer = ggml_reshape_3d(ctx->g_ctx, k, head_size, num_kv_heads, qlen);
+            // [batch, qlen, heads, head_size]
+            ggml_tensor *key_layer = ggml_reshape_4d(ctx->g_ctx, k, head_size, num_kv_heads, qlen, batch);
             key_layer = apply_pos_embedding_k(ctx, key_layer, hidden_size, qlen, pos);
 
-            // [qlen, heads, head_size]
-            ggml_tensor *query_layer = ggml_reshape_3d(ctx->g_ctx, q, head_size, num_attention_heads, qlen);
+            // [batch, qlen, heads, head_size]
+            ggml_tensor *query_layer = ggml_reshape_4d(ctx->g_ctx, q, head_size, num_attention_heads, qlen, batch);
             query_layer = apply_pos_embedding_q(ctx, query_layer, hidden_size, qlen, pos);
 
             if (!attn_scaling_)
@@ -382,7 +404,7 @@ namespace INSTINCT_TRANSFORMER_NS::layers {
             save_to_cache(ctx, kv_hidden_size, n_past, qlen, key_layer, v);
 
             query_layer = ggml_permute(ctx->g_ctx, query_layer, 0, 2, 1,
-                                       3);                     // [heads, qlen, head_size]
+                                       3);                     // [batch, heads, qlen, head_size]
 
             key_layer = get_k_from_cache(ctx, hidden_size, n_past, qlen);
 
@@ -424,22 +446,23 @@ namespace INSTINCT_TRANSFORMER_NS::layers {
             raw_v = v;
         }
 
-        // output: [heads, qlen, head_size]
+        // output: [batch, heads, qlen, head_size]
         ggml_tensor *
         get_k_from_cache(ForwardContext *ctx, const int hidden_size, const int n_past, const int qlen) override {
             ggml_tensor *r = ggml_permute(ctx->g_ctx, raw_k, 0, 2, 1, 3);
             return r;
         }
 
-        // output: [heads, head_size, klen]
+        // output: [batch, heads, head_size, klen]
         ggml_tensor *
         get_v_from_cache(ForwardContext *ctx, const int hidden_size, const int n_past, const int qlen) override {
             const int head_size = hidden_size / num_attention_heads;
+            const int batch = (int) raw_v->ne[2];
 
-            // [qlen, hidden_size] -> [heads, head_size, qlen]
-            ggml_tensor *r = ggml_reshape_3d(ctx->g_ctx, raw_v, head_size, num_kv_heads,
-                                             qlen);  // -> [qlen, heads, head_size]
-            r = ggml_permute(ctx->g_ctx, r, 1, 2, 0, 3);   // [heads, head_size, qlen]
+            // [batch, qlen, hidden_size] -> [batch, heads, head_size, qlen]
+            ggml_tensor *r = ggml_reshape_4d(ctx->g_ctx, raw_v, head_size, num_kv_heads,
+                                             qlen, batch);  // -> [batch, qlen, heads, head_size]
+            r = ggml_permute(ctx->g_ctx, r, 1, 2, 0, 3);   // [batch, heads, head_size, qlen]
             r = ggml_cont(ctx->g_ctx, r);
             return r;
         }
@@ -555,11 +578,38 @@ namespace INSTINCT_TRANSFORMER_NS::layers {
                 : RobertaSelfAttention(ctx, hidden_size, num_attention_heads, num_kv_heads, max_length, true, true) {}
 
         RobertaSelfAttention(InitContext *ctx, int hidden_size, int num_attention_heads, int num_kv_heads, int max_length, bool qkv_bias, bool o_bias)
-                : BaseSelfAttention(ctx, hidden_size, num_attention_heads, num_kv_heads, max_length, qkv_bias, o_bias)
+                : BaseSelfAttention(ctx, hidden_size, num_attention_heads, num_kv_heads, max_length, qkv_bias, o_bias),
+                  fused_attention(true)
         {
             causal_ = false;
         }
 
+        using Block::forward;
+
+        ggml_tensor *forward(ForwardContext *ctx, ggml_tensor *hidden_states, int n_past) override {
+            if (!fused_attention || num_attention_heads != num_kv_heads) {
+                return BaseSelfAttention::forward(ctx, hidden_states, n_past);
+            }
+            const int hidden_size = o_proj.in_features();
+            const int head_size = hidden_size / num_attention_heads;
+            const int qlen = (int) hidden_states->ne[1];
+            const int batch = (int) hidden_states->ne[2];
+
+            // projections are used as-is in [batch, qlen, heads, head_size], and context layer comes out in the same layout, so no permute or copy is needed
+            ggml_tensor *q = q_proj.forward(ctx, hidden_states);
+            q = ggml_scale_inplace(ctx->g_ctx, q, 1.f / sqrtf((float) head_size));
+            q = ggml_reshape_4d(ctx->g_ctx, q, head_size, num_attention_heads, qlen, batch);
+            ggml_tensor *k = ggml_reshape_4d(ctx->g_ctx, k_proj.forward(ctx, hidden_states), head_size, num_kv_heads, qlen, batch);
+            ggml_tensor *v = ggml_reshape_4d(ctx->g_ctx, v_proj.forward(ctx, hidden_states), head_size, num_kv_heads, qlen, batch);
+
+            ggml_tensor *context_layer = ops::ggml_fused_attention(ctx->g_ctx, q, k, v, ctx->attn_mask);
+            context_layer = ggml_reshape_3d(ctx->g_ctx, context_layer, hidden_size, qlen, batch);
+            return o_proj.forward(ctx, context_layer);
+        }
+
+        // use fused attention op instead of separate matmul, scale, mask and softmax ops
+        bool fused_attention;
+
     protected:
         // input & output: [qlen, heads, head_size]
         ggml_tensor *apply_pos_embedding_k(ForwardContext *ctx, ggml_tensor *k, int hidden_size, int qlen, ggml_tensor * past) const override
@@ -665,14 +715,15 @@ namespace INSTINCT_TRANSFORMER_NS::layers {
 
         ggml_tensor *forward(ForwardContext *ctx, ggml_tensor *hidden_states) override {
             int hidden_size = (int)hidden_states->ne[0];
+            int batch = (int)hidden_states->ne[2];
 
-            // We "pool" the model by simply taking the hidden state corresponding to the first token.
-            ggml_tensor *first_token_tensor = ggml_view_2d(ctx->g_ctx, hidden_states, hidden_size, 1,
-                                                           hidden_size * ggml_element_size(hidden_states), 0);
+            // We "pool" the model by simply taking the hidden state corresponding to the first token of each sequence.
+            ggml_tensor *first_token_tensor = ggml_view_2d(ctx->g_ctx, hidden_states, hidden_size, batch,
+                                                           hidden_states->nb[2], 0);
             ggml_tensor *output = dense.forward(ctx, first_token_tensor);
             output = inplace_act(ctx->g_ctx, activation, output);
             output = out_proj.forward(ctx, output);
-            output = ggml_map_custom1(ctx->g_ctx, output, ops::ggml_compute_forward_sigmoid, 1, nullptr);
+            output = ggml_map_custom1(ctx->g_ctx, output, ops::ggml_compute_forward_sigmoid, GGML_N_TASKS_MAX, nullptr);
             return output;
         }
 
@@ -689,10 +740,56 @@ namespace INSTINCT_TRANSFORMER_NS::layers {
 
         ggml_tensor *forward(ForwardContext *ctx, ggml_tensor *hidden_states) override {
             int hidden_size = (int)hidden_states->ne[0];
-            ggml_tensor *first_token_tensor = ggml_view_1d(ctx->g_ctx, hidden_states, hidden_size, 0);
-            ggml_tensor *output = ggml_map_custom1(ctx->g_ctx, first_token_tensor, ops::ggml_compute_forward_simple_norm, 1, this);
+            int batch = (int)hidden_states->ne[2];
+            // [batch, hidden_size] of CLS tokens
+            ggml_tensor *first_token_tensor = ggml_view_2d(ctx->g_ctx, hidden_states, hidden_size, batch,
+                                                           hidden_states->nb[2], 0);
+            ggml_tensor *output = ggml_map_custom1(ctx->g_ctx, first_token_tensor, ops::ggml_compute_forward_simple_norm, GGML_N_TASKS_MAX, this);
+            return output;
+        }
+    };
+
+    /**
+     * Output heads of BGE-M3. Returned tensor is the dense embedding, exactly as `BCEFinalNorm`.
+     *
+     * If weights of sparse and ColBERT heads are loaded and `ForwardContext::with_extra_outputs` is set, two more tensors are recorded in `ForwardContext::extra_outputs` of the same forward:
+     * 1. lexical weight of each token, of [batch, qlen, 1]
+     * 2. normalized ColBERT vector of each token, of [batch, qlen, hidden_size]
+     */
+    class BGEM3Heads final: public Block
+    {
+    public:
+        BGEM3Heads() = default;
+        BGEM3Heads(InitContext *ctx, int hidden_size):
+            sparse_linear(ctx, hidden_size, 1),
+            colbert_linear(ctx, hidden_size, hidden_size) {}
+
+        ggml_tensor *forward(ForwardContext *ctx, ggml_tensor *hidden_states) override {
+            int hidden_size = (int)hidden_states->ne[0];
+            int batch = (int)hidden_states->ne[2];
+            // [batch, hidden_size] of CLS tokens
+            ggml_tensor *first_token_tensor = ggml_view_2d(ctx->g_ctx, hidden_states, hidden_size, batch,
+                                                           hidden_states->nb[2], 0);
+            ggml_tensor *output = ggml_map_custom1(ctx->g_ctx, first_token_tensor, ops::ggml_compute_forward_simple_norm, GGML_N_TASKS_MAX, this);
+
+            // dense-only forwards skip both heads, which are as costly as a large linear over every token
+            if (multi_output && ctx->with_extra_outputs) {
+                ggml_tensor *token_weights = sparse_linear.forward(ctx, hidden_states);
+                token_weights = ggml_relu_inplace(ctx->g_ctx, token_weights);
+                ctx->extra_outputs.push_back(token_weights);
+
+                // CLS token is projected as well, which is cheaper than making a contiguous copy without it. Caller should skip it.
+                ggml_tensor *colbert_vecs = colbert_linear.forward(ctx, hidden_states);
+                colbert_vecs = ggml_map_custom1(ctx->g_ctx, colbert_vecs, ops::ggml_compute_forward_simple_norm, GGML_N_TASKS_MAX, this);
+                ctx->extra_outputs.push_back(colbert_vecs);
+            }
             return output;
         }
+
+        Linear sparse_linear;
+        Linear colbert_linear;
+        // whether weights of sparse and ColBERT heads are loaded
+        bool multi_output = false;
     };
 
 
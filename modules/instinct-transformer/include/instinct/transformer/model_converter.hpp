@@ -0,0 +1,160 @@
+#ifndef MODEL_CONVERTER_HPP
+#define MODEL_CONVERTER_HPP
+
+#include <fstream>
+
+#include <instinct/transformer_global.hpp>
+#include <instinct/transformer/model_factory.hpp>
+
+namespace INSTINCT_TRANSFORMER_NS {
+
+    /**
+     * Offline counterpart of load-time conversion in `ModelLoader`. It rewrites a model file with weight matrices stored in another type, so that the cost of conversion is paid only once.
+     *
+     * Layout of model file is kept: header, config, tokenizer proto and tensors. Only 2D tensors of config's dtype are converted, as biases and norm weights are always float.
+     *
+     * Float tensors can be appended after conversion, e.g. sparse and ColBERT heads of BGE-M3, which are shipped separately from encoder in original model.
+     */
+    class ModelConverter {
+        ModelLoader loader_;
+        std::ofstream output_;
+
+    public:
+        ModelConverter(const std::string& input_path, const std::string& output_path):
+            loader_(input_path),
+            output_(output_path, std::ios::binary | std::ios::trunc) {
+            GGML_ASSERT(output_.good());
+        }
+
+        /**
+         * @param weight_type target type of weight matrices. `GGML_TYPE_COUNT` means no conversion, which only copies model file.
+         * @return count of converted tensors
+         */
+        size_t convert(const ggml_type weight_type) {
+            GGML_ASSERT(weight_type == GGML_TYPE_COUNT || is_supported_weight_type(weight_type));
+            loader_.seek(0, SEEK_SET);
+            const std::string magic = loader_.read_string(4);
+            GGML_ASSERT(magic == "ggml");
+            const auto model_type = loader_.read_basic<int>();
+            const auto version = loader_.read_basic<int>();
+            output_.write(magic.data(), (std::streamsize) magic.size());
+            write_basic(model_type);
+            write_basic(version);
+
+            switch (model_type) {
+                case ModelType::BGE_M3_RERANKER:
+                    return convert_<bge::ranker::Tokenizer, bge::ranker::Config>(weight_type);
+                case ModelType::BGE_M3_EMBEDDING:
+                    return convert_<bge::embedding::Tokenizer, bge::embedding::Config>(weight_type);
+                default:
+                    throw std::runtime_error("unknown model type");
+            }
+        }
+
+        /**
+         * Append a float tensor to output file. It should be called after `convert`. Weight matrices are converted to model's weight type when loaded.
+         * @param name name of tensor, e.g. `sparse_linear.weight`
+         * @param shape dims of tensor with outermost first, which is the same order of PyTorch
+         * @param values values in row-major order
+         */
+        void append_tensor(const std::string& name, const std::vector<int>& shape, const std::vector<float>& values) {
+            GGML_ASSERT(!shape.empty() && shape.size() <= 4);
+            int64_t count = 1;
+            for (const int dim: shape) {
+                count *= dim;
+            }
+            GGML_ASSERT(count == (int64_t) values.size());
+
+            write_basic((int) name.size());
+            output_.write(name.data(), (std::streamsize) name.size());
+            write_basic((int) shape.size());
+            for (const int dim: shape) {
+                write_basic(dim);
+            }
+            write_basic((int) GGML_TYPE_F32);
+
+            constexpr int64_t MEM_ALIGNED = 16;
+            const int64_t pos = output_.tellp();
+            const int64_t padding = ((pos + (MEM_ALIGNED - 1)) & ~(MEM_ALIGNED - 1)) - pos;
+            for (int64_t i = 0; i < padding; ++i) {
+                output_.put(0);
+            }
+            output_.write(reinterpret_cast<const char *>(values.data()), (std::streamsize) (values.size() * sizeof(float)));
+            output_.flush();
+            GGML_ASSERT(output_.good());
+        }
+
+    private:
+        template<typename T>
+        void write_basic(const T& obj) {
+            output_.write(reinterpret_cast<const char *>(&obj), sizeof(T));
+        }
+
+        template<typename Tokenizer, typename Config>
+        requires std::derived_from<Tokenizer, BaseTokenizer> && std::derived_from<Config, BaseConfig>
+        size_t convert_(const ggml_type weight_type) {
+            auto config = loader_.read_basic<Config>();
+            const ggml_type src_type = config.dtype;
+            if (weight_type != GGML_TYPE_COUNT) {
+                config.dtype = weight_type;
+            }
+            write_basic(config);
+
+            // tokenizer proto is copied as is
+            Tokenizer tokenizer(config);
+            const auto proto_size = tokenizer.load(loader_.ptr, config.vocab_size);
+            output_.write(loader_.ptr, (std::streamsize) proto_size);
+            loader_.seek((int64_t) proto_size, SEEK_CUR);
+
+            size_t converted = 0;
+            std::vector<char> buffer;
+            while (loader_.tell() < (int64_t) loader_.size) {
+                const int name_size = loader_.read_basic<int>();
+                const std::string name = loader_.read_string(name_size);
+                write_basic(name_size);
+                output_.write(name.data(), name_size);
+
+                int64_t ne[4] = {1, 1, 1, 1};
+                const int ndim = loader_.read_basic<int>();
+                write_basic(ndim);
+                for (int i = ndim - 1; i >= 0; i--) {
+                    const int dim_size = loader_.read_basic<int>();
+                    ne[i] = dim_size;
+                    write_basic(dim_size);
+                }
+
+                const auto dtype = (ggml_type) loader_.read_basic<int>();
+                const auto out_type = (ndim == 2 && dtype == src_type && weight_type != GGML_TYPE_COUNT) ? weight_type : dtype;
+                write_basic((int) out_type);
+
+                constexpr int64_t MEM_ALIGNED = 16;
+                const int64_t data_offset = (loader_.tell() + (MEM_ALIGNED - 1)) & ~(MEM_ALIGNED - 1);
+                const int64_t nrows = ne[1] * ne[2] * ne[3];
+                const auto src_size = (int64_t) ggml_row_size(dtype, ne[0]) * nrows;
+                const auto dst_size = (int64_t) ggml_row_size(out_type, ne[0]) * nrows;
+
+                const int64_t pos = output_.tellp();
+                const int64_t padding = ((pos + (MEM_ALIGNED - 1)) & ~(MEM_ALIGNED - 1)) - pos;
+                for (int64_t i = 0; i < padding; ++i) {
+                    output_.put(0);
+                }
+
+                if (out_type == dtype) {
+                    output_.write(loader_.data + data_offset, src_size);
+                } else {
+                    buffer.resize(dst_size);
+                    convert_weights(loader_.data + data_offset, dtype, buffer.data(), out_type, nrows, ne[0]);
+                    output_.write(buffer.data(), dst_size);
+                    ++converted;
+                }
+                loader_.seek(data_offset + src_size, SEEK_SET);
+            }
+            output_.flush();
+            GGML_ASSERT(output_.good());
+            return converted;
+        }
+    };
+
+}
+
+#endif //MODEL_CONVERTER_HPP
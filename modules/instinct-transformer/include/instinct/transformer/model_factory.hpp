@@ -26,6 +26,44 @@ namespace INSTINCT_TRANSFORMER_NS {
         throw std::runtime_error("unknown model type");
     }
 
+    /**
+     * Parse weight type name like `q4_1`, `q8_0` or `f16`. Empty string means weights are used as stored in model file, and `GGML_TYPE_COUNT` is returned.
+     */
+    static ggml_type parse_weight_type(const std::string& name) {
+        if (name.empty()) {
+            return GGML_TYPE_COUNT;
+        }
+        for (int i = 0; i < GGML_TYPE_COUNT; ++i) {
+            const auto type = static_cast<ggml_type>(i);
+            if (is_supported_weight_type(type) && name == ggml_type_name(type)) {
+                return type;
+            }
+        }
+        throw std::runtime_error("unsupported weight type: " + name);
+    }
+
+
+    struct ModelLoadOptions {
+        /**
+         * Type of weight matrices. Weights are converted at load time if it's different from the one in model file. `GGML_TYPE_COUNT` means no conversion.
+         */
+        ggml_type weight_type = GGML_TYPE_COUNT;
+
+        /**
+         * How model file is mapped. It only takes effect when a model file is loaded for the first time, as mapping is shared by all models of the same file.
+         */
+        MappedFileOptions mapping = {};
+
+        /**
+         * Run a dummy forward before returning model
+         */
+        bool warm_up = false;
+
+        /**
+         * Threads used by warm-up forward
+         */
+        unsigned int warm_up_threads = std::max(1u, std::thread::hardware_concurrency());
+    };
 
     /**
      * A factory class that manages lifecycle of model instances
@@ -46,18 +84,39 @@ namespace INSTINCT_TRANSFORMER_NS {
         /**
          * Load model by weight file path. Same instance will be returned for single model path.
          * @param model_path
+         * @param weight_type type of weight matrices. Weights are converted at load time if it's different from the one in model file. `GGML_TYPE_COUNT` means no conversion.
+         * @return
+         */
+        std::pair<ModelPtr, TokenizerPtr> load(const std::string& model_path, const ggml_type weight_type = GGML_TYPE_COUNT) {
+            return load(model_path, ModelLoadOptions {.weight_type = weight_type});
+        }
+
+        /**
+         * Load model with given options. Time spent on loading and warm-up is reported by `BaseModel::get_cold_start_stats`.
+         * @param model_path
+         * @param options
          * @return
          */
-        std::pair<ModelPtr, TokenizerPtr> load(const std::string& model_path) {
+        std::pair<ModelPtr, TokenizerPtr> load(const std::string& model_path, const ModelLoadOptions& options) {
+            const auto t1 = std::chrono::steady_clock::now();
+            auto result = load_model_file_(model_path, options.weight_type, options.mapping);
+            result.first->set_load_time(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - t1).count());
+            if (options.warm_up) {
+                result.first->warm_up({.num_threads = options.warm_up_threads});
+            }
+            return result;
+        }
+
+    private:
+        std::pair<ModelPtr, TokenizerPtr> load_model_file_(const std::string& model_path, const ggml_type weight_type, const MappedFileOptions& mapping) {
             std::shared_ptr<ModelLoader> loader = nullptr;
-            { // sequential access to model_loaders_
-                std::lock_guard loader_lock {mutex_};
-                if(model_loaders_.contains(model_path)) {
-                    loader = model_loaders_.at(model_path);
-                } else {
-                    loader = std::make_shared<ModelLoader>(model_path);
-                    model_loaders_.emplace(model_path, loader);
-                }
+            // loaders are shared by path and keep a read cursor, so whole loading process has to be sequential
+            std::lock_guard loader_lock {mutex_};
+            if(model_loaders_.contains(model_path)) {
+                loader = model_loaders_.at(model_path);
+            } else {
+                loader = std::make_shared<ModelLoader>(model_path, mapping);
+                model_loaders_.emplace(model_path, loader);
             }
 
             // read headers
@@ -70,11 +129,11 @@ namespace INSTINCT_TRANSFORMER_NS {
             switch (model_type) {
                 case ModelType::BGE_M3_RERANKER: {
                     GGML_ASSERT(version == 1);
-                    return load_<bge::ranker::Tokenizer, bge::ranker::BGERerankerModel, bge::ranker::Config>(*loader);
+                    return load_<bge::ranker::Tokenizer, bge::ranker::BGERerankerModel, bge::ranker::Config>(*loader, weight_type);
                 }
                 case ModelType::BGE_M3_EMBEDDING: {
                     GGML_ASSERT(version == 1);
-                    return load_<bge::embedding::Tokenizer, bge::embedding::BGEEmbeddingModel, bge::embedding::Config>(*loader);
+                    return load_<bge::embedding::Tokenizer, bge::embedding::BGEEmbeddingModel, bge::embedding::Config>(*loader, weight_type);
                 }
                 default:
                     // TODO throw exception
@@ -82,10 +141,9 @@ namespace INSTINCT_TRANSFORMER_NS {
             }
         }
 
-    private:
         template<typename Tokenizer, typename Model, typename Config>
         requires std::derived_from<Tokenizer, BaseTokenizer> && std::derived_from<Model, BaseModel> && std::derived_from<Config, BaseConfig>
-        std::pair<ModelPtr, TokenizerPtr> load_(ModelLoader& loader) {
+        std::pair<ModelPtr, TokenizerPtr> load_(ModelLoader& loader, const ggml_type weight_type) {
             // read config
             if (0 == loader.offset_config)
                 loader.offset_config = loader.tell();
@@ -111,6 +169,10 @@ namespace INSTINCT_TRANSFORMER_NS {
             loader.seek(loader.offset_tensors, SEEK_SET);
 
             // load model
+            if (weight_type != GGML_TYPE_COUNT && weight_type != config.dtype) {
+                GGML_ASSERT(is_supported_weight_type(weight_type));
+                config.dtype = weight_type;
+            }
             auto model = std::make_shared<Model>(config);
             model->load(loader);
 
@@ -6,6 +6,8 @@
 #define CXX_TEST_MODEL_HPP
 
 #include <ggml.h>
+#include <ggml-alloc.h>
+#include <ggml-backend.h>
 #include <string>
 #include <sys/mman.h>
 #include <sys/stat.h>
@@ -15,6 +17,17 @@
 #include <unistd.h>
 #include <memory>
 #include <vector>
+#include <numeric>
+#include <algorithm>
+#include <cmath>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <thread>
+#include <list>
+#include <atomic>
+#include <chrono>
+#include <utility>
 
 
 #include <instinct/transformer/config.hpp>
@@ -28,6 +41,167 @@ namespace INSTINCT_TRANSFORMER_NS::models {
         unsigned int num_threads;
     };
 
+    /**
+     * Default count of forward passes allowed to run at the same time for a single model instance.
+     * @return
+     */
+    inline size_t default_model_concurrency() {
+        // matmul in ggml hardly scales beyond eight threads, so it's better to spend the rest of cores on parallel forwards
+        return std::max<size_t>(1, std::thread::hardware_concurrency() / 8);
+    }
+
+    /**
+     * A compute graph recorded for a specific input shape. Its context only holds tensor metadata, and tensor data is placed in compute buffer of `ForwardBuffer` by graph allocator.
+     */
+    struct CachedGraph {
+        int64_t qlen = 0;
+        int64_t batch_size = 0;
+        bool masked = false;
+        int past = 0;
+        bool with_extra_outputs = false;
+        ggml_context *ctx = nullptr;
+        ggml_cgraph *graph = nullptr;
+        ggml_tensor *input_ids = nullptr;
+        ggml_tensor *attn_mask = nullptr;
+        ggml_tensor *output = nullptr;
+        std::vector<ggml_tensor *> extra_outputs;
+
+        CachedGraph() = default;
+        CachedGraph(const CachedGraph&) = delete;
+        CachedGraph& operator=(const CachedGraph&) = delete;
+
+        ~CachedGraph() {
+            ggml_free(ctx);
+        }
+    };
+
+    struct GraphAllocatorDeleter {
+        void operator()(ggml_gallocr *allocator) const {
+            ggml_gallocr_free(allocator);
+        }
+    };
+
+    /**
+     * Buffers for a single forward pass. Weights are mapped from model file, and other tensors in a compute graph are placed by a graph allocator, which plans offsets by liveness of tensors so that buffers are reused across ops.
+     *
+     * Size of compute buffer is decided by the largest graph ever allocated, so it scales with actual batch size and sequence length.
+     */
+    struct ForwardBuffer {
+        std::unique_ptr<ggml_gallocr, GraphAllocatorDeleter> allocator;
+        CachedGraph *allocated = nullptr; // graph whose tensors are currently placed in compute buffer
+        std::vector<uint8_t> work_buffer; // work data for ggml compute plan
+        std::list<std::unique_ptr<CachedGraph>> graphs; // most recently used graph comes first
+    };
+
+    /**
+     * Counters of graph cache in `BaseGenerationModel`. A miss means a graph is recorded for a new input shape.
+     */
+    struct GraphCacheStats {
+        size_t hits = 0;
+        size_t misses = 0;
+    };
+
+    struct ColdStartStats {
+        /**
+         * Time spent on mapping model file, reading and converting weights
+         */
+        int64_t load_ms = 0;
+        /**
+         * Time spent on dummy forward at startup. Zero if warm-up is not requested.
+         */
+        int64_t warm_up_ms = 0;
+        /**
+         * Latency of the first forward serving real input, or -1 if there is none yet. Without prefetch or warm-up it includes page faults of weights and graph building.
+         */
+        int64_t first_forward_ms = -1;
+    };
+
+    /**
+     * All outputs of BGE-M3 for a single sequence, computed in one forward
+     */
+    struct HybridEmbedding {
+        /**
+         * Normalized embedding of CLS token, same as the one from `BaseModel::text_embedding`
+         */
+        std::vector<float> dense;
+        /**
+         * Max weight of each distinct token id in sequence, sorted by token id. Special tokens and tokens of zero weight are excluded.
+         */
+        std::vector<std::pair<int, float>> lexical_weights;
+        /**
+         * Normalized ColBERT vector of each token except CLS
+         */
+        std::vector<std::vector<float>> multi_vectors;
+    };
+
+    /**
+     * A bounded pool of `ForwardBuffer`. Buffers are allocated lazily, and callers will be blocked if all buffers are leased out.
+     */
+    class ForwardBufferPool {
+    public:
+        using Lease = std::unique_ptr<ForwardBuffer, std::function<void(ForwardBuffer*)>>;
+
+        explicit ForwardBufferPool(const size_t max_size = 1):
+            max_size_(std::max<size_t>(1, max_size)),
+            created_(0) {}
+
+        ForwardBufferPool(const ForwardBufferPool&)=delete;
+        ForwardBufferPool(ForwardBufferPool&&)=delete;
+
+        Lease acquire() {
+            std::unique_lock lock {mutex_};
+            cv_.wait(lock, [&] { return !idle_.empty() || created_ < max_size_; });
+            ForwardBuffer *buffer;
+            if (!idle_.empty()) {
+                buffer = idle_.back().release();
+                idle_.pop_back();
+            } else {
+                // compute buffer is allocated on first forward
+                buffer = new ForwardBuffer {
+                    .allocator = std::unique_ptr<ggml_gallocr, GraphAllocatorDeleter>(ggml_gallocr_new(ggml_backend_cpu_buffer_type()))
+                };
+                ++created_;
+            }
+            return {buffer, [this](ForwardBuffer *released) { release(released); }};
+        }
+
+        void set_max_size(const size_t max_size) {
+            std::lock_guard lock {mutex_};
+            max_size_ = std::max<size_t>(1, max_size);
+            while (created_ > max_size_ && !idle_.empty()) {
+                idle_.pop_back();
+                --created_;
+            }
+            cv_.notify_all();
+        }
+
+        [[nodiscard]] size_t get_max_size() {
+            std::lock_guard lock {mutex_};
+            return max_size_;
+        }
+
+    private:
+        void release(ForwardBuffer *buffer) {
+            {
+                std::lock_guard lock {mutex_};
+                if (created_ > max_size_) {
+                    // pool has been shrunk
+                    delete buffer;
+                    --created_;
+                } else {
+                    idle_.emplace_back(buffer);
+                }
+            }
+            cv_.notify_one();
+        }
+
+        size_t max_size_;
+        size_t created_;
+        std::vector<std::unique_ptr<ForwardBuffer>> idle_;
+        std::mutex mutex_;
+        std::condition_variable cv_;
+    };
+
     static ggml_tensor * ggml_init_tensor(ggml_tensor *tensor,
                                    const ggml_type type,
                                    const int n_dims,
@@ -74,10 +248,89 @@ namespace INSTINCT_TRANSFORMER_NS::models {
     }
 
 
+    /**
+     * Weight types that can be produced by `convert_weights`. Quantized types that require importance matrix are excluded.
+     */
+    static bool is_supported_weight_type(const ggml_type type) {
+        switch (type) {
+            case GGML_TYPE_F32:
+            case GGML_TYPE_F16:
+            case GGML_TYPE_Q4_0:
+            case GGML_TYPE_Q4_1:
+            case GGML_TYPE_Q5_0:
+            case GGML_TYPE_Q5_1:
+            case GGML_TYPE_Q8_0:
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    /**
+     * Convert rows of weights from `src_type` to `dst_type` by dequantizing to float and quantizing again. Rows are processed in chunks so that float copy of large embedding tables is never materialized as a whole.
+     * @param src source data with `nrows * n_per_row` elements of `src_type`
+     * @param dst destination data with `ggml_row_size(dst_type, n_per_row) * nrows` bytes
+     */
+    static void convert_weights(const void *src, const ggml_type src_type, void *dst, const ggml_type dst_type, const int64_t nrows, const int64_t n_per_row) {
+        GGML_ASSERT(is_supported_weight_type(src_type));
+        GGML_ASSERT(is_supported_weight_type(dst_type));
+        GGML_ASSERT(n_per_row % ggml_blck_size(src_type) == 0);
+        GGML_ASSERT(n_per_row % ggml_blck_size(dst_type) == 0);
+
+        const size_t src_row_size = ggml_row_size(src_type, n_per_row);
+        const size_t dst_row_size = ggml_row_size(dst_type, n_per_row);
+        if (src_type == dst_type) {
+            std::memcpy(dst, src, src_row_size * nrows);
+            return;
+        }
+
+        constexpr int64_t CHUNK_ROWS = 256;
+        const auto src_traits = ggml_internal_get_type_traits(src_type);
+        std::vector<float> buffer(CHUNK_ROWS * n_per_row);
+        for (int64_t row = 0; row < nrows; row += CHUNK_ROWS) {
+            const int64_t rows = std::min(CHUNK_ROWS, nrows - row);
+            const int64_t n = rows * n_per_row;
+            const char *src_chunk = (const char *) src + row * src_row_size;
+            char *dst_chunk = (char *) dst + row * dst_row_size;
+
+            const float *f32 = buffer.data();
+            if (src_type == GGML_TYPE_F32) {
+                f32 = (const float *) src_chunk;
+            } else {
+                src_traits.to_float(src_chunk, buffer.data(), n);
+            }
+
+            if (dst_type == GGML_TYPE_F32) {
+                std::memcpy(dst_chunk, f32, n * sizeof(float));
+            } else if (dst_type == GGML_TYPE_F16) {
+                ggml_fp32_to_fp16_row(f32, (ggml_fp16_t *) dst_chunk, n);
+            } else {
+                ggml_quantize_chunk(dst_type, f32, dst_chunk, 0, rows, n_per_row, nullptr);
+            }
+        }
+    }
+
+    struct MappedFileOptions {
+        /**
+         * Fault in all pages while mapping with `MAP_POPULATE`, so that loading blocks until whole file is in memory. Only available on Linux.
+         */
+        bool populate = false;
+
+        /**
+         * Hint kernel with `MADV_WILLNEED` and touch every page in a background thread, so that loading returns immediately while page faults are taken off the first forward.
+         */
+        bool prefetch = false;
+
+        /**
+         * Ask for transparent huge pages with `MADV_HUGEPAGE` to reduce TLB misses during forward. It's best-effort, as file-backed huge pages depend on kernel config and file system.
+         */
+        bool huge_pages = false;
+    };
+
     class MappedFile
     {
     public:
-        explicit MappedFile(const std::string &path) {
+        explicit MappedFile(const std::string &path, const MappedFileOptions& options = {}) {
             int fd = open(path.c_str(), O_RDONLY);
             GGML_ASSERT(fd>0);
 
@@ -85,20 +338,81 @@ namespace INSTINCT_TRANSFORMER_NS::models {
             GGML_ASSERT(fstat(fd, &sb) == 0);
             size = sb.st_size;
 
-            data = (char *)mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+            int flags = MAP_SHARED;
+#ifdef MAP_POPULATE
+            if (options.populate) {
+                flags |= MAP_POPULATE;
+            }
+#endif
+            data = (char *)mmap(nullptr, size, PROT_READ, flags, fd, 0);
             GGML_ASSERT(data != MAP_FAILED);
 
             GGML_ASSERT(close(fd) == 0);
+
+#ifdef MADV_HUGEPAGE
+            if (options.huge_pages) {
+                // failure only means huge pages are not supported for this mapping
+                madvise(data, size, MADV_HUGEPAGE);
+            }
+#endif
+            if (options.prefetch) {
+                madvise(data, size, MADV_WILLNEED);
+                prefetch_thread_ = std::thread([this] { prefetch_(); });
+            }
         }
+
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
         ~MappedFile() {
+            stopping_ = true;
+            if (prefetch_thread_.joinable()) {
+                prefetch_thread_.join();
+            }
             GGML_ASSERT(munmap(data, size) == 0);
         }
 
+        /**
+         * Block until background prefetch is done. It returns immediately if prefetch is not enabled.
+         */
+        void wait_prefetch() {
+            std::unique_lock lock {prefetch_mutex_};
+            prefetch_cv_.wait(lock, [&] { return !prefetch_thread_.joinable() || prefetch_done_; });
+        }
+
+        [[nodiscard]] size_t get_prefetched_bytes() const {
+            return prefetched_bytes_.load();
+        }
+
     public:
         char *data;
         size_t size;
-    };
 
+    private:
+        void prefetch_() {
+            const auto page_size = (size_t) sysconf(_SC_PAGESIZE);
+            // read one byte per page, so every page is faulted in by this thread
+            volatile char sink = 0;
+            size_t offset = 0;
+            for (; offset < size && !stopping_; offset += page_size) {
+                sink = sink + data[offset];
+                prefetched_bytes_.store(std::min(size, offset + page_size), std::memory_order_relaxed);
+            }
+            (void) sink;
+            {
+                std::lock_guard lock {prefetch_mutex_};
+                prefetch_done_ = true;
+            }
+            prefetch_cv_.notify_all();
+        }
+
+        std::thread prefetch_thread_;
+        std::atomic<bool> stopping_ = false;
+        std::atomic<size_t> prefetched_bytes_ = 0;
+        bool prefetch_done_ = false;
+        std::mutex prefetch_mutex_;
+        std::condition_variable prefetch_cv_;
+    };
 
     class ModelLoader {
     public:
@@ -113,10 +427,14 @@ namespace INSTINCT_TRANSFORMER_NS::models {
         int model_type;
         int version;
         std::map<std::string, int64_t> tensor_dict;
+        /**
+         * Weights converted at load time, keyed by tensor name and target type. They are kept with loader so that models loaded again with same precision can share them.
+         */
+        std::map<std::pair<std::string, ggml_type>, std::vector<char>> converted_tensors;
 
 
-        explicit ModelLoader(const std::string& model_file_path):
-                mapped_file(std::make_unique<MappedFile>(model_file_path)),
+        explicit ModelLoader(const std::string& model_file_path, const MappedFileOptions& mapped_file_options = {}):
+                mapped_file(std::make_unique<MappedFile>(model_file_path, mapped_file_options)),
                 data(mapped_file->data),
                 size(mapped_file->size),
                 ptr(mapped_file->data),
@@ -188,19 +506,35 @@ namespace INSTINCT_TRANSFORMER_NS::models {
                 }
             }
 
-            // read and check tensor dtype
-            {
-                auto dtype = (ggml_type)read_basic<int>();
-                GGML_ASSERT(dtype == tensor->type);
-            }
+            // read tensor dtype, which may differ from tensor if model is created with another weight type
+            const auto dtype = (ggml_type)read_basic<int>();
 
             // map tensor data
             {
                 constexpr int64_t MEM_ALIGNED = 16;
                 const int64_t data_offset = (tell() + (MEM_ALIGNED - 1)) & ~(MEM_ALIGNED - 1);
-                tensor->data = const_cast<char *>(data) + data_offset;
-                seek(data_offset + ggml_nbytes(tensor), SEEK_SET);
+                if (dtype == tensor->type) {
+                    tensor->data = const_cast<char *>(data) + data_offset;
+                    seek(data_offset + ggml_nbytes(tensor), SEEK_SET);
+                } else {
+                    tensor->data = convert_tensor(name, data + data_offset, dtype, tensor);
+                    seek(data_offset + (int64_t) ggml_row_size(dtype, tensor->ne[0]) * ggml_nrows(tensor), SEEK_SET);
+                }
+            }
+        }
+
+        [[nodiscard]] bool has_tensor(const std::string& name) const {
+            return tensor_dict.contains(name);
+        }
+
+        void *convert_tensor(const std::string& name, const char *src, const ggml_type src_type, const ggml_tensor *tensor) {
+            const auto key = std::make_pair(name, tensor->type);
+            if (const auto itr = converted_tensors.find(key); itr != converted_tensors.end()) {
+                return itr->second.data();
             }
+            std::vector<char> buffer(ggml_nbytes(tensor));
+            convert_weights(src, src_type, buffer.data(), tensor->type, ggml_nrows(tensor), tensor->ne[0]);
+            return converted_tensors.emplace(key, std::move(buffer)).first->second.data();
         }
 
         void load_all_tensors() {
@@ -267,11 +601,64 @@ namespace INSTINCT_TRANSFORMER_NS::models {
         virtual ~BaseModel()=default;
         virtual void load(ModelLoader& loader) = 0;
         virtual float qa_rank(const GenerationConfig& generation_config, const std::vector<int> &input_ids) = 0;
+
+        /**
+         * Compute ranking scores for multiple encoded QA pairs. Implementations are expected to run them in as few forward passes as possible.
+         * @param generation_config
+         * @param batch_input_ids token ids for each QA pair
+         * @param scores score for each QA pair, in the same order of `batch_input_ids`
+         */
+        virtual void batch_qa_rank(const GenerationConfig& generation_config, const std::vector<std::vector<int>>& batch_input_ids, std::vector<float>& scores) = 0;
         virtual void text_embedding(const GenerationConfig& generation_config, const std::vector<int>& input_ids, std::vector<float>& output_embedding) = 0;
+
+        /**
+         * Compute embeddings for multiple sequences. Implementations are expected to run them in as few forward passes as possible.
+         * @param generation_config
+         * @param batch_input_ids token ids for each sequence
+         * @param output_embeddings embedding for each sequence, in the same order of `batch_input_ids`
+         */
+        virtual void batch_text_embedding(const GenerationConfig& generation_config, const std::vector<std::vector<int>>& batch_input_ids, std::vector<std::vector<float>>& output_embeddings) = 0;
         virtual size_t get_text_embedding_dim() { return 0; }
+
+        /**
+         * @return true if model can compute lexical weights and multi-vectors along with dense embedding
+         */
+        virtual bool has_hybrid_embedding() { return false; }
+
+        /**
+         * Compute dense embedding, lexical weights and multi-vectors of multiple sequences in shared forwards.
+         * @param generation_config
+         * @param batch_input_ids token ids for each sequence
+         * @param outputs outputs for each sequence, in the same order of `batch_input_ids`
+         */
+        virtual void batch_hybrid_text_embedding(const GenerationConfig& generation_config, const std::vector<std::vector<int>>& batch_input_ids, std::vector<HybridEmbedding>& outputs) {
+            throw std::runtime_error("hybrid embedding is not supported by this model");
+        }
+
+        /**
+         * Set count of forward passes that can run in parallel. Weights are shared, but each of them needs its own compute buffers.
+         * @param max_concurrency
+         */
+        virtual void set_max_concurrency(size_t max_concurrency) = 0;
+        virtual size_t get_max_concurrency() = 0;
+
+        virtual GraphCacheStats get_graph_cache_stats() { return {}; }
+
+        /**
+         * Run a dummy forward so that weights are paged in and graph for short inputs is built before serving real requests
+         */
+        virtual void warm_up(const GenerationConfig& generation_config) {}
+
+        virtual ColdStartStats get_cold_start_stats() { return {.load_ms = load_ms_}; }
+
+        /**
+         * Record time spent on loading, which is measured by `ModelFactory`
+         */
+        void set_load_time(const int64_t load_ms) { load_ms_ = load_ms; }
     protected:
         ModelType model_type_;
         ModelPurpose model_purpose_;
+        int64_t load_ms_ = 0;
     };
 
     using ModelPtr = std::shared_ptr<BaseModel>;
@@ -284,18 +671,16 @@ namespace INSTINCT_TRANSFORMER_NS::models {
         BaseGenerationModel(
             const ModelType model_type,
             const ModelPurpose model_purpose,
-            const BaseConfig& config,
-            const size_t mem_size,
-            const size_t scratch_size):
+            const BaseConfig& config):
                 BaseModel(model_type, model_purpose),
                 config_(config),
-                mem_size_(mem_size),
-                mem_buffer_(new char[mem_size]),
-                scratch_size_(scratch_size),
-                scratch_buffer_(new char[scratch_size]),
+                buffer_pool_(),
                 graph_size(GGML_DEFAULT_GRAPH_SIZE),
                 batch_input(true),
-                logit_scale(-1.0f)
+                logit_scale(-1.0f),
+                max_batch_tokens(DEFAULT_MAX_BATCH_TOKENS),
+                seq_len_bucket_size(DEFAULT_SEQ_LEN_BUCKET_SIZE),
+                max_cached_graphs(DEFAULT_MAX_CACHED_GRAPHS)
         {
             for (int i = 0; i < config.num_hidden_layers; i++)
                 layer_ids.push_back(i);
@@ -304,7 +689,8 @@ namespace INSTINCT_TRANSFORMER_NS::models {
         virtual TransformerModel& get_transformer() = 0;
 
         float qa_rank(const GenerationConfig &config, const std::vector<int> &input_ids) override {
-            const auto *lm = run_model(input_ids, config, 0);
+            const auto buffer = buffer_pool_.acquire();
+            const auto *lm = run_model(*buffer, input_ids, config, 0);
             // "lm->type must be GGML_TYPE_F32"
             GGML_ASSERT(lm->type == GGML_TYPE_F32);
             // "ouput must be scaler"
@@ -313,55 +699,338 @@ namespace INSTINCT_TRANSFORMER_NS::models {
             return *(float *)lm->data;
         }
 
+        void batch_qa_rank(const GenerationConfig &generation_config, const std::vector<std::vector<int>> &batch_input_ids,
+            std::vector<float> &scores) override {
+            scores.resize(batch_input_ids.size());
+            const auto buffer = buffer_pool_.acquire();
+            for_each_batch(batch_input_ids, [&](const std::vector<std::vector<int>>& batch, const std::vector<size_t>& indices) {
+                const ggml_tensor *lm = run_model(*buffer, batch, generation_config, 0);
+                GGML_ASSERT(lm->type == GGML_TYPE_F32);
+                // one score for each pair
+                GGML_ASSERT(lm->ne[0] == 1 && lm->ne[1] == (int64_t) batch.size());
+                for (size_t i = 0; i < indices.size(); ++i) {
+                    scores[indices[i]] = *(const float *) ((const char *) lm->data + i * lm->nb[1]);
+                }
+            });
+        }
+
         void text_embedding(const GenerationConfig &generation_config, const std::vector<int> &input_ids,
             std::vector<float> &output_embedding) override {
-            const ggml_tensor *lm = run_model(input_ids, generation_config, 0);
+            const auto buffer = buffer_pool_.acquire();
+            const ggml_tensor *lm = run_model(*buffer, input_ids, generation_config, 0);
             GGML_ASSERT(lm->type == GGML_TYPE_F32);
             output_embedding.resize(lm->ne[0]);
             memcpy(output_embedding.data(), lm->data, output_embedding.size() * sizeof(output_embedding[0]));
         }
 
+        void batch_text_embedding(const GenerationConfig &generation_config, const std::vector<std::vector<int>> &batch_input_ids,
+            std::vector<std::vector<float>> &output_embeddings) override {
+            output_embeddings.resize(batch_input_ids.size());
+            const auto buffer = buffer_pool_.acquire();
+            for_each_batch(batch_input_ids, [&](const std::vector<std::vector<int>>& batch, const std::vector<size_t>& indices) {
+                const ggml_tensor *lm = run_model(*buffer, batch, generation_config, 0);
+                GGML_ASSERT(lm->type == GGML_TYPE_F32);
+                GGML_ASSERT(lm->ne[1] == (int64_t) batch.size());
+                for (size_t i = 0; i < indices.size(); ++i) {
+                    const auto *row = (const float *) ((const char *) lm->data + i * lm->nb[1]);
+                    output_embeddings[indices[i]].assign(row, row + lm->ne[0]);
+                }
+            });
+        }
+
+        /**
+         * Default token budget for a single batched forward, counting padded tokens. It bounds peak size of compute buffer, which grows with total tokens and with sum of squared sequence lengths in attention.
+         */
+        static constexpr size_t DEFAULT_MAX_BATCH_TOKENS = 2048;
+
+        /**
+         * Default granularity of padded sequence length. Inputs are padded to a multiple of it so that forwards of similar lengths share a cached graph.
+         */
+        static constexpr size_t DEFAULT_SEQ_LEN_BUCKET_SIZE = 16;
+
+        /**
+         * Default count of graphs cached in each `ForwardBuffer`
+         */
+        static constexpr size_t DEFAULT_MAX_CACHED_GRAPHS = 8;
+
+        void set_max_concurrency(const size_t max_concurrency) override {
+            buffer_pool_.set_max_size(max_concurrency);
+        }
+
+        size_t get_max_concurrency() override {
+            return buffer_pool_.get_max_size();
+        }
+
+        GraphCacheStats get_graph_cache_stats() override {
+            return {.hits = graph_cache_hits_.load(), .misses = graph_cache_misses_.load()};
+        }
+
+        void warm_up(const GenerationConfig &generation_config) override {
+            const auto t1 = std::chrono::steady_clock::now();
+            {
+                const auto buffer = buffer_pool_.acquire();
+                run_model(*buffer, std::vector {config_.bos_token_id, config_.eos_token_id}, generation_config, 0);
+            }
+            warm_up_ms_ = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - t1).count();
+            // the forward above is accounted as warm-up
+            first_forward_ms_ = -1;
+        }
+
+        ColdStartStats get_cold_start_stats() override {
+            return {.load_ms = load_ms_, .warm_up_ms = warm_up_ms_, .first_forward_ms = first_forward_ms_.load()};
+        }
+
     protected:
 
-        virtual ggml_tensor *run_model(const std::vector<int> &input_ids,
+        /**
+         * Split sequences into batches that respect `max_batch_tokens`. Sequences are sorted by length first so that padding in each batch is minimized.
+         * @param batch_input_ids all sequences
+         * @param fn callback receiving sequences of a batch and their indices in `batch_input_ids`
+         */
+        template<typename Fn>
+        void for_each_batch(const std::vector<std::vector<int>> &batch_input_ids, Fn&& fn) const {
+            std::vector<size_t> order(batch_input_ids.size());
+            std::iota(order.begin(), order.end(), 0);
+            std::stable_sort(order.begin(), order.end(), [&](const size_t a, const size_t b) {
+                return batch_input_ids[a].size() < batch_input_ids[b].size();
+            });
+
+            size_t begin = 0;
+            while (begin < order.size()) {
+                // sequences are sorted ascending, so the last one in a batch decides padded length, which is what `run_graph` actually computes
+                size_t end = begin + 1;
+                while (end < order.size() && (size_t) padded_length((int64_t) batch_input_ids[order[end]].size()) * (end - begin + 1) <= max_batch_tokens) {
+                    ++end;
+                }
+                std::vector<std::vector<int>> batch;
+                std::vector<size_t> indices;
+                batch.reserve(end - begin);
+                indices.reserve(end - begin);
+                for (size_t i = begin; i < end; ++i) {
+                    batch.push_back(batch_input_ids[order[i]]);
+                    indices.push_back(order[i]);
+                }
+                fn(batch, indices);
+                begin = end;
+            }
+        }
+
+        virtual ggml_tensor *run_model(ForwardBuffer &buffer,
+                                       const std::vector<int> &input_ids,
                                        const GenerationConfig &gen_config,
                                        int past)
         {
-            ForwardContext ctx;
-            ctx.g_ctx = ggml_init({.mem_size = mem_size_, .mem_buffer = mem_buffer_.get(), .no_alloc = false});
-            ctx.g_scratch = {.offs = 0, .size = scratch_size_, .data = scratch_buffer_.get()};
+            return run_model(buffer, std::vector<std::vector<int>> {input_ids}, gen_config, past);
+        }
+
+        /**
+         * Run a single forward for multiple sequences. Sequences are right-padded with `pad_token_id` to a bucketed length and padded positions are hidden from attention by an additive mask.
+         *
+         * Graphs are cached in `buffer` by input shape, so a forward with a shape seen before only rebinds inputs and computes.
+         * @param buffer buffers leased from pool, which should be held until output is consumed
+         * @param batch_input_ids
+         * @param gen_config
+         * @param past
+         * @return output tensor whose last dim is batch size
+         */
+        virtual ggml_tensor *run_model(ForwardBuffer &buffer,
+                                       const std::vector<std::vector<int>> &batch_input_ids,
+                                       const GenerationConfig &gen_config,
+                                       int past)
+        {
+            return run_graph(buffer, batch_input_ids, gen_config, past)->output;
+        }
+
+        /**
+         * Same as `run_model`, but returns the computed graph, so that extra outputs can be read as well. Graph is valid until next forward with the same buffer.
+         * @param with_extra_outputs whether optional heads of model are computed into `CachedGraph::extra_outputs`. Graphs with and without them are cached separately.
+         */
+        CachedGraph *run_graph(ForwardBuffer &buffer,
+                               const std::vector<std::vector<int>> &batch_input_ids,
+                               const GenerationConfig &gen_config,
+                               int past,
+                               const bool with_extra_outputs = false)
+        {
+            GGML_ASSERT(!batch_input_ids.empty());
+            const auto t1 = std::chrono::steady_clock::now();
+            const auto batch_size = (int64_t) batch_input_ids.size();
+            int64_t max_len = 0;
+            for (const auto& ids: batch_input_ids) {
+                max_len = std::max(max_len, (int64_t) ids.size());
+            }
+            const int64_t qlen = padded_length(max_len);
+            bool masked = false;
+            for (const auto& ids: batch_input_ids) {
+                masked = masked || (int64_t) ids.size() < qlen;
+            }
+
+            CachedGraph *graph = find_graph(buffer, qlen, batch_size, masked, past, with_extra_outputs);
+            if (graph) {
+                ++graph_cache_hits_;
+            } else {
+                ++graph_cache_misses_;
+                graph = build_graph(buffer, qlen, batch_size, masked, past, with_extra_outputs);
+            }
+            if (buffer.allocated != graph) {
+                allocate_graph(buffer, *graph);
+            }
+            bind_inputs(*graph, batch_input_ids);
 
             // int n_threads = input_ids.size() >= 32 && ggml_cpu_has_blas() && !ggml_cpu_has_gpublas() ? 1 : gen_config.num_threads;
-            int n_threads = input_ids.size() >= 32 ? gen_config.num_threads : 1;
+            const int n_threads = qlen * batch_size >= 32 ? (int) gen_config.num_threads : 1;
+            // work data is kept in buffer instead of graph context, which would otherwise grow in every compute
+            ggml_cplan plan = ggml_graph_plan(graph->graph, n_threads);
+            if (plan.work_size > buffer.work_buffer.size()) {
+                buffer.work_buffer.resize(plan.work_size);
+            }
+            plan.work_data = buffer.work_buffer.data();
+            ggml_graph_compute(graph->graph, &plan);
+
+#ifdef GGML_PERF
+            ggml_graph_print(graph->graph);
+#endif
+            if (first_forward_ms_.load(std::memory_order_relaxed) < 0) {
+                int64_t expected = -1;
+                first_forward_ms_.compare_exchange_strong(expected, std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - t1).count());
+            }
+            return graph;
+        }
+
+        /**
+         * Round sequence length up to a multiple of `seq_len_bucket_size`, without exceeding count of position embeddings.
+         */
+        [[nodiscard]] int64_t padded_length(const int64_t qlen) const {
+            if (seq_len_bucket_size <= 1) {
+                return qlen;
+            }
+            const auto bucket = (int64_t) seq_len_bucket_size;
+            // position ids are offset by two in RobertaEmbedding
+            const int64_t limit = config_.max_length - 2;
+            return std::max(qlen, std::min((qlen + bucket - 1) / bucket * bucket, limit));
+        }
+
+    private:
+        CachedGraph *find_graph(ForwardBuffer& buffer, const int64_t qlen, const int64_t batch_size, const bool masked, const int past, const bool with_extra_outputs) {
+            for (auto itr = buffer.graphs.begin(); itr != buffer.graphs.end(); ++itr) {
+                if (const auto& graph = *itr; graph->qlen == qlen && graph->batch_size == batch_size && graph->masked == masked && graph->past == past && graph->with_extra_outputs == with_extra_outputs) {
+                    buffer.graphs.splice(buffer.graphs.begin(), buffer.graphs, itr);
+                    return buffer.graphs.front().get();
+                }
+            }
+            return nullptr;
+        }
+
+        CachedGraph *build_graph(ForwardBuffer& buffer, const int64_t qlen, const int64_t batch_size, const bool masked, const int past, const bool with_extra_outputs) {
+            auto cached = std::make_unique<CachedGraph>();
+            cached->qlen = qlen;
+            cached->batch_size = batch_size;
+            cached->masked = masked;
+            cached->past = past;
+            cached->with_extra_outputs = with_extra_outputs;
+
+            ForwardContext ctx;
+            ctx.with_extra_outputs = with_extra_outputs;
+            // only metadata of tensors and graph lives in context
+            const size_t ctx_size = ggml_tensor_overhead() * graph_size * 2 + ggml_graph_overhead_custom(graph_size, false);
+            ctx.g_ctx = ggml_init({.mem_size = ctx_size, .mem_buffer = nullptr, .no_alloc = true});
             ctx.g_cgraph = ggml_new_graph_custom(ctx.g_ctx, graph_size, false);
 
-            ggml_tensor *input_ids_tensor = ggml_new_tensor_1d(ctx.g_ctx, GGML_TYPE_I32, input_ids.size());
-            std::memcpy(input_ids_tensor->data, input_ids.data(), ggml_nbytes(input_ids_tensor));
+            cached->input_ids = ggml_new_tensor_2d(ctx.g_ctx, GGML_TYPE_I32, qlen, batch_size);
+            ggml_set_input(cached->input_ids);
+            if (masked) {
+                ctx.attn_mask = ggml_new_tensor_4d(ctx.g_ctx, GGML_TYPE_F32, qlen, 1, 1, batch_size);
+                ggml_set_input(ctx.attn_mask);
+            }
+            cached->attn_mask = ctx.attn_mask;
 
-            ggml_tensor *r = get_transformer().forward(&ctx, input_ids_tensor, past);
+            {
+                // layers keep intermediate states while recording graph, so only graph building is serialized. Computation of graphs from different buffers can run in parallel.
+                std::lock_guard build_lock {build_mutex_};
+                ggml_tensor *r = get_transformer().forward(&ctx, cached->input_ids, past);
+
+                if (logit_scale > 0)
+                    r = ggml_scale_inplace(ctx.g_ctx, r, logit_scale);
+
+                ggml_set_output(r);
+                ggml_build_forward_expand(ctx.g_cgraph, r);
+                cached->output = r;
+                for (ggml_tensor *extra: ctx.extra_outputs) {
+                    ggml_set_output(extra);
+                    ggml_build_forward_expand(ctx.g_cgraph, extra);
+                }
+                cached->extra_outputs = ctx.extra_outputs;
+            }
+            cached->graph = ctx.g_cgraph;
+            // context is owned by cached graph from now on
+            cached->ctx = std::exchange(ctx.g_ctx, nullptr);
+
+            buffer.graphs.push_front(std::move(cached));
+            // the graph just built is always kept, as its output is read by caller
+            while (buffer.graphs.size() > std::max<size_t>(1, max_cached_graphs)) {
+                if (buffer.allocated == buffer.graphs.back().get()) {
+                    buffer.allocated = nullptr;
+                }
+                buffer.graphs.pop_back();
+            }
+            return buffer.graphs.front().get();
+        }
 
-            if (logit_scale > 0)
-                r = ggml_scale_inplace(ctx.g_ctx, r, logit_scale);
+        /**
+         * Place tensors of given graph in compute buffer. Graphs cached in the same buffer share the compute buffer, so placement of previous graph is dropped before allocating again.
+         */
+        static void allocate_graph(ForwardBuffer& buffer, CachedGraph& graph) {
+            for (ggml_tensor *t = ggml_get_first_tensor(graph.ctx); t; t = ggml_get_next_tensor(graph.ctx, t)) {
+                // views of weights are not managed by allocator
+                if (t->buffer) {
+                    t->buffer = nullptr;
+                    t->data = nullptr;
+                }
+            }
+            buffer.allocated = nullptr;
+            GGML_ASSERT(ggml_gallocr_alloc_graph(buffer.allocator.get(), graph.graph));
+            buffer.allocated = &graph;
+        }
 
-            ggml_build_forward_expand(ctx.g_cgraph, r);
-            ggml_graph_compute_with_ctx(ctx.g_ctx, ctx.g_cgraph, n_threads);
+        void bind_inputs(const CachedGraph& graph, const std::vector<std::vector<int>> &batch_input_ids) const {
+            const int64_t qlen = graph.qlen;
+            auto *input_ids_data = (int32_t *) graph.input_ids->data;
+            for (int64_t b = 0; b < graph.batch_size; ++b) {
+                const auto& ids = batch_input_ids[b];
+                std::copy(ids.begin(), ids.end(), input_ids_data + b * qlen);
+                std::fill(input_ids_data + b * qlen + (int64_t) ids.size(), input_ids_data + (b + 1) * qlen, config_.pad_token_id);
+            }
 
-#ifdef GGML_PERF
-            ggml_graph_print(ctx.g_cgraph);
-#endif
-            return r;
+            if (graph.attn_mask) {
+                auto *mask_data = (float *) graph.attn_mask->data;
+                for (int64_t b = 0; b < graph.batch_size; ++b) {
+                    const auto n = (int64_t) batch_input_ids[b].size();
+                    for (int64_t i = 0; i < qlen; ++i) {
+                        mask_data[b * qlen + i] = i < n ? 0.0f : -INFINITY;
+                    }
+                }
+            }
         }
 
+    protected:
         BaseConfig config_;
-        size_t mem_size_;
-        std::unique_ptr<char[]> mem_buffer_; // BLAS buffer
-        size_t scratch_size_;
-        std::unique_ptr<char[]> scratch_buffer_; // intermediate tensor buffer
+        ForwardBufferPool buffer_pool_;
+        std::mutex build_mutex_;
     public:
         size_t graph_size;
         bool batch_input;
         float logit_scale;
         std::vector<int> layer_ids;
+        // max count of tokens, including paddings, in a single batched forward
+        size_t max_batch_tokens;
+        // sequence length is padded to a multiple of this value. 0 or 1 to disable padding.
+        size_t seq_len_bucket_size;
+        // max count of graphs cached in each buffer
+        size_t max_cached_graphs;
+    private:
+        std::atomic<size_t> graph_cache_hits_ {0};
+        std::atomic<size_t> graph_cache_misses_ {0};
+        int64_t warm_up_ms_ = 0;
+        std::atomic<int64_t> first_forward_ms_ {-1};
     };
 
 
@@ -393,7 +1062,6 @@ namespace INSTINCT_TRANSFORMER_NS::models {
         ggml_tensor *forward(ForwardContext *ctx, ggml_tensor *input_ids, int n_past) override {
             ggml_tensor *hidden_states = word_embeddings.forward(ctx, input_ids, n_past);
             for (auto &layer : layers) {
-                ggml_set_scratch(ctx->g_ctx, ctx->g_scratch);
                 hidden_states = layer.forward(ctx, hidden_states, n_past);
             }
             return final_steps(ctx, input_ids, hidden_states);
@@ -406,7 +1074,6 @@ namespace INSTINCT_TRANSFORMER_NS::models {
     private:
         ggml_tensor *final_steps(ForwardContext *ctx, ggml_tensor *input_ids, ggml_tensor *hidden_states)
         {
-            ggml_set_scratch(ctx->g_ctx, {.offs = 0, .size = 0, .data = nullptr});
             ggml_tensor *transformer_outputs = final.forward(ctx, hidden_states);
             return transformer_outputs;
         }
@@ -56,15 +56,12 @@ namespace INSTINCT_TRANSFORMER_NS::models::bge::embedding {
         }
     };
 
-    class BGEEmbeddingModel final: public BaseGenerationModel<XLMRoberta<BCEFinalNorm>> {
+    class BGEEmbeddingModel final: public BaseGenerationModel<XLMRoberta<BGEM3Heads>> {
     public:
-        static constexpr size_t MEM_SIZE = 812ull * 1024 * 1024;
-        static constexpr size_t SCRATCH_SIZE = 544ull * 1024 * 1024;
-
-        explicit BGEEmbeddingModel(const Config& config, const size_t mem_size = MEM_SIZE, const size_t scratch_size = SCRATCH_SIZE):
-            BaseGenerationModel(BGE_M3_EMBEDDING, TextEmbedding, config, mem_size, scratch_size),
+        explicit BGEEmbeddingModel(const Config& config):
+            BaseGenerationModel(BGE_M3_EMBEDDING, TextEmbedding, config),
             w_ctx_({
-                ggml_init({.mem_size = (GGML_TENSOR_SIZE + GGML_OBJECT_SIZE) * (5 + config.num_hidden_layers * 19), .mem_buffer = nullptr, .no_alloc = true}),
+                ggml_init({.mem_size = (GGML_TENSOR_SIZE + GGML_OBJECT_SIZE) * (9 + config.num_hidden_layers * 19), .mem_buffer = nullptr, .no_alloc = true}),
                 config.dtype
             }),
             transformer_(&w_ctx_, config)
@@ -99,10 +96,19 @@ namespace INSTINCT_TRANSFORMER_NS::models::bge::embedding {
                 loader.read_tensor(layer_prefix + "output.LayerNorm.bias",      transformer_.layers[i].mlp.output.norm.bias);
             }
 
+            // sparse and ColBERT heads are shipped separately from encoder in original model, so they are optional in model file
+            if (loader.has_tensor("sparse_linear.weight") && loader.has_tensor("colbert_linear.weight")) {
+                loader.read_tensor("sparse_linear.weight",      transformer_.final.sparse_linear.weight);
+                loader.read_tensor("sparse_linear.bias",        transformer_.final.sparse_linear.bias);
+                loader.read_tensor("colbert_linear.weight",     transformer_.final.colbert_linear.weight);
+                loader.read_tensor("colbert_linear.bias",       transformer_.final.colbert_linear.bias);
+                transformer_.final.multi_output = true;
+            }
+
             GGML_ASSERT(ggml_used_mem(w_ctx_.g_ctx) == ggml_get_mem_size(w_ctx_.g_ctx));
         }
 
-        XLMRoberta<BCEFinalNorm> & get_transformer() override {
+        XLMRoberta<BGEM3Heads> & get_transformer() override {
             return transformer_;
         }
 
@@ -110,9 +116,61 @@ namespace INSTINCT_TRANSFORMER_NS::models::bge::embedding {
             return config_.hidden_size;
         }
 
+        bool has_hybrid_embedding() override {
+            return transformer_.final.multi_output;
+        }
+
+        void batch_hybrid_text_embedding(const GenerationConfig &generation_config, const std::vector<std::vector<int>> &batch_input_ids,
+            std::vector<HybridEmbedding> &outputs) override {
+            if (!has_hybrid_embedding()) {
+                throw std::runtime_error("weights of sparse and ColBERT heads are not found in model file");
+            }
+            // same as unknown token of `Tokenizer`
+            const int unk_token_id = config_.eos_token_id + 1;
+            auto is_special = [&](const int id) {
+                return id == config_.bos_token_id || id == config_.eos_token_id || id == config_.pad_token_id || id == unk_token_id;
+            };
+
+            outputs.resize(batch_input_ids.size());
+            const auto buffer = buffer_pool_.acquire();
+            for_each_batch(batch_input_ids, [&](const std::vector<std::vector<int>>& batch, const std::vector<size_t>& indices) {
+                const CachedGraph *graph = run_graph(*buffer, batch, generation_config, 0, true);
+                const ggml_tensor *dense = graph->output;
+                const ggml_tensor *token_weights = graph->extra_outputs[0];
+                const ggml_tensor *colbert_vecs = graph->extra_outputs[1];
+                GGML_ASSERT(dense->ne[1] == (int64_t) batch.size());
+
+                for (size_t i = 0; i < indices.size(); ++i) {
+                    const auto& ids = batch[i];
+                    auto& output = outputs[indices[i]];
+
+                    const auto *dense_row = (const float *) ((const char *) dense->data + i * dense->nb[1]);
+                    output.dense.assign(dense_row, dense_row + dense->ne[0]);
+
+                    // padded positions are never visited
+                    std::map<int, float> weights;
+                    for (size_t t = 0; t < ids.size(); ++t) {
+                        const float w = *(const float *) ((const char *) token_weights->data + t * token_weights->nb[1] + i * token_weights->nb[2]);
+                        if (is_special(ids[t]) || w <= 0) continue;
+                        if (const auto [itr, inserted] = weights.emplace(ids[t], w); !inserted) {
+                            itr->second = std::max(itr->second, w);
+                        }
+                    }
+                    output.lexical_weights.assign(weights.begin(), weights.end());
+
+                    output.multi_vectors.clear();
+                    output.multi_vectors.reserve(ids.size());
+                    for (size_t t = 1; t < ids.size(); ++t) {
+                        const auto *row = (const float *) ((const char *) colbert_vecs->data + t * colbert_vecs->nb[1] + i * colbert_vecs->nb[2]);
+                        output.multi_vectors.emplace_back(row, row + colbert_vecs->ne[0]);
+                    }
+                }
+            });
+        }
+
     private:
         InitContext w_ctx_; // weight context
-        XLMRoberta<BCEFinalNorm> transformer_;
+        XLMRoberta<BGEM3Heads> transformer_;
     };
 
 
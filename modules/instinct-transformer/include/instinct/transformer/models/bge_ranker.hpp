@@ -29,16 +29,70 @@ namespace INSTINCT_TRANSFORMER_NS::models::bge::ranker {
         }
 
         void encode_qa(const std::string &q, const std::string &a, std::vector<int> &ids) const override {
-            const int max_length = this->max_length - 2;
+            std::vector<int> ids_q;
+            BaseTokenizer::encode(q, ids_q);
+            pack_qa(ids_q, a, ids);
+        }
 
+        void encode_qa_batch(const std::string &q, const std::vector<std::string> &answers, std::vector<std::vector<int>> &batch_ids) const override {
+            // query is shared by all pairs
             std::vector<int> ids_q;
-            std::vector<int> ids_a;
             BaseTokenizer::encode(q, ids_q);
+            batch_ids.resize(answers.size());
+            size_t total_bytes = 0;
+            for (const auto& answer: answers) {
+                total_bytes += answer.size();
+            }
+            parallel_for(answers.size(), total_bytes, [&](const size_t i) {
+                batch_ids[i].clear();
+                pack_qa(ids_q, answers[i], batch_ids[i]);
+            });
+        }
+
+        void encode_qa_windows(const std::string &q, const std::vector<std::string> &answers, const size_t window_overlap,
+            std::vector<std::vector<int>> &batch_ids, std::vector<size_t> &answer_indices) const override {
+            std::vector<int> ids_q;
+            BaseTokenizer::encode(q, ids_q);
+            // same budget of answer tokens as truncation in `pack_qa`
+            const int window = max_length - 2 - 4 - (int)ids_q.size();
+            GGML_ASSERT(window > 0);
+            const int stride = std::max(1, window - (int)window_overlap);
+
+            std::vector<std::vector<int>> ids_answers(answers.size());
+            size_t total_bytes = 0;
+            for (const auto& answer: answers) {
+                total_bytes += answer.size();
+            }
+            parallel_for(answers.size(), total_bytes, [&](const size_t i) {
+                BaseTokenizer::encode(answers[i], ids_answers[i]);
+            });
+
+            batch_ids.clear();
+            answer_indices.clear();
+            for (size_t i = 0; i < answers.size(); ++i) {
+                const auto& ids_a = ids_answers[i];
+                const int n = (int)ids_a.size();
+                for (int begin = 0; ; begin += stride) {
+                    const int end = std::min(n, begin + window);
+                    pack_ids(ids_q, ids_a.data() + begin, ids_a.data() + end, batch_ids.emplace_back());
+                    answer_indices.push_back(i);
+                    if (end == n) {
+                        break;
+                    }
+                }
+            }
+        }
+
+    private:
+        void pack_qa(const std::vector<int> &ids_q, const std::string &a, std::vector<int> &ids) const {
+            const int max_length = this->max_length - 2;
+
+            std::vector<int> ids_a;
             BaseTokenizer::encode(a, ids_a);
 
             int total = (int)ids_q.size() + (int)ids_a.size();
 
-            // this is bad
+            // long answers are truncated here. `encode_qa_windows` keeps all of them.
             if (total > max_length - 4)
             {
                 int remain = max_length - 4 - (int)ids_q.size();
@@ -47,23 +101,24 @@ namespace INSTINCT_TRANSFORMER_NS::models::bge::ranker {
                 ids_a.resize(remain);
             }
 
+            pack_ids(ids_q, ids_a.data(), ids_a.data() + ids_a.size(), ids);
+        }
+
+        void pack_ids(const std::vector<int> &ids_q, const int *a_begin, const int *a_end, std::vector<int> &ids) const {
             ids.push_back(bos_token_id);
             ids.insert(std::end(ids), std::begin(ids_q), std::end(ids_q));
             ids.push_back(eos_token_id);
 
             ids.push_back(bos_token_id);
-            ids.insert(std::end(ids), std::begin(ids_a), std::end(ids_a));
+            ids.insert(std::end(ids), a_begin, a_end);
             ids.push_back(eos_token_id);
         }
     };
 
     class BGERerankerModel final: public BaseGenerationModel<XLMRoberta<RobertaClassificationHead>> {
     public:
-        static constexpr size_t MEM_SIZE = 812ull * 1024 * 1024;
-        static constexpr size_t SCRATCH_SIZE = 544ull * 1024 * 1024 * 3;
-
-        explicit BGERerankerModel(const Config& config, const size_t mem_size = MEM_SIZE, const size_t scratch_size = SCRATCH_SIZE):
-            BaseGenerationModel(BGE_M3_RERANKER, Ranker, config, mem_size, scratch_size),
+        explicit BGERerankerModel(const Config& config):
+            BaseGenerationModel(BGE_M3_RERANKER, Ranker, config),
                 w_ctx_(
                        {
                            ggml_init({.mem_size = ((9 + config.num_hidden_layers * 19) * (GGML_TENSOR_SIZE + GGML_OBJECT_SIZE)), .mem_buffer = nullptr, .no_alloc = true}),
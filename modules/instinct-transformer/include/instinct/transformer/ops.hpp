@@ -5,26 +5,343 @@
 #ifndef CXX_TEST_OPS_HPP
 #define CXX_TEST_OPS_HPP
 #include <instinct/transformer_global.hpp>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 
 namespace INSTINCT_TRANSFORMER_NS::ops {
 
+    namespace details {
+        // scalar kernels are also used as reference in tests
+
+        static void sigmoid_f32_scalar(const float *x, float *y, const int64_t n) {
+            for (int64_t i = 0; i < n; ++i) {
+                y[i] = 1 / (1 + expf(-x[i]));
+            }
+        }
+
+        static float sum_sq_f32_scalar(const float *x, const int64_t n) {
+            double sum = 0.0;
+            for (int64_t i = 0; i < n; ++i) {
+                sum += (double)(x[i] * x[i]);
+            }
+            return (float) sum;
+        }
+
+        static void scale_f32_scalar(const float *x, float *y, const float s, const int64_t n) {
+            for (int64_t i = 0; i < n; ++i) {
+                y[i] = x[i] * s;
+            }
+        }
+
+        static float dot_f32_scalar(const float *x, const float *y, const int64_t n) {
+            float sum = 0.0f;
+            for (int64_t i = 0; i < n; ++i) {
+                sum += x[i] * y[i];
+            }
+            return sum;
+        }
+
+        // y = y * s + x * v
+        static void scale_mad_f32_scalar(float *y, const float s, const float *x, const float v, const int64_t n) {
+            for (int64_t i = 0; i < n; ++i) {
+                y[i] = y[i] * s + x[i] * v;
+            }
+        }
+
+        // exp is approximated with range reduction to [-ln2/2, ln2/2] and a degree-5 polynomial from Cephes, with relative error around 1e-7.
+        static constexpr float EXP_HI = 88.3762626647949f;
+        static constexpr float EXP_LO = -88.3762626647949f;
+        static constexpr float LOG2E = 1.44269504088896341f;
+        static constexpr float EXP_C1 = 0.693359375f;
+        static constexpr float EXP_C2 = -2.12194440e-4f;
+        static constexpr float EXP_P0 = 1.9875691500E-4f;
+        static constexpr float EXP_P1 = 1.3981999507E-3f;
+        static constexpr float EXP_P2 = 8.3334519073E-3f;
+        static constexpr float EXP_P3 = 4.1665795894E-2f;
+        static constexpr float EXP_P4 = 1.6666665459E-1f;
+        static constexpr float EXP_P5 = 5.0000001201E-1f;
+
+#if (defined(__x86_64__) || defined(_M_X64)) && (defined(__GNUC__) || defined(__clang__))
+#define INSTINCT_TRANSFORMER_X86_DISPATCH
+
+        __attribute__((target("avx2,fma")))
+        static float hsum_avx2(const __m256 v) {
+            __m128 s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+            s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+            s = _mm_add_ss(s, _mm_movehdup_ps(s));
+            return _mm_cvtss_f32(s);
+        }
+
+        __attribute__((target("avx2,fma")))
+        static __m256 exp_avx2(__m256 x) {
+            x = _mm256_min_ps(_mm256_max_ps(x, _mm256_set1_ps(EXP_LO)), _mm256_set1_ps(EXP_HI));
+            const __m256 fx = _mm256_floor_ps(_mm256_fmadd_ps(x, _mm256_set1_ps(LOG2E), _mm256_set1_ps(0.5f)));
+            x = _mm256_fnmadd_ps(fx, _mm256_set1_ps(EXP_C1), x);
+            x = _mm256_fnmadd_ps(fx, _mm256_set1_ps(EXP_C2), x);
+            __m256 y = _mm256_set1_ps(EXP_P0);
+            y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(EXP_P1));
+            y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(EXP_P2));
+            y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(EXP_P3));
+            y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(EXP_P4));
+            y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(EXP_P5));
+            y = _mm256_fmadd_ps(y, _mm256_mul_ps(x, x), _mm256_add_ps(x, _mm256_set1_ps(1.0f)));
+            const __m256i pow2n = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(fx), _mm256_set1_epi32(127)), 23);
+            return _mm256_mul_ps(y, _mm256_castsi256_ps(pow2n));
+        }
+
+        __attribute__((target("avx2,fma")))
+        static void sigmoid_f32_avx2(const float *x, float *y, const int64_t n) {
+            const __m256 one = _mm256_set1_ps(1.0f);
+            int64_t i = 0;
+            for (; i + 8 <= n; i += 8) {
+                const __m256 e = exp_avx2(_mm256_sub_ps(_mm256_setzero_ps(), _mm256_loadu_ps(x + i)));
+                _mm256_storeu_ps(y + i, _mm256_div_ps(one, _mm256_add_ps(one, e)));
+            }
+            sigmoid_f32_scalar(x + i, y + i, n - i);
+        }
+
+        __attribute__((target("avx2,fma")))
+        static float sum_sq_f32_avx2(const float *x, const int64_t n) {
+            __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+            int64_t i = 0;
+            for (; i + 16 <= n; i += 16) {
+                const __m256 a0 = _mm256_loadu_ps(x + i), a1 = _mm256_loadu_ps(x + i + 8);
+                acc0 = _mm256_fmadd_ps(a0, a0, acc0);
+                acc1 = _mm256_fmadd_ps(a1, a1, acc1);
+            }
+            return hsum_avx2(_mm256_add_ps(acc0, acc1)) + sum_sq_f32_scalar(x + i, n - i);
+        }
+
+        __attribute__((target("avx2,fma")))
+        static void scale_f32_avx2(const float *x, float *y, const float s, const int64_t n) {
+            const __m256 ss = _mm256_set1_ps(s);
+            int64_t i = 0;
+            for (; i + 8 <= n; i += 8) {
+                _mm256_storeu_ps(y + i, _mm256_mul_ps(_mm256_loadu_ps(x + i), ss));
+            }
+            scale_f32_scalar(x + i, y + i, s, n - i);
+        }
+
+        __attribute__((target("avx2,fma")))
+        static float dot_f32_avx2(const float *x, const float *y, const int64_t n) {
+            __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+            int64_t i = 0;
+            for (; i + 16 <= n; i += 16) {
+                acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(x + i), _mm256_loadu_ps(y + i), acc0);
+                acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(x + i + 8), _mm256_loadu_ps(y + i + 8), acc1);
+            }
+            return hsum_avx2(_mm256_add_ps(acc0, acc1)) + dot_f32_scalar(x + i, y + i, n - i);
+        }
+
+        __attribute__((target("avx2,fma")))
+        static void scale_mad_f32_avx2(float *y, const float s, const float *x, const float v, const int64_t n) {
+            const __m256 ss = _mm256_set1_ps(s), vv = _mm256_set1_ps(v);
+            int64_t i = 0;
+            for (; i + 8 <= n; i += 8) {
+                _mm256_storeu_ps(y + i, _mm256_fmadd_ps(_mm256_loadu_ps(x + i), vv, _mm256_mul_ps(_mm256_loadu_ps(y + i), ss)));
+            }
+            scale_mad_f32_scalar(y + i, s, x + i, v, n - i);
+        }
+
+        __attribute__((target("avx512f")))
+        static __m512 exp_avx512(__m512 x) {
+            x = _mm512_min_ps(_mm512_max_ps(x, _mm512_set1_ps(EXP_LO)), _mm512_set1_ps(EXP_HI));
+            const __m512 fx = _mm512_roundscale_ps(_mm512_fmadd_ps(x, _mm512_set1_ps(LOG2E), _mm512_set1_ps(0.5f)), _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+            x = _mm512_fnmadd_ps(fx, _mm512_set1_ps(EXP_C1), x);
+            x = _mm512_fnmadd_ps(fx, _mm512_set1_ps(EXP_C2), x);
+            __m512 y = _mm512_set1_ps(EXP_P0);
+            y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(EXP_P1));
+            y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(EXP_P2));
+            y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(EXP_P3));
+            y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(EXP_P4));
+            y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(EXP_P5));
+            y = _mm512_fmadd_ps(y, _mm512_mul_ps(x, x), _mm512_add_ps(x, _mm512_set1_ps(1.0f)));
+            const __m512i pow2n = _mm512_slli_epi32(_mm512_add_epi32(_mm512_cvtps_epi32(fx), _mm512_set1_epi32(127)), 23);
+            return _mm512_mul_ps(y, _mm512_castsi512_ps(pow2n));
+        }
+
+        __attribute__((target("avx512f")))
+        static void sigmoid_f32_avx512(const float *x, float *y, const int64_t n) {
+            const __m512 one = _mm512_set1_ps(1.0f);
+            int64_t i = 0;
+            for (; i + 16 <= n; i += 16) {
+                const __m512 e = exp_avx512(_mm512_sub_ps(_mm512_setzero_ps(), _mm512_loadu_ps(x + i)));
+                _mm512_storeu_ps(y + i, _mm512_div_ps(one, _mm512_add_ps(one, e)));
+            }
+            sigmoid_f32_scalar(x + i, y + i, n - i);
+        }
+
+        __attribute__((target("avx512f")))
+        static float sum_sq_f32_avx512(const float *x, const int64_t n) {
+            __m512 acc0 = _mm512_setzero_ps(), acc1 = _mm512_setzero_ps();
+            int64_t i = 0;
+            for (; i + 32 <= n; i += 32) {
+                const __m512 a0 = _mm512_loadu_ps(x + i), a1 = _mm512_loadu_ps(x + i + 16);
+                acc0 = _mm512_fmadd_ps(a0, a0, acc0);
+                acc1 = _mm512_fmadd_ps(a1, a1, acc1);
+            }
+            return _mm512_reduce_add_ps(_mm512_add_ps(acc0, acc1)) + sum_sq_f32_scalar(x + i, n - i);
+        }
+
+        __attribute__((target("avx512f")))
+        static void scale_f32_avx512(const float *x, float *y, const float s, const int64_t n) {
+            const __m512 ss = _mm512_set1_ps(s);
+            int64_t i = 0;
+            for (; i + 16 <= n; i += 16) {
+                _mm512_storeu_ps(y + i, _mm512_mul_ps(_mm512_loadu_ps(x + i), ss));
+            }
+            scale_f32_scalar(x + i, y + i, s, n - i);
+        }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#define INSTINCT_TRANSFORMER_NEON
+
+        static float32x4_t exp_neon(float32x4_t x) {
+            x = vminq_f32(vmaxq_f32(x, vdupq_n_f32(EXP_LO)), vdupq_n_f32(EXP_HI));
+            const float32x4_t fx = vrndmq_f32(vfmaq_f32(vdupq_n_f32(0.5f), x, vdupq_n_f32(LOG2E)));
+            x = vfmsq_f32(x, fx, vdupq_n_f32(EXP_C1));
+            x = vfmsq_f32(x, fx, vdupq_n_f32(EXP_C2));
+            float32x4_t y = vdupq_n_f32(EXP_P0);
+            y = vfmaq_f32(vdupq_n_f32(EXP_P1), y, x);
+            y = vfmaq_f32(vdupq_n_f32(EXP_P2), y, x);
+            y = vfmaq_f32(vdupq_n_f32(EXP_P3), y, x);
+            y = vfmaq_f32(vdupq_n_f32(EXP_P4), y, x);
+            y = vfmaq_f32(vdupq_n_f32(EXP_P5), y, x);
+            y = vfmaq_f32(vaddq_f32(x, vdupq_n_f32(1.0f)), y, vmulq_f32(x, x));
+            const int32x4_t pow2n = vshlq_n_s32(vaddq_s32(vcvtq_s32_f32(fx), vdupq_n_s32(127)), 23);
+            return vmulq_f32(y, vreinterpretq_f32_s32(pow2n));
+        }
+
+        static void sigmoid_f32_neon(const float *x, float *y, const int64_t n) {
+            const float32x4_t one = vdupq_n_f32(1.0f);
+            int64_t i = 0;
+            for (; i + 4 <= n; i += 4) {
+                const float32x4_t e = exp_neon(vnegq_f32(vld1q_f32(x + i)));
+                vst1q_f32(y + i, vdivq_f32(one, vaddq_f32(one, e)));
+            }
+            sigmoid_f32_scalar(x + i, y + i, n - i);
+        }
+
+        static float sum_sq_f32_neon(const float *x, const int64_t n) {
+            float32x4_t acc0 = vdupq_n_f32(0.0f), acc1 = vdupq_n_f32(0.0f);
+            int64_t i = 0;
+            for (; i + 8 <= n; i += 8) {
+                const float32x4_t a0 = vld1q_f32(x + i), a1 = vld1q_f32(x + i + 4);
+                acc0 = vfmaq_f32(acc0, a0, a0);
+                acc1 = vfmaq_f32(acc1, a1, a1);
+            }
+            return vaddvq_f32(vaddq_f32(acc0, acc1)) + sum_sq_f32_scalar(x + i, n - i);
+        }
+
+        static void scale_f32_neon(const float *x, float *y, const float s, const int64_t n) {
+            int64_t i = 0;
+            for (; i + 4 <= n; i += 4) {
+                vst1q_f32(y + i, vmulq_n_f32(vld1q_f32(x + i), s));
+            }
+            scale_f32_scalar(x + i, y + i, s, n - i);
+        }
+
+        static float dot_f32_neon(const float *x, const float *y, const int64_t n) {
+            float32x4_t acc0 = vdupq_n_f32(0.0f), acc1 = vdupq_n_f32(0.0f);
+            int64_t i = 0;
+            for (; i + 8 <= n; i += 8) {
+                acc0 = vfmaq_f32(acc0, vld1q_f32(x + i), vld1q_f32(y + i));
+                acc1 = vfmaq_f32(acc1, vld1q_f32(x + i + 4), vld1q_f32(y + i + 4));
+            }
+            return vaddvq_f32(vaddq_f32(acc0, acc1)) + dot_f32_scalar(x + i, y + i, n - i);
+        }
+
+        static void scale_mad_f32_neon(float *y, const float s, const float *x, const float v, const int64_t n) {
+            const float32x4_t ss = vdupq_n_f32(s);
+            int64_t i = 0;
+            for (; i + 4 <= n; i += 4) {
+                vst1q_f32(y + i, vfmaq_n_f32(vmulq_f32(vld1q_f32(y + i), ss), vld1q_f32(x + i), v));
+            }
+            scale_mad_f32_scalar(y + i, s, x + i, v, n - i);
+        }
+#endif
+    }
+
+    /**
+     * Vector kernels used by custom ops. On x86 they are selected once by CPU features at runtime, so that binaries built without `-march` flags still get SIMD. NEON is always available on aarch64.
+     */
+    struct OpKernels {
+        void (*sigmoid_f32)(const float*, float*, int64_t) = details::sigmoid_f32_scalar;
+        float (*sum_sq_f32)(const float*, int64_t) = details::sum_sq_f32_scalar;
+        void (*scale_f32)(const float*, float*, float, int64_t) = details::scale_f32_scalar;
+        float (*dot_f32)(const float*, const float*, int64_t) = details::dot_f32_scalar;
+        void (*scale_mad_f32)(float*, float, const float*, float, int64_t) = details::scale_mad_f32_scalar;
+
+        static const OpKernels& Get() {
+            static const OpKernels INSTANCE = Detect();
+            return INSTANCE;
+        }
+
+        static OpKernels Scalar() {
+            return {};
+        }
+
+    private:
+        static OpKernels Detect() {
+            OpKernels kernels;
+#ifdef INSTINCT_TRANSFORMER_X86_DISPATCH
+            __builtin_cpu_init();
+            if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+                kernels.sigmoid_f32 = details::sigmoid_f32_avx2;
+                kernels.sum_sq_f32 = details::sum_sq_f32_avx2;
+                kernels.scale_f32 = details::scale_f32_avx2;
+                kernels.dot_f32 = details::dot_f32_avx2;
+                kernels.scale_mad_f32 = details::scale_mad_f32_avx2;
+            }
+            if (__builtin_cpu_supports("avx512f")) {
+                kernels.sigmoid_f32 = details::sigmoid_f32_avx512;
+                kernels.sum_sq_f32 = details::sum_sq_f32_avx512;
+                kernels.scale_f32 = details::scale_f32_avx512;
+            }
+#elif defined(INSTINCT_TRANSFORMER_NEON)
+            kernels.sigmoid_f32 = details::sigmoid_f32_neon;
+            kernels.sum_sq_f32 = details::sum_sq_f32_neon;
+            kernels.scale_f32 = details::scale_f32_neon;
+            kernels.dot_f32 = details::dot_f32_neon;
+            kernels.scale_mad_f32 = details::scale_mad_f32_neon;
+#endif
+            return kernels;
+        }
+    };
+
     static void ggml_compute_forward_sigmoid_f32(struct ggml_tensor * dst , const struct ggml_tensor * src0, int ith, int nth, void * userdata) {
         GGML_ASSERT(ggml_are_same_shape(src0, dst));
 
         GGML_ASSERT(dst->type == GGML_TYPE_F32);
 
-        GGML_TENSOR_UNARY_OP_LOCALS
-
-        // TODO: make this tunable
-        float eps = 1e-6f;
+        const auto& kernels = OpKernels::Get();
+        if (ggml_is_contiguous(src0) && ggml_is_contiguous(dst)) {
+            // element-wise op, so contiguous tensors are split into equal ranges regardless of rows. ranker outputs [batch, 1] in which each row has a single element.
+            const int64_t n = ggml_nelements(src0);
+            const int64_t chunk = (n + nth - 1) / nth;
+            const int64_t begin = std::min(n, chunk * ith);
+            const int64_t end = std::min(n, begin + chunk);
+            kernels.sigmoid_f32((const float *) src0->data + begin, (float *) dst->data + begin, end - begin);
+            return;
+        }
 
-        GGML_ASSERT(eps > 0.0f);
+        GGML_TENSOR_UNARY_OP_LOCALS
 
-        // TODO: optimize
         for (int64_t i03 = 0; i03 < ne03; i03++) {
             for (int64_t i02 = 0; i02 < ne02; i02++) {
                 for (int64_t i01 = ith; i01 < ne01; i01 += nth) {
-
+                    if (nb00 == sizeof(float) && nb0 == sizeof(float)) {
+                        const auto * x = (const float *) ((const char *) src0->data + i01*nb01 + i02*nb02 + i03*nb03);
+                        auto * y = (float *) ((char *) dst->data + i01*nb1 + i02*nb2 + i03*nb3);
+                        kernels.sigmoid_f32(x, y, ne00);
+                        continue;
+                    }
                     for (int64_t i00 = 0; i00 < ne00; i00++) {
                         const float * x = (float *) ((char *) src0->data + i00*nb00 + i01*nb01 + i02*nb02 + i03*nb03);
                         auto * y = (float *) ((char *) dst->data + i00*nb0 + i01*nb1 + i02*nb2 + i03*nb3);
@@ -52,6 +369,7 @@ namespace INSTINCT_TRANSFORMER_NS::ops {
         GGML_ASSERT(ggml_are_same_shape(src0, dst));
 
         GGML_ASSERT(src0->nb[0] == sizeof(float));
+        GGML_ASSERT(dst->nb[0] == sizeof(float));
 
         GGML_TENSOR_UNARY_OP_LOCALS
 
@@ -60,23 +378,17 @@ namespace INSTINCT_TRANSFORMER_NS::ops {
 
         GGML_ASSERT(eps > 0.0f);
 
-        // TODO: optimize
+        const auto& kernels = OpKernels::Get();
+        // rows are distributed among threads
         for (int64_t i03 = 0; i03 < ne03; i03++) {
             for (int64_t i02 = 0; i02 < ne02; i02++) {
                 for (int64_t i01 = ith; i01 < ne01; i01 += nth) {
                     const float * x = (float *) ((char *) src0->data + i01*nb01 + i02*nb02 + i03*nb03);
-
-                    double sum = 0.0;
-                    for (int64_t i00 = 0; i00 < ne00; i00++) {
-                        sum += (double)(x[i00] * x[i00]);
-                    }
-
                     float * y = (float *) ((char *) dst->data + i01*nb1 + i02*nb2 + i03*nb3);
 
-                    const float scale = 1.0f / sqrtf((float)sum + eps);
-
-                    for (int64_t i = 0; i < ne00; i++)
-                        y[i] = x[i] * scale;
+                    const float sum = kernels.sum_sq_f32(x, ne00);
+                    const float scale = 1.0f / sqrtf(sum + eps);
+                    kernels.scale_f32(x, y, scale, ne00);
                 }
             }
         }
@@ -95,6 +407,116 @@ namespace INSTINCT_TRANSFORMER_NS::ops {
         }
     }
 
+    /**
+     * Bidirectional scaled-dot-product attention in a single pass, with online softmax over tiles of keys, so that attention scores of [heads, qlen, klen] are never materialized.
+     *
+     * q, k, v and dst are of [batch, len, heads, head_size], which is exactly the layout of outputs of q/k/v projections, and query is expected to be scaled already. Additive mask of [batch, 1, 1, klen] is optional and passed as `dst->src[3]`.
+     */
+    static void ggml_compute_forward_fused_attention_f32(struct ggml_tensor * dst, const struct ggml_tensor * q, const struct ggml_tensor * k, const struct ggml_tensor * v, int ith, int nth, void * userdata) {
+        // queries in a tile share keys and values loaded into cache
+        constexpr int64_t TILE_Q = 16;
+        constexpr int64_t TILE_K = 64;
+
+        const ggml_tensor *mask = dst->src[3];
+        GGML_ASSERT(q->type == GGML_TYPE_F32 && k->type == GGML_TYPE_F32 && v->type == GGML_TYPE_F32 && dst->type == GGML_TYPE_F32);
+        GGML_ASSERT(q->nb[0] == sizeof(float) && k->nb[0] == sizeof(float) && v->nb[0] == sizeof(float) && dst->nb[0] == sizeof(float));
+        GGML_ASSERT(ggml_are_same_shape(k, v) && ggml_are_same_shape(q, dst));
+        GGML_ASSERT(q->ne[0] == k->ne[0] && q->ne[1] == k->ne[1] && q->ne[3] == k->ne[3]);
+
+        const int64_t head_size = q->ne[0], heads = q->ne[1], qlen = q->ne[2], batch = q->ne[3];
+        const int64_t klen = k->ne[2];
+        if (mask) {
+            GGML_ASSERT(mask->type == GGML_TYPE_F32 && mask->ne[0] == klen && mask->ne[3] == batch);
+        }
+
+        const auto& kernels = OpKernels::Get();
+        thread_local std::vector<float> work;
+        work.resize(TILE_Q * (head_size + 2) + TILE_K);
+        float *acc = work.data();                   // [TILE_Q, head_size] weighted sum of values
+        float *row_max = acc + TILE_Q * head_size;  // [TILE_Q] running max of scores
+        float *row_sum = row_max + TILE_Q;          // [TILE_Q] running sum of exp(score - max)
+        float *scores = row_sum + TILE_Q;           // [TILE_K]
+
+        const int64_t q_tiles = (qlen + TILE_Q - 1) / TILE_Q;
+        for (int64_t unit = ith; unit < batch * heads * q_tiles; unit += nth) {
+            const int64_t b = unit / (heads * q_tiles);
+            const int64_t h = unit / q_tiles % heads;
+            const int64_t i0 = unit % q_tiles * TILE_Q;
+            const int64_t nq = std::min(TILE_Q, qlen - i0);
+
+            std::fill_n(acc, nq * head_size, 0.0f);
+            std::fill_n(row_max, nq, -INFINITY);
+            std::fill_n(row_sum, nq, 0.0f);
+            const float *mask_row = mask ? (const float *) ((const char *) mask->data + b * mask->nb[3]) : nullptr;
+
+            for (int64_t j0 = 0; j0 < klen; j0 += TILE_K) {
+                const int64_t nk = std::min(TILE_K, klen - j0);
+                for (int64_t qi = 0; qi < nq; ++qi) {
+                    const auto *q_row = (const float *) ((const char *) q->data + (i0 + qi) * q->nb[2] + h * q->nb[1] + b * q->nb[3]);
+                    float tile_max = -INFINITY;
+                    for (int64_t kj = 0; kj < nk; ++kj) {
+                        const auto *k_row = (const float *) ((const char *) k->data + (j0 + kj) * k->nb[2] + h * k->nb[1] + b * k->nb[3]);
+                        float score = kernels.dot_f32(q_row, k_row, head_size);
+                        if (mask_row) {
+                            score += mask_row[j0 + kj];
+                        }
+                        scores[kj] = score;
+                        tile_max = std::max(tile_max, score);
+                    }
+                    if (tile_max == -INFINITY) {
+                        // every key in this tile is masked
+                        continue;
+                    }
+
+                    const float new_max = std::max(row_max[qi], tile_max);
+                    // rescale previous partial results to the new max
+                    float correction = std::exp(row_max[qi] - new_max);
+                    float *acc_row = acc + qi * head_size;
+                    for (int64_t kj = 0; kj < nk; ++kj) {
+                        const float p = std::exp(scores[kj] - new_max);
+                        if (p == 0.0f) {
+                            continue;
+                        }
+                        const auto *v_row = (const float *) ((const char *) v->data + (j0 + kj) * v->nb[2] + h * v->nb[1] + b * v->nb[3]);
+                        kernels.scale_mad_f32(acc_row, correction, v_row, p, head_size);
+                        row_sum[qi] = row_sum[qi] * correction + p;
+                        correction = 1.0f;
+                    }
+                    if (correction != 1.0f) {
+                        for (int64_t d = 0; d < head_size; ++d) {
+                            acc_row[d] *= correction;
+                        }
+                        row_sum[qi] *= correction;
+                    }
+                    row_max[qi] = new_max;
+                }
+            }
+
+            for (int64_t qi = 0; qi < nq; ++qi) {
+                auto *out = (float *) ((char *) dst->data + (i0 + qi) * dst->nb[2] + h * dst->nb[1] + b * dst->nb[3]);
+                const float inv = row_sum[qi] > 0 ? 1.0f / row_sum[qi] : 0.0f;
+                for (int64_t d = 0; d < head_size; ++d) {
+                    out[d] = acc[qi * head_size + d] * inv;
+                }
+            }
+        }
+    }
+
+    /**
+     * Build fused attention op. See `ggml_compute_forward_fused_attention_f32` for layout of inputs.
+     * @param ctx
+     * @param q scaled query of [batch, qlen, heads, head_size]
+     * @param k key of [batch, klen, heads, head_size]
+     * @param v value of [batch, klen, heads, head_size]
+     * @param mask optional additive mask of [batch, 1, 1, klen]
+     * @return context layer of [batch, qlen, heads, head_size]
+     */
+    static ggml_tensor *ggml_fused_attention(ggml_context *ctx, ggml_tensor *q, ggml_tensor *k, ggml_tensor *v, ggml_tensor *mask) {
+        ggml_tensor *result = ggml_map_custom3(ctx, q, k, v, ggml_compute_forward_fused_attention_f32, GGML_N_TASKS_MAX, nullptr);
+        // mask is not an operand of map_custom3, but it's recorded as source so that graph keeps it alive until this op is computed
+        result->src[3] = mask;
+        return result;
+    }
 
 }
 
@@ -13,7 +13,10 @@
 #include <regex>
 #include <cstring>
 #include <limits>
+#include <algorithm>
+#include <numeric>
 
+#include <instinct/core_global.hpp>
 #include <instinct/transformer/config.hpp>
 
 
@@ -233,6 +236,56 @@ namespace INSTINCT_TRANSFORMER_NS::tokenizer {
             tp->Encode(input, &ids);
         }
 
+        /**
+         * Encode a query against multiple answers. Sub-classes may override this to avoid encoding query repeatedly.
+         * @param q
+         * @param answers
+         * @param batch_ids token ids for each pair, in the same order of `answers`
+         */
+        virtual void encode_qa_batch(const std::string &q, const std::vector<std::string> &answers, std::vector<std::vector<int>> &batch_ids) const {
+            batch_ids.resize(answers.size());
+            size_t total_bytes = 0;
+            for (const auto& answer: answers) {
+                total_bytes += q.size() + answer.size();
+            }
+            parallel_for(answers.size(), total_bytes, [&](const size_t i) {
+                batch_ids[i].clear();
+                encode_qa(q, answers[i], batch_ids[i]);
+            });
+        }
+
+        /**
+         * Encode a query against multiple answers like `encode_qa_batch`, except that answers too long for a single input are split into overlapping windows instead of being truncated. Tokenizers that never truncate answers can keep this default, which gives exactly one window per answer.
+         * @param q
+         * @param answers
+         * @param window_overlap count of answer tokens shared by adjacent windows
+         * @param batch_ids token ids for each window. Windows of the same answer are adjacent.
+         * @param answer_indices index of answer in `answers` for each window in `batch_ids`
+         */
+        virtual void encode_qa_windows(const std::string &q, const std::vector<std::string> &answers, const size_t window_overlap,
+            std::vector<std::vector<int>> &batch_ids, std::vector<size_t> &answer_indices) const {
+            encode_qa_batch(q, answers, batch_ids);
+            answer_indices.resize(answers.size());
+            std::iota(answer_indices.begin(), answer_indices.end(), 0);
+        }
+
+        /**
+         * Encode multiple texts. Large batches are split among threads, as encoding is independent for each text.
+         * @param texts
+         * @param batch_ids token ids for each text, in the same order of `texts`
+         */
+        virtual void encode_batch(const std::vector<std::string> &texts, std::vector<std::vector<int>> &batch_ids) const {
+            batch_ids.resize(texts.size());
+            size_t total_bytes = 0;
+            for (const auto& text: texts) {
+                total_bytes += text.size();
+            }
+            parallel_for(texts.size(), total_bytes, [&](const size_t i) {
+                batch_ids[i].clear();
+                encode(texts[i], batch_ids[i]);
+            });
+        }
+
         [[nodiscard]] virtual std::string decode(const std::vector<int> &ids) const {
             // filter out special tokens
             std::vector<int> normal_ids(ids);
@@ -247,6 +300,13 @@ namespace INSTINCT_TRANSFORMER_NS::tokenizer {
 
         virtual void set_additional_args(const std::map<std::string, std::string> &args) {}
 
+        /**
+         * Run batch encoding with given pool instead of `COMPUTE_WORKER_POOL`
+         */
+        void set_thread_pool(INSTINCT_CORE_NS::ThreadPool& thread_pool) {
+            thread_pool_ = &thread_pool;
+        }
+
         [[nodiscard]] virtual bool is_terminate_token_id(int id) const {
             if (terminate_ids.empty())
                 return id == eos_token_id;
@@ -263,6 +323,32 @@ namespace INSTINCT_TRANSFORMER_NS::tokenizer {
         int sep_token_id;
 
     protected:
+        /**
+         * Minimal bytes of text for a task in batch encoding, so that small batches are not slowed down by scheduling
+         */
+        static constexpr size_t MIN_BYTES_PER_THREAD = 16 * 1024;
+
+        /**
+         * Pool shared by batch encoding of all tokenizers, so that concurrent calls don't oversubscribe CPU cores
+         */
+        INSTINCT_CORE_NS::ThreadPool* thread_pool_ = &INSTINCT_CORE_NS::COMPUTE_WORKER_POOL;
+
+        template<typename Fn>
+        void parallel_for(const size_t n, const size_t total_bytes, Fn&& fn) const {
+            const size_t n_blocks = std::min({n, total_bytes / MIN_BYTES_PER_THREAD, (size_t) thread_pool_->get_thread_count()});
+            // waiting on tasks of the pool from one of its workers may never return if all workers are waiting
+            const auto current_pool = BS::this_thread::get_pool();
+            if (n_blocks <= 1 || (current_pool && *current_pool == thread_pool_)) {
+                for (size_t i = 0; i < n; ++i) {
+                    fn(i);
+                }
+                return;
+            }
+            auto futures = thread_pool_->submit_loop<size_t>(0, n, fn, n_blocks);
+            // all blocks should be finished before `fn` goes out of scope, even if some of them failed
+            futures.wait();
+            futures.get();
+        }
 
         virtual std::string preprocess(const std::string &text) const {
             return text;
@@ -353,111 +439,214 @@ namespace INSTINCT_TRANSFORMER_NS::tokenizer {
     }
 
 
+    /**
+     * Double-array trie over byte strings. Transition from node `s` with byte `c` goes to `t = base[s] + c + 1` if `check[t] == s`.
+     */
+    struct double_array_trie {
+        std::vector<int32_t> base;
+        std::vector<int32_t> check;
+        std::vector<int32_t> value;
+
+        /**
+         * @param keys unique keys with their values, which should be non-negative
+         */
+        void build(std::vector<std::pair<std::string, int32_t>> keys) {
+            std::sort(keys.begin(), keys.end());
+            base.assign(1, -1);
+            check.assign(1, ROOT_CHECK);
+            value.assign(1, -1);
+            std::vector<bool> used_base;
+            int32_t next_check_pos = 1;
+
+            struct range { int32_t node; size_t lo, hi, depth; };
+            std::vector<range> queue {{0, 0, keys.size(), 0}};
+            std::vector<uint8_t> labels;
+            std::vector<size_t> bounds;
+            for (size_t q = 0; q < queue.size(); ++q) {
+                const auto [node, lo0, hi, depth] = queue[q];
+                size_t lo = lo0;
+                // the key ending at this node is sorted before its extensions
+                if (lo < hi && keys[lo].first.size() == depth) {
+                    value[node] = keys[lo].second;
+                    ++lo;
+                }
+                if (lo == hi) {
+                    continue;
+                }
+
+                labels.clear();
+                bounds.clear();
+                for (size_t i = lo; i < hi; ++i) {
+                    const auto c = (uint8_t) keys[i].first[depth];
+                    if (labels.empty() || labels.back() != c) {
+                        labels.push_back(c);
+                        bounds.push_back(i);
+                    }
+                }
+                bounds.push_back(hi);
+
+                // first-fit search of a base whose slots for all labels are free
+                int32_t pos = std::max<int32_t>(labels.front() + 1, next_check_pos) - 1;
+                int32_t nonzero = 0;
+                bool first = true;
+                int32_t b;
+                while (true) {
+                    ++pos;
+                    resize_(pos + 1);
+                    if (check[pos] != FREE) {
+                        ++nonzero;
+                        continue;
+                    }
+                    if (first) {
+                        next_check_pos = pos;
+                        first = false;
+                    }
+                    b = pos - labels.front() - 1;
+                    if ((size_t) b < used_base.size() && used_base[b]) {
+                        continue;
+                    }
+                    resize_(b + labels.back() + 2);
+                    bool fit = true;
+                    for (size_t i = 1; i < labels.size() && fit; ++i) {
+                        fit = check[b + labels[i] + 1] == FREE;
+                    }
+                    if (fit) {
+                        break;
+                    }
+                }
+                // skip densely occupied region in following searches
+                if (nonzero * 20 >= (pos - next_check_pos + 1) * 19) {
+                    next_check_pos = pos;
+                }
+                if ((size_t) b >= used_base.size()) {
+                    used_base.resize(b + 1, false);
+                }
+                used_base[b] = true;
+
+                base[node] = b;
+                for (size_t i = 0; i < labels.size(); ++i) {
+                    const int32_t t = b + labels[i] + 1;
+                    check[t] = node;
+                    queue.push_back({t, bounds[i], bounds[i + 1], depth + 1});
+                }
+            }
+        }
+
+        /**
+         * Visit all keys that are prefixes of `text`, from the shortest one
+         * @param fn callback receiving length of matched key and its value
+         */
+        template<typename Fn>
+        void common_prefix_search(const char *text, const size_t len, Fn&& fn) const {
+            int32_t node = 0;
+            for (size_t i = 0; i < len; ++i) {
+                if (base[node] < 0) {
+                    return;
+                }
+                const int32_t t = base[node] + (uint8_t) text[i] + 1;
+                if (t >= (int32_t) check.size() || check[t] != node) {
+                    return;
+                }
+                node = t;
+                if (value[node] >= 0) {
+                    fn(i + 1, value[node]);
+                }
+            }
+        }
+
+    private:
+        static constexpr int32_t FREE = -1;
+        static constexpr int32_t ROOT_CHECK = -2;
+
+        void resize_(const size_t size) {
+            if (size > check.size()) {
+                const size_t capacity = std::max(size, check.size() * 2);
+                base.resize(capacity, -1);
+                check.resize(capacity, FREE);
+                value.resize(capacity, -1);
+            }
+        }
+    };
+
+
+    /**
+     * Viterbi search of the most probable segmentation over UTF-8 characters. Candidates ending at each position are found by walking a trie from every character boundary, so no substring is created during the search.
+     */
     struct unigram_tokenizer {
         using index = int;
 
         struct best {
-            best(int prev, float score, int tok_id = 0) : prev(prev), score(score), tok_id(tok_id) {}
-
             index prev;
             float score;
             index tok_id;
         };
 
-        struct unigram {
-            unigram(const char *text, int pos, int n) : text(text), start(pos), end(pos + n) {}
-
-            const char *text;
-            index start, end;
-        };
-
-        unigram_tokenizer(const _vocab &vocab, int tok_max_len, int unk_id) : vocab_(vocab), tok_max_len(tok_max_len),
-                                                                              unk_id(unk_id) {}
+        unigram_tokenizer(const double_array_trie &trie, const std::vector<float> &scores, int unk_id) : trie_(trie), scores_(scores),
+                                                                                                       unk_id(unk_id) {}
 
         void tokenize(const std::string &text, std::vector<_vocab::id> &output) {
-            size_t offs = 0;
+            const size_t n = text.size();
 
-            symbols_.emplace_back(text.c_str(), 0, 0);
-            trace.emplace_back(0, 0.0f);
-
-            while (offs < text.size()) {
-                size_t char_len = std::min(text.size() - offs, utf8_len(text[offs]));
-                symbols_.emplace_back(text.c_str() + offs, (int) offs, (int) char_len);
-                offs += char_len;
+            // byte offset of each character boundary, and character index of each byte offset that is a boundary
+            bounds_.assign(1, 0);
+            char_index_.assign(n + 1, -1);
+            char_index_[0] = 0;
+            size_t offs = 0;
+            while (offs < n) {
+                offs += std::min(n - offs, utf8_len(text[offs]));
+                char_index_[offs] = (index) bounds_.size();
+                bounds_.push_back((index) offs);
             }
 
-            if (symbols_.size() <= 1)
+            const auto n_chars = (index) bounds_.size() - 1;
+            if (n_chars == 0)
                 return;
 
-            // Viterbi algorithm
-            for (int i = 1; i < (int) symbols_.size(); i++) {
-                find_best(i);
+            // forward Viterbi. Starting positions are visited in ascending order and only a strictly better score replaces previous one, so ties are resolved in favor of longer tokens, same as a backward search over candidates.
+            trace_.assign(n_chars + 1, best {-1, std::numeric_limits<float>::lowest(), -1});
+            trace_[0] = best {0, 0.0f, 0};
+            for (index i = 0; i <= n_chars; i++) {
+                if (i > 0 && trace_[i].prev < 0) {
+                    // no token ends here
+                    trace_[i] = best {i - 1, trace_[i - 1].score + scores_[unk_id], unk_id};
+                }
+                if (i == n_chars)
+                    break;
+
+                const float score = trace_[i].score;
+                const index begin = bounds_[i];
+                trie_.common_prefix_search(text.data() + begin, n - begin, [&](const size_t len, const int32_t tok_id) {
+                    const index end = char_index_[begin + len];
+                    // tokens ending in the middle of a character are ignored
+                    if (end < 0)
+                        return;
+                    if (score + scores_[tok_id] > trace_[end].score) {
+                        trace_[end] = best {i, score + scores_[tok_id], tok_id};
+                    }
+                });
             }
 
             // backtrace
-            int prev = (int) (trace.size()) - 1;
-            std::vector<int> temp;
-            while (prev != 0) {
-                auto &b = trace[prev];
-                temp.push_back(b.tok_id);
-                prev = b.prev;
+            const size_t first = output.size();
+            for (index prev = n_chars; prev != 0; prev = trace_[prev].prev) {
+                output.push_back(trace_[prev].tok_id);
             }
-            for (int i = (int) temp.size() - 1; i >= 0; i--)
-                output.push_back(temp[i]);
+            std::reverse(output.begin() + (std::ptrdiff_t) first, output.end());
         }
 
     private:
-        void find_best(int pos) {
-            int start = pos - tok_max_len;
-            if (start < 0) start = 0;
-
-            float max_prop = std::numeric_limits<float>::lowest();
-            int prev = -1;
-            int tok_id = -1;
-
-            for (int i = start; i < pos; i++) {
-                auto &b = trace[i];
-                auto &sym = symbols_[i];
-
-                const std::string text = std::string(sym.text + sym.end - sym.start, symbols_[pos].end - sym.end);
-
-                auto token = vocab_.token_to_id.find(text);
-                if (token == vocab_.token_to_id.end())
-                    continue;
-
-                auto &tok = vocab_.id_to_token[token->second];
-
-                if (b.score + tok.score > max_prop) {
-                    prev = i;
-                    max_prop = b.score + tok.score;
-                    tok_id = token->second;
-                }
-            }
-
-            if (prev < 0) {
-                auto i = pos - 1;
-                auto &b = trace[i];
-                auto &tok = vocab_.id_to_token[unk_id];
-
-                prev = i;
-                max_prop = b.score + tok.score;
-                tok_id = unk_id;
-            }
-
-            trace.emplace_back(prev, max_prop, tok_id);
-        }
-
-        const _vocab &vocab_;
-        std::vector<best> trace;
-        std::vector<unigram> symbols_;
-        int tok_max_len;
+        const double_array_trie &trie_;
+        const std::vector<float> &scores_;
+        std::vector<best> trace_;
+        std::vector<index> bounds_;
+        std::vector<index> char_index_;
         int unk_id;
     };
 
     class UnigramProcessor final : public Processor {
     public:
         explicit UnigramProcessor(int unk_tok_id) :
-                Processor::Processor(), unk_tok_id(unk_tok_id), tok_max_len(0) {};
+                Processor::Processor(), unk_tok_id(unk_tok_id) {};
 
         size_t Load(const char *buffer, int n_vocab) override {
             Reader reader(buffer);
@@ -468,10 +657,11 @@ namespace INSTINCT_TRANSFORMER_NS::tokenizer {
             piece_size = load_vocab_list(vocab_, reader, true, false, 0);
             vocab_.id_to_token.resize(piece_size);
 
-            // TODO: tok_max_len should be number of characters, not bytes
-            for (auto &tok: vocab_.id_to_token) {
-                if (tok.tok.size() > tok_max_len)
-                    tok_max_len = tok.tok.size();
+            // pieces are looked up exactly as in `token_to_id`, in which the last one wins for duplicated pieces
+            trie_.build(std::vector<std::pair<std::string, int32_t>>(vocab_.token_to_id.begin(), vocab_.token_to_id.end()));
+            scores_.resize(vocab_.id_to_token.size());
+            for (size_t i = 0; i < scores_.size(); i++) {
+                scores_[i] = vocab_.id_to_token[i].score;
             }
 
             return reader.get_total_size();
@@ -482,13 +672,14 @@ namespace INSTINCT_TRANSFORMER_NS::tokenizer {
     private:
         int DoEncode(const std::string &input,
                      std::vector<int> *ids) const override {
-            unigram_tokenizer tokenizer(vocab_, (int) tok_max_len, unk_tok_id);
+            unigram_tokenizer tokenizer(trie_, scores_, unk_tok_id);
             tokenizer.tokenize(input, *ids);
             return 0;
         }
 
     private:
-        size_t tok_max_len;
+        double_array_trie trie_;
+        std::vector<float> scores_;
     };
 
 
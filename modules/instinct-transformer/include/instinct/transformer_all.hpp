@@ -6,7 +6,9 @@
 #define TRANSFORMER_ALL_HPP
 
 #include <instinct/transformer/config.hpp>
+#include <instinct/transformer/inference_scheduler.hpp>
 #include <instinct/transformer/layers.hpp>
+#include <instinct/transformer/model_converter.hpp>
 #include <instinct/transformer/model_factory.hpp>
 #include <instinct/transformer/models.hpp>
 #include <instinct/transformer/models/bge_embedding.hpp>
@@ -3,11 +3,13 @@
 //
 
 #include <filesystem>
+#include <random>
 #include <thread>
 #include <gtest/gtest.h>
 
 #include <instinct/transformer/models/bge_embedding.hpp>
 #include <instinct/transformer/model_factory.hpp>
+#include <instinct/transformer/model_converter.hpp>
 #include <instinct/tools/tensor_utils.hpp>
 
 namespace INSTINCT_TRANSFORMER_NS {
@@ -46,6 +48,170 @@ namespace INSTINCT_TRANSFORMER_NS {
         core::TensorUtils::PrintEmbedding(embedding);
     }
 
+    TEST_F(BGEM3EmbeddingTest, test_batch_embedding) {
+        const GenerationConfig config {.num_threads = std::thread::hardware_concurrency()};
+        const std::vector<std::string> texts = {
+            "hello",
+            "The quick brown fox jumps over the lazy dog",
+            "BGE M3 is an embedding model supporting dense retrieval, lexical matching and multi-vector interaction.",
+            "world"
+        };
+        std::vector<std::vector<int>> batch_input_ids;
+        for (const auto& text: texts) {
+            batch_input_ids.push_back(tokenizer_->encode(text));
+        }
+        std::vector<std::vector<float>> batch_embeddings;
+        model_->batch_text_embedding(config, batch_input_ids, batch_embeddings);
+        ASSERT_EQ(batch_embeddings.size(), texts.size());
+
+        // padded sequences should produce the same embeddings as unpadded ones
+        for (size_t i = 0; i < texts.size(); ++i) {
+            std::vector<float> embedding;
+            model_->text_embedding(config, batch_input_ids[i], embedding);
+            ASSERT_EQ(embedding.size(), batch_embeddings[i].size());
+            for (size_t j = 0; j < embedding.size(); ++j) {
+                ASSERT_NEAR(embedding[j], batch_embeddings[i][j], 1e-3);
+            }
+        }
+    }
+
+    TEST_F(BGEM3EmbeddingTest, test_graph_cache) {
+        const GenerationConfig config {.num_threads = std::thread::hardware_concurrency()};
+        const auto before = model_->get_graph_cache_stats();
+        std::vector<float> e1, e2, e3;
+        // these short sequences fall into the same length bucket
+        model_->text_embedding(config, tokenizer_->encode("hello"), e1);
+        model_->text_embedding(config, tokenizer_->encode("world"), e2);
+        model_->text_embedding(config, tokenizer_->encode("hello"), e3);
+        const auto after = model_->get_graph_cache_stats();
+        ASSERT_EQ(after.misses - before.misses, 1);
+        ASSERT_EQ(after.hits - before.hits, 2);
+
+        // rebinding inputs of a cached graph gives the same result
+        ASSERT_EQ(e1.size(), e3.size());
+        for (size_t i = 0; i < e1.size(); ++i) {
+            ASSERT_FLOAT_EQ(e1[i], e3[i]);
+        }
+        ASSERT_NE(e1, e2);
+    }
+
+    TEST_F(BGEM3EmbeddingTest, test_batch_encode) {
+        std::vector<std::string> texts;
+        for (int i = 0; i < 64; ++i) {
+            // long enough to be split among threads
+            std::string text;
+            for (int j = 0; j < 100; ++j) {
+                text += "BGE M3 supports more than 100 languages, 中文 included. ";
+            }
+            texts.push_back(text + std::to_string(i));
+        }
+        std::vector<std::vector<int>> batch_ids;
+        tokenizer_->encode_batch(texts, batch_ids);
+        ASSERT_EQ(batch_ids.size(), texts.size());
+        for (size_t i = 0; i < texts.size(); ++i) {
+            ASSERT_EQ(batch_ids[i], tokenizer_->encode(texts[i]));
+        }
+    }
+
+    TEST_F(BGEM3EmbeddingTest, test_prefetch) {
+        MappedFile mapped_file {bge_m3_ranker_bin.string(), {.prefetch = true, .huge_pages = true}};
+        mapped_file.wait_prefetch();
+        ASSERT_EQ(mapped_file.get_prefetched_bytes(), mapped_file.size);
+        ASSERT_EQ(std::string(mapped_file.data, 4), "ggml");
+    }
+
+    TEST_F(BGEM3EmbeddingTest, test_cold_start) {
+        // a new factory so that model file is mapped again
+        ModelFactory factory;
+        const auto [model, tokenizer] = factory.load(bge_m3_ranker_bin.string(), ModelLoadOptions {.mapping = {.prefetch = true}, .warm_up = true});
+        auto stats = model->get_cold_start_stats();
+        ASSERT_GE(stats.load_ms, 0);
+        ASSERT_GT(stats.warm_up_ms, 0);
+        ASSERT_EQ(stats.first_forward_ms, -1);
+
+        const GenerationConfig config {.num_threads = std::thread::hardware_concurrency()};
+        std::vector<float> embedding;
+        model->text_embedding(config, tokenizer->encode("hello"), embedding);
+        stats = model->get_cold_start_stats();
+        ASSERT_GE(stats.first_forward_ms, 0);
+        std::cout << "load_ms=" << stats.load_ms << ", warm_up_ms=" << stats.warm_up_ms << ", first_forward_ms=" << stats.first_forward_ms << std::endl;
+
+        // warmed model gives same result as cold one
+        std::vector<float> expected;
+        model_->text_embedding(config, tokenizer_->encode("hello"), expected);
+        ASSERT_EQ(embedding, expected);
+    }
+
+    TEST_F(BGEM3EmbeddingTest, test_hybrid_embedding) {
+        if (!model_->has_hybrid_embedding()) {
+            // heads are not shipped in model file, so synthetic ones are appended: lexical weight is one for every token, and ColBERT head is a random projection
+            const auto hybrid_bin = std::filesystem::temp_directory_path() / "bge-m3e-hybrid.bin";
+            {
+                ModelConverter converter {bge_m3_ranker_bin.string(), hybrid_bin.string()};
+                converter.convert(GGML_TYPE_COUNT);
+                const int hidden_size = (int) model_->get_text_embedding_dim();
+                std::mt19937 rng {42};
+                std::normal_distribution<float> dist {0, 0.02f};
+                std::vector<float> colbert_weight((size_t) hidden_size * hidden_size);
+                for (auto& f: colbert_weight) f = dist(rng);
+                converter.append_tensor("sparse_linear.weight", {1, hidden_size}, std::vector<float>(hidden_size, 0));
+                converter.append_tensor("sparse_linear.bias", {1}, {1.0f});
+                converter.append_tensor("colbert_linear.weight", {hidden_size, hidden_size}, colbert_weight);
+                converter.append_tensor("colbert_linear.bias", {hidden_size}, std::vector<float>(hidden_size, 0));
+            }
+            std::tie(this->model_, this->tokenizer_) = model_factory.load(hybrid_bin.string());
+            // file is mapped already
+            std::filesystem::remove(hybrid_bin);
+            ASSERT_TRUE(model_->has_hybrid_embedding());
+        }
+        const GenerationConfig config {.num_threads = std::thread::hardware_concurrency()};
+        const std::vector<std::string> texts = {
+            "hello hello",
+            "BGE M3 is an embedding model supporting dense retrieval, lexical matching and multi-vector interaction."
+        };
+        std::vector<std::vector<int>> batch_input_ids;
+        tokenizer_->encode_batch(texts, batch_input_ids);
+        std::vector<HybridEmbedding> outputs;
+        model_->batch_hybrid_text_embedding(config, batch_input_ids, outputs);
+        ASSERT_EQ(outputs.size(), texts.size());
+
+        for (size_t i = 0; i < texts.size(); ++i) {
+            const auto& ids = batch_input_ids[i];
+            // dense output is not changed by extra heads
+            std::vector<float> embedding;
+            model_->text_embedding(config, ids, embedding);
+            ASSERT_EQ(embedding.size(), outputs[i].dense.size());
+            for (size_t j = 0; j < embedding.size(); ++j) {
+                ASSERT_NEAR(embedding[j], outputs[i].dense[j], 1e-3);
+            }
+
+            // one weight for each distinct non-special token
+            ASSERT_FALSE(outputs[i].lexical_weights.empty());
+            ASSERT_LE(outputs[i].lexical_weights.size(), ids.size() - 2);
+            for (size_t j = 0; j < outputs[i].lexical_weights.size(); ++j) {
+                const auto& [token_id, weight] = outputs[i].lexical_weights[j];
+                ASSERT_GT(weight, 0);
+                ASSERT_NE(std::find(ids.begin() + 1, ids.end() - 1, token_id), ids.end() - 1);
+                if (j > 0) {
+                    ASSERT_LT(outputs[i].lexical_weights[j - 1].first, token_id);
+                }
+            }
+
+            // unit vector for each token except CLS
+            ASSERT_EQ(outputs[i].multi_vectors.size(), ids.size() - 1);
+            for (const auto& vec: outputs[i].multi_vectors) {
+                ASSERT_EQ(vec.size(), model_->get_text_embedding_dim());
+                double sum = 0;
+                for (const float v: vec) {
+                    sum += v * v;
+                }
+                ASSERT_NEAR(sum, 1.0, 1e-3);
+            }
+        }
+        // repeated token is merged
+        ASSERT_EQ(outputs[0].lexical_weights.size(), 1);
+    }
+
     TEST_F(BGEM3EmbeddingTest, test_long_text) {
         const auto result = get_embedding(R"(Create an Endpoint\n\nAfter your first login, you will be directed to the [Endpoint creation page](https://ui.endpoints.huggingface.co/new). As an example, this guide will go through the steps to deploy [distilbert-base-uncased-finetuned-sst-2-english](https://huggingface.co/distilbert-base-uncased-finetuned-sst-2-english) for text classification. \n\n## 1. Enter the Hugging Face Repository ID and your desired endpoint name:\n\n<img src=\"https://raw.githubusercontent.com/huggingface/hf-endpoints-documentation/main/assets/1_repository.png\" alt=\"select repository\" />",
       "## 2. Select your Cloud Provider and region. Initially, only AWS will be available as a Cloud Provider with the `us-east-1` and `eu-west-1` regions. We will add Azure soon, and if you need to test Endpoints with other Cloud Providers or regions, please let us know.\n\n<img src=\"https://raw.githubusercontent.com/huggingface/hf-endpoints-documentation/main/assets/1_region.png\" alt=\"select region\" />\n\n## 3. Define the [Security Level](security) for the Endpoint:\n\n<img src=\"https://raw.githubusercontent.com/huggingface/hf-endpoints-documentation/main/assets/1_security.png\" alt=\"define security\" />",
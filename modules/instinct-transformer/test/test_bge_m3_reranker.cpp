@@ -63,6 +63,75 @@ namespace INSTINCT_TRANSFORMER_NS {
         std::cout << std::chrono::duration_cast<std::chrono::milliseconds>(t2-t1).count() <<std::endl;
     }
 
+    TEST_F(BGEM3RankerTest, test_batch_ranking) {
+        const GenerationConfig config {.num_threads = std::max(1u, std::thread::hardware_concurrency() / 2)};
+        const std::vector<std::string> docs = {"hello", "farewell", "hello, how are you doing today?", "The quick brown fox jumps over the lazy dog"};
+        std::vector<std::vector<int>> batch_ids;
+        tokenizer_->encode_qa_batch("hello", docs, batch_ids);
+        ASSERT_EQ(batch_ids.size(), docs.size());
+
+        std::vector<float> scores;
+        model_->batch_qa_rank(config, batch_ids, scores);
+        ASSERT_EQ(scores.size(), docs.size());
+        for (size_t i = 0; i < docs.size(); ++i) {
+            std::vector<int> ids;
+            tokenizer_->encode_qa("hello", docs[i], ids);
+            ASSERT_EQ(ids, batch_ids[i]);
+            ASSERT_NEAR(scores[i], model_->qa_rank(config, ids), 1e-3);
+        }
+    }
+
+    TEST_F(BGEM3RankerTest, test_windowed_encoding) {
+        std::string long_doc;
+        for (int i = 0; i < 200; ++i) {
+            long_doc += "Sentence number " + std::to_string(i) + " is part of a very long passage. ";
+        }
+        // the answer hidden at the end would be truncated away by `encode_qa`
+        long_doc += "The secret password is swordfish.";
+        const std::vector<std::string> docs = {"hello", long_doc};
+
+        std::vector<std::vector<int>> batch_ids;
+        std::vector<size_t> doc_indices;
+        tokenizer_->encode_qa_windows("what is the secret password?", docs, 32, batch_ids, doc_indices);
+        ASSERT_EQ(batch_ids.size(), doc_indices.size());
+        ASSERT_GT(batch_ids.size(), 2);
+        ASSERT_EQ(doc_indices.front(), 0);
+        ASSERT_EQ(doc_indices.back(), 1);
+
+        // short doc gives the same input as `encode_qa`
+        std::vector<int> ids;
+        tokenizer_->encode_qa("what is the secret password?", "hello", ids);
+        ASSERT_EQ(batch_ids.front(), ids);
+
+        std::vector<float> scores;
+        const GenerationConfig config {.num_threads = std::max(1u, std::thread::hardware_concurrency() / 2)};
+        model_->batch_qa_rank(config, batch_ids, scores);
+        ASSERT_EQ(scores.size(), batch_ids.size());
+        // window containing the answer scores best
+        ASSERT_EQ(std::max_element(scores.begin(), scores.end()) - scores.begin(), (long) scores.size() - 1);
+    }
+
+    TEST_F(BGEM3RankerTest, test_concurrent_ranking) {
+        model_->set_max_concurrency(2);
+        ASSERT_EQ(model_->get_max_concurrency(), 2);
+        const GenerationConfig config {.num_threads = std::max(1u, std::thread::hardware_concurrency() / 2)};
+        std::vector<int> ids;
+        tokenizer_->encode_qa("hello", "hello", ids);
+        const auto expected = model_->qa_rank(config, ids);
+
+        std::vector<float> scores(4);
+        std::vector<std::thread> threads;
+        for (size_t i = 0; i < scores.size(); ++i) {
+            threads.emplace_back([&, i] { scores[i] = model_->qa_rank(config, ids); });
+        }
+        for (auto& t: threads) {
+            t.join();
+        }
+        for (const auto& score: scores) {
+            ASSERT_NEAR(score, expected, 1e-4);
+        }
+    }
+
 
 
 }
@@ -0,0 +1,140 @@
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <gtest/gtest.h>
+
+#include <instinct/transformer/ops.hpp>
+
+namespace INSTINCT_TRANSFORMER_NS {
+
+    class CustomOpsTest: public testing::Test {
+    protected:
+        void SetUp() override {
+            ctx_ = ggml_init({.mem_size = 64ull * 1024 * 1024, .mem_buffer = nullptr, .no_alloc = false});
+        }
+
+        void TearDown() override {
+            ggml_free(ctx_);
+        }
+
+        std::vector<float> random_vector(const size_t n, const float range) {
+            std::uniform_real_distribution<float> dist(-range, range);
+            std::vector<float> result(n);
+            for (auto& v: result) {
+                v = dist(rng_);
+            }
+            return result;
+        }
+
+        ggml_tensor *random_tensor(const int64_t ne0, const int64_t ne1, const float range) {
+            ggml_tensor *t = ggml_new_tensor_2d(ctx_, GGML_TYPE_F32, ne0, ne1);
+            const auto data = random_vector(ggml_nelements(t), range);
+            std::copy(data.begin(), data.end(), (float *) t->data);
+            return t;
+        }
+
+        void compute(ggml_tensor *output, const int n_threads) const {
+            ggml_cgraph *graph = ggml_new_graph(ctx_);
+            ggml_build_forward_expand(graph, output);
+            ggml_graph_compute_with_ctx(ctx_, graph, n_threads);
+        }
+
+        ggml_context *ctx_ = nullptr;
+        std::mt19937 rng_ {42};
+    };
+
+    TEST_F(CustomOpsTest, KernelsMatchScalarReference) {
+        const auto scalar = ops::OpKernels::Scalar();
+        const auto& kernels = ops::OpKernels::Get();
+        // lengths not aligned to any SIMD width are included to cover tails
+        for (const size_t n: {1, 7, 16, 33, 1024, 1031}) {
+            const auto x = random_vector(n, 20.f);
+            const auto y = random_vector(n, 1.f);
+
+            std::vector<float> expected(n), actual(n);
+            scalar.sigmoid_f32(x.data(), expected.data(), (int64_t) n);
+            kernels.sigmoid_f32(x.data(), actual.data(), (int64_t) n);
+            for (size_t i = 0; i < n; ++i) {
+                ASSERT_NEAR(expected[i], actual[i], 1e-6) << "sigmoid at index " << i;
+            }
+
+            ASSERT_NEAR(scalar.sum_sq_f32(x.data(), (int64_t) n), kernels.sum_sq_f32(x.data(), (int64_t) n), 1e-3);
+            ASSERT_NEAR(scalar.dot_f32(x.data(), y.data(), (int64_t) n), kernels.dot_f32(x.data(), y.data(), (int64_t) n), 1e-3);
+
+            scalar.scale_f32(x.data(), expected.data(), 0.3f, (int64_t) n);
+            kernels.scale_f32(x.data(), actual.data(), 0.3f, (int64_t) n);
+            for (size_t i = 0; i < n; ++i) {
+                ASSERT_FLOAT_EQ(expected[i], actual[i]);
+            }
+
+            expected = y;
+            actual = y;
+            scalar.scale_mad_f32(expected.data(), 0.7f, x.data(), 1.5f, (int64_t) n);
+            kernels.scale_mad_f32(actual.data(), 0.7f, x.data(), 1.5f, (int64_t) n);
+            for (size_t i = 0; i < n; ++i) {
+                ASSERT_NEAR(expected[i], actual[i], 1e-5) << "scale_mad at index " << i;
+            }
+        }
+    }
+
+    TEST_F(CustomOpsTest, SigmoidOp) {
+        // a single column like scores of ranker, and a wider one
+        for (const auto& [ne0, ne1]: std::vector<std::pair<int64_t, int64_t>> {{1, 37}, {1029, 5}}) {
+            ggml_tensor *x = random_tensor(ne0, ne1, 10.f);
+            ggml_tensor *y = ggml_map_custom1(ctx_, x, ops::ggml_compute_forward_sigmoid, GGML_N_TASKS_MAX, nullptr);
+            compute(y, 4);
+            const auto *x_data = (const float *) x->data;
+            const auto *y_data = (const float *) y->data;
+            for (int64_t i = 0; i < ggml_nelements(x); ++i) {
+                ASSERT_NEAR(y_data[i], 1 / (1 + expf(-x_data[i])), 1e-6);
+            }
+        }
+    }
+
+    TEST_F(CustomOpsTest, SimpleNormOp) {
+        ggml_tensor *x = random_tensor(1024, 9, 2.f);
+        ggml_tensor *y = ggml_map_custom1(ctx_, x, ops::ggml_compute_forward_simple_norm, GGML_N_TASKS_MAX, nullptr);
+        compute(y, 4);
+        for (int64_t row = 0; row < x->ne[1]; ++row) {
+            const auto *x_row = (const float *) x->data + row * x->ne[0];
+            const auto *y_row = (const float *) y->data + row * x->ne[0];
+            double sum = 0;
+            for (int64_t i = 0; i < x->ne[0]; ++i) {
+                sum += x_row[i] * x_row[i];
+            }
+            const auto scale = (float) (1.0 / sqrt(sum + 1e-6));
+            for (int64_t i = 0; i < x->ne[0]; ++i) {
+                ASSERT_NEAR(y_row[i], x_row[i] * scale, 1e-6);
+            }
+        }
+    }
+
+    // timing only, so it's left out of unit tests. Run with `--gtest_also_run_disabled_tests --gtest_filter=*Benchmark`.
+    TEST_F(CustomOpsTest, DISABLED_Benchmark) {
+        const auto scalar = ops::OpKernels::Scalar();
+        const auto& kernels = ops::OpKernels::Get();
+        constexpr size_t n = 1 << 20;
+        constexpr int rounds = 20;
+        const auto x = random_vector(n, 5.f);
+        std::vector<float> y(n);
+
+        auto measure = [&](auto&& fn) {
+            const auto t1 = std::chrono::steady_clock::now();
+            for (int i = 0; i < rounds; ++i) {
+                fn();
+            }
+            return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - t1).count() / rounds;
+        };
+
+        float sink = 0;
+        std::cout << "sigmoid: scalar=" << measure([&] { scalar.sigmoid_f32(x.data(), y.data(), n); })
+            << "us, simd=" << measure([&] { kernels.sigmoid_f32(x.data(), y.data(), n); }) << "us" << std::endl;
+        std::cout << "sum_sq: scalar=" << measure([&] { sink += scalar.sum_sq_f32(x.data(), n); })
+            << "us, simd=" << measure([&] { sink += kernels.sum_sq_f32(x.data(), n); }) << "us" << std::endl;
+        std::cout << "scale: scalar=" << measure([&] { scalar.scale_f32(x.data(), y.data(), 0.5f, n); })
+            << "us, simd=" << measure([&] { kernels.scale_f32(x.data(), y.data(), 0.5f, n); }) << "us" << std::endl;
+        std::cout << "dot: scalar=" << measure([&] { sink += scalar.dot_f32(x.data(), y.data(), n); })
+            << "us, simd=" << measure([&] { sink += kernels.dot_f32(x.data(), y.data(), n); }) << "us" << std::endl;
+        ASSERT_TRUE(std::isfinite(sink));
+    }
+}
@@ -0,0 +1,95 @@
+#include <random>
+#include <gtest/gtest.h>
+
+#include <instinct/transformer/ops.hpp>
+
+namespace INSTINCT_TRANSFORMER_NS {
+
+    class FusedAttentionTest: public testing::Test {
+    protected:
+        void SetUp() override {
+            ctx_ = ggml_init({.mem_size = 256ull * 1024 * 1024, .mem_buffer = nullptr, .no_alloc = false});
+        }
+
+        void TearDown() override {
+            ggml_free(ctx_);
+        }
+
+        ggml_tensor *random_tensor(const int64_t ne0, const int64_t ne1, const int64_t ne2, const int64_t ne3) {
+            ggml_tensor *t = ggml_new_tensor_4d(ctx_, GGML_TYPE_F32, ne0, ne1, ne2, ne3);
+            std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+            auto *data = (float *) t->data;
+            for (int64_t i = 0; i < ggml_nelements(t); ++i) {
+                data[i] = dist(rng_);
+            }
+            return t;
+        }
+
+        // same sequence of ops as `CoreAttention::calc_attn_scores`
+        ggml_tensor *reference_attention(ggml_tensor *q, ggml_tensor *k, ggml_tensor *v, ggml_tensor *mask) const {
+            const int64_t head_size = q->ne[0];
+            ggml_tensor *key_layer = ggml_permute(ctx_, k, 0, 2, 1, 3);
+            ggml_tensor *query_layer = ggml_permute(ctx_, q, 0, 2, 1, 3);
+            ggml_tensor *value_layer = ggml_cont(ctx_, ggml_permute(ctx_, v, 1, 2, 0, 3));
+            ggml_tensor *scores = ggml_mul_mat(ctx_, key_layer, query_layer);
+            scores = ggml_scale_inplace(ctx_, scores, 1.f / sqrtf((float) head_size));
+            if (mask) {
+                scores = ggml_add_inplace(ctx_, scores, mask);
+            }
+            ggml_tensor *probs = ggml_soft_max_inplace(ctx_, scores);
+            ggml_tensor *context_layer = ggml_mul_mat(ctx_, value_layer, probs);
+            return ggml_cont(ctx_, ggml_permute(ctx_, context_layer, 0, 2, 1, 3));
+        }
+
+        void check_equivalence(const int64_t head_size, const int64_t heads, const int64_t qlen, const std::vector<int64_t>& lengths) {
+            const auto batch = (int64_t) lengths.size();
+            ggml_tensor *q = random_tensor(head_size, heads, qlen, batch);
+            ggml_tensor *k = random_tensor(head_size, heads, qlen, batch);
+            ggml_tensor *v = random_tensor(head_size, heads, qlen, batch);
+            ggml_tensor *mask = nullptr;
+            if (std::ranges::any_of(lengths, [&](const int64_t n) { return n < qlen; })) {
+                mask = ggml_new_tensor_4d(ctx_, GGML_TYPE_F32, qlen, 1, 1, batch);
+                auto *mask_data = (float *) mask->data;
+                for (int64_t b = 0; b < batch; ++b) {
+                    for (int64_t i = 0; i < qlen; ++i) {
+                        mask_data[b * qlen + i] = i < lengths[b] ? 0.0f : -INFINITY;
+                    }
+                }
+            }
+
+            ggml_tensor *expected = reference_attention(q, k, v, mask);
+            ggml_tensor *scaled_q = ggml_scale(ctx_, q, 1.f / sqrtf((float) head_size));
+            ggml_tensor *actual = ops::ggml_fused_attention(ctx_, scaled_q, k, v, mask);
+
+            ggml_cgraph *graph = ggml_new_graph(ctx_);
+            ggml_build_forward_expand(graph, expected);
+            ggml_build_forward_expand(graph, actual);
+            ggml_graph_compute_with_ctx(ctx_, graph, 4);
+
+            ASSERT_TRUE(ggml_are_same_shape(expected, actual));
+            const auto *expected_data = (const float *) expected->data;
+            const auto *actual_data = (const float *) actual->data;
+            for (int64_t i = 0; i < ggml_nelements(expected); ++i) {
+                ASSERT_NEAR(expected_data[i], actual_data[i], 1e-4) << "at index " << i;
+            }
+        }
+
+        ggml_context *ctx_ = nullptr;
+        std::mt19937 rng_ {42};
+    };
+
+    TEST_F(FusedAttentionTest, WithoutMask) {
+        check_equivalence(64, 4, 37, {37});
+        check_equivalence(64, 2, 130, {130, 130});
+    }
+
+    TEST_F(FusedAttentionTest, WithPaddingMask) {
+        check_equivalence(64, 4, 48, {48, 20, 1});
+        // head size not aligned to SIMD width
+        check_equivalence(20, 3, 70, {5, 70});
+    }
+
+    TEST_F(FusedAttentionTest, LongSequence) {
+        check_equivalence(64, 16, 512, {512, 300});
+    }
+}
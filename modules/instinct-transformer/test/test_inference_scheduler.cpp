@@ -0,0 +1,208 @@
+#include <atomic>
+#include <future>
+#include <thread>
+#include <gtest/gtest.h>
+
+#include <instinct/transformer/inference_scheduler.hpp>
+
+namespace INSTINCT_TRANSFORMER_NS {
+
+    /**
+     * A model whose outputs are lengths of inputs, and which records every batch it receives
+     */
+    class FakeEncoderModel final: public BaseModel {
+    public:
+        struct BatchRecord {
+            std::vector<size_t> lengths;
+            unsigned int num_threads;
+        };
+
+        FakeEncoderModel(): BaseModel(BGE_M3_EMBEDDING, TextEmbedding) {}
+
+        void load(ModelLoader &loader) override {}
+
+        float qa_rank(const GenerationConfig &generation_config, const std::vector<int> &input_ids) override {
+            return (float) input_ids.size();
+        }
+
+        void batch_qa_rank(const GenerationConfig &generation_config, const std::vector<std::vector<int>> &batch_input_ids, std::vector<float> &scores) override {
+            record(generation_config, batch_input_ids);
+            scores.clear();
+            for (const auto& ids: batch_input_ids) {
+                scores.push_back((float) ids.size());
+            }
+        }
+
+        void text_embedding(const GenerationConfig &generation_config, const std::vector<int> &input_ids, std::vector<float> &output_embedding) override {
+            output_embedding = {(float) input_ids.size()};
+        }
+
+        void batch_text_embedding(const GenerationConfig &generation_config, const std::vector<std::vector<int>> &batch_input_ids, std::vector<std::vector<float>> &output_embeddings) override {
+            record(generation_config, batch_input_ids);
+            const auto running = running_threads_ += generation_config.num_threads;
+            for (auto peak = peak_running_threads_.load(); running > peak && !peak_running_threads_.compare_exchange_weak(peak, running);) {}
+            std::this_thread::sleep_for(batch_delay_);
+            running_threads_ -= generation_config.num_threads;
+            for (const auto& ids: batch_input_ids) {
+                if (ids.empty()) {
+                    throw std::runtime_error("empty input");
+                }
+            }
+            output_embeddings.clear();
+            for (const auto& ids: batch_input_ids) {
+                output_embeddings.push_back({(float) ids.size()});
+            }
+        }
+
+        void set_max_concurrency(size_t max_concurrency) override {}
+
+        size_t get_max_concurrency() override { return 2; }
+
+        /**
+         * Make each embedding batch take at least given time, so that batches overlap
+         */
+        void set_batch_delay(const std::chrono::milliseconds batch_delay) {
+            batch_delay_ = batch_delay;
+        }
+
+        /**
+         * @return max of total threads of embedding batches running at the same time
+         */
+        unsigned int get_peak_running_threads() const {
+            return peak_running_threads_;
+        }
+
+        std::vector<BatchRecord> get_records() {
+            std::lock_guard lock {mutex_};
+            return records_;
+        }
+
+    private:
+        void record(const GenerationConfig &generation_config, const std::vector<std::vector<int>> &batch_input_ids) {
+            BatchRecord batch_record {.num_threads = generation_config.num_threads};
+            for (const auto& ids: batch_input_ids) {
+                batch_record.lengths.push_back(ids.size());
+            }
+            std::lock_guard lock {mutex_};
+            records_.push_back(batch_record);
+        }
+
+        std::mutex mutex_;
+        std::vector<BatchRecord> records_;
+        std::chrono::milliseconds batch_delay_ {0};
+        std::atomic<unsigned int> running_threads_ = 0;
+        std::atomic<unsigned int> peak_running_threads_ = 0;
+    };
+
+    class InferenceSchedulerTest: public testing::Test {
+    protected:
+        static std::vector<std::vector<int>> make_inputs(const std::vector<size_t>& lengths) {
+            std::vector<std::vector<int>> inputs;
+            for (const auto len: lengths) {
+                inputs.emplace_back(len, 7);
+            }
+            return inputs;
+        }
+
+        std::shared_ptr<FakeEncoderModel> model_ = std::make_shared<FakeEncoderModel>();
+    };
+
+    TEST_F(InferenceSchedulerTest, AssignThreads) {
+        ASSERT_EQ(InferenceScheduler::assign_threads(InferenceScheduler::estimate_cost(1, 8, 1024), 64, 16), 1);
+        ASSERT_EQ(InferenceScheduler::assign_threads(InferenceScheduler::estimate_cost(4, 64, 1024), 64, 16), 5);
+        ASSERT_EQ(InferenceScheduler::assign_threads(InferenceScheduler::estimate_cost(4, 512, 1024), 64, 16), 16);
+        // attention makes long sequences cost more than the same count of tokens in short ones
+        ASSERT_GT(InferenceScheduler::estimate_cost(1, 512, 1024), InferenceScheduler::estimate_cost(32, 16, 1024));
+    }
+
+    TEST_F(InferenceSchedulerTest, GroupByLengthBucket) {
+        InferenceScheduler scheduler {model_, {.max_batch_tokens = 256, .max_batch_delay = std::chrono::milliseconds {20}, .total_threads = 8}};
+        const auto short_inputs = make_inputs({3, 5, 9, 12, 16, 4, 7, 1});
+        const auto long_inputs = make_inputs({100, 90, 120, 300, 310});
+
+        // concurrent callers with mixed lengths
+        auto embed = [&](const std::vector<std::vector<int>>& inputs) {
+            std::vector<std::vector<float>> outputs;
+            scheduler.text_embedding(inputs, outputs);
+            return outputs;
+        };
+        auto f1 = std::async(std::launch::async, embed, std::cref(short_inputs));
+        auto f2 = std::async(std::launch::async, embed, std::cref(long_inputs));
+        std::vector<float> scores;
+        scheduler.qa_rank(make_inputs({20, 30}), scores);
+
+        for (const auto& [inputs, outputs]: {std::pair {short_inputs, f1.get()}, std::pair {long_inputs, f2.get()}}) {
+            ASSERT_EQ(inputs.size(), outputs.size());
+            for (size_t i = 0; i < inputs.size(); ++i) {
+                ASSERT_EQ(outputs[i], std::vector<float> {(float) inputs[i].size()});
+            }
+        }
+        ASSERT_EQ(scores, (std::vector<float> {20, 30}));
+
+        size_t sequences = 0;
+        for (const auto& record: model_->get_records()) {
+            // all sequences of a batch fall into the same bucket, and padded tokens are within budget unless a single sequence exceeds it
+            const size_t bucket = (record.lengths.front() + 15) / 16;
+            for (const auto len: record.lengths) {
+                ASSERT_EQ((len + 15) / 16, bucket);
+            }
+            ASSERT_TRUE(record.lengths.size() == 1 || record.lengths.size() * bucket * 16 <= 256);
+            ASSERT_GE(record.num_threads, 1);
+            ASSERT_LE(record.num_threads, 8);
+            sequences += record.lengths.size();
+        }
+        ASSERT_EQ(sequences, short_inputs.size() + long_inputs.size() + 2);
+        ASSERT_EQ(scheduler.get_stats().sequences, sequences);
+    }
+
+    TEST_F(InferenceSchedulerTest, DispatchFullBucketWithoutDelay) {
+        // capacity of bucket of 16 tokens is 4 sequences
+        InferenceScheduler scheduler {model_, {.max_batch_tokens = 64, .max_batch_delay = std::chrono::seconds {10}}};
+        const auto t1 = std::chrono::steady_clock::now();
+        std::vector<std::vector<float>> outputs;
+        scheduler.text_embedding(make_inputs({10, 11, 12, 13}), outputs);
+        ASSERT_LT(std::chrono::steady_clock::now() - t1, std::chrono::seconds {5});
+        ASSERT_EQ(model_->get_records().size(), 1);
+        ASSERT_EQ(model_->get_records().front().lengths.size(), 4);
+    }
+
+    TEST_F(InferenceSchedulerTest, DispatchOnDeadline) {
+        InferenceScheduler scheduler {model_, {.max_batch_delay = std::chrono::milliseconds {10}}};
+        std::vector<std::vector<float>> outputs;
+        scheduler.text_embedding(make_inputs({5}), outputs);
+        ASSERT_EQ(outputs, (std::vector<std::vector<float>> {{5}}));
+        const auto records = model_->get_records();
+        ASSERT_EQ(records.size(), 1);
+        // a single short query isn't worth more threads
+        ASSERT_EQ(records.front().num_threads, 1);
+    }
+
+    TEST_F(InferenceSchedulerTest, PropagateError) {
+        InferenceScheduler scheduler {model_, {.max_batch_delay = std::chrono::milliseconds {1}}};
+        std::vector<std::vector<float>> outputs;
+        ASSERT_THROW(scheduler.text_embedding(make_inputs({0}), outputs), std::runtime_error);
+        // scheduler keeps working
+        scheduler.text_embedding(make_inputs({3}), outputs);
+        ASSERT_EQ(outputs, (std::vector<std::vector<float>> {{3}}));
+    }
+
+    TEST_F(InferenceSchedulerTest, KeepWithinThreadBudget) {
+        model_->set_batch_delay(std::chrono::milliseconds {20});
+        // more workers than threads
+        InferenceScheduler scheduler {model_, {.max_batch_tokens = 64, .max_batch_delay = std::chrono::milliseconds {1}, .total_threads = 2, .workers = 6}};
+        std::vector<std::future<std::vector<std::vector<float>>>> futures;
+        for (size_t i = 0; i < 12; ++i) {
+            futures.push_back(std::async(std::launch::async, [&, i] {
+                std::vector<std::vector<float>> outputs;
+                // inputs of distinct buckets, which are never grouped together
+                scheduler.text_embedding(make_inputs({16 * (i % 4) + 1}), outputs);
+                return outputs;
+            }));
+        }
+        for (size_t i = 0; i < futures.size(); ++i) {
+            ASSERT_EQ(futures[i].get(), (std::vector<std::vector<float>> {{(float) (16 * (i % 4) + 1)}}));
+        }
+        ASSERT_GE(model_->get_peak_running_threads(), 1);
+        ASSERT_LE(model_->get_peak_running_threads(), 2);
+    }
+}
@@ -0,0 +1,125 @@
+#include <random>
+#include <gtest/gtest.h>
+
+#include <instinct/transformer/tokenizer.hpp>
+
+namespace INSTINCT_TRANSFORMER_NS {
+    using namespace INSTINCT_TRANSFORMER_NS::tokenizer;
+
+    class UnigramTokenizerTest: public testing::Test {
+    protected:
+        // ASCII, multi-byte characters, and a truncated three-byte sequence
+        const std::vector<std::string> alphabet = {"a", "b", "c", "d", " ", "\xc3\xa9", "\xe4\xb8\xad", "\xe6\x96\x87", "\xf0\x9f\x98\x80", "\xe4\xb8"};
+        std::vector<std::string> pieces;
+        std::vector<float> scores;
+        std::unordered_map<std::string, int> piece_to_id;
+        std::unique_ptr<UnigramProcessor> processor;
+        std::mt19937 rng {42};
+        static constexpr int UNK_ID = 1;
+
+        void SetUp() override {
+            pieces = {"<s>", "<unk>", "</s>"};
+            std::uniform_int_distribution<int> piece_length(1, 6);
+            for (int i = 0; i < 20000; ++i) {
+                pieces.push_back(random_text(piece_length(rng)));
+            }
+            std::normal_distribution<float> score_dist(-8.f, 3.f);
+            for (size_t i = 0; i < pieces.size(); ++i) {
+                // some equal scores to cover tie-breaking
+                scores.push_back(i % 10 == 0 ? -6.f : score_dist(rng));
+                piece_to_id[pieces[i]] = (int) i;
+            }
+
+            // same layout as vocab section of model file
+            std::string buffer;
+            for (size_t i = 0; i < pieces.size(); ++i) {
+                const auto len = (int32_t) pieces[i].size();
+                buffer.append((const char *) &len, sizeof(len));
+                buffer.append(pieces[i]);
+                buffer.append((const char *) &scores[i], sizeof(float));
+            }
+            constexpr int32_t end = -1;
+            buffer.append((const char *) &end, sizeof(end));
+
+            processor = std::make_unique<UnigramProcessor>(UNK_ID);
+            ASSERT_EQ(processor->Load(buffer.data(), (int) pieces.size()), buffer.size());
+        }
+
+        std::string random_text(const int n_chars) {
+            std::uniform_int_distribution<size_t> char_dist(0, alphabet.size() - 1);
+            std::string text;
+            for (int i = 0; i < n_chars; ++i) {
+                text += alphabet[char_dist(rng)];
+            }
+            return text;
+        }
+
+        // previous implementation which looks up every substring in a hash map
+        [[nodiscard]] std::vector<int> reference_encode(const std::string &text) const {
+            std::vector<size_t> ends = {0};
+            size_t offs = 0;
+            while (offs < text.size()) {
+                offs += std::min(text.size() - offs, utf8_len(text[offs]));
+                ends.push_back(offs);
+            }
+            size_t max_len = 0;
+            for (const auto& piece: pieces) {
+                max_len = std::max(max_len, piece.size());
+            }
+
+            struct best { int prev; float score; int tok_id; };
+            std::vector<best> trace = {{0, 0.0f, 0}};
+            for (int pos = 1; pos < (int) ends.size(); ++pos) {
+                const int start = std::max(0, pos - (int) max_len);
+                float max_prop = std::numeric_limits<float>::lowest();
+                int prev = -1, tok_id = -1;
+                for (int i = start; i < pos; ++i) {
+                    const auto itr = piece_to_id.find(text.substr(ends[i], ends[pos] - ends[i]));
+                    if (itr == piece_to_id.end()) continue;
+                    if (trace[i].score + scores[itr->second] > max_prop) {
+                        prev = i;
+                        max_prop = trace[i].score + scores[itr->second];
+                        tok_id = itr->second;
+                    }
+                }
+                if (prev < 0) {
+                    prev = pos - 1;
+                    max_prop = trace[prev].score + scores[UNK_ID];
+                    tok_id = UNK_ID;
+                }
+                trace.push_back({prev, max_prop, tok_id});
+            }
+
+            std::vector<int> ids;
+            for (int prev = (int) trace.size() - 1; prev != 0; prev = trace[prev].prev) {
+                ids.push_back(trace[prev].tok_id);
+            }
+            std::reverse(ids.begin(), ids.end());
+            return ids;
+        }
+    };
+
+    TEST_F(UnigramTokenizerTest, TrieLookup) {
+        double_array_trie trie;
+        trie.build({{"a", 1}, {"ab", 2}, {"abc", 3}, {"b", 4}, {"\xe4\xb8\xad", 5}});
+        std::vector<std::pair<size_t, int>> matches;
+        trie.common_prefix_search("abcd", 4, [&](const size_t len, const int32_t value) { matches.emplace_back(len, value); });
+        ASSERT_EQ(matches, (std::vector<std::pair<size_t, int>> {{1, 1}, {2, 2}, {3, 3}}));
+        matches.clear();
+        trie.common_prefix_search("\xe4\xb8\xad", 3, [&](const size_t len, const int32_t value) { matches.emplace_back(len, value); });
+        ASSERT_EQ(matches, (std::vector<std::pair<size_t, int>> {{3, 5}}));
+        matches.clear();
+        trie.common_prefix_search("cab", 3, [&](const size_t len, const int32_t value) { matches.emplace_back(len, value); });
+        ASSERT_TRUE(matches.empty());
+    }
+
+    TEST_F(UnigramTokenizerTest, SameIdsAsReference) {
+        std::uniform_int_distribution<int> text_length(0, 500);
+        for (int i = 0; i < 200; ++i) {
+            const auto text = random_text(text_length(rng));
+            std::vector<int> ids;
+            processor->Encode(text, &ids);
+            ASSERT_EQ(ids, reference_encode(text)) << "text: " << text;
+        }
+    }
+}
@@ -0,0 +1,137 @@
+#include <chrono>
+#include <filesystem>
+#include <random>
+#include <thread>
+#include <gtest/gtest.h>
+
+#include <instinct/transformer/model_converter.hpp>
+#include <instinct/transformer/model_factory.hpp>
+
+namespace INSTINCT_TRANSFORMER_NS {
+
+    class WeightPrecisionTest: public testing::Test {
+    protected:
+        const std::filesystem::path bge_m3_bin = std::filesystem::current_path() / "_assets/model_bins/bge-m3e.bin";
+
+        const std::vector<std::string> queries = {
+            "how to bake a cake",
+            "what is the capital of France",
+            "symptoms of the flu",
+            "best way to learn programming"
+        };
+
+        const std::vector<std::string> docs = {
+            "Mix flour, sugar and eggs, then bake the batter in the oven for thirty minutes.",
+            "Paris is the capital and most populous city of France.",
+            "Influenza usually comes with fever, cough, sore throat and muscle aches.",
+            "Writing small projects every day is an effective way to get better at coding."
+        };
+
+        static float cosine(const std::vector<float>& a, const std::vector<float>& b) {
+            double dot = 0, na = 0, nb = 0;
+            for (size_t i = 0; i < a.size(); ++i) {
+                dot += a[i] * b[i];
+                na += a[i] * a[i];
+                nb += b[i] * b[i];
+            }
+            return (float) (dot / std::sqrt(na * nb));
+        }
+
+        static std::vector<std::vector<float>> embed(const std::pair<ModelPtr, TokenizerPtr>& model, const std::vector<std::string>& texts) {
+            const GenerationConfig config {.num_threads = std::max(1u, std::thread::hardware_concurrency())};
+            std::vector<std::vector<int>> batch_input_ids;
+            for (const auto& text: texts) {
+                batch_input_ids.push_back(model.second->encode(text));
+            }
+            std::vector<std::vector<float>> embeddings;
+            model.first->batch_text_embedding(config, batch_input_ids, embeddings);
+            return embeddings;
+        }
+    };
+
+    TEST_F(WeightPrecisionTest, ConvertWeights) {
+        constexpr int64_t nrows = 64, n_per_row = 256;
+        std::mt19937 rng {42};
+        std::uniform_real_distribution<float> dist(-1.f, 1.f);
+        std::vector<float> weights(nrows * n_per_row);
+        for (auto& w: weights) {
+            w = dist(rng);
+        }
+
+        for (const auto& [type, tolerance]: std::vector<std::pair<ggml_type, float>> {{GGML_TYPE_F16, 1e-3}, {GGML_TYPE_Q8_0, 1e-2}, {GGML_TYPE_Q4_1, 1e-1}}) {
+            std::vector<char> quantized(ggml_row_size(type, n_per_row) * nrows);
+            convert_weights(weights.data(), GGML_TYPE_F32, quantized.data(), type, nrows, n_per_row);
+            std::vector<float> restored(weights.size());
+            convert_weights(quantized.data(), type, restored.data(), GGML_TYPE_F32, nrows, n_per_row);
+            for (size_t i = 0; i < weights.size(); ++i) {
+                ASSERT_NEAR(weights[i], restored[i], tolerance) << ggml_type_name(type) << " at index " << i;
+            }
+        }
+    }
+
+    TEST_F(WeightPrecisionTest, ParseWeightType) {
+        ASSERT_EQ(parse_weight_type(""), GGML_TYPE_COUNT);
+        ASSERT_EQ(parse_weight_type("q8_0"), GGML_TYPE_Q8_0);
+        ASSERT_EQ(parse_weight_type("f16"), GGML_TYPE_F16);
+        ASSERT_THROW(parse_weight_type("q3_k"), std::runtime_error);
+    }
+
+    TEST_F(WeightPrecisionTest, OfflineConversion) {
+        const auto output_path = bge_m3_bin.parent_path() / "bge-m3e-q8_0.bin";
+        ModelConverter converter {bge_m3_bin.string(), output_path.string()};
+        ASSERT_GT(converter.convert(GGML_TYPE_Q8_0), 0);
+
+        ModelFactory model_factory;
+        const auto converted = embed(model_factory.load(output_path.string()), docs);
+        const auto at_load_time = embed(model_factory.load(bge_m3_bin.string(), GGML_TYPE_Q8_0), docs);
+        for (size_t i = 0; i < docs.size(); ++i) {
+            ASSERT_NEAR(cosine(converted[i], at_load_time[i]), 1.0f, 1e-5);
+        }
+        std::filesystem::remove(output_path);
+    }
+
+    /**
+     * A tiny eval to compare precisions. Shipped model file is q4_1, so its f16 conversion serves as reference for fidelity. Retrieval accuracy is measured as recall@1 of queries against matching docs.
+     */
+    TEST_F(WeightPrecisionTest, Eval) {
+        ModelFactory model_factory;
+        const auto reference = embed(model_factory.load(bge_m3_bin.string(), GGML_TYPE_F16), docs);
+
+        for (const auto weight_type: {GGML_TYPE_COUNT, GGML_TYPE_Q8_0, GGML_TYPE_F16}) {
+            const auto model = model_factory.load(bge_m3_bin.string(), weight_type);
+            // warm up
+            embed(model, docs);
+
+            constexpr int rounds = 3;
+            const auto t1 = std::chrono::steady_clock::now();
+            std::vector<std::vector<float>> doc_embeddings;
+            for (int i = 0; i < rounds; ++i) {
+                doc_embeddings = embed(model, docs);
+            }
+            const auto latency = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - t1).count() / rounds;
+            const auto query_embeddings = embed(model, queries);
+
+            float min_fidelity = 1.0f;
+            for (size_t i = 0; i < docs.size(); ++i) {
+                min_fidelity = std::min(min_fidelity, cosine(doc_embeddings[i], reference[i]));
+            }
+            size_t hits = 0;
+            for (size_t i = 0; i < queries.size(); ++i) {
+                size_t best = 0;
+                for (size_t j = 1; j < docs.size(); ++j) {
+                    if (cosine(query_embeddings[i], doc_embeddings[j]) > cosine(query_embeddings[i], doc_embeddings[best])) {
+                        best = j;
+                    }
+                }
+                hits += best == i;
+            }
+
+            std::cout << "weight_type=" << (weight_type == GGML_TYPE_COUNT ? "as-is" : ggml_type_name(weight_type))
+                << ", batch_latency=" << latency << "ms"
+                << ", min_cosine_to_reference=" << min_fidelity
+                << ", recall@1=" << (float) hits / (float) queries.size() << std::endl;
+            ASSERT_GT(min_fidelity, 0.99f);
+            ASSERT_EQ(hits, queries.size());
+        }
+    }
+}